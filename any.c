@@ -1,144 +1,410 @@
 #include <malloc.h>
 
+/* The library itself always dispatches through the function tables */
+#undef ANYTREE_STATIC_TYPE
+
 #include "any.h"
 #include "avl.h"
 #include "bs.h"
+#include "btree.h"
+#include "frozen.h"
+#include "interval.h"
+#include "pool.h"
 #include "rb.h"
+#include "skiplist.h"
 #include "splay.h"
+#include "treap.h"
 
 
-struct anytree_functions * get_avltree_functions(void)
-{
-    static struct anytree_functions avltree_functions;
-    static int inited = 0;
-    if (!inited)
-    {
-        inited = 1;
-        avltree_functions.first_fn = (anytree_first_fn_t)avltree_first;
-        avltree_functions.last_fn  = (anytree_last_fn_t)avltree_last;
-        avltree_functions.next_fn  = (anytree_next_fn_t)avltree_next;
-        avltree_functions.prev_fn  = (anytree_prev_fn_t)avltree_prev;
-        avltree_functions.lookup_fn  = (anytree_lookup_fn_t)avltree_lookup;
-        avltree_functions.insert_fn  = (anytree_insert_fn_t)avltree_insert;
-        avltree_functions.remove_fn  = (anytree_remove_fn_t)avltree_remove;
-        avltree_functions.replace_fn = (anytree_replace_fn_t)avltree_replace;
-        avltree_functions.clean_fn = (anytree_clean_fn_t)avltree_clean;
-    }
-    return &avltree_functions;
-}
+static const struct anytree_functions avltree_functions = {
+    .first_fn           = (anytree_first_fn_t)avltree_first,
+    .last_fn            = (anytree_last_fn_t)avltree_last,
+    .next_fn            = (anytree_next_fn_t)avltree_next,
+    .prev_fn            = (anytree_prev_fn_t)avltree_prev,
+    .lookup_fn          = (anytree_lookup_fn_t)avltree_lookup,
+    .lower_bound_fn     = (anytree_lookup_fn_t)avltree_lower_bound,
+    .upper_bound_fn     = (anytree_lookup_fn_t)avltree_upper_bound,
+    .floor_fn           = (anytree_lookup_fn_t)avltree_floor,
+    .range_fn           = (anytree_range_fn_t)avltree_range,
+    .range_count_fn     = (anytree_range_count_fn_t)avltree_range_count,
+    .lookup_key_fn      = (anytree_lookup_key_fn_t)avltree_lookup_key,
+    .lower_bound_key_fn = (anytree_lookup_key_fn_t)avltree_lower_bound_key,
+    .upper_bound_key_fn = (anytree_lookup_key_fn_t)avltree_upper_bound_key,
+    .floor_key_fn       = (anytree_lookup_key_fn_t)avltree_floor_key,
+    .remove_key_fn      = (anytree_remove_key_fn_t)avltree_remove_key,
+    .insert_fn          = (anytree_insert_fn_t)avltree_insert,
+    .insert_after_fn    = (anytree_insert_hint_fn_t)avltree_insert_after,
+    .insert_before_fn   = (anytree_insert_hint_fn_t)avltree_insert_before,
+    .remove_fn          = (anytree_remove_fn_t)avltree_remove,
+    .replace_fn         = (anytree_replace_fn_t)avltree_replace,
+    .build_sorted_fn    = (anytree_build_sorted_fn_t)avltree_build_sorted,
+    .clean_fn           = (anytree_clean_fn_t)avltree_clean,
+};
 
-struct anytree_functions * get_bstree_functions(void)
-{
-    static struct anytree_functions bstree_functions;
-    static int inited = 0;
-    if (!inited)
-    {
-        inited = 1;
-        bstree_functions.first_fn = (anytree_first_fn_t)bstree_first;
-        bstree_functions.last_fn  = (anytree_last_fn_t)bstree_last;
-        bstree_functions.next_fn  = (anytree_next_fn_t)bstree_next;
-        bstree_functions.prev_fn  = (anytree_prev_fn_t)bstree_prev;
-        bstree_functions.lookup_fn  = (anytree_lookup_fn_t)bstree_lookup;
-        bstree_functions.insert_fn  = (anytree_insert_fn_t)bstree_insert;
-        bstree_functions.remove_fn  = (anytree_remove_fn_t)bstree_remove;
-        bstree_functions.replace_fn = (anytree_replace_fn_t)bstree_replace;
-        bstree_functions.clean_fn = (anytree_clean_fn_t)bstree_clean;
-    }
-    return &bstree_functions;
-}
+static const struct anytree_functions bstree_functions = {
+    .first_fn           = (anytree_first_fn_t)bstree_first,
+    .last_fn            = (anytree_last_fn_t)bstree_last,
+    .next_fn            = (anytree_next_fn_t)bstree_next,
+    .prev_fn            = (anytree_prev_fn_t)bstree_prev,
+    .lookup_fn          = (anytree_lookup_fn_t)bstree_lookup,
+    .lower_bound_fn     = (anytree_lookup_fn_t)bstree_lower_bound,
+    .upper_bound_fn     = (anytree_lookup_fn_t)bstree_upper_bound,
+    .floor_fn           = (anytree_lookup_fn_t)bstree_floor,
+    .range_fn           = (anytree_range_fn_t)bstree_range,
+    .range_count_fn     = (anytree_range_count_fn_t)bstree_range_count,
+    .lookup_key_fn      = (anytree_lookup_key_fn_t)bstree_lookup_key,
+    .lower_bound_key_fn = (anytree_lookup_key_fn_t)bstree_lower_bound_key,
+    .upper_bound_key_fn = (anytree_lookup_key_fn_t)bstree_upper_bound_key,
+    .floor_key_fn       = (anytree_lookup_key_fn_t)bstree_floor_key,
+    .remove_key_fn      = (anytree_remove_key_fn_t)bstree_remove_key,
+    .insert_fn          = (anytree_insert_fn_t)bstree_insert,
+    .insert_after_fn    = (anytree_insert_hint_fn_t)bstree_insert_after,
+    .insert_before_fn   = (anytree_insert_hint_fn_t)bstree_insert_before,
+    .remove_fn          = (anytree_remove_fn_t)bstree_remove,
+    .replace_fn         = (anytree_replace_fn_t)bstree_replace,
+    .build_sorted_fn    = (anytree_build_sorted_fn_t)bstree_build_sorted,
+    .clean_fn           = (anytree_clean_fn_t)bstree_clean,
+};
 
-struct anytree_functions * get_rbtree_functions(void)
-{
-    static struct anytree_functions rbtree_functions;
-    static int inited = 0;
-    if (!inited)
-    {
-        inited = 1;
-        rbtree_functions.first_fn = (anytree_first_fn_t)rbtree_first;
-        rbtree_functions.last_fn  = (anytree_last_fn_t)rbtree_last;
-        rbtree_functions.next_fn  = (anytree_next_fn_t)rbtree_next;
-        rbtree_functions.prev_fn  = (anytree_prev_fn_t)rbtree_prev;
-        rbtree_functions.lookup_fn  = (anytree_lookup_fn_t)rbtree_lookup;
-        rbtree_functions.insert_fn  = (anytree_insert_fn_t)rbtree_insert;
-        rbtree_functions.remove_fn  = (anytree_remove_fn_t)rbtree_remove;
-        rbtree_functions.replace_fn = (anytree_replace_fn_t)rbtree_replace;
-        rbtree_functions.clean_fn = (anytree_clean_fn_t)rbtree_clean;
-    }
-    return &rbtree_functions;
-}
+static const struct anytree_functions rbtree_functions = {
+    .first_fn           = (anytree_first_fn_t)rbtree_first,
+    .last_fn            = (anytree_last_fn_t)rbtree_last,
+    .next_fn            = (anytree_next_fn_t)rbtree_next,
+    .prev_fn            = (anytree_prev_fn_t)rbtree_prev,
+    .lookup_fn          = (anytree_lookup_fn_t)rbtree_lookup,
+    .lower_bound_fn     = (anytree_lookup_fn_t)rbtree_lower_bound,
+    .upper_bound_fn     = (anytree_lookup_fn_t)rbtree_upper_bound,
+    .floor_fn           = (anytree_lookup_fn_t)rbtree_floor,
+    .range_fn           = (anytree_range_fn_t)rbtree_range,
+    .range_count_fn     = (anytree_range_count_fn_t)rbtree_range_count,
+    .lookup_key_fn      = (anytree_lookup_key_fn_t)rbtree_lookup_key,
+    .lower_bound_key_fn = (anytree_lookup_key_fn_t)rbtree_lower_bound_key,
+    .upper_bound_key_fn = (anytree_lookup_key_fn_t)rbtree_upper_bound_key,
+    .floor_key_fn       = (anytree_lookup_key_fn_t)rbtree_floor_key,
+    .remove_key_fn      = (anytree_remove_key_fn_t)rbtree_remove_key,
+    .insert_fn          = (anytree_insert_fn_t)rbtree_insert,
+    .insert_after_fn    = (anytree_insert_hint_fn_t)rbtree_insert_after,
+    .insert_before_fn   = (anytree_insert_hint_fn_t)rbtree_insert_before,
+    .remove_fn          = (anytree_remove_fn_t)rbtree_remove,
+    .replace_fn         = (anytree_replace_fn_t)rbtree_replace,
+    .build_sorted_fn    = (anytree_build_sorted_fn_t)rbtree_build_sorted,
+    .clean_fn           = (anytree_clean_fn_t)rbtree_clean,
+};
+
+static const struct anytree_functions splaytree_functions = {
+    .first_fn           = (anytree_first_fn_t)splaytree_first,
+    .last_fn            = (anytree_last_fn_t)splaytree_last,
+    .next_fn            = (anytree_next_fn_t)splaytree_next,
+    .prev_fn            = (anytree_prev_fn_t)splaytree_prev,
+    .lookup_fn          = (anytree_lookup_fn_t)splaytree_lookup,
+    .lower_bound_fn     = (anytree_lookup_fn_t)splaytree_lower_bound,
+    .upper_bound_fn     = (anytree_lookup_fn_t)splaytree_upper_bound,
+    .floor_fn           = (anytree_lookup_fn_t)splaytree_floor,
+    .range_fn           = (anytree_range_fn_t)splaytree_range,
+    .range_count_fn     = (anytree_range_count_fn_t)splaytree_range_count,
+    .lookup_key_fn      = (anytree_lookup_key_fn_t)splaytree_lookup_key,
+    .lower_bound_key_fn = (anytree_lookup_key_fn_t)splaytree_lower_bound_key,
+    .upper_bound_key_fn = (anytree_lookup_key_fn_t)splaytree_upper_bound_key,
+    .floor_key_fn       = (anytree_lookup_key_fn_t)splaytree_floor_key,
+    .remove_key_fn      = (anytree_remove_key_fn_t)splaytree_remove_key,
+    .insert_fn          = (anytree_insert_fn_t)splaytree_insert,
+    .insert_after_fn    = (anytree_insert_hint_fn_t)splaytree_insert_after,
+    .insert_before_fn   = (anytree_insert_hint_fn_t)splaytree_insert_before,
+    .remove_fn          = (anytree_remove_fn_t)splaytree_remove,
+    .replace_fn         = (anytree_replace_fn_t)splaytree_replace,
+    .build_sorted_fn    = (anytree_build_sorted_fn_t)splaytree_build_sorted,
+    .clean_fn           = (anytree_clean_fn_t)splaytree_clean,
+};
+
+static const struct anytree_functions skiplist_functions = {
+    .first_fn           = (anytree_first_fn_t)skiplist_first,
+    .last_fn            = (anytree_last_fn_t)skiplist_last,
+    .next_fn            = (anytree_next_fn_t)skiplist_next,
+    .prev_fn            = (anytree_prev_fn_t)skiplist_prev,
+    .lookup_fn          = (anytree_lookup_fn_t)skiplist_lookup,
+    .lower_bound_fn     = (anytree_lookup_fn_t)skiplist_lower_bound,
+    .upper_bound_fn     = (anytree_lookup_fn_t)skiplist_upper_bound,
+    .floor_fn           = (anytree_lookup_fn_t)skiplist_floor,
+    .range_fn           = (anytree_range_fn_t)skiplist_range,
+    .range_count_fn     = (anytree_range_count_fn_t)skiplist_range_count,
+    .lookup_key_fn      = (anytree_lookup_key_fn_t)skiplist_lookup_key,
+    .lower_bound_key_fn = (anytree_lookup_key_fn_t)skiplist_lower_bound_key,
+    .upper_bound_key_fn = (anytree_lookup_key_fn_t)skiplist_upper_bound_key,
+    .floor_key_fn       = (anytree_lookup_key_fn_t)skiplist_floor_key,
+    .remove_key_fn      = (anytree_remove_key_fn_t)skiplist_remove_key,
+    .insert_fn          = (anytree_insert_fn_t)skiplist_insert,
+    .insert_after_fn    = (anytree_insert_hint_fn_t)skiplist_insert_after,
+    .insert_before_fn   = (anytree_insert_hint_fn_t)skiplist_insert_before,
+    .remove_fn          = (anytree_remove_fn_t)skiplist_remove,
+    .replace_fn         = (anytree_replace_fn_t)skiplist_replace,
+    .build_sorted_fn    = (anytree_build_sorted_fn_t)skiplist_build_sorted,
+    .clean_fn           = (anytree_clean_fn_t)skiplist_clean,
+};
+
+static const struct anytree_functions btree_functions = {
+    .first_fn           = (anytree_first_fn_t)btree_first,
+    .last_fn            = (anytree_last_fn_t)btree_last,
+    .next_fn            = (anytree_next_fn_t)btree_next,
+    .prev_fn            = (anytree_prev_fn_t)btree_prev,
+    .lookup_fn          = (anytree_lookup_fn_t)btree_lookup,
+    .lower_bound_fn     = (anytree_lookup_fn_t)btree_lower_bound,
+    .upper_bound_fn     = (anytree_lookup_fn_t)btree_upper_bound,
+    .floor_fn           = (anytree_lookup_fn_t)btree_floor,
+    .range_fn           = (anytree_range_fn_t)btree_range,
+    .range_count_fn     = (anytree_range_count_fn_t)btree_range_count,
+    .lookup_key_fn      = (anytree_lookup_key_fn_t)btree_lookup_key,
+    .lower_bound_key_fn = (anytree_lookup_key_fn_t)btree_lower_bound_key,
+    .upper_bound_key_fn = (anytree_lookup_key_fn_t)btree_upper_bound_key,
+    .floor_key_fn       = (anytree_lookup_key_fn_t)btree_floor_key,
+    .remove_key_fn      = (anytree_remove_key_fn_t)btree_remove_key,
+    .insert_fn          = (anytree_insert_fn_t)btree_insert,
+    .insert_after_fn    = (anytree_insert_hint_fn_t)btree_insert_after,
+    .insert_before_fn   = (anytree_insert_hint_fn_t)btree_insert_before,
+    .remove_fn          = (anytree_remove_fn_t)btree_remove,
+    .replace_fn         = (anytree_replace_fn_t)btree_replace,
+    .build_sorted_fn    = (anytree_build_sorted_fn_t)btree_build_sorted,
+    .clean_fn           = (anytree_clean_fn_t)btree_clean,
+};
+
+static const struct anytree_functions frozentree_functions = {
+    .first_fn           = (anytree_first_fn_t)frozentree_first,
+    .last_fn            = (anytree_last_fn_t)frozentree_last,
+    .next_fn            = (anytree_next_fn_t)frozentree_next,
+    .prev_fn            = (anytree_prev_fn_t)frozentree_prev,
+    .lookup_fn          = (anytree_lookup_fn_t)frozentree_lookup,
+    .lower_bound_fn     = (anytree_lookup_fn_t)frozentree_lower_bound,
+    .upper_bound_fn     = (anytree_lookup_fn_t)frozentree_upper_bound,
+    .floor_fn           = (anytree_lookup_fn_t)frozentree_floor,
+    .range_fn           = (anytree_range_fn_t)frozentree_range,
+    .range_count_fn     = (anytree_range_count_fn_t)frozentree_range_count,
+    .lookup_key_fn      = (anytree_lookup_key_fn_t)frozentree_lookup_key,
+    .lower_bound_key_fn = (anytree_lookup_key_fn_t)frozentree_lower_bound_key,
+    .upper_bound_key_fn = (anytree_lookup_key_fn_t)frozentree_upper_bound_key,
+    .floor_key_fn       = (anytree_lookup_key_fn_t)frozentree_floor_key,
+    .remove_key_fn      = (anytree_remove_key_fn_t)frozentree_remove_key,
+    .insert_fn          = (anytree_insert_fn_t)frozentree_insert,
+    .insert_after_fn    = (anytree_insert_hint_fn_t)frozentree_insert_after,
+    .insert_before_fn   = (anytree_insert_hint_fn_t)frozentree_insert_before,
+    .remove_fn          = (anytree_remove_fn_t)frozentree_remove,
+    .replace_fn         = (anytree_replace_fn_t)frozentree_replace,
+    .build_sorted_fn    = (anytree_build_sorted_fn_t)frozentree_build_sorted,
+    .clean_fn           = (anytree_clean_fn_t)frozentree_clean,
+};
+
+static const struct anytree_functions inttree_functions = {
+    .first_fn           = (anytree_first_fn_t)inttree_first,
+    .last_fn            = (anytree_last_fn_t)inttree_last,
+    .next_fn            = (anytree_next_fn_t)inttree_next,
+    .prev_fn            = (anytree_prev_fn_t)inttree_prev,
+    .lookup_fn          = (anytree_lookup_fn_t)inttree_lookup,
+    .lower_bound_fn     = (anytree_lookup_fn_t)inttree_lower_bound,
+    .upper_bound_fn     = (anytree_lookup_fn_t)inttree_upper_bound,
+    .floor_fn           = (anytree_lookup_fn_t)inttree_floor,
+    .range_fn           = (anytree_range_fn_t)inttree_range,
+    .range_count_fn     = (anytree_range_count_fn_t)inttree_range_count,
+    .lookup_key_fn      = (anytree_lookup_key_fn_t)inttree_lookup_key,
+    .lower_bound_key_fn = (anytree_lookup_key_fn_t)inttree_lower_bound_key,
+    .upper_bound_key_fn = (anytree_lookup_key_fn_t)inttree_upper_bound_key,
+    .floor_key_fn       = (anytree_lookup_key_fn_t)inttree_floor_key,
+    .remove_key_fn      = (anytree_remove_key_fn_t)inttree_remove_key,
+    .insert_fn          = (anytree_insert_fn_t)inttree_insert,
+    .insert_after_fn    = (anytree_insert_hint_fn_t)inttree_insert_after,
+    .insert_before_fn   = (anytree_insert_hint_fn_t)inttree_insert_before,
+    .remove_fn          = (anytree_remove_fn_t)inttree_remove,
+    .replace_fn         = (anytree_replace_fn_t)inttree_replace,
+    .build_sorted_fn    = (anytree_build_sorted_fn_t)inttree_build_sorted,
+    .clean_fn           = (anytree_clean_fn_t)inttree_clean,
+};
 
-struct anytree_functions * get_splaytree_functions(void)
+static const struct anytree_functions treap_functions = {
+    .first_fn           = (anytree_first_fn_t)treap_first,
+    .last_fn            = (anytree_last_fn_t)treap_last,
+    .next_fn            = (anytree_next_fn_t)treap_next,
+    .prev_fn            = (anytree_prev_fn_t)treap_prev,
+    .lookup_fn          = (anytree_lookup_fn_t)treap_lookup,
+    .lower_bound_fn     = (anytree_lookup_fn_t)treap_lower_bound,
+    .upper_bound_fn     = (anytree_lookup_fn_t)treap_upper_bound,
+    .floor_fn           = (anytree_lookup_fn_t)treap_floor,
+    .range_fn           = (anytree_range_fn_t)treap_range,
+    .range_count_fn     = (anytree_range_count_fn_t)treap_range_count,
+    .lookup_key_fn      = (anytree_lookup_key_fn_t)treap_lookup_key,
+    .lower_bound_key_fn = (anytree_lookup_key_fn_t)treap_lower_bound_key,
+    .upper_bound_key_fn = (anytree_lookup_key_fn_t)treap_upper_bound_key,
+    .floor_key_fn       = (anytree_lookup_key_fn_t)treap_floor_key,
+    .remove_key_fn      = (anytree_remove_key_fn_t)treap_remove_key,
+    .insert_fn          = (anytree_insert_fn_t)treap_insert,
+    .insert_after_fn    = (anytree_insert_hint_fn_t)treap_insert_after,
+    .insert_before_fn   = (anytree_insert_hint_fn_t)treap_insert_before,
+    .remove_fn          = (anytree_remove_fn_t)treap_remove,
+    .replace_fn         = (anytree_replace_fn_t)treap_replace,
+    .build_sorted_fn    = (anytree_build_sorted_fn_t)treap_build_sorted,
+    .clean_fn           = (anytree_clean_fn_t)treap_clean,
+};
+
+static struct anytree * alloc_tree(struct anytree_pool *pool)
 {
-    static struct anytree_functions splaytree_functions;
-    static int inited = 0;
-    if (!inited)
-    {
-        inited = 1;
-        splaytree_functions.first_fn = (anytree_first_fn_t)splaytree_first;
-        splaytree_functions.last_fn  = (anytree_last_fn_t)splaytree_last;
-        splaytree_functions.next_fn  = (anytree_next_fn_t)splaytree_next;
-        splaytree_functions.prev_fn  = (anytree_prev_fn_t)splaytree_prev;
-        splaytree_functions.lookup_fn  = (anytree_lookup_fn_t)splaytree_lookup;
-        splaytree_functions.insert_fn  = (anytree_insert_fn_t)splaytree_insert;
-        splaytree_functions.remove_fn  = (anytree_remove_fn_t)splaytree_remove;
-        splaytree_functions.replace_fn = (anytree_replace_fn_t)splaytree_replace;
-        splaytree_functions.clean_fn = (anytree_clean_fn_t)splaytree_clean;
+    struct anytree *tree;
+
+    if (pool)
+        tree = anytree_pool_new(pool, struct anytree);
+    else
+        tree = (struct anytree *)malloc(sizeof(struct anytree));
+    if (tree) {
+        tree->functions = NULL;
+        tree->pool = pool;
     }
-    return &splaytree_functions;
+    return tree;
 }
 
-struct anytree * anytree_init(enum anytree_type type, anytree_cmp_fn_t cmp)
+struct anytree * anytree_init_keyed(enum anytree_type type, anytree_cmp_fn_t cmp, anytree_key_fn_t key, struct anytree_pool *pool)
 {
-    struct anytree *tree = NULL;
+    struct anytree *tree = alloc_tree(pool);
+    if (!tree)
+        return NULL;
     switch (type)
     {
     case ANYTREE_AVL:
-        tree = (struct anytree *)malloc(sizeof(struct anytree));
-        tree->functions = get_avltree_functions();
+        tree->functions = &avltree_functions;
         if (avltree_init((struct avltree*)tree, (avltree_cmp_fn_t)cmp))
         {
-            free((void*)tree);
+            anytree_release(tree);
             tree = NULL;
         }
         break;
 
     case ANYTREE_BS:
-        tree = (struct anytree *)malloc(sizeof(struct anytree));
-        tree->functions = get_bstree_functions();
+        tree->functions = &bstree_functions;
         if (bstree_init((struct bstree*)tree, (bstree_cmp_fn_t)cmp))
         {
-            free((void*)tree);
+            anytree_release(tree);
             tree = NULL;
         }
         break;
 
     case ANYTREE_RB:
-        tree = (struct anytree *)malloc(sizeof(struct anytree));
-        tree->functions = get_rbtree_functions();
+        tree->functions = &rbtree_functions;
         if (rbtree_init((struct rbtree*)tree, (rbtree_cmp_fn_t)cmp))
         {
-            free((void*)tree);
+            anytree_release(tree);
             tree = NULL;
         }
         break;
 
     case ANYTREE_SPLAY:
-        tree = (struct anytree *)malloc(sizeof(struct anytree));
-        tree->functions = get_splaytree_functions();
+        tree->functions = &splaytree_functions;
         if (splaytree_init((struct splaytree*)tree, (splaytree_cmp_fn_t)cmp))
         {
-            free((void*)tree);
+            anytree_release(tree);
             tree = NULL;
         }
         break;
 
+    case ANYTREE_INTERVAL:
+        /* an interval tree is an augmented rbtree, the rbtree functions apply */
+        tree->functions = &rbtree_functions;
+        if (intervaltree_init((struct intervaltree*)tree))
+        {
+            anytree_release(tree);
+            tree = NULL;
+        }
+        break;
+
+    case ANYTREE_SKIPLIST:
+        tree->functions = &skiplist_functions;
+        if (skiplist_init((struct skiplist*)tree, (skiplist_cmp_fn_t)cmp))
+        {
+            anytree_release(tree);
+            tree = NULL;
+        }
+        break;
+
+    case ANYTREE_BTREE:
+        tree->functions = &btree_functions;
+        if (btree_init_with_pool((struct btree*)tree, (btree_cmp_fn_t)cmp, pool))
+        {
+            anytree_release(tree);
+            tree = NULL;
+        }
+        break;
+
+    case ANYTREE_FROZEN:
+        tree->functions = &frozentree_functions;
+        if (frozentree_init_keyed((struct frozentree*)tree, (frozentree_cmp_fn_t)cmp, (frozentree_key_fn_t)key))
+        {
+            anytree_release(tree);
+            tree = NULL;
+        }
+        break;
+
+    case ANYTREE_INTTREE:
+        tree->functions = &inttree_functions;
+        if (inttree_init_with_pool((struct inttree*)tree, (inttree_cmp_fn_t)cmp, (inttree_key_fn_t)key, pool))
+        {
+            anytree_release(tree);
+            tree = NULL;
+        }
+        break;
+
+    case ANYTREE_TREAP:
+        tree->functions = &treap_functions;
+        if (treap_init((struct treap*)tree, (treap_cmp_fn_t)cmp))
+        {
+            anytree_release(tree);
+            tree = NULL;
+        }
+        break;
+
+    default:
+        anytree_release(tree);
+        tree = NULL;
     }
     return tree;
 }
 
+struct anytree * anytree_init_with_allocator(enum anytree_type type, anytree_cmp_fn_t cmp, struct anytree_pool *pool)
+{
+    return anytree_init_keyed(type, cmp, NULL, pool);
+}
+
+struct anytree * anytree_init(enum anytree_type type, anytree_cmp_fn_t cmp)
+{
+    return anytree_init_with_allocator(type, cmp, NULL);
+}
+
 void anytree_release(struct anytree *tree)
 {
-    free((void*)tree);
+    /* the trees with memory of their own */
+    if (tree->functions == &btree_functions)
+        btree_release(&tree->btree);
+    else if (tree->functions == &frozentree_functions)
+        frozentree_release(&tree->frozen);
+    else if (tree->functions == &inttree_functions)
+        inttree_release(&tree->inttree);
+    if (tree->pool)
+        anytree_pool_delete(tree->pool, tree);
+    else
+        free((void*)tree);
+}
+
+int anytree_freeze(struct anytree *tree, anytree_key_fn_t key)
+{
+    struct anytree old = *tree;
+
+    if (tree->functions == &frozentree_functions)
+        return 0;
+    frozentree_init_keyed(&tree->frozen, (frozentree_cmp_fn_t)old.common.cmp_fn, (frozentree_key_fn_t)key);
+    if (frozentree_freeze(&tree->frozen, (struct frozentree_node *)old.functions->first_fn(&old),
+                          (frozentree_next_fn_t)old.functions->next_fn, old.common.size))
+    {
+        *tree = old;
+        return -1;
+    }
+    if (old.functions == &btree_functions)
+        btree_release(&old.btree);
+    else if (old.functions == &inttree_functions)
+        inttree_release(&old.inttree);
+    tree->functions = &frozentree_functions;
+    return 0;
 }
 
 void anytree_foreach(struct anytree *tree, anytree_call_fn_t call)
@@ -147,7 +413,7 @@ void anytree_foreach(struct anytree *tree, anytree_call_fn_t call)
     struct anytree_node * n;
     for (i = anytree_first(tree); i; )
     {
-        n = anytree_next(i);
+        n = anytree_next_in(i, tree);
         call(i);
         i = n;
     }
@@ -159,7 +425,7 @@ void anytree_foreach_backward(struct anytree *tree, anytree_call_fn_t call)
     struct anytree_node * n;
     for (i = anytree_last(tree); i; )
     {
-        n = anytree_prev(i);
+        n = anytree_prev_in(i, tree);
         call(i);
         i = n;
     }
@@ -3,8 +3,15 @@
 
 #include "avl.h"
 #include "bs.h"
+#include "btree.h"
+#include "frozen.h"
+#include "interval.h"
+#include "inttree.h"
+#include "pool.h"
 #include "rb.h"
+#include "skiplist.h"
 #include "splay.h"
+#include "treap.h"
 
 
 #ifdef __GNUC__
@@ -20,15 +27,22 @@ struct anytree;
 
 struct anytree_node {
     union {
+#ifndef ANYTREE_NO_TREE_POINTER
         struct anytree *tree;
+#endif
         struct avltree_node avl;
         struct bstree_node bs;
         struct rbtree_node rb;
         struct splaytree_node splay;
+        struct btree_node btree;
+        struct frozentree_node frozen;
+        struct inttree_node inttree;
+        struct treap_node treap;
     };
 };
 
 typedef int (*anytree_cmp_fn_t)(const struct anytree_node *, const struct anytree_node *);
+typedef int (*anytree_key_cmp_fn_t)(const void *key, const struct anytree_node *);
 
 typedef struct anytree_node * (*anytree_first_fn_t)(const struct anytree *tree);
 typedef struct anytree_node * (*anytree_last_fn_t)(const struct anytree *tree);
@@ -36,9 +50,15 @@ typedef struct anytree_node * (*anytree_next_fn_t)(const struct anytree_node *no
 typedef struct anytree_node * (*anytree_prev_fn_t)(const struct anytree_node *node);
 
 typedef struct anytree_node * (*anytree_lookup_fn_t)(const struct anytree_node *key, const struct anytree *tree);
+typedef struct anytree_node * (*anytree_range_fn_t)(const struct anytree_node *lo, const struct anytree_node *hi, const struct anytree *tree, struct anytree_node **end);
+typedef unsigned (*anytree_range_count_fn_t)(const struct anytree_node *lo, const struct anytree_node *hi, const struct anytree *tree);
+typedef struct anytree_node * (*anytree_lookup_key_fn_t)(const void *key, anytree_key_cmp_fn_t cmp, const struct anytree *tree);
+typedef struct anytree_node * (*anytree_remove_key_fn_t)(const void *key, anytree_key_cmp_fn_t cmp, struct anytree *tree);
 typedef struct anytree_node * (*anytree_insert_fn_t)(struct anytree_node *node, struct anytree *tree);
+typedef struct anytree_node * (*anytree_insert_hint_fn_t)(struct anytree_node *node, struct anytree_node *hint, struct anytree *tree);
 typedef void (*anytree_remove_fn_t)(struct anytree_node *node, struct anytree *tree);
 typedef void (*anytree_replace_fn_t)(struct anytree_node *old, struct anytree_node *node, struct anytree *tree);
+typedef int (*anytree_build_sorted_fn_t)(struct anytree_node **nodes, unsigned count, struct anytree *tree);
 
 typedef void (*anytree_clean_fn_t)(const struct anytree *tree);
 
@@ -49,9 +69,24 @@ struct anytree_functions {
     anytree_prev_fn_t prev_fn;
 
     anytree_lookup_fn_t lookup_fn;
+    anytree_lookup_fn_t lower_bound_fn;
+    anytree_lookup_fn_t upper_bound_fn;
+    anytree_lookup_fn_t floor_fn;
+    anytree_range_fn_t range_fn;
+    anytree_range_count_fn_t range_count_fn;
+
+    anytree_lookup_key_fn_t lookup_key_fn;
+    anytree_lookup_key_fn_t lower_bound_key_fn;
+    anytree_lookup_key_fn_t upper_bound_key_fn;
+    anytree_lookup_key_fn_t floor_key_fn;
+    anytree_remove_key_fn_t remove_key_fn;
+
     anytree_insert_fn_t insert_fn;
+    anytree_insert_hint_fn_t insert_after_fn;
+    anytree_insert_hint_fn_t insert_before_fn;
     anytree_remove_fn_t remove_fn;
     anytree_replace_fn_t replace_fn;
+    anytree_build_sorted_fn_t build_sorted_fn;
 
     anytree_clean_fn_t clean_fn;
 };
@@ -68,26 +103,185 @@ struct anytree {
         struct bstree bs;
         struct rbtree rb;
         struct splaytree splay;
+        struct intervaltree interval;
+        struct skiplist skiplist;
+        struct btree btree;
+        struct frozentree frozen;
+        struct inttree inttree;
+        struct treap treap;
     };
 
-    struct anytree_functions *functions;
+    const struct anytree_functions *functions;
+    struct anytree_pool *pool;      /* the handle's allocator, NULL for malloc */
 };
 
+/*
+ * Static dispatch: TYPE is one of the ANYTREE_AVL, ANYTREE_BS, ANYTREE_RB,
+ * ANYTREE_SPLAY, ANYTREE_INTERVAL, ANYTREE_SKIPLIST, ANYTREE_BTREE, ANYTREE_FROZEN, ANYTREE_INTTREE or ANYTREE_TREAP tokens, or a macro
+ * expanding to one, and the anytree_static_* macros turn into direct,
+ * inlinable calls to the functions of that tree type. The tree must have been set up with TYPE.
+ */
+#define ANYTREE__PREFIX_ANYTREE_AVL avltree
+#define ANYTREE__PREFIX_ANYTREE_BS bstree
+#define ANYTREE__PREFIX_ANYTREE_RB rbtree
+#define ANYTREE__PREFIX_ANYTREE_SPLAY splaytree
+#define ANYTREE__PREFIX_ANYTREE_INTERVAL rbtree
+#define ANYTREE__PREFIX_ANYTREE_SKIPLIST skiplist
+#define ANYTREE__PREFIX_ANYTREE_BTREE btree
+#define ANYTREE__PREFIX_ANYTREE_FROZEN frozentree
+#define ANYTREE__PREFIX_ANYTREE_INTTREE inttree
+#define ANYTREE__PREFIX_ANYTREE_TREAP treap
+#define ANYTREE__MEMBER_ANYTREE_AVL avl
+#define ANYTREE__MEMBER_ANYTREE_BS bs
+#define ANYTREE__MEMBER_ANYTREE_RB rb
+#define ANYTREE__MEMBER_ANYTREE_SPLAY splay
+#define ANYTREE__MEMBER_ANYTREE_INTERVAL rb     /* interval.rb shares its offset */
+#define ANYTREE__MEMBER_ANYTREE_SKIPLIST skiplist
+#define ANYTREE__MEMBER_ANYTREE_BTREE btree
+#define ANYTREE__MEMBER_ANYTREE_FROZEN frozen
+#define ANYTREE__MEMBER_ANYTREE_INTTREE inttree
+#define ANYTREE__MEMBER_ANYTREE_TREAP treap
+
+#define ANYTREE__PREFIX(TYPE) ANYTREE__PREFIX_(TYPE)
+#define ANYTREE__PREFIX_(TYPE) ANYTREE__PREFIX_##TYPE
+#define ANYTREE__MEMBER(TYPE) ANYTREE__MEMBER_(TYPE)
+#define ANYTREE__MEMBER_(TYPE) ANYTREE__MEMBER_##TYPE
+#define ANYTREE__PASTE(A, B) ANYTREE__PASTE_(A, B)
+#define ANYTREE__PASTE_(A, B) A##_##B
+#define ANYTREE__FN(TYPE, OP) ANYTREE__PASTE(ANYTREE__PREFIX(TYPE), OP)
+#define ANYTREE__NODE(TYPE, NODE) ((struct ANYTREE__FN(TYPE, node) *)(NODE))
+#define ANYTREE__NODES(TYPE, NODES) ((struct ANYTREE__FN(TYPE, node) **)(NODES))
+#define ANYTREE__TREE(TYPE, TREE) (&(TREE)->ANYTREE__MEMBER(TYPE))
+#define ANYTREE__KEY_CMP(TYPE, CMP) ((ANYTREE__FN(TYPE, key_cmp_fn_t))(CMP))
+
+#define anytree_static_first(TYPE, TREE) ((struct anytree_node *)ANYTREE__FN(TYPE, first)(ANYTREE__TREE(TYPE, TREE)))
+#define anytree_static_last(TYPE, TREE) ((struct anytree_node *)ANYTREE__FN(TYPE, last)(ANYTREE__TREE(TYPE, TREE)))
+#define anytree_static_next(TYPE, NODE) ((struct anytree_node *)ANYTREE__FN(TYPE, next)(ANYTREE__NODE(TYPE, NODE)))
+#define anytree_static_prev(TYPE, NODE) ((struct anytree_node *)ANYTREE__FN(TYPE, prev)(ANYTREE__NODE(TYPE, NODE)))
+
+#define anytree_static_lookup(TYPE, KEY, TREE) \
+    ((struct anytree_node *)ANYTREE__FN(TYPE, lookup)(ANYTREE__NODE(TYPE, KEY), ANYTREE__TREE(TYPE, TREE)))
+#define anytree_static_lower_bound(TYPE, KEY, TREE) \
+    ((struct anytree_node *)ANYTREE__FN(TYPE, lower_bound)(ANYTREE__NODE(TYPE, KEY), ANYTREE__TREE(TYPE, TREE)))
+#define anytree_static_upper_bound(TYPE, KEY, TREE) \
+    ((struct anytree_node *)ANYTREE__FN(TYPE, upper_bound)(ANYTREE__NODE(TYPE, KEY), ANYTREE__TREE(TYPE, TREE)))
+#define anytree_static_floor(TYPE, KEY, TREE) \
+    ((struct anytree_node *)ANYTREE__FN(TYPE, floor)(ANYTREE__NODE(TYPE, KEY), ANYTREE__TREE(TYPE, TREE)))
+#define anytree_static_range(TYPE, LO, HI, TREE, END) \
+    ((struct anytree_node *)ANYTREE__FN(TYPE, range)(ANYTREE__NODE(TYPE, LO), ANYTREE__NODE(TYPE, HI), \
+                                                     ANYTREE__TREE(TYPE, TREE), ANYTREE__NODES(TYPE, END)))
+#define anytree_static_range_count(TYPE, LO, HI, TREE) \
+    (ANYTREE__FN(TYPE, range_count)(ANYTREE__NODE(TYPE, LO), ANYTREE__NODE(TYPE, HI), ANYTREE__TREE(TYPE, TREE)))
+
+#define anytree_static_lookup_key(TYPE, KEY, CMP, TREE) \
+    ((struct anytree_node *)ANYTREE__FN(TYPE, lookup_key)(KEY, ANYTREE__KEY_CMP(TYPE, CMP), ANYTREE__TREE(TYPE, TREE)))
+#define anytree_static_lower_bound_key(TYPE, KEY, CMP, TREE) \
+    ((struct anytree_node *)ANYTREE__FN(TYPE, lower_bound_key)(KEY, ANYTREE__KEY_CMP(TYPE, CMP), ANYTREE__TREE(TYPE, TREE)))
+#define anytree_static_upper_bound_key(TYPE, KEY, CMP, TREE) \
+    ((struct anytree_node *)ANYTREE__FN(TYPE, upper_bound_key)(KEY, ANYTREE__KEY_CMP(TYPE, CMP), ANYTREE__TREE(TYPE, TREE)))
+#define anytree_static_floor_key(TYPE, KEY, CMP, TREE) \
+    ((struct anytree_node *)ANYTREE__FN(TYPE, floor_key)(KEY, ANYTREE__KEY_CMP(TYPE, CMP), ANYTREE__TREE(TYPE, TREE)))
+#define anytree_static_remove_key(TYPE, KEY, CMP, TREE) \
+    ((struct anytree_node *)ANYTREE__FN(TYPE, remove_key)(KEY, ANYTREE__KEY_CMP(TYPE, CMP), ANYTREE__TREE(TYPE, TREE)))
+
+#define anytree_static_insert(TYPE, NODE, TREE) \
+    ((struct anytree_node *)ANYTREE__FN(TYPE, insert)(ANYTREE__NODE(TYPE, NODE), ANYTREE__TREE(TYPE, TREE)))
+#define anytree_static_insert_after(TYPE, NODE, HINT, TREE) \
+    ((struct anytree_node *)ANYTREE__FN(TYPE, insert_after)(ANYTREE__NODE(TYPE, NODE), ANYTREE__NODE(TYPE, HINT), ANYTREE__TREE(TYPE, TREE)))
+#define anytree_static_insert_before(TYPE, NODE, HINT, TREE) \
+    ((struct anytree_node *)ANYTREE__FN(TYPE, insert_before)(ANYTREE__NODE(TYPE, NODE), ANYTREE__NODE(TYPE, HINT), ANYTREE__TREE(TYPE, TREE)))
+#define anytree_static_remove(TYPE, NODE, TREE) \
+    (ANYTREE__FN(TYPE, remove)(ANYTREE__NODE(TYPE, NODE), ANYTREE__TREE(TYPE, TREE)))
+#define anytree_static_replace(TYPE, OLD, NODE, TREE) \
+    (ANYTREE__FN(TYPE, replace)(ANYTREE__NODE(TYPE, OLD), ANYTREE__NODE(TYPE, NODE), ANYTREE__TREE(TYPE, TREE)))
+#define anytree_static_build_sorted(TYPE, NODES, COUNT, TREE) \
+    (ANYTREE__FN(TYPE, build_sorted)(ANYTREE__NODES(TYPE, NODES), COUNT, ANYTREE__TREE(TYPE, TREE)))
+#define anytree_static_clean(TYPE, TREE) (ANYTREE__FN(TYPE, clean)(ANYTREE__TREE(TYPE, TREE)))
+
+/*
+ * A translation unit working with a single tree type can define
+ * ANYTREE_STATIC_TYPE to it before including any.h: the anytree_* macros
+ * below then dispatch statically as well, and do not need the tree pointer.
+ */
+#ifdef ANYTREE_STATIC_TYPE
+
+#define anytree_first(TREE) anytree_static_first(ANYTREE_STATIC_TYPE, TREE)
+#define anytree_last(TREE) anytree_static_last(ANYTREE_STATIC_TYPE, TREE)
+#define anytree_next_in(NODE, TREE) anytree_static_next(ANYTREE_STATIC_TYPE, NODE)
+#define anytree_prev_in(NODE, TREE) anytree_static_prev(ANYTREE_STATIC_TYPE, NODE)
+#define anytree_next(NODE) anytree_static_next(ANYTREE_STATIC_TYPE, NODE)
+#define anytree_prev(NODE) anytree_static_prev(ANYTREE_STATIC_TYPE, NODE)
+
+#define anytree_lookup(KEY, TREE) anytree_static_lookup(ANYTREE_STATIC_TYPE, KEY, TREE)
+#define anytree_lower_bound(KEY, TREE) anytree_static_lower_bound(ANYTREE_STATIC_TYPE, KEY, TREE)
+#define anytree_upper_bound(KEY, TREE) anytree_static_upper_bound(ANYTREE_STATIC_TYPE, KEY, TREE)
+#define anytree_floor(KEY, TREE) anytree_static_floor(ANYTREE_STATIC_TYPE, KEY, TREE)
+#define anytree_ceil(KEY, TREE) anytree_lower_bound(KEY, TREE)
+#define anytree_range(LO, HI, TREE, END) anytree_static_range(ANYTREE_STATIC_TYPE, LO, HI, TREE, END)
+#define anytree_range_count(LO, HI, TREE) anytree_static_range_count(ANYTREE_STATIC_TYPE, LO, HI, TREE)
+
+#define anytree_lookup_key(KEY, CMP, TREE) anytree_static_lookup_key(ANYTREE_STATIC_TYPE, KEY, CMP, TREE)
+#define anytree_lower_bound_key(KEY, CMP, TREE) anytree_static_lower_bound_key(ANYTREE_STATIC_TYPE, KEY, CMP, TREE)
+#define anytree_upper_bound_key(KEY, CMP, TREE) anytree_static_upper_bound_key(ANYTREE_STATIC_TYPE, KEY, CMP, TREE)
+#define anytree_floor_key(KEY, CMP, TREE) anytree_static_floor_key(ANYTREE_STATIC_TYPE, KEY, CMP, TREE)
+#define anytree_remove_key(KEY, CMP, TREE) anytree_static_remove_key(ANYTREE_STATIC_TYPE, KEY, CMP, TREE)
+
+#define anytree_insert(NODE, TREE) anytree_static_insert(ANYTREE_STATIC_TYPE, NODE, TREE)
+#define anytree_insert_after(NODE, HINT, TREE) anytree_static_insert_after(ANYTREE_STATIC_TYPE, NODE, HINT, TREE)
+#define anytree_insert_before(NODE, HINT, TREE) anytree_static_insert_before(ANYTREE_STATIC_TYPE, NODE, HINT, TREE)
+#define anytree_remove_from(NODE, TREE) anytree_static_remove(ANYTREE_STATIC_TYPE, NODE, TREE)
+#define anytree_replace_in(OLD, NODE, TREE) anytree_static_replace(ANYTREE_STATIC_TYPE, OLD, NODE, TREE)
+#ifndef ANYTREE_NO_TREE_POINTER
+#  define anytree_remove(NODE) anytree_remove_from(NODE, NODE->tree)
+#  define anytree_replace(OLD, NODE) anytree_replace_in(OLD, NODE, OLD->tree)
+#endif
+#define anytree_build_sorted(NODES, COUNT, TREE) anytree_static_build_sorted(ANYTREE_STATIC_TYPE, NODES, COUNT, TREE)
+
+#define anytree_clean(TREE) anytree_static_clean(ANYTREE_STATIC_TYPE, TREE)
+
+#else
+
 #define anytree_first(TREE) (TREE->functions->first_fn(TREE))
 #define anytree_last(TREE) (TREE->functions->last_fn(TREE))
-#define anytree_next(NODE) (NODE->tree->functions->next_fn(NODE))
-#define anytree_prev(NODE) (NODE->tree->functions->prev_fn(NODE))
+#define anytree_next_in(NODE, TREE) (TREE->functions->next_fn(NODE))
+#define anytree_prev_in(NODE, TREE) (TREE->functions->prev_fn(NODE))
+#ifndef ANYTREE_NO_TREE_POINTER
+#  define anytree_next(NODE) anytree_next_in(NODE, NODE->tree)
+#  define anytree_prev(NODE) anytree_prev_in(NODE, NODE->tree)
+#endif
 
 #define anytree_lookup(KEY, TREE) (TREE->functions->lookup_fn(KEY, TREE))
+#define anytree_lower_bound(KEY, TREE) (TREE->functions->lower_bound_fn(KEY, TREE))
+#define anytree_upper_bound(KEY, TREE) (TREE->functions->upper_bound_fn(KEY, TREE))
+#define anytree_floor(KEY, TREE) (TREE->functions->floor_fn(KEY, TREE))
+#define anytree_ceil(KEY, TREE) anytree_lower_bound(KEY, TREE)
+#define anytree_range(LO, HI, TREE, END) (TREE->functions->range_fn(LO, HI, TREE, END))
+#define anytree_range_count(LO, HI, TREE) (TREE->functions->range_count_fn(LO, HI, TREE))
+
+#define anytree_lookup_key(KEY, CMP, TREE) (TREE->functions->lookup_key_fn(KEY, CMP, TREE))
+#define anytree_lower_bound_key(KEY, CMP, TREE) (TREE->functions->lower_bound_key_fn(KEY, CMP, TREE))
+#define anytree_upper_bound_key(KEY, CMP, TREE) (TREE->functions->upper_bound_key_fn(KEY, CMP, TREE))
+#define anytree_floor_key(KEY, CMP, TREE) (TREE->functions->floor_key_fn(KEY, CMP, TREE))
+#define anytree_remove_key(KEY, CMP, TREE) (TREE->functions->remove_key_fn(KEY, CMP, TREE))
+
 #define anytree_insert(NODE, TREE) (TREE->functions->insert_fn(NODE, TREE))
-#define anytree_remove(NODE) (NODE->tree->functions->remove_fn(NODE, NODE->tree))
-#define anytree_replace(OLD, NODE) (OLD->tree->functions->replace_fn(OLD, NODE, OLD->tree))
+#define anytree_insert_after(NODE, HINT, TREE) (TREE->functions->insert_after_fn(NODE, HINT, TREE))
+#define anytree_insert_before(NODE, HINT, TREE) (TREE->functions->insert_before_fn(NODE, HINT, TREE))
+#define anytree_remove_from(NODE, TREE) (TREE->functions->remove_fn(NODE, TREE))
+#define anytree_replace_in(OLD, NODE, TREE) (TREE->functions->replace_fn(OLD, NODE, TREE))
+#ifndef ANYTREE_NO_TREE_POINTER
+#  define anytree_remove(NODE) anytree_remove_from(NODE, NODE->tree)
+#  define anytree_replace(OLD, NODE) anytree_replace_in(OLD, NODE, OLD->tree)
+#endif
+#define anytree_build_sorted(NODES, COUNT, TREE) (TREE->functions->build_sorted_fn(NODES, COUNT, TREE))
+
+#define anytree_clean(TREE) (TREE->functions->clean_fn(TREE))
+
+#endif
 
 #define anytree_is_empty(TREE) (TREE->common.size == 0)
 #define anytree_size(TREE) (TREE->common.size)
 
-#define anytree_clean(TREE) (TREE->functions->clean_fn(TREE))
-
 typedef void (*anytree_call_fn_t)(const struct anytree_node *);
 void anytree_foreach(struct anytree *tree, anytree_call_fn_t call);
 void anytree_foreach_backward(struct anytree *tree, anytree_call_fn_t call);
@@ -97,10 +291,43 @@ enum anytree_type {
     ANYTREE_AVL,
     ANYTREE_BS,
     ANYTREE_RB,
-    ANYTREE_SPLAY
+    ANYTREE_SPLAY,
+    ANYTREE_INTERVAL,   /* nodes are struct intervaltree_node, cmp is ignored;
+                           query overlaps with intervaltree_overlap_*(&tree->interval) */
+    ANYTREE_SKIPLIST,   /* lock-free, all operations may run concurrently; nodes are
+                           struct skiplist_node, allocated with their tower and
+                           retired after removal as skiplist.h describes */
+    ANYTREE_BTREE,      /* B+tree, allocates its own nodes from the handle's
+                           allocator; insert returns the node itself when out of memory */
+    ANYTREE_FROZEN,     /* read-only Eytzinger array, filled by anytree_build_sorted()
+                           or anytree_freeze(); insert returns the node itself */
+    ANYTREE_INTTREE,    /* B+tree over integer keys searched with SIMD compares, set up
+                           with anytree_init_keyed(); allocates as ANYTREE_BTREE does */
+    ANYTREE_TREAP       /* randomized treap; split, join, union and range removal
+                           through treap.h on &tree->treap */
 };
 
 struct anytree * anytree_init(enum anytree_type type, anytree_cmp_fn_t cmp);
+/* Allocates the handle from 'pool'; anytree_pool_release() also disposes of it */
+struct anytree * anytree_init_with_allocator(enum anytree_type type, anytree_cmp_fn_t cmp, struct anytree_pool *pool);
+
+/*
+ * Maps nodes to integers ordered as the comparator orders the nodes. It
+ * is required by ANYTREE_INTTREE, and given to ANYTREE_FROZEN it caches
+ * the keys (see frozen.h); the other types ignore it. 'pool' may be NULL.
+ */
+typedef uint64_t (*anytree_key_fn_t)(const struct anytree_node *);
+struct anytree * anytree_init_keyed(enum anytree_type type, anytree_cmp_fn_t cmp, anytree_key_fn_t key, struct anytree_pool *pool);
 void anytree_release(struct anytree *tree);
 
+/*
+ * Turns a tree of any type into an ANYTREE_FROZEN snapshot of its nodes, in
+ * place: the nodes' links are overwritten, the handle stays the same. 'key',
+ * if not NULL, maps nodes to integers ordered as the comparator orders them,
+ * and is cached for node lookups (see frozen.h). Returns -1, the tree left
+ * as it was, when out of memory.
+ */
+typedef anytree_key_fn_t anytree_frozen_key_fn_t;
+int anytree_freeze(struct anytree *tree, anytree_key_fn_t key);
+
 #endif
\ No newline at end of file
@@ -2,23 +2,74 @@
 #include <assert.h>
 
 #include "avl.h"
+#include "veb.h"
 
-
-static inline int is_root(struct avltree_node *node)
+/* Without tree pointers membership cannot be checked and is assumed */
+#ifdef ANYTREE_NO_TREE_POINTER
+static inline void set_tree(struct avltree *tree, struct avltree_node *node)
 {
-    return node->parent == NULL;
+    (void)tree;
+    (void)node;
 }
 
-static inline void INIT_NODE(struct avltree_node *node, struct avltree *tree)
+static inline int in_tree(const struct avltree_node *node, const struct avltree *tree)
+{
+    (void)node;
+    (void)tree;
+    return 1;
+}
+#else
+static inline void set_tree(struct avltree *tree, struct avltree_node *node)
 {
-    node->left = NULL;
-    node->right = NULL;
     node->tree = tree;
-    node->parent = NULL;
-    node->balance = 0;
 }
 
-static inline signed get_balance(struct avltree_node *node)
+static inline int in_tree(const struct avltree_node *node, const struct avltree *tree)
+{
+    return node->tree == tree;
+}
+#endif
+
+
+#ifdef ANYTREE_COMPACT_NODES
+
+static inline signed get_balance(const struct avltree_node *node)
+{
+    return (signed)(node->parent_balance & 7) - 2;
+}
+
+static inline void set_balance(int balance, struct avltree_node *node)
+{
+    node->parent_balance = (node->parent_balance & ~(uintptr_t)7) | (uintptr_t)(balance + 2);
+}
+
+static inline int inc_balance(struct avltree_node *node)
+{
+    int balance = get_balance(node) + 1;
+    set_balance(balance, node);
+    return balance;
+}
+
+static inline int dec_balance(struct avltree_node *node)
+{
+    int balance = get_balance(node) - 1;
+    set_balance(balance, node);
+    return balance;
+}
+
+static inline struct avltree_node *get_parent(const struct avltree_node *node)
+{
+    return avltree_parent(node);
+}
+
+static inline void set_parent(struct avltree_node *parent, struct avltree_node *node)
+{
+    node->parent_balance = (uintptr_t)parent | (node->parent_balance & 7);
+}
+
+#else
+
+static inline signed get_balance(const struct avltree_node *node)
 {
     return node->balance;
 }
@@ -48,6 +99,62 @@ static inline void set_parent(struct avltree_node *parent, struct avltree_node *
     node->parent = parent;
 }
 
+#endif
+
+static inline int is_root(struct avltree_node *node)
+{
+    return get_parent(node) == NULL;
+}
+
+static inline void INIT_NODE(struct avltree_node *node, struct avltree *tree)
+{
+    node->left = NULL;
+    node->right = NULL;
+    set_tree(tree, node);
+    set_parent(NULL, node);
+    set_balance(0, node);
+}
+
+/*
+ * Subtree sizes, only present in ranked trees where every node is
+ * embedded in a struct avltree_ranked_node.
+ */
+static inline unsigned get_count(const struct avltree_node *node)
+{
+    if (!node)
+        return 0;
+    return avltree_container_of(node, struct avltree_ranked_node, node)->count;
+}
+
+static inline void set_count(unsigned count, struct avltree_node *node)
+{
+    avltree_container_of(node, struct avltree_ranked_node, node)->count = count;
+}
+
+static inline void update_count(struct avltree_node *node)
+{
+    set_count(get_count(node->left) + get_count(node->right) + 1, node);
+}
+
+static inline void update_counts(struct avltree_node *node)
+{
+    for (; node; node = get_parent(node))
+        update_count(node);
+}
+
+/*
+ * A node just linked in carries a stale aggregate, so it is computed on its
+ * own before propagating: an early stop is only valid above it.
+ */
+static inline void augment_linked(struct avltree_node *node, struct avltree *tree)
+{
+    struct avltree_node *parent = get_parent(node);
+
+    tree->augment->propagate(node, parent);
+    if (parent)
+        tree->augment->propagate(parent, NULL);
+}
+
 
 static inline struct avltree_node *get_first(struct avltree_node *node)
 {
@@ -117,6 +224,13 @@ static void rotate_left(struct avltree_node *node, struct avltree *tree)
     if (p->right)
         set_parent(p, p->right);
     q->left = p;
+
+    if (tree->ranked) {
+        update_count(p);
+        update_count(q);
+    }
+    if (tree->augment)
+        tree->augment->rotate(p, q);
 }
 
 static void rotate_right(struct avltree_node *node, struct avltree *tree)
@@ -139,6 +253,13 @@ static void rotate_right(struct avltree_node *node, struct avltree *tree)
     if (p->left)
         set_parent(p, p->left);
     q->right = p;
+
+    if (tree->ranked) {
+        update_count(p);
+        update_count(q);
+    }
+    if (tree->augment)
+        tree->augment->rotate(p, q);
 }
 
 
@@ -176,6 +297,195 @@ struct avltree_node *avltree_lookup(const struct avltree_node *key,
     return do_lookup(key, tree, &parent, &unbalanced, &is_left);
 }
 
+/*
+ * Bounded searches: a single descent remembering the closest node seen on
+ * the requested side of the key.
+ */
+static struct avltree_node *do_bound(const struct avltree_node *key, const struct avltree *tree, int after, int strict)
+{
+    struct avltree_node *node = tree->root;
+    struct avltree_node *bound = NULL;
+
+    while (node) {
+        int res = tree->cmp_fn(node, key);
+        if (res == 0 && !strict)
+            return node;
+        if (after) {
+            if (res > 0) {
+                bound = node;
+                node = node->left;
+            } else
+                node = node->right;
+        } else {
+            if (res < 0) {
+                bound = node;
+                node = node->right;
+            } else
+                node = node->left;
+        }
+    }
+    return bound;
+}
+
+struct avltree_node *avltree_lower_bound(const struct avltree_node *key, const struct avltree *tree)
+{
+    return do_bound(key, tree, 1, 0);
+}
+
+struct avltree_node *avltree_upper_bound(const struct avltree_node *key, const struct avltree *tree)
+{
+    return do_bound(key, tree, 1, 1);
+}
+
+struct avltree_node *avltree_floor(const struct avltree_node *key, const struct avltree *tree)
+{
+    return do_bound(key, tree, 0, 0);
+}
+
+/*
+ * Range [lo, hi): returns the first node of the range and stores the node
+ * following it in *end, so that iteration needs no comparisons. A NULL
+ * bound leaves that side open; the cached first/last nodes spare the
+ * descent when a bound lies outside the tree.
+ */
+struct avltree_node *avltree_range(const struct avltree_node *lo, const struct avltree_node *hi, const struct avltree *tree, struct avltree_node **end)
+{
+    *end = NULL;
+    if (!tree->root || (lo && hi && tree->cmp_fn(lo, hi) >= 0))
+        return NULL;
+
+    if (hi && tree->cmp_fn(tree->last, hi) >= 0)
+        *end = avltree_lower_bound(hi, tree);
+    if (!lo || tree->cmp_fn(tree->first, lo) >= 0)
+        return tree->first;
+    return avltree_lower_bound(lo, tree);
+}
+
+unsigned avltree_range_count(const struct avltree_node *lo, const struct avltree_node *hi, const struct avltree *tree)
+{
+    struct avltree_node *node, *end;
+    unsigned count = 0;
+
+    if (tree->ranked) {
+        node = avltree_range(lo, hi, tree, &end);
+        if (node == end)
+            return 0;
+        return (end ? avltree_rank(end, tree) : tree->size) - avltree_rank(node, tree);
+    }
+    for (node = avltree_range(lo, hi, tree, &end); node != end; node = avltree_next(node))
+        count++;
+    return count;
+}
+
+/*
+ * Order statistics: O(log n) in ranked trees, a walk from the ends in
+ * plain ones. Ranks count from zero.
+ */
+struct avltree_node *avltree_select(unsigned k, const struct avltree *tree)
+{
+    struct avltree_node *node;
+    unsigned left;
+
+    if (k >= tree->size)
+        return NULL;
+
+    if (!tree->ranked) {
+        for (node = tree->first; k--; )
+            node = avltree_next(node);
+        return node;
+    }
+    node = tree->root;
+    for (;;) {
+        left = get_count(node->left);
+        if (k == left)
+            return node;
+        if (k < left)
+            node = node->left;
+        else {
+            k -= left + 1;
+            node = node->right;
+        }
+    }
+}
+
+unsigned avltree_rank(const struct avltree_node *node, const struct avltree *tree)
+{
+    const struct avltree_node *parent;
+    unsigned rank = 0;
+
+    if (!tree->ranked) {
+        while ((node = avltree_prev(node)))
+            rank++;
+        return rank;
+    }
+    rank = get_count(node->left);
+    for (; (parent = get_parent(node)); node = parent)
+        if (parent->right == node)
+            rank += get_count(parent->left) + 1;
+    return rank;
+}
+
+/*
+ * Searches by key: cmp(key, node) orders a bare key against the nodes, so
+ * callers need not wrap the key into a node of their own.
+ */
+static struct avltree_node *do_bound_key(const void *key, avltree_key_cmp_fn_t cmp, const struct avltree *tree, int after, int strict)
+{
+    struct avltree_node *node = tree->root;
+    struct avltree_node *bound = NULL;
+
+    while (node) {
+        int res = cmp(key, node);
+        if (res == 0 && !strict)
+            return node;
+        if (after) {
+            if (res < 0) {
+                bound = node;
+                node = node->left;
+            } else
+                node = node->right;
+        } else {
+            if (res > 0) {
+                bound = node;
+                node = node->right;
+            } else
+                node = node->left;
+        }
+    }
+    return bound;
+}
+
+struct avltree_node *avltree_lookup_key(const void *key, avltree_key_cmp_fn_t cmp, const struct avltree *tree)
+{
+    struct avltree_node *node = tree->root;
+
+    while (node) {
+        int res = cmp(key, node);
+        if (res == 0)
+            return node;
+        if (res < 0)
+            node = node->left;
+        else
+            node = node->right;
+    }
+    return NULL;
+}
+
+struct avltree_node *avltree_lower_bound_key(const void *key, avltree_key_cmp_fn_t cmp, const struct avltree *tree)
+{
+    return do_bound_key(key, cmp, tree, 1, 0);
+}
+
+struct avltree_node *avltree_upper_bound_key(const void *key, avltree_key_cmp_fn_t cmp, const struct avltree *tree)
+{
+    return do_bound_key(key, cmp, tree, 1, 1);
+}
+
+struct avltree_node *avltree_floor_key(const void *key, avltree_key_cmp_fn_t cmp, const struct avltree *tree)
+{
+    return do_bound_key(key, cmp, tree, 0, 0);
+}
+
 static void set_child(struct avltree_node *child, struct avltree_node *node, int left)
 {
     if (left)
@@ -184,24 +494,21 @@ static void set_child(struct avltree_node *child, struct avltree_node *node, int
         node->right = child;
 }
 
-struct avltree_node *avltree_insert(struct avltree_node *node, struct avltree *tree)
+static void do_insert(struct avltree_node *node, struct avltree_node *parent, struct avltree_node *unbalanced, int is_left, struct avltree *tree)
 {
-    struct avltree_node *key, *parent, *unbalanced;
-    int is_left;
-
-    key = do_lookup(node, tree, &parent, &unbalanced, &is_left);
-    if (key)
-        return key;
-
     ++tree->size;
 
     INIT_NODE(node, tree);
+    if (tree->ranked)
+        set_count(1, node);
 
     if (!parent) {
         tree->root = node;
         tree->first = tree->last = node;
         tree->height++;
-        return NULL;
+        if (tree->augment)
+            augment_linked(node, tree);
+        return;
     }
     if (is_left) {
         if (parent == tree->first)
@@ -212,6 +519,10 @@ struct avltree_node *avltree_insert(struct avltree_node *node, struct avltree *t
     }
     set_parent(parent, node);
     set_child(node, parent, is_left);
+    if (tree->ranked)
+        update_counts(parent);
+    if (tree->augment)
+        augment_linked(node, tree);
 
     for (;;) {
         if (parent->left == node)
@@ -288,9 +599,82 @@ struct avltree_node *avltree_insert(struct avltree_node *node, struct avltree *t
         break;
     }
     }
+}
+
+struct avltree_node *avltree_insert(struct avltree_node *node, struct avltree *tree)
+{
+    struct avltree_node *key, *parent, *unbalanced;
+    int is_left;
+
+    key = do_lookup(node, tree, &parent, &unbalanced, &is_left);
+    if (key)
+        return key;
+
+    do_insert(node, parent, unbalanced, is_left, tree);
+    return NULL;
+}
+
+/*
+ * Links 'node' at a free child slot of 'parent' found by the caller's own
+ * descent and rebalances. The deepest unbalanced ancestor is where
+ * do_lookup() would have stopped rebalancing.
+ */
+void avltree_link(struct avltree_node *node, struct avltree_node *parent, int is_left, struct avltree *tree)
+{
+    struct avltree_node *unbalanced = parent;
+
+    while (unbalanced && get_balance(unbalanced) == 0 && !is_root(unbalanced))
+        unbalanced = get_parent(unbalanced);
+
+    do_insert(node, parent, unbalanced, is_left, tree);
+}
+
+/*
+ * Hinted insertion: 'node' goes between the neighbours 'prev' and 'next'
+ * (either may be NULL at the ends of the tree). One of them always has a
+ * free child slot for it, so only the rebalancing work remains. A hint
+ * that does not bracket the node falls back to a regular insertion.
+ */
+static struct avltree_node *insert_between(struct avltree_node *node, struct avltree_node *prev, struct avltree_node *next, struct avltree *tree)
+{
+    int res;
+
+    if (prev) {
+        res = tree->cmp_fn(prev, node);
+        if (res == 0)
+            return prev;
+        if (res > 0)
+            return avltree_insert(node, tree);
+    }
+    if (next) {
+        res = tree->cmp_fn(next, node);
+        if (res == 0)
+            return next;
+        if (res < 0)
+            return avltree_insert(node, tree);
+    }
+
+    if (prev && !prev->right)
+        avltree_link(node, prev, 0, tree);
+    else
+        avltree_link(node, next, 1, tree);
     return NULL;
 }
 
+struct avltree_node *avltree_insert_after(struct avltree_node *node, struct avltree_node *hint, struct avltree *tree)
+{
+    if (hint && !in_tree(hint, tree))
+        return avltree_insert(node, tree);
+    return insert_between(node, hint, hint ? avltree_next(hint) : tree->first, tree);
+}
+
+struct avltree_node *avltree_insert_before(struct avltree_node *node, struct avltree_node *hint, struct avltree *tree)
+{
+    if (hint && !in_tree(hint, tree))
+        return avltree_insert(node, tree);
+    return insert_between(node, hint ? avltree_prev(hint) : tree->last, hint, tree);
+}
+
 void avltree_remove(struct avltree_node *node, struct avltree *tree)
 {
     struct avltree_node *parent = get_parent(node);
@@ -299,7 +683,7 @@ void avltree_remove(struct avltree_node *node, struct avltree *tree)
     struct avltree_node *next;
     int is_left = is_left;
 
-    if (tree && (node->tree != tree))
+    if (tree && !in_tree(node, tree))
         return;
 
     --tree->size;
@@ -324,6 +708,8 @@ void avltree_remove(struct avltree_node *node, struct avltree *tree)
 
     if (left && right) {
         set_balance(get_balance(node), next);
+        if (tree->augment)
+            tree->augment->copy(node, next);
 
         next->left = left;
         set_parent(next, left);
@@ -350,6 +736,16 @@ void avltree_remove(struct avltree_node *node, struct avltree *tree)
 
     if (node)
         set_parent(parent, node);
+    if (tree->ranked)
+        update_counts(parent);
+    if (tree->augment) {
+        if (left && right) {
+            if (parent != next)
+                tree->augment->propagate(parent, next);
+            tree->augment->propagate(next, NULL);
+        } else if (parent)
+            tree->augment->propagate(parent, NULL);
+    }
 
     while (parent) {
         int balance;
@@ -439,6 +835,15 @@ void avltree_remove(struct avltree_node *node, struct avltree *tree)
     tree->height--;
 }
 
+struct avltree_node *avltree_remove_key(const void *key, avltree_key_cmp_fn_t cmp, struct avltree *tree)
+{
+    struct avltree_node *node = avltree_lookup_key(key, cmp, tree);
+
+    if (node)
+        avltree_remove(node, tree);
+    return node;
+}
+
 void avltree_replace(struct avltree_node *old, struct avltree_node *node, struct avltree *tree)
 {
     struct avltree_node *parent = get_parent(old);
@@ -459,6 +864,394 @@ void avltree_replace(struct avltree_node *old, struct avltree_node *node, struct
         tree->last = node;
 
     *node = *old;
+    if (tree->ranked)
+        set_count(get_count(old), node);
+    if (tree->augment)
+        tree->augment->copy(old, node);
+}
+
+/*
+ * Bulk build: links nodes[], which must be sorted in strictly ascending
+ * order, into a perfectly balanced tree without calling the comparator.
+ * Subtree sizes differ by at most one, so every balance is set from the
+ * heights returned by the recursion.
+ */
+static struct avltree_node *build_sorted(struct avltree_node **nodes, unsigned count, struct avltree_node *parent, struct avltree *tree, int *height)
+{
+    struct avltree_node *node;
+    unsigned mid = count / 2;
+    int lheight, rheight;
+
+    if (!count) {
+        *height = 0;
+        return NULL;
+    }
+    node = nodes[mid];
+    INIT_NODE(node, tree);
+    set_parent(parent, node);
+
+    node->left = build_sorted(nodes, mid, node, tree, &lheight);
+    node->right = build_sorted(nodes + mid + 1, count - mid - 1, node, tree, &rheight);
+    set_balance(rheight - lheight, node);
+    if (tree->ranked)
+        set_count(count, node);
+    if (tree->augment)
+        tree->augment->propagate(node, parent);
+
+    *height = (lheight > rheight ? lheight : rheight) + 1;
+    return node;
+}
+
+int avltree_build_sorted(struct avltree_node **nodes, unsigned count, struct avltree *tree)
+{
+    int height;
+
+    if (tree->size)
+        return -1;
+
+    tree->root = build_sorted(nodes, count, NULL, tree, &height);
+    tree->size = count;
+    tree->height = height - 1;
+    tree->first = count ? nodes[0] : NULL;
+    tree->last = count ? nodes[count - 1] : NULL;
+    return 0;
+}
+
+static void *veb_child(const void *node, int right)
+{
+    const struct avltree_node *n = (const struct avltree_node *)node;
+    return right ? n->right : n->left;
+}
+
+static inline struct avltree_node *moved(const struct anytree_veb *veb, const struct avltree_node *node)
+{
+    return (struct avltree_node *)anytree_veb_moved(veb, node);
+}
+
+int avltree_relayout(struct avltree *tree, void *array, unsigned count, size_t stride, size_t offset)
+{
+    struct anytree_veb veb;
+    struct avltree_node *node;
+    unsigned i;
+
+    if (anytree_veb_plan(&veb, array, count, stride, offset, tree->root, tree->size, veb_child))
+        return -1;
+    anytree_veb_move(&veb);
+
+    for (i = 0; i < tree->size; i++) {
+        node = (struct avltree_node *)anytree_veb_node(&veb, i);
+        node->left = moved(&veb, node->left);
+        node->right = moved(&veb, node->right);
+        set_parent(moved(&veb, get_parent(node)), node);
+    }
+    tree->root = moved(&veb, tree->root);
+    tree->first = moved(&veb, tree->first);
+    tree->last = moved(&veb, tree->last);
+
+    anytree_veb_done(&veb);
+    return 0;
+}
+
+/* Empties 'tree', giving it the comparator and options of 'like' */
+static void init_like(struct avltree *tree, const struct avltree *like)
+{
+    int ranked = like->ranked;
+    const struct avltree_augment_callbacks *augment = like->augment;
+
+    avltree_init(tree, like->cmp_fn);
+    tree->ranked = ranked;
+    tree->augment = augment;
+}
+
+/*
+ * Retraces after the subtree rooted at 'node' grew by one level. Returns
+ * non-zero when the whole tree grew.
+ */
+static int grow_fixup(struct avltree_node *node, struct avltree *tree)
+{
+    struct avltree_node *parent, *child;
+    int balance;
+
+    while ((parent = get_parent(node))) {
+        if (parent->left == node)
+            balance = dec_balance(parent);
+        else
+            balance = inc_balance(parent);
+
+        if (balance == 0)
+            return 0;
+        if (balance == 1 || balance == -1) {
+            node = parent;
+            continue;
+        }
+        if (balance == 2) {
+            child = parent->right;
+            switch (get_balance(child)) {
+            case 1:
+                set_balance(0, parent);
+                set_balance(0, child);
+                rotate_left(parent, tree);
+                return 0;
+            case 0:
+                set_balance( 1, parent);
+                set_balance(-1, child);
+                rotate_left(parent, tree);
+                node = child;
+                continue;
+            }
+            switch (get_balance(child->left)) {
+            case 1:
+                set_balance(-1, parent);
+                set_balance( 0, child);
+                break;
+            case 0:
+                set_balance(0, parent);
+                set_balance(0, child);
+                break;
+            case -1:
+                set_balance(0, parent);
+                set_balance(1, child);
+                break;
+            }
+            set_balance(0, child->left);
+            rotate_right(child, tree);
+            rotate_left(parent, tree);
+            return 0;
+        } else {
+            child = parent->left;
+            switch (get_balance(child)) {
+            case -1:
+                set_balance(0, parent);
+                set_balance(0, child);
+                rotate_right(parent, tree);
+                return 0;
+            case 0:
+                set_balance(-1, parent);
+                set_balance( 1, child);
+                rotate_right(parent, tree);
+                node = child;
+                continue;
+            }
+            switch (get_balance(child->right)) {
+            case 1:
+                set_balance( 0, parent);
+                set_balance(-1, child);
+                break;
+            case 0:
+                set_balance(0, parent);
+                set_balance(0, child);
+                break;
+            case -1:
+                set_balance(1, parent);
+                set_balance(0, child);
+                break;
+            }
+            set_balance(0, child->right);
+            rotate_left(child, tree);
+            rotate_right(parent, tree);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+ * Join and split. do_join() links two detached subtrees of heights
+ * 'lheight' and 'rheight' (-1 when empty) under 'pivot': the pivot takes
+ * the place of the first node on the inner spine of the taller subtree
+ * that is no more than one level above the shorter one, then the spine
+ * is retraced as after an insertion. The result is rooted in
+ * scratch->root and its height is returned.
+ */
+static int do_join(struct avltree_node *left, int lheight, struct avltree_node *pivot, struct avltree_node *right, int rheight, struct avltree *scratch)
+{
+    struct avltree_node *parent = NULL, *node;
+    int height;
+
+    if (left)
+        set_parent(NULL, left);
+    if (right)
+        set_parent(NULL, right);
+
+    if (lheight - rheight <= 1 && rheight - lheight <= 1) {
+        pivot->left = left;
+        pivot->right = right;
+        if (left)
+            set_parent(pivot, left);
+        if (right)
+            set_parent(pivot, right);
+        set_parent(NULL, pivot);
+        set_balance(rheight - lheight, pivot);
+        if (scratch->ranked)
+            update_count(pivot);
+        if (scratch->augment)
+            augment_linked(pivot, scratch);
+        scratch->root = pivot;
+        return (lheight > rheight ? lheight : rheight) + 1;
+    }
+
+    if (lheight > rheight) {
+        for (node = left, height = lheight; height > rheight + 1; node = node->right) {
+            height -= get_balance(node) < 0 ? 2 : 1;
+            parent = node;
+        }
+        pivot->left = node;
+        pivot->right = right;
+        set_balance(rheight - height, pivot);
+        parent->right = pivot;
+        scratch->root = left;
+        height = lheight;
+    } else {
+        for (node = right, height = rheight; height > lheight + 1; node = node->left) {
+            height -= get_balance(node) > 0 ? 2 : 1;
+            parent = node;
+        }
+        pivot->left = left;
+        pivot->right = node;
+        set_balance(height - lheight, pivot);
+        parent->left = pivot;
+        scratch->root = right;
+        height = rheight;
+    }
+    if (pivot->left)
+        set_parent(pivot, pivot->left);
+    if (pivot->right)
+        set_parent(pivot, pivot->right);
+    set_parent(parent, pivot);
+    if (scratch->ranked)
+        update_counts(pivot);
+    if (scratch->augment)
+        augment_linked(pivot, scratch);
+
+    return height + grow_fixup(pivot, scratch);
+}
+
+/* Moves the nodes of a detached subtree over to 'tree' and counts them. */
+static unsigned adopt(struct avltree_node *root, struct avltree *tree)
+{
+    struct avltree_node *node;
+    unsigned count = 0;
+
+    if (!root)
+        return 0;
+#ifdef ANYTREE_NO_TREE_POINTER
+    if (tree->ranked)
+        return get_count(root);
+#endif
+    for (node = get_first(root); node; node = avltree_next(node)) {
+        set_tree(tree, node);
+        count++;
+    }
+    return count;
+}
+
+/*
+ * Keys in 'left' must precede 'pivot', which must precede the keys in
+ * 'right'. A NULL pivot is taken from the front of 'right'. All nodes end
+ * up in 'left' and 'right' is left empty. Linking is O(log n), but the
+ * nodes coming from 'right' are walked to update their tree pointer, so
+ * that join costs O(log n + size of 'right'). Built with
+ * ANYTREE_NO_TREE_POINTER there is no walk and join is O(log n).
+ */
+void avltree_join(struct avltree *left, struct avltree_node *pivot, struct avltree *right)
+{
+    struct avltree scratch;
+    unsigned size;
+
+    scratch.ranked = left->ranked;
+    scratch.augment = left->augment;
+    if (!pivot) {
+        pivot = right->first;
+        if (!pivot)
+            return;
+        avltree_remove(pivot, right);
+    }
+    size = left->size + right->size + 1;
+#ifndef ANYTREE_NO_TREE_POINTER
+    adopt(right->root, left);
+    set_tree(left, pivot);
+#endif
+
+    left->height = do_join(left->root, left->height, pivot, right->root, right->height, &scratch);
+
+    left->root = scratch.root;
+    left->size = size;
+    if (!left->first)
+        left->first = pivot;
+    left->last = right->last ? right->last : pivot;
+    init_like(right, right);
+}
+
+static void do_split(struct avltree_node *node, int height, const struct avltree_node *key, const struct avltree *tree,
+                     struct avltree_node **left, int *lheight, struct avltree_node **right, int *rheight)
+{
+    struct avltree scratch;
+    struct avltree_node *sub;
+    int res, lsub, rsub;
+
+    scratch.ranked = tree->ranked;
+    scratch.augment = tree->augment;
+    if (!node) {
+        *left = *right = NULL;
+        *lheight = *rheight = -1;
+        return;
+    }
+    lsub = height - (get_balance(node) > 0 ? 2 : 1);
+    rsub = height - (get_balance(node) < 0 ? 2 : 1);
+
+    res = tree->cmp_fn(node, key);
+    if (res < 0) {
+        sub = node->left;
+        do_split(node->right, rsub, key, tree, left, lheight, right, rheight);
+        *lheight = do_join(sub, lsub, node, *left, *lheight, &scratch);
+        *left = scratch.root;
+    } else {
+        if (res == 0) {
+            *left = node->left;
+            *lheight = lsub;
+            *right = NULL;
+            *rheight = -1;
+        } else
+            do_split(node->left, lsub, key, tree, left, lheight, right, rheight);
+        sub = node->right;
+        *rheight = do_join(*right, *rheight, node, sub, rsub, &scratch);
+        *right = scratch.root;
+    }
+}
+
+/*
+ * Moves every node not less than 'key' into 'right', which is
+ * (re)initialized with the comparator of 'tree'. Relinking is O(log n),
+ * but the nodes moving to 'right' are walked to update their tree pointer
+ * and to count them, so that split costs O(log n + nodes moved). Built
+ * with ANYTREE_NO_TREE_POINTER a ranked tree takes the count from the
+ * root and splits in O(log n); a plain one still walks to count.
+ */
+void avltree_split(const struct avltree_node *key, struct avltree *tree, struct avltree *right)
+{
+    struct avltree_node *l, *r, *first = tree->first, *last = tree->last;
+    int lheight, rheight;
+
+    init_like(right, tree);
+    if (!tree->root)
+        return;
+
+    do_split(tree->root, tree->height, key, tree, &l, &lheight, &r, &rheight);
+    if (l)
+        set_parent(NULL, l);
+    if (r)
+        set_parent(NULL, r);
+
+    tree->root = l;
+    tree->height = lheight;
+    tree->first = l ? first : NULL;
+    tree->last = l ? get_last(l) : NULL;
+    right->root = r;
+    right->height = rheight;
+    right->first = r ? get_first(r) : NULL;
+    right->last = r ? last : NULL;
+    right->size = adopt(r, right);
+    tree->size -= right->size;
 }
 
 int avltree_init(struct avltree *tree, avltree_cmp_fn_t cmp)
@@ -469,6 +1262,22 @@ int avltree_init(struct avltree *tree, avltree_cmp_fn_t cmp)
     tree->first = NULL;
     tree->last = NULL;
     tree->height = -1;
+    tree->ranked = 0;
+    tree->augment = NULL;
+    return 0;
+}
+
+int avltree_init_ranked(struct avltree *tree, avltree_cmp_fn_t cmp)
+{
+    avltree_init(tree, cmp);
+    tree->ranked = 1;
+    return 0;
+}
+
+int avltree_init_augmented(struct avltree *tree, avltree_cmp_fn_t cmp, const struct avltree_augment_callbacks *augment)
+{
+    avltree_init(tree, cmp);
+    tree->augment = augment;
     return 0;
 }
 
@@ -476,8 +1285,8 @@ void avltree_clean(struct avltree *tree)
 {
     struct avltree_node *i;
     for (i = avltree_first(tree); i; i = avltree_next(i))
-        i->tree = NULL;
-    avltree_init(tree, tree->cmp_fn);
+        set_tree(NULL, i);
+    init_like(tree, tree);
 }
 
 void avltree_foreach(struct avltree *tree, avltree_call_fn_t call)
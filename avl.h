@@ -16,14 +16,84 @@
 
 struct avltree;
 
+#ifdef ANYTREE_COMPACT_NODES
+/* The balance factor, biased by 2, lives in the low 3 bits of the parent pointer */
 struct avltree_node {
+#ifndef ANYTREE_NO_TREE_POINTER
     struct avltree *tree;
+#endif
+    struct avltree_node *left, *right;
+    uintptr_t parent_balance;
+}
+#  ifdef __GNUC__
+__attribute__((aligned(8)))
+#  endif
+;
+#  define avltree_parent(NODE) ((struct avltree_node *)((NODE)->parent_balance & ~(uintptr_t)7))
+#else
+struct avltree_node {
+#ifndef ANYTREE_NO_TREE_POINTER
+    struct avltree *tree;
+#endif
     struct avltree_node *left, *right;
     struct avltree_node *parent;
     signed balance:3;      
 };
+#  define avltree_parent(NODE) ((NODE)->parent)
+#endif
+
+/* Node of a tree set up with avltree_init_ranked(), which keeps subtree sizes */
+struct avltree_ranked_node {
+    struct avltree_node node;
+    unsigned count;
+};
 
 typedef int (*avltree_cmp_fn_t)(const struct avltree_node *, const struct avltree_node *);
+typedef int (*avltree_key_cmp_fn_t)(const void *key, const struct avltree_node *);
+
+/*
+ * Augmentation, as in the Linux kernel rbtree: per-subtree aggregates
+ * living next to the node in its container.
+ *   propagate: recompute the aggregates from 'node' up to, not including,
+ *              'stop'; it may stop early once an aggregate is unchanged
+ *   copy:      'node' takes the place of 'old', copy the aggregate over
+ *   rotate:    'node' takes the place of 'old' in a rotation, copy the
+ *              aggregate over and recompute the one of 'old'
+ */
+struct avltree_augment_callbacks {
+    void (*propagate)(struct avltree_node *node, struct avltree_node *stop);
+    void (*copy)(struct avltree_node *old, struct avltree_node *node);
+    void (*rotate)(struct avltree_node *old, struct avltree_node *node);
+};
+
+/*
+ * Defines the callbacks NAME for an aggregate FIELD of TYPE, embedding the
+ * node as MEMBER. COMPUTE(TYPE *node, int exit) stores the aggregate of
+ * 'node' computed from its children and returns non-zero when 'exit' is
+ * set and the stored value did not change.
+ */
+#define AVLTREE_AUGMENT_CALLBACKS(NAME, TYPE, MEMBER, FIELD, COMPUTE)                \
+static void NAME##_propagate(struct avltree_node *node, struct avltree_node *stop)  \
+{                                                                                   \
+    while (node != stop) {                                                          \
+        if (COMPUTE(avltree_container_of(node, TYPE, MEMBER), 1))                   \
+            break;                                                                  \
+        node = avltree_parent(node);                                                \
+    }                                                                               \
+}                                                                                   \
+static void NAME##_copy(struct avltree_node *old, struct avltree_node *node)        \
+{                                                                                   \
+    avltree_container_of(node, TYPE, MEMBER)->FIELD =                              \
+        avltree_container_of(old, TYPE, MEMBER)->FIELD;                             \
+}                                                                                   \
+static void NAME##_rotate(struct avltree_node *old, struct avltree_node *node)      \
+{                                                                                   \
+    NAME##_copy(old, node);                                                         \
+    COMPUTE(avltree_container_of(old, TYPE, MEMBER), 0);                            \
+}                                                                                   \
+static const struct avltree_augment_callbacks NAME = {                              \
+    NAME##_propagate, NAME##_copy, NAME##_rotate                                    \
+}
 
 struct avltree {
     avltree_cmp_fn_t cmp_fn;
@@ -33,6 +103,8 @@ struct avltree {
     struct avltree_node *first, *last;
 
     int height;
+    int ranked;
+    const struct avltree_augment_callbacks *augment;
 };
 
 struct avltree_node *avltree_first(const struct avltree *tree);
@@ -41,18 +113,155 @@ struct avltree_node *avltree_next(const struct avltree_node *node);
 struct avltree_node *avltree_prev(const struct avltree_node *node);
 
 struct avltree_node *avltree_lookup(const struct avltree_node *key, const struct avltree *tree);
+struct avltree_node *avltree_lower_bound(const struct avltree_node *key, const struct avltree *tree);
+struct avltree_node *avltree_upper_bound(const struct avltree_node *key, const struct avltree *tree);
+struct avltree_node *avltree_floor(const struct avltree_node *key, const struct avltree *tree);
+#define avltree_ceil(KEY, TREE) avltree_lower_bound(KEY, TREE)
+
+struct avltree_node *avltree_range(const struct avltree_node *lo, const struct avltree_node *hi, const struct avltree *tree, struct avltree_node **end);
+unsigned avltree_range_count(const struct avltree_node *lo, const struct avltree_node *hi, const struct avltree *tree);
+
+struct avltree_node *avltree_lookup_key(const void *key, avltree_key_cmp_fn_t cmp, const struct avltree *tree);
+struct avltree_node *avltree_lower_bound_key(const void *key, avltree_key_cmp_fn_t cmp, const struct avltree *tree);
+struct avltree_node *avltree_upper_bound_key(const void *key, avltree_key_cmp_fn_t cmp, const struct avltree *tree);
+struct avltree_node *avltree_floor_key(const void *key, avltree_key_cmp_fn_t cmp, const struct avltree *tree);
+struct avltree_node *avltree_remove_key(const void *key, avltree_key_cmp_fn_t cmp, struct avltree *tree);
 struct avltree_node *avltree_insert(struct avltree_node *node, struct avltree *tree);
+struct avltree_node *avltree_insert_after(struct avltree_node *node, struct avltree_node *hint, struct avltree *tree);
+struct avltree_node *avltree_insert_before(struct avltree_node *node, struct avltree_node *hint, struct avltree *tree);
+/* Links 'node' at a free child slot of 'parent' found by the caller's own descent */
+void avltree_link(struct avltree_node *node, struct avltree_node *parent, int is_left, struct avltree *tree);
 void avltree_remove(struct avltree_node *node, struct avltree *tree);
 void avltree_replace(struct avltree_node *old, struct avltree_node *node, struct avltree *tree);
+int avltree_build_sorted(struct avltree_node **nodes, unsigned count, struct avltree *tree);
+
+/*
+ * Relayout during a quiet period: the tree's nodes are embedded in
+ * 'array', 'count' elements of 'stride' bytes with the node at 'offset'.
+ * The elements are moved so that the tree's come first, in van Emde Boas
+ * order, and the others after them, and the links are fixed up. Pointers
+ * to elements held outside the tree are stale afterwards. Fails, moving
+ * nothing, when a node is not in the array or when out of memory.
+ */
+int avltree_relayout(struct avltree *tree, void *array, unsigned count, size_t stride, size_t offset);
+#define AVLTREE_RELAYOUT(TREE, ARRAY, MEMBER, COUNT) \
+    avltree_relayout(TREE, ARRAY, COUNT, sizeof((ARRAY)[0]), (size_t)((char *)&(ARRAY)[0].MEMBER - (char *)&(ARRAY)[0]))
+
+struct avltree_node *avltree_select(unsigned k, const struct avltree *tree);
+unsigned avltree_rank(const struct avltree_node *node, const struct avltree *tree);
+
+void avltree_join(struct avltree *left, struct avltree_node *pivot, struct avltree *right);
+void avltree_split(const struct avltree_node *key, struct avltree *tree, struct avltree *right);
 
 #define avltree_is_empty(TREE) (TREE->size == 0)
 #define avltree_size(TREE) (TREE->size)
 
 int avltree_init(struct avltree *tree, avltree_cmp_fn_t cmp);
+int avltree_init_ranked(struct avltree *tree, avltree_cmp_fn_t cmp);
+int avltree_init_augmented(struct avltree *tree, avltree_cmp_fn_t cmp, const struct avltree_augment_callbacks *augment);
 void avltree_clean(struct avltree *tree);
 
 typedef void (*avltree_call_fn_t)(const struct avltree_node *);
 void avltree_foreach(struct avltree *tree, avltree_call_fn_t call);
 void avltree_foreach_backward(struct avltree *tree, avltree_call_fn_t call);
 
+/*
+ * Type-specialized front end, in the manner of the BSD RB_GENERATE(): defines
+ * static inline NAME_lookup(), NAME_lower_bound(), NAME_upper_bound(),
+ * NAME_floor(), NAME_insert(), NAME_remove(), NAME_first(), NAME_last(),
+ * NAME_next() and NAME_prev() for TYPE elements embedding their node as
+ * FIELD. CMP(const TYPE *a, const TYPE *b) orders two elements like
+ * strcmp() and is expanded in place of the call through cmp_fn, so a macro
+ * or an inline function gets inlined into the descent.
+ *
+ * The descents are the only part generated: linking and rebalancing stay in
+ * the library, and the tree is a regular one. Generated and library calls
+ * can be mixed on it as long as cmp_fn orders the nodes the same way.
+ */
+#define AVLTREE_GENERATE(NAME, TYPE, FIELD, CMP)                                                    \
+static inline TYPE *NAME##_entry(const struct avltree_node *node)                                   \
+{                                                                                                   \
+    return node ? avltree_container_of(node, TYPE, FIELD) : NULL;                                   \
+}                                                                                                   \
+static inline TYPE *NAME##_first(const struct avltree *tree)                                        \
+{                                                                                                   \
+    return NAME##_entry(avltree_first(tree));                                                       \
+}                                                                                                   \
+static inline TYPE *NAME##_last(const struct avltree *tree)                                         \
+{                                                                                                   \
+    return NAME##_entry(avltree_last(tree));                                                        \
+}                                                                                                   \
+static inline TYPE *NAME##_next(const TYPE *elm)                                                    \
+{                                                                                                   \
+    return NAME##_entry(avltree_next(&elm->FIELD));                                                 \
+}                                                                                                   \
+static inline TYPE *NAME##_prev(const TYPE *elm)                                                    \
+{                                                                                                   \
+    return NAME##_entry(avltree_prev(&elm->FIELD));                                                 \
+}                                                                                                   \
+static inline TYPE *NAME##_lookup(const TYPE *key, const struct avltree *tree)                      \
+{                                                                                                   \
+    const struct avltree_node *node = tree->root;                                                   \
+    while (node) {                                                                                  \
+        int res = CMP(key, NAME##_entry(node));                                                     \
+        if (res == 0)                                                                               \
+            return NAME##_entry(node);                                                              \
+        node = res < 0 ? node->left : node->right;                                                  \
+    }                                                                                               \
+    return NULL;                                                                                    \
+}                                                                                                   \
+static inline TYPE *NAME##_bound(const TYPE *key, const struct avltree *tree, int after, int strict)\
+{                                                                                                   \
+    const struct avltree_node *node = tree->root, *bound = NULL;                                    \
+    while (node) {                                                                                  \
+        int res = CMP(key, NAME##_entry(node));                                                     \
+        if (res == 0 && !strict)                                                                    \
+            return NAME##_entry(node);                                                              \
+        if (after) {                                                                                \
+            if (res < 0) {                                                                          \
+                bound = node;                                                                       \
+                node = node->left;                                                                  \
+            } else                                                                                  \
+                node = node->right;                                                                 \
+        } else {                                                                                    \
+            if (res > 0) {                                                                          \
+                bound = node;                                                                       \
+                node = node->right;                                                                 \
+            } else                                                                                  \
+                node = node->left;                                                                  \
+        }                                                                                           \
+    }                                                                                               \
+    return NAME##_entry(bound);                                                                     \
+}                                                                                                   \
+static inline TYPE *NAME##_lower_bound(const TYPE *key, const struct avltree *tree)                 \
+{                                                                                                   \
+    return NAME##_bound(key, tree, 1, 0);                                                           \
+}                                                                                                   \
+static inline TYPE *NAME##_upper_bound(const TYPE *key, const struct avltree *tree)                 \
+{                                                                                                   \
+    return NAME##_bound(key, tree, 1, 1);                                                           \
+}                                                                                                   \
+static inline TYPE *NAME##_floor(const TYPE *key, const struct avltree *tree)                       \
+{                                                                                                   \
+    return NAME##_bound(key, tree, 0, 0);                                                           \
+}                                                                                                   \
+static inline TYPE *NAME##_insert(TYPE *elm, struct avltree *tree)                                  \
+{                                                                                                   \
+    struct avltree_node *node = tree->root, *parent = NULL;                                         \
+    int res = 0;                                                                                    \
+    while (node) {                                                                                  \
+        res = CMP(elm, NAME##_entry(node));                                                         \
+        if (res == 0)                                                                               \
+            return NAME##_entry(node);                                                              \
+        parent = node;                                                                              \
+        node = res < 0 ? node->left : node->right;                                                  \
+    }                                                                                               \
+    avltree_link(&elm->FIELD, parent, res < 0, tree);                                               \
+    return NULL;                                                                                    \
+}                                                                                                   \
+static inline void NAME##_remove(TYPE *elm, struct avltree *tree)                                   \
+{                                                                                                   \
+    avltree_remove(&elm->FIELD, tree);                                                              \
+}
+
 #endif 
@@ -0,0 +1,558 @@
+#include <assert.h>
+
+#include "avl32.h"
+
+/*
+ * The algorithms are those of avl.c, with pointers replaced by indices into
+ * the tree's array and NIL standing in for NULL.
+ */
+#define NIL AVLTREE32_NIL
+#define PARENT_NIL (NIL >> 3)
+
+#define NODE(I) avltree32_node_at(tree, I)
+#define LEFT(I) (NODE(I)->left)
+#define RIGHT(I) (NODE(I)->right)
+
+
+static inline signed get_balance(uint32_t node, const struct avltree32 *tree)
+{
+    return (signed)(NODE(node)->parent_balance & 7) - 2;
+}
+
+static inline void set_balance(int balance, uint32_t node, const struct avltree32 *tree)
+{
+    NODE(node)->parent_balance = (NODE(node)->parent_balance & ~(uint32_t)7) | (uint32_t)(balance + 2);
+}
+
+static inline int inc_balance(uint32_t node, const struct avltree32 *tree)
+{
+    int balance = get_balance(node, tree) + 1;
+    set_balance(balance, node, tree);
+    return balance;
+}
+
+static inline int dec_balance(uint32_t node, const struct avltree32 *tree)
+{
+    int balance = get_balance(node, tree) - 1;
+    set_balance(balance, node, tree);
+    return balance;
+}
+
+static inline uint32_t get_parent(uint32_t node, const struct avltree32 *tree)
+{
+    uint32_t parent = NODE(node)->parent_balance >> 3;
+    return parent == PARENT_NIL ? NIL : parent;
+}
+
+static inline void set_parent(uint32_t parent, uint32_t node, const struct avltree32 *tree)
+{
+    NODE(node)->parent_balance = (parent << 3) | (NODE(node)->parent_balance & 7);
+}
+
+static inline int is_root(uint32_t node, const struct avltree32 *tree)
+{
+    return get_parent(node, tree) == NIL;
+}
+
+static inline void INIT_NODE(uint32_t node, const struct avltree32 *tree)
+{
+    LEFT(node) = NIL;
+    RIGHT(node) = NIL;
+    set_parent(NIL, node, tree);
+    set_balance(0, node, tree);
+}
+
+
+static inline uint32_t get_first(uint32_t node, const struct avltree32 *tree)
+{
+    while (LEFT(node) != NIL)
+        node = LEFT(node);
+    return node;
+}
+
+static inline uint32_t get_last(uint32_t node, const struct avltree32 *tree)
+{
+    while (RIGHT(node) != NIL)
+        node = RIGHT(node);
+    return node;
+}
+
+uint32_t avltree32_first(const struct avltree32 *tree)
+{
+    return tree->first;
+}
+
+uint32_t avltree32_last(const struct avltree32 *tree)
+{
+    return tree->last;
+}
+
+uint32_t avltree32_next(uint32_t node, const struct avltree32 *tree)
+{
+    uint32_t parent;
+
+    if (RIGHT(node) != NIL)
+        return get_first(RIGHT(node), tree);
+
+    while ((parent = get_parent(node, tree)) != NIL && RIGHT(parent) == node)
+        node = parent;
+    return parent;
+}
+
+uint32_t avltree32_prev(uint32_t node, const struct avltree32 *tree)
+{
+    uint32_t parent;
+
+    if (LEFT(node) != NIL)
+        return get_last(LEFT(node), tree);
+
+    while ((parent = get_parent(node, tree)) != NIL && LEFT(parent) == node)
+        node = parent;
+    return parent;
+}
+
+static void rotate_left(uint32_t node, struct avltree32 *tree)
+{
+    uint32_t p = node;
+    uint32_t q = RIGHT(node);
+    uint32_t parent = get_parent(p, tree);
+
+    if (!is_root(p, tree)) {
+        if (LEFT(parent) == p)
+            LEFT(parent) = q;
+        else
+            RIGHT(parent) = q;
+    } else
+        tree->root = q;
+    set_parent(parent, q, tree);
+    set_parent(q, p, tree);
+
+    RIGHT(p) = LEFT(q);
+    if (RIGHT(p) != NIL)
+        set_parent(p, RIGHT(p), tree);
+    LEFT(q) = p;
+}
+
+static void rotate_right(uint32_t node, struct avltree32 *tree)
+{
+    uint32_t p = node;
+    uint32_t q = LEFT(node);
+    uint32_t parent = get_parent(p, tree);
+
+    if (!is_root(p, tree)) {
+        if (LEFT(parent) == p)
+            LEFT(parent) = q;
+        else
+            RIGHT(parent) = q;
+    } else
+        tree->root = q;
+    set_parent(parent, q, tree);
+    set_parent(q, p, tree);
+
+    LEFT(p) = RIGHT(q);
+    if (LEFT(p) != NIL)
+        set_parent(p, LEFT(p), tree);
+    RIGHT(q) = p;
+}
+
+
+static inline uint32_t do_lookup(const struct avltree32_node *key, const struct avltree32 *tree, uint32_t *pparent, uint32_t *unbalanced, int *is_left)
+{
+    uint32_t node = tree->root;
+    int res = 0;
+
+    *pparent = NIL;
+    *unbalanced = node;
+    *is_left = 0;
+
+    while (node != NIL) {
+        if (get_balance(node, tree) != 0)
+            *unbalanced = node;
+
+        res = tree->cmp_fn(NODE(node), key);
+        if (res == 0)
+            return node;
+        *pparent = node;
+        if ((*is_left = res > 0))
+            node = LEFT(node);
+        else
+            node = RIGHT(node);
+    }
+    return NIL;
+}
+
+uint32_t avltree32_lookup(const struct avltree32_node *key, const struct avltree32 *tree)
+{
+    uint32_t parent, unbalanced;
+    int is_left;
+
+    return do_lookup(key, tree, &parent, &unbalanced, &is_left);
+}
+
+/* Bounded searches, see avl.c */
+static uint32_t do_bound(const struct avltree32_node *key, const struct avltree32 *tree, int after, int strict)
+{
+    uint32_t node = tree->root;
+    uint32_t bound = NIL;
+
+    while (node != NIL) {
+        int res = tree->cmp_fn(NODE(node), key);
+        if (res == 0 && !strict)
+            return node;
+        if (after) {
+            if (res > 0) {
+                bound = node;
+                node = LEFT(node);
+            } else
+                node = RIGHT(node);
+        } else {
+            if (res < 0) {
+                bound = node;
+                node = RIGHT(node);
+            } else
+                node = LEFT(node);
+        }
+    }
+    return bound;
+}
+
+uint32_t avltree32_lower_bound(const struct avltree32_node *key, const struct avltree32 *tree)
+{
+    return do_bound(key, tree, 1, 0);
+}
+
+uint32_t avltree32_upper_bound(const struct avltree32_node *key, const struct avltree32 *tree)
+{
+    return do_bound(key, tree, 1, 1);
+}
+
+uint32_t avltree32_floor(const struct avltree32_node *key, const struct avltree32 *tree)
+{
+    return do_bound(key, tree, 0, 0);
+}
+
+uint32_t avltree32_lookup_key(const void *key, avltree32_key_cmp_fn_t cmp, const struct avltree32 *tree)
+{
+    uint32_t node = tree->root;
+
+    while (node != NIL) {
+        int res = cmp(key, NODE(node));
+        if (res == 0)
+            return node;
+        if (res < 0)
+            node = LEFT(node);
+        else
+            node = RIGHT(node);
+    }
+    return NIL;
+}
+
+static void set_child(uint32_t child, uint32_t node, int left, const struct avltree32 *tree)
+{
+    if (left)
+        LEFT(node) = child;
+    else
+        RIGHT(node) = child;
+}
+
+static void do_insert(uint32_t node, uint32_t parent, uint32_t unbalanced, int is_left, struct avltree32 *tree)
+{
+    ++tree->size;
+
+    INIT_NODE(node, tree);
+
+    if (parent == NIL) {
+        tree->root = node;
+        tree->first = tree->last = node;
+        tree->height++;
+        return;
+    }
+    if (is_left) {
+        if (parent == tree->first)
+            tree->first = node;
+    } else {
+        if (parent == tree->last)
+            tree->last = node;
+    }
+    set_parent(parent, node, tree);
+    set_child(node, parent, is_left, tree);
+
+    for (;;) {
+        if (LEFT(parent) == node)
+            dec_balance(parent, tree);
+        else
+            inc_balance(parent, tree);
+
+        if (parent == unbalanced)
+            break;
+        node = parent;
+        parent = get_parent(parent, tree);
+    }
+
+    switch (get_balance(unbalanced, tree)) {
+    case  1: case -1:
+        tree->height++;
+
+    case 0:
+        break;
+    case 2: {
+        uint32_t right = RIGHT(unbalanced);
+
+        if (get_balance(right, tree) == 1) {
+            set_balance(0, unbalanced, tree);
+            set_balance(0, right, tree);
+        } else {
+            switch (get_balance(LEFT(right), tree)) {
+            case 1:
+                set_balance(-1, unbalanced, tree);
+                set_balance( 0, right, tree);
+                break;
+            case 0:
+                set_balance(0, unbalanced, tree);
+                set_balance(0, right, tree);
+                break;
+            case -1:
+                set_balance(0, unbalanced, tree);
+                set_balance(1, right, tree);
+                break;
+            }
+            set_balance(0, LEFT(right), tree);
+
+            rotate_right(right, tree);
+        }
+        rotate_left(unbalanced, tree);
+        break;
+    }
+    case -2: {
+        uint32_t left = LEFT(unbalanced);
+
+        if (get_balance(left, tree) == -1) {
+            set_balance(0, unbalanced, tree);
+            set_balance(0, left, tree);
+        } else {
+            switch (get_balance(RIGHT(left), tree)) {
+            case 1:
+                set_balance( 0, unbalanced, tree);
+                set_balance(-1, left, tree);
+                break;
+            case 0:
+                set_balance(0, unbalanced, tree);
+                set_balance(0, left, tree);
+                break;
+            case -1:
+                set_balance(1, unbalanced, tree);
+                set_balance(0, left, tree);
+                break;
+            }
+            set_balance(0, RIGHT(left), tree);
+
+            rotate_left(left, tree);
+        }
+        rotate_right(unbalanced, tree);
+        break;
+    }
+    }
+}
+
+/* Returns the index of an equal node already in the tree, NIL otherwise */
+uint32_t avltree32_insert(uint32_t node, struct avltree32 *tree)
+{
+    uint32_t key, parent, unbalanced;
+    int is_left;
+
+    assert(node <= AVLTREE32_MAX_INDEX);
+    key = do_lookup(NODE(node), tree, &parent, &unbalanced, &is_left);
+    if (key != NIL)
+        return key;
+
+    do_insert(node, parent, unbalanced, is_left, tree);
+    return NIL;
+}
+
+/* Nodes carry no tree pointer: 'node' must be in 'tree' */
+void avltree32_remove(uint32_t node, struct avltree32 *tree)
+{
+    uint32_t parent = get_parent(node, tree);
+    uint32_t left = LEFT(node);
+    uint32_t right = RIGHT(node);
+    uint32_t next;
+    int is_left = 0;
+
+    --tree->size;
+
+    if (node == tree->first)
+        tree->first = avltree32_next(node, tree);
+    if (node == tree->last)
+        tree->last = avltree32_prev(node, tree);
+
+    if (left == NIL)
+        next = right;
+    else if (right == NIL)
+        next = left;
+    else
+        next = get_first(right, tree);
+
+    if (parent != NIL) {
+        is_left = LEFT(parent) == node;
+        set_child(next, parent, is_left, tree);
+    } else
+        tree->root = next;
+
+    if (left != NIL && right != NIL) {
+        set_balance(get_balance(node, tree), next, tree);
+
+        LEFT(next) = left;
+        set_parent(next, left, tree);
+
+        if (next != right) {
+            parent = get_parent(next, tree);
+            set_parent(get_parent(node, tree), next, tree);
+
+            node = RIGHT(next);
+            LEFT(parent) = node;
+            is_left = 1;
+
+            RIGHT(next) = right;
+            set_parent(next, right, tree);
+        } else {
+            set_parent(parent, next, tree);
+            parent = next;
+            node = RIGHT(parent);
+            is_left = 0;
+        }
+        assert(parent != NIL);
+    } else
+        node = next;
+
+    if (node != NIL)
+        set_parent(parent, node, tree);
+
+    while (parent != NIL) {
+        int balance;
+        node   = parent;
+        parent = get_parent(parent, tree);
+
+        if (is_left) {
+            is_left = parent != NIL && LEFT(parent) == node;
+
+            balance = inc_balance(node, tree);
+            if (balance == 0)        /* case 1 */
+                continue;
+            if (balance == 1)        /* case 2 */
+                return;
+            right = RIGHT(node);        /* case 3 */
+            switch (get_balance(right, tree)) {
+            case 0:                /* case 3.1 */
+                set_balance( 1, node, tree);
+                set_balance(-1, right, tree);
+                rotate_left(node, tree);
+                return;
+            case 1:                /* case 3.2 */
+                set_balance(0, node, tree);
+                set_balance(0, right, tree);
+                break;
+            case -1:            /* case 3.3 */
+                switch (get_balance(LEFT(right), tree)) {
+                case 1:
+                    set_balance(-1, node, tree);
+                    set_balance( 0, right, tree);
+                    break;
+                case 0:
+                    set_balance(0, node, tree);
+                    set_balance(0, right, tree);
+                    break;
+                case -1:
+                    set_balance(0, node, tree);
+                    set_balance(1, right, tree);
+                    break;
+                }
+                set_balance(0, LEFT(right), tree);
+
+                rotate_right(right, tree);
+            }
+            rotate_left(node, tree);
+        } else {
+            is_left = parent != NIL && LEFT(parent) == node;
+
+            balance = dec_balance(node, tree);
+            if (balance == 0)
+                continue;
+            if (balance == -1)
+                return;
+            left = LEFT(node);
+            switch (get_balance(left, tree)) {
+            case 0:
+                set_balance(-1, node, tree);
+                set_balance(1, left, tree);
+                rotate_right(node, tree);
+                return;
+            case -1:
+                set_balance(0, node, tree);
+                set_balance(0, left, tree);
+                break;
+            case 1:
+                switch (get_balance(RIGHT(left), tree)) {
+                case 1:
+                    set_balance(0, node, tree);
+                    set_balance(-1, left, tree);
+                    break;
+                case 0:
+                    set_balance(0, node, tree);
+                    set_balance(0, left, tree);
+                    break;
+                case -1:
+                    set_balance(1, node, tree);
+                    set_balance(0, left, tree);
+                    break;
+                }
+                set_balance(0, RIGHT(left), tree);
+
+                rotate_left(left, tree);
+            }
+            rotate_right(node, tree);
+        }
+    }
+    tree->height--;
+}
+
+int avltree32_init(struct avltree32 *tree, avltree32_cmp_fn_t cmp, void *base, size_t stride)
+{
+    tree->cmp_fn = cmp;
+    tree->size = 0;
+    tree->root = NIL;
+    tree->first = NIL;
+    tree->last = NIL;
+    tree->height = -1;
+    tree->base = (char *)base;
+    tree->stride = stride;
+    return 0;
+}
+
+void avltree32_clean(struct avltree32 *tree)
+{
+    avltree32_init(tree, tree->cmp_fn, tree->base, tree->stride);
+}
+
+void avltree32_foreach(struct avltree32 *tree, avltree32_call_fn_t call)
+{
+    uint32_t i;
+    uint32_t n;
+    for (i = avltree32_first(tree); i != NIL; )
+    {
+        n = avltree32_next(i, tree);
+        call(i, tree);
+        i = n;
+    }
+}
+
+void avltree32_foreach_backward(struct avltree32 *tree, avltree32_call_fn_t call)
+{
+    uint32_t i;
+    uint32_t n;
+    for (i = avltree32_last(tree); i != NIL; )
+    {
+        n = avltree32_prev(i, tree);
+        call(i, tree);
+        i = n;
+    }
+}
@@ -0,0 +1,82 @@
+#ifndef ANYTREE__AVL32__INCLUDED
+#define ANYTREE__AVL32__INCLUDED
+
+#include <stdint.h>
+#include <stddef.h>
+
+
+#ifdef __GNUC__
+#  define avltree32_container_of(node, type, member) ({      \
+    const struct avltree32_node *__mptr = (node);            \
+    (type *)( (char *)__mptr - offsetof(type,member) );})
+#else
+#  define avltree32_container_of(node, type, member)         \
+    ((type *)((char *)(node) - offsetof(type, member)))
+#endif
+
+
+/*
+ * AVL tree over a caller-provided array: nodes are linked by their 32-bit
+ * index in the array rather than by pointers, so the links stay valid when
+ * the array is copied, mapped elsewhere or shared between processes. Only
+ * 'base' and 'cmp_fn' in struct avltree32 are address dependent.
+ *
+ * The balance factor shares a word with the parent index, which limits a
+ * tree to AVLTREE32_MAX_INDEX + 1 nodes.
+ */
+#define AVLTREE32_NIL ((uint32_t)0xffffffff)
+#define AVLTREE32_MAX_INDEX ((uint32_t)0x1ffffffe)
+
+struct avltree32_node {
+    uint32_t left, right;
+    uint32_t parent_balance;    /* parent index << 3 | balance + 2 */
+};
+
+typedef int (*avltree32_cmp_fn_t)(const struct avltree32_node *, const struct avltree32_node *);
+typedef int (*avltree32_key_cmp_fn_t)(const void *key, const struct avltree32_node *);
+
+struct avltree32 {
+    avltree32_cmp_fn_t cmp_fn;
+    unsigned size;
+
+    uint32_t root;
+    uint32_t first, last;
+
+    int height;
+
+    char *base;         /* node of element 0 */
+    size_t stride;      /* element size */
+};
+
+#define avltree32_node_at(TREE, INDEX) ((struct avltree32_node *)((TREE)->base + (size_t)(INDEX) * (TREE)->stride))
+#define avltree32_index_of(TREE, NODE) ((uint32_t)(((const char *)(NODE) - (TREE)->base) / (TREE)->stride))
+
+uint32_t avltree32_first(const struct avltree32 *tree);
+uint32_t avltree32_last(const struct avltree32 *tree);
+uint32_t avltree32_next(uint32_t index, const struct avltree32 *tree);
+uint32_t avltree32_prev(uint32_t index, const struct avltree32 *tree);
+
+uint32_t avltree32_lookup(const struct avltree32_node *key, const struct avltree32 *tree);
+uint32_t avltree32_lower_bound(const struct avltree32_node *key, const struct avltree32 *tree);
+uint32_t avltree32_upper_bound(const struct avltree32_node *key, const struct avltree32 *tree);
+uint32_t avltree32_floor(const struct avltree32_node *key, const struct avltree32 *tree);
+uint32_t avltree32_lookup_key(const void *key, avltree32_key_cmp_fn_t cmp, const struct avltree32 *tree);
+uint32_t avltree32_insert(uint32_t index, struct avltree32 *tree);
+void avltree32_remove(uint32_t index, struct avltree32 *tree);
+
+#define avltree32_is_empty(TREE) (TREE->size == 0)
+#define avltree32_size(TREE) (TREE->size)
+
+/* 'base' is the node of element 0 of an array of 'stride' sized elements */
+int avltree32_init(struct avltree32 *tree, avltree32_cmp_fn_t cmp, void *base, size_t stride);
+#define AVLTREE32_INIT(TREE, CMP, ARRAY, MEMBER) \
+    avltree32_init(TREE, CMP, &(ARRAY)[0].MEMBER, sizeof((ARRAY)[0]))
+/* Points the tree at a copy or another mapping of its array */
+#define avltree32_rebase(TREE, BASE) ((TREE)->base = (char *)(BASE))
+void avltree32_clean(struct avltree32 *tree);
+
+typedef void (*avltree32_call_fn_t)(uint32_t index, const struct avltree32 *tree);
+void avltree32_foreach(struct avltree32 *tree, avltree32_call_fn_t call);
+void avltree32_foreach_backward(struct avltree32 *tree, avltree32_call_fn_t call);
+
+#endif
@@ -0,0 +1,625 @@
+#include <sched.h>
+#include <string.h>
+
+#include "avlcc.h"
+
+
+#define LOAD(P, ORDER) __atomic_load_n(P, ORDER)
+#define STORE(P, V, ORDER) __atomic_store_n(P, V, ORDER)
+
+/* Version bits: the rest counts the shrinks */
+#define SHRINKING 1UL
+#define UNLINKED 2UL
+
+/* Heights of a subtree, as returned by node_condition() */
+#define NOTHING_REQUIRED -1
+#define REBALANCE_REQUIRED -2
+
+#define MAX(A, B) ((A) > (B) ? (A) : (B))
+
+enum { LEFT, RIGHT };
+
+/* Returned by the attempts when the node they started from moved */
+static struct avltree_cc_node retry_node;
+#define RETRY (&retry_node)
+
+static inline struct avltree_cc_node *get_child(const struct avltree_cc_node *node, int dir)
+{
+    return LOAD(dir == LEFT ? &node->left : &node->right, __ATOMIC_ACQUIRE);
+}
+
+static inline void set_child(struct avltree_cc_node *node, int dir, struct avltree_cc_node *child)
+{
+    STORE(dir == LEFT ? &node->left : &node->right, child, __ATOMIC_RELEASE);
+}
+
+static inline int child_dir(const struct avltree_cc_node *parent, const struct avltree_cc_node *node)
+{
+    return get_child(parent, LEFT) == node ? LEFT : RIGHT;
+}
+
+static inline struct avltree_cc_node *get_parent(const struct avltree_cc_node *node)
+{
+    return LOAD(&node->parent, __ATOMIC_ACQUIRE);
+}
+
+static inline void set_parent(struct avltree_cc_node *node, struct avltree_cc_node *parent)
+{
+    STORE(&node->parent, parent, __ATOMIC_RELEASE);
+}
+
+static inline int get_height(const struct avltree_cc_node *node)
+{
+    return node ? LOAD(&node->height, __ATOMIC_RELAXED) : 0;
+}
+
+static inline void set_height(struct avltree_cc_node *node, int height)
+{
+    STORE(&node->height, height, __ATOMIC_RELAXED);
+}
+
+static inline unsigned long get_version(const struct avltree_cc_node *node)
+{
+    return LOAD(&node->version, __ATOMIC_ACQUIRE);
+}
+
+/* The fence orders the version before the link updates, as write_seqcount_begin() */
+static inline void begin_change(struct avltree_cc_node *node, unsigned long version)
+{
+    STORE(&node->version, version | SHRINKING, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void end_change(struct avltree_cc_node *node, unsigned long version)
+{
+    STORE(&node->version, (version | SHRINKING | UNLINKED) + 1, __ATOMIC_RELEASE);
+}
+
+static inline void relax(unsigned *spins)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+    if (++*spins % 64 == 0)
+        sched_yield();
+}
+
+static inline void lock_node(struct avltree_cc_node *node)
+{
+    unsigned spins = 0;
+
+    while (__atomic_exchange_n(&node->lock, 1, __ATOMIC_ACQUIRE))
+        while (LOAD(&node->lock, __ATOMIC_RELAXED))
+            relax(&spins);
+}
+
+static inline void unlock_node(struct avltree_cc_node *node)
+{
+    STORE(&node->lock, 0, __ATOMIC_RELEASE);
+}
+
+static void wait_until_shrunk(const struct avltree_cc_node *node, unsigned long version)
+{
+    unsigned spins = 0;
+
+    if (version & SHRINKING)
+        while (get_version(node) == version)
+            relax(&spins);
+}
+
+/* Orders the key against 'node', > 0 when the key comes after it */
+static inline int compare(const void *key, avltree_cc_key_cmp_fn_t cmp, const struct avltree_cc *tree, const struct avltree_cc_node *node)
+{
+    int res;
+
+    if (cmp)
+        return cmp(key, node);
+    res = tree->cmp_fn(node, (const struct avltree_cc_node *)key);
+    return (res < 0) - (res > 0);
+}
+
+
+/*
+ * Rebalancing. As in avl.c a node more than one level out of balance is
+ * fixed by a single or a double rotation, but with heights instead of
+ * balance factors: a writer only sees the nodes it locked, so a height may
+ * be stale for a while and the next writer to pass finishes the repair.
+ * The helpers run with the parent and the node locked ('_nl') and return
+ * the next node to look at, NULL when done.
+ */
+static int node_condition(const struct avltree_cc_node *node)
+{
+    int hl = get_height(get_child(node, LEFT));
+    int hr = get_height(get_child(node, RIGHT));
+    int height = 1 + MAX(hl, hr);
+
+    if (hl - hr < -1 || hl - hr > 1)
+        return REBALANCE_REQUIRED;
+    return height != get_height(node) ? height : NOTHING_REQUIRED;
+}
+
+static inline int unbalanced(int h1, int h2)
+{
+    return h1 - h2 < -1 || h1 - h2 > 1;
+}
+
+static struct avltree_cc_node *fix_height_nl(struct avltree_cc_node *node)
+{
+    int condition;
+
+    if (!get_parent(node))          /* the holder */
+        return NULL;
+    condition = node_condition(node);
+    if (condition == REBALANCE_REQUIRED)
+        return node;
+    if (condition == NOTHING_REQUIRED)
+        return NULL;
+    set_height(node, condition);
+    return get_parent(node);
+}
+
+/* Lifts the child on side 'dir' of 'node': the subtree of 'node' shrinks */
+static struct avltree_cc_node *rotate_nl(struct avltree_cc_node *parent, struct avltree_cc_node *node, int dir,
+                                         int h_other, int h_outer, struct avltree_cc_node *inner, int h_inner)
+{
+    unsigned long version = get_version(node);
+    struct avltree_cc_node *child = get_child(node, dir);
+    int side = child_dir(parent, node);
+    int height;
+
+    begin_change(node, version);
+
+    set_child(node, dir, inner);
+    if (inner)
+        set_parent(inner, node);
+    set_child(child, !dir, node);
+    set_parent(node, child);
+    set_child(parent, side, child);
+    set_parent(child, parent);
+
+    height = 1 + MAX(h_inner, h_other);
+    set_height(node, height);
+    set_height(child, 1 + MAX(h_outer, height));
+
+    end_change(node, version);
+
+    if (unbalanced(h_inner, h_other))
+        return node;
+    if (unbalanced(h_outer, height))
+        return child;
+    return fix_height_nl(parent);
+}
+
+/* Lifts the inner grandchild on side 'dir' over both 'node' and the child */
+static struct avltree_cc_node *rotate_over_nl(struct avltree_cc_node *parent, struct avltree_cc_node *node, int dir,
+                                              int h_other, int h_outer, struct avltree_cc_node *inner, int h_inner_in)
+{
+    unsigned long version = get_version(node);
+    struct avltree_cc_node *child = get_child(node, dir);
+    unsigned long child_version = get_version(child);
+    struct avltree_cc_node *inner_in = get_child(inner, dir);
+    struct avltree_cc_node *inner_out = get_child(inner, !dir);
+    int h_inner_out = get_height(inner_out);
+    int side = child_dir(parent, node);
+    int height, child_height;
+
+    begin_change(node, version);
+    begin_change(child, child_version);
+
+    set_child(node, dir, inner_out);
+    if (inner_out)
+        set_parent(inner_out, node);
+    set_child(child, !dir, inner_in);
+    if (inner_in)
+        set_parent(inner_in, child);
+    set_child(inner, dir, child);
+    set_parent(child, inner);
+    set_child(inner, !dir, node);
+    set_parent(node, inner);
+    set_child(parent, side, inner);
+    set_parent(inner, parent);
+
+    height = 1 + MAX(h_inner_out, h_other);
+    set_height(node, height);
+    child_height = 1 + MAX(h_outer, h_inner_in);
+    set_height(child, child_height);
+    set_height(inner, 1 + MAX(child_height, height));
+
+    end_change(node, version);
+    end_change(child, child_version);
+
+    if (unbalanced(h_inner_out, h_other))
+        return node;
+    if (unbalanced(child_height, height))
+        return inner;
+    return fix_height_nl(parent);
+}
+
+/* 'node' is too high on side 'dir', whose sibling subtree is 'h_other' high */
+static struct avltree_cc_node *rebalance_to_nl(struct avltree_cc_node *parent, struct avltree_cc_node *node, int dir, int h_other)
+{
+    struct avltree_cc_node *child = get_child(node, dir), *inner, *next;
+    int h_outer, h_inner, h_inner_in;
+
+    lock_node(child);
+    if (get_height(child) - h_other <= 1) {
+        next = node;                /* changed meanwhile, look again */
+        goto out;
+    }
+    inner = get_child(child, !dir);
+    h_outer = get_height(get_child(child, dir));
+    h_inner = get_height(inner);
+    if (h_outer >= h_inner) {
+        next = rotate_nl(parent, node, dir, h_other, h_outer, inner, h_inner);
+        goto out;
+    }
+
+    lock_node(inner);
+    h_inner = get_height(inner);
+    if (h_outer >= h_inner) {
+        next = rotate_nl(parent, node, dir, h_other, h_outer, inner, h_inner);
+        unlock_node(inner);
+        goto out;
+    }
+    h_inner_in = get_height(get_child(inner, dir));
+    if (!unbalanced(h_outer, h_inner_in)) {
+        next = rotate_over_nl(parent, node, dir, h_other, h_outer, inner, h_inner_in);
+        unlock_node(inner);
+        goto out;
+    }
+    unlock_node(inner);
+
+    /* the double rotation would leave the child unbalanced: rotate it first */
+    next = rebalance_to_nl(node, child, !dir, h_outer);
+out:
+    unlock_node(child);
+    return next;
+}
+
+static struct avltree_cc_node *rebalance_nl(struct avltree_cc_node *parent, struct avltree_cc_node *node)
+{
+    int hl = get_height(get_child(node, LEFT));
+    int hr = get_height(get_child(node, RIGHT));
+    int height = 1 + MAX(hl, hr);
+
+    if (hl - hr > 1)
+        return rebalance_to_nl(parent, node, LEFT, hr);
+    if (hl - hr < -1)
+        return rebalance_to_nl(parent, node, RIGHT, hl);
+    if (height != get_height(node)) {
+        set_height(node, height);
+        return fix_height_nl(parent);
+    }
+    return NULL;
+}
+
+static void fix_height_and_rebalance(struct avltree_cc_node *node)
+{
+    while (node && get_parent(node)) {
+        struct avltree_cc_node *parent, *next;
+        int condition = node_condition(node);
+
+        if (condition == NOTHING_REQUIRED || (get_version(node) & UNLINKED))
+            return;
+
+        if (condition != REBALANCE_REQUIRED) {
+            lock_node(node);
+            next = fix_height_nl(node);
+            unlock_node(node);
+        } else {
+            parent = get_parent(node);
+            lock_node(parent);
+            next = node;
+            if (!(get_version(parent) & UNLINKED) && get_parent(node) == parent) {
+                lock_node(node);
+                /* an unlinked node keeps its parent pointer */
+                next = get_version(node) & UNLINKED ? NULL : rebalance_nl(parent, node);
+                unlock_node(node);
+            }
+            unlock_node(parent);
+        }
+        node = next;
+    }
+}
+
+
+/*
+ * Readers: the search below 'node', entered on side 'dir' while its
+ * version was 'version'. Each step validates the version of the node it
+ * leaves; a miss is only returned once every node on the way back up is
+ * found unchanged, which also covers a successor moving up past the path.
+ * '*bound', if given, receives the lowest node on the path above the key.
+ */
+static struct avltree_cc_node *attempt_find(const void *key, avltree_cc_key_cmp_fn_t cmp, const struct avltree_cc *tree,
+                                            const struct avltree_cc_node *node, int dir, unsigned long version,
+                                            struct avltree_cc_node **bound)
+{
+    for (;;) {
+        struct avltree_cc_node *child = get_child(node, dir), *found;
+        unsigned long child_version;
+        int res;
+
+        if (!child)
+            return get_version(node) == version ? NULL : RETRY;
+
+        res = compare(key, cmp, tree, child);
+        child_version = get_version(child);
+        if (res == 0 && !(child_version & UNLINKED))
+            return child;
+
+        if (child_version & (SHRINKING | UNLINKED)) {
+            wait_until_shrunk(child, child_version);
+            if (get_version(node) != version)
+                return RETRY;
+            continue;
+        }
+        if (child != get_child(node, dir)) {
+            if (get_version(node) != version)
+                return RETRY;
+            continue;
+        }
+        if (get_version(node) != version)
+            return RETRY;
+
+        if (bound)
+            *bound = NULL;
+        found = attempt_find(key, cmp, tree, child, res > 0, child_version, bound);
+        if (found == RETRY)
+            continue;
+        if (found)
+            return found;
+        if (get_version(node) != version)
+            return RETRY;
+        if (res < 0 && bound && !*bound)
+            *bound = child;
+        return NULL;
+    }
+}
+
+static struct avltree_cc_node *do_find(const void *key, avltree_cc_key_cmp_fn_t cmp, const struct avltree_cc *tree, struct avltree_cc_node **bound)
+{
+    struct avltree_cc_node *found;
+
+    do {
+        if (bound)
+            *bound = NULL;
+        found = attempt_find(key, cmp, tree, &tree->holder, RIGHT, get_version(&tree->holder), bound);
+    } while (found == RETRY);
+    return found;
+}
+
+struct avltree_cc_node *avltree_cc_lookup(const struct avltree_cc_node *key, const struct avltree_cc *tree)
+{
+    return do_find(key, NULL, tree, NULL);
+}
+
+struct avltree_cc_node *avltree_cc_lookup_key(const void *key, avltree_cc_key_cmp_fn_t cmp, const struct avltree_cc *tree)
+{
+    return do_find(key, cmp, tree, NULL);
+}
+
+struct avltree_cc_node *avltree_cc_lower_bound_key(const void *key, avltree_cc_key_cmp_fn_t cmp, const struct avltree_cc *tree)
+{
+    struct avltree_cc_node *bound, *found = do_find(key, cmp, tree, &bound);
+
+    return found ? found : bound;
+}
+
+
+/*
+ * Writers. An insertion links the node under the lock of its parent-to-be
+ * once the whole path down is found unchanged, so the path is recorded on
+ * the stack as the search recurses.
+ */
+struct path {
+    const struct avltree_cc_node *node;
+    unsigned long version;
+    const struct path *up;
+};
+
+static int path_changed(const struct path *path)
+{
+    for (; path; path = path->up)
+        if (get_version(path->node) != path->version)
+            return 1;
+    return 0;
+}
+
+static struct avltree_cc_node *attempt_insert(struct avltree_cc_node *node, struct avltree_cc *tree, struct avltree_cc_node *parent,
+                                              int dir, unsigned long version, const struct path *up)
+{
+    struct path here = { parent, version, up };
+
+    for (;;) {
+        struct avltree_cc_node *child = get_child(parent, dir), *found;
+        unsigned long child_version;
+        int res;
+
+        if (!child) {
+            lock_node(parent);
+            if (path_changed(&here)) {
+                unlock_node(parent);
+                return RETRY;
+            }
+            if (get_child(parent, dir)) {
+                unlock_node(parent);
+                continue;
+            }
+            node->left = node->right = NULL;
+            node->parent = parent;
+            node->version = 0;
+            node->height = 1;
+            node->lock = 0;
+            set_child(parent, dir, node);
+            unlock_node(parent);
+
+            fix_height_and_rebalance(parent);
+            return NULL;
+        }
+
+        res = compare(node, NULL, tree, child);
+        child_version = get_version(child);
+        if (res == 0 && !(child_version & UNLINKED))
+            return child;
+
+        if (child_version & (SHRINKING | UNLINKED)) {
+            wait_until_shrunk(child, child_version);
+            if (get_version(parent) != version)
+                return RETRY;
+            continue;
+        }
+        if (child != get_child(parent, dir)) {
+            if (get_version(parent) != version)
+                return RETRY;
+            continue;
+        }
+        if (get_version(parent) != version)
+            return RETRY;
+
+        found = attempt_insert(node, tree, child, res > 0, child_version, &here);
+        if (found != RETRY)
+            return found;
+        /* retry from the highest node that did not move */
+        if (path_changed(&here))
+            return RETRY;
+    }
+}
+
+struct avltree_cc_node *avltree_cc_insert(struct avltree_cc_node *node, struct avltree_cc *tree)
+{
+    struct avltree_cc_node *found;
+
+    do
+        found = attempt_insert(node, tree, &tree->holder, RIGHT, get_version(&tree->holder), NULL);
+    while (found == RETRY);
+    if (!found)
+        __atomic_add_fetch(&tree->size, 1, __ATOMIC_RELAXED);
+    return found;
+}
+
+/* 'node' has at most one child, which takes its place */
+static struct avltree_cc_node *unlink_nl(struct avltree_cc_node *parent, struct avltree_cc_node *node)
+{
+    struct avltree_cc_node *child = get_child(node, LEFT);
+
+    if (!child)
+        child = get_child(node, RIGHT);
+    set_child(parent, child_dir(parent, node), child);
+    if (child)
+        set_parent(child, parent);
+    STORE(&node->version, UNLINKED, __ATOMIC_RELEASE);
+    return parent;
+}
+
+/*
+ * 'node' has two children: its successor takes its place. The successor is
+ * found by locking down the left spine of the right subtree, which keeps
+ * anything from getting in between. Searches that went through 'node'
+ * see its version change; those that get to the successor from its new
+ * place see a consistent tree.
+ */
+static struct avltree_cc_node *replace_nl(struct avltree_cc_node *parent, struct avltree_cc_node *node)
+{
+    unsigned long version = get_version(node);
+    struct avltree_cc_node *prev = node, *succ = get_child(node, RIGHT), *next;
+    struct avltree_cc_node *left = get_child(node, LEFT), *right = succ;
+    int side = child_dir(parent, node);
+
+    lock_node(succ);
+    while ((next = get_child(succ, LEFT))) {
+        lock_node(next);
+        if (prev != node)
+            unlock_node(prev);
+        prev = succ;
+        succ = next;
+    }
+
+    begin_change(node, version);
+    if (prev != node) {
+        next = get_child(succ, RIGHT);
+        set_child(prev, LEFT, next);
+        if (next)
+            set_parent(next, prev);
+        set_child(succ, RIGHT, right);
+        set_parent(right, succ);
+    }
+    set_child(succ, LEFT, left);
+    set_parent(left, succ);
+    set_height(succ, get_height(node));
+    set_parent(succ, parent);
+    set_child(parent, side, succ);
+    STORE(&node->version, UNLINKED, __ATOMIC_RELEASE);
+
+    unlock_node(succ);
+    if (prev != node) {
+        unlock_node(prev);
+        return prev;
+    }
+    return succ;
+}
+
+void avltree_cc_remove(struct avltree_cc_node *node, struct avltree_cc *tree)
+{
+    struct avltree_cc_node *parent, *fix;
+
+    for (;;) {
+        /* an unlinked node keeps its stale parent, which may be unlinked too */
+        if (get_version(node) & UNLINKED)
+            return;
+        parent = get_parent(node);
+        lock_node(parent);
+        if (get_parent(node) != parent || (get_version(parent) & UNLINKED)) {
+            unlock_node(parent);
+            continue;
+        }
+        lock_node(node);
+        if (get_version(node) & UNLINKED) {     /* not in the tree */
+            unlock_node(node);
+            unlock_node(parent);
+            return;
+        }
+        if (get_child(node, LEFT) && get_child(node, RIGHT))
+            fix = replace_nl(parent, node);
+        else
+            fix = unlink_nl(parent, node);
+        unlock_node(node);
+        unlock_node(parent);
+        break;
+    }
+    __atomic_sub_fetch(&tree->size, 1, __ATOMIC_RELAXED);
+    fix_height_and_rebalance(fix);
+}
+
+
+struct avltree_cc_node *avltree_cc_first(const struct avltree_cc *tree)
+{
+    struct avltree_cc_node *node = tree->holder.right;
+
+    if (node)
+        while (node->left)
+            node = node->left;
+    return node;
+}
+
+struct avltree_cc_node *avltree_cc_next(const struct avltree_cc_node *node)
+{
+    struct avltree_cc_node *parent;
+
+    if (node->right) {
+        for (node = node->right; node->left; node = node->left)
+            ;
+        return (struct avltree_cc_node *)node;
+    }
+    /* the holder has no parent and the root on its right */
+    while ((parent = node->parent) && node == parent->right)
+        node = parent;
+    return parent;
+}
+
+int avltree_cc_init(struct avltree_cc *tree, avltree_cc_cmp_fn_t cmp)
+{
+    tree->cmp_fn = cmp;
+    tree->size = 0;
+    memset(&tree->holder, 0, sizeof(tree->holder));
+    return 0;
+}
@@ -0,0 +1,74 @@
+#ifndef ANYTREE__AVLCC__INCLUDED
+#define ANYTREE__AVLCC__INCLUDED
+
+#include <stddef.h>
+
+#include "epoch.h"
+
+
+#ifdef __GNUC__
+#  define avltree_cc_container_of(node, type, member) ({      \
+    const struct avltree_cc_node *__mptr = (node);            \
+    (type *)( (char *)__mptr - offsetof(type,member) );})
+#else
+#  define avltree_cc_container_of(node, type, member)         \
+    ((type *)((char *)(node) - offsetof(type, member)))
+#endif
+
+
+/*
+ * Concurrent AVL tree after Bronson, Casper, Chafi and Olukotun: every
+ * node carries a spin lock and a version that changes whenever a rotation
+ * shrinks its subtree. Readers take no lock and validate each step down
+ * against the version of the node they came from, retrying from there when
+ * it moved. Writers lock the node they change, its parent and, to rotate,
+ * one or two children, and rebalancing is relaxed: heights are fixed up
+ * bottom-up after the change, a node at a time.
+ *
+ * A node with two children is replaced by its successor, which keeps the
+ * nodes intrusive; the removed node's version changes for the duration, and
+ * a search that misses checks on its way back up that no node it went
+ * through changed.
+ *
+ * All operations may run concurrently, each inside an epoch section (see
+ * epoch.h). A removed node may still be under another thread's traversal:
+ * hand it to anytree_epoch_retire() rather than freeing or inserting it
+ * again.
+ */
+struct avltree_cc_node {
+    struct avltree_cc_node *left, *right, *parent;
+    unsigned long version;
+    int height;
+    int lock;
+    struct anytree_epoch_entry retire;  /* free for the caller's use, see above */
+};
+
+typedef int (*avltree_cc_cmp_fn_t)(const struct avltree_cc_node *, const struct avltree_cc_node *);
+typedef int (*avltree_cc_key_cmp_fn_t)(const void *key, const struct avltree_cc_node *);
+
+struct avltree_cc {
+    avltree_cc_cmp_fn_t cmp_fn;
+    unsigned size;
+
+    struct avltree_cc_node holder;      /* never rotated, the root is its right child */
+};
+
+/* Lockless, from any thread inside an epoch section */
+struct avltree_cc_node *avltree_cc_lookup(const struct avltree_cc_node *key, const struct avltree_cc *tree);
+struct avltree_cc_node *avltree_cc_lookup_key(const void *key, avltree_cc_key_cmp_fn_t cmp, const struct avltree_cc *tree);
+struct avltree_cc_node *avltree_cc_lower_bound_key(const void *key, avltree_cc_key_cmp_fn_t cmp, const struct avltree_cc *tree);
+
+/* Lock only the nodes around the change, from any thread inside an epoch section */
+struct avltree_cc_node *avltree_cc_insert(struct avltree_cc_node *node, struct avltree_cc *tree);
+void avltree_cc_remove(struct avltree_cc_node *node, struct avltree_cc *tree);
+
+/* In-order iteration, only while no other thread changes the tree */
+struct avltree_cc_node *avltree_cc_first(const struct avltree_cc *tree);
+struct avltree_cc_node *avltree_cc_next(const struct avltree_cc_node *node);
+
+#define avltree_cc_is_empty(TREE) (avltree_cc_size(TREE) == 0)
+#define avltree_cc_size(TREE) __atomic_load_n(&(TREE)->size, __ATOMIC_RELAXED)
+
+int avltree_cc_init(struct avltree_cc *tree, avltree_cc_cmp_fn_t cmp);
+
+#endif
@@ -0,0 +1,928 @@
+/*
+ * anytree_bench - compare the tree implementations under a set of workloads.
+ *
+ * Every workload is run through the direct <type>tree_* API, through the
+ * anytree_* function table and through the statically dispatched
+ * anytree_static_* macros, and one row is printed per measured phase:
+ * nanoseconds per operation, comparator calls per operation and the peak
+ * resident set size of the case.
+ *
+ * Usage: anytree_bench [-t types] [-a apis] [-w workloads] [-m exp] [-M exp]
+ *                      [-f csv|json] [-s seed] [-x] [-h]
+ *
+ *   -t  comma separated tree types: avl,bs,rb,splay,btree,inttree,treap
+ *       (default: all)
+ *   -a  comma separated apis: direct,any,static (default: all)
+ *   -w  comma separated workloads (default: all):
+ *         seq        sorted insert, lookup, iterate and remove
+ *         random     the same in random order
+ *         zipf       skewed lookups (theta 0.99) over a random tree
+ *         timestamp  sliding window: insert a new maximum, remove the minimum
+ *         readheavy  95% lookups, 5% inserts/removes on random keys
+ *         churn      50% inserts, 50% removes on random keys
+ *         relayout   random lookups before and after a van Emde Boas
+ *                    relayout of the nodes (avl and rb only)
+ *         ranges     half of the keys removed and restored in ranges of 16,
+ *                    with range removal and union on the treap
+ *   -m  smallest size as a power of ten (default 3)
+ *   -M  largest size as a power of ten (default 6, up to 9)
+ *   -f  output format (default csv)
+ *   -s  random seed
+ *   -x  do not skip sorted workloads on the unbalanced bs tree above 10^4
+ *   -h  print the option list with the type, api and workload names
+ */
+
+#define _GNU_SOURCE
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include "any.h"
+
+
+struct item {
+    struct anytree_node node;
+    uint64_t key;
+    int in_tree;
+};
+
+#define node_item(NODE) ((struct item *)(NODE))
+
+static unsigned long long cmp_count;
+
+static inline int item_cmp(const void *a, const void *b)
+{
+    uint64_t x = node_item(a)->key, y = node_item(b)->key;
+
+    ++cmp_count;
+    return (x > y) - (x < y);
+}
+
+static int avl_cmp(const struct avltree_node *a, const struct avltree_node *b)
+{
+    return item_cmp(a, b);
+}
+
+static int bs_cmp(const struct bstree_node *a, const struct bstree_node *b)
+{
+    return item_cmp(a, b);
+}
+
+static int rb_cmp(const struct rbtree_node *a, const struct rbtree_node *b)
+{
+    return item_cmp(a, b);
+}
+
+static int splay_cmp(const struct splaytree_node *a, const struct splaytree_node *b)
+{
+    return item_cmp(a, b);
+}
+
+static int btree_cmp(const struct btree_node *a, const struct btree_node *b)
+{
+    return item_cmp(a, b);
+}
+
+static int inttree_cmp(const struct inttree_node *a, const struct inttree_node *b)
+{
+    return item_cmp(a, b);
+}
+
+static uint64_t inttree_key(const struct inttree_node *node)
+{
+    return node_item(node)->key;
+}
+
+static int treap_cmp(const struct treap_node *a, const struct treap_node *b)
+{
+    return item_cmp(a, b);
+}
+
+static int any_cmp(const struct anytree_node *a, const struct anytree_node *b)
+{
+    return item_cmp(a, b);
+}
+
+static uint64_t any_key(const struct anytree_node *node)
+{
+    return node_item(node)->key;
+}
+
+
+/*
+ * Tree wrapper: one switch per operation so that the direct path ends in a
+ * direct call, the any path goes through the function table and the static
+ * path uses the anytree_static_* macros on an anytree handle.
+ */
+enum bench_api {
+    API_DIRECT,
+    API_ANY,
+    API_STATIC
+};
+
+struct bench_tree {
+    enum anytree_type type;
+    enum bench_api api;
+    union {
+        struct avltree avl;
+        struct bstree bs;
+        struct rbtree rb;
+        struct splaytree splay;
+        struct btree btree;
+        struct inttree inttree;
+        struct treap treap;
+    } u;
+    struct anytree *any;
+};
+
+static int bt_init(struct bench_tree *bt, enum anytree_type type, enum bench_api api)
+{
+    bt->type = type;
+    bt->api = api;
+    bt->any = NULL;
+
+    if (api != API_DIRECT) {
+        bt->any = anytree_init_keyed(type, any_cmp, any_key, NULL);
+        return bt->any ? 0 : -1;
+    }
+    switch (type) {
+    case ANYTREE_AVL:   return avltree_init(&bt->u.avl, avl_cmp);
+    case ANYTREE_BS:    return bstree_init(&bt->u.bs, bs_cmp);
+    case ANYTREE_RB:    return rbtree_init(&bt->u.rb, rb_cmp);
+    case ANYTREE_SPLAY: return splaytree_init(&bt->u.splay, splay_cmp);
+    case ANYTREE_BTREE: return btree_init(&bt->u.btree, btree_cmp);
+    case ANYTREE_INTTREE: return inttree_init(&bt->u.inttree, inttree_cmp, inttree_key);
+    case ANYTREE_TREAP: return treap_init(&bt->u.treap, treap_cmp);
+    default:            break;
+    }
+    return -1;
+}
+
+static void bt_release(struct bench_tree *bt)
+{
+    if (bt->any)
+        anytree_release(bt->any);
+    else if (bt->type == ANYTREE_BTREE)
+        btree_release(&bt->u.btree);
+    else if (bt->type == ANYTREE_INTTREE)
+        inttree_release(&bt->u.inttree);
+}
+
+static inline struct item *bt_insert(struct bench_tree *bt, struct item *it)
+{
+    if (bt->api == API_ANY)
+        return node_item(anytree_insert(&it->node, bt->any));
+    if (bt->api == API_STATIC) {
+        switch (bt->type) {
+        case ANYTREE_AVL:   return node_item(anytree_static_insert(ANYTREE_AVL, &it->node, bt->any));
+        case ANYTREE_BS:    return node_item(anytree_static_insert(ANYTREE_BS, &it->node, bt->any));
+        case ANYTREE_RB:    return node_item(anytree_static_insert(ANYTREE_RB, &it->node, bt->any));
+        case ANYTREE_SPLAY: return node_item(anytree_static_insert(ANYTREE_SPLAY, &it->node, bt->any));
+        case ANYTREE_BTREE: return node_item(anytree_static_insert(ANYTREE_BTREE, &it->node, bt->any));
+        case ANYTREE_INTTREE: return node_item(anytree_static_insert(ANYTREE_INTTREE, &it->node, bt->any));
+        case ANYTREE_TREAP: return node_item(anytree_static_insert(ANYTREE_TREAP, &it->node, bt->any));
+        default:            break;
+        }
+        return NULL;
+    }
+
+    switch (bt->type) {
+    case ANYTREE_AVL:   return node_item(avltree_insert(&it->node.avl, &bt->u.avl));
+    case ANYTREE_BS:    return node_item(bstree_insert(&it->node.bs, &bt->u.bs));
+    case ANYTREE_RB:    return node_item(rbtree_insert(&it->node.rb, &bt->u.rb));
+    case ANYTREE_SPLAY: return node_item(splaytree_insert(&it->node.splay, &bt->u.splay));
+    case ANYTREE_BTREE: return node_item(btree_insert(&it->node.btree, &bt->u.btree));
+    case ANYTREE_INTTREE: return node_item(inttree_insert(&it->node.inttree, &bt->u.inttree));
+    case ANYTREE_TREAP: return node_item(treap_insert(&it->node.treap, &bt->u.treap));
+    default:            break;
+    }
+    return NULL;
+}
+
+static inline struct item *bt_lookup(struct bench_tree *bt, struct item *key)
+{
+    if (bt->api == API_ANY)
+        return node_item(anytree_lookup(&key->node, bt->any));
+    if (bt->api == API_STATIC) {
+        switch (bt->type) {
+        case ANYTREE_AVL:   return node_item(anytree_static_lookup(ANYTREE_AVL, &key->node, bt->any));
+        case ANYTREE_BS:    return node_item(anytree_static_lookup(ANYTREE_BS, &key->node, bt->any));
+        case ANYTREE_RB:    return node_item(anytree_static_lookup(ANYTREE_RB, &key->node, bt->any));
+        case ANYTREE_SPLAY: return node_item(anytree_static_lookup(ANYTREE_SPLAY, &key->node, bt->any));
+        case ANYTREE_BTREE: return node_item(anytree_static_lookup(ANYTREE_BTREE, &key->node, bt->any));
+        case ANYTREE_INTTREE: return node_item(anytree_static_lookup(ANYTREE_INTTREE, &key->node, bt->any));
+        case ANYTREE_TREAP: return node_item(anytree_static_lookup(ANYTREE_TREAP, &key->node, bt->any));
+        default:            break;
+        }
+        return NULL;
+    }
+
+    switch (bt->type) {
+    case ANYTREE_AVL:   return node_item(avltree_lookup(&key->node.avl, &bt->u.avl));
+    case ANYTREE_BS:    return node_item(bstree_lookup(&key->node.bs, &bt->u.bs));
+    case ANYTREE_RB:    return node_item(rbtree_lookup(&key->node.rb, &bt->u.rb));
+    case ANYTREE_SPLAY: return node_item(splaytree_lookup(&key->node.splay, &bt->u.splay));
+    case ANYTREE_BTREE: return node_item(btree_lookup(&key->node.btree, &bt->u.btree));
+    case ANYTREE_INTTREE: return node_item(inttree_lookup(&key->node.inttree, &bt->u.inttree));
+    case ANYTREE_TREAP: return node_item(treap_lookup(&key->node.treap, &bt->u.treap));
+    default:            break;
+    }
+    return NULL;
+}
+
+static inline void bt_remove(struct bench_tree *bt, struct item *it)
+{
+    if (bt->api == API_ANY) {
+        struct anytree_node *node = &it->node;
+        anytree_remove_from(node, bt->any);
+        return;
+    }
+    if (bt->api == API_STATIC) {
+        switch (bt->type) {
+        case ANYTREE_AVL:   anytree_static_remove(ANYTREE_AVL, &it->node, bt->any); break;
+        case ANYTREE_BS:    anytree_static_remove(ANYTREE_BS, &it->node, bt->any); break;
+        case ANYTREE_RB:    anytree_static_remove(ANYTREE_RB, &it->node, bt->any); break;
+        case ANYTREE_SPLAY: anytree_static_remove(ANYTREE_SPLAY, &it->node, bt->any); break;
+        case ANYTREE_BTREE: anytree_static_remove(ANYTREE_BTREE, &it->node, bt->any); break;
+        case ANYTREE_INTTREE: anytree_static_remove(ANYTREE_INTTREE, &it->node, bt->any); break;
+        case ANYTREE_TREAP: anytree_static_remove(ANYTREE_TREAP, &it->node, bt->any); break;
+        default:            break;
+        }
+        return;
+    }
+    switch (bt->type) {
+    case ANYTREE_AVL:   avltree_remove(&it->node.avl, &bt->u.avl); break;
+    case ANYTREE_BS:    bstree_remove(&it->node.bs, &bt->u.bs); break;
+    case ANYTREE_RB:    rbtree_remove(&it->node.rb, &bt->u.rb); break;
+    case ANYTREE_SPLAY: splaytree_remove(&it->node.splay, &bt->u.splay); break;
+    case ANYTREE_BTREE: btree_remove(&it->node.btree, &bt->u.btree); break;
+    case ANYTREE_INTTREE: inttree_remove(&it->node.inttree, &bt->u.inttree); break;
+    case ANYTREE_TREAP: treap_remove(&it->node.treap, &bt->u.treap); break;
+    default:            break;
+    }
+}
+
+static inline struct item *bt_first(struct bench_tree *bt)
+{
+    if (bt->api == API_ANY)
+        return node_item(anytree_first(bt->any));
+    if (bt->api == API_STATIC) {
+        switch (bt->type) {
+        case ANYTREE_AVL:   return node_item(anytree_static_first(ANYTREE_AVL, bt->any));
+        case ANYTREE_BS:    return node_item(anytree_static_first(ANYTREE_BS, bt->any));
+        case ANYTREE_RB:    return node_item(anytree_static_first(ANYTREE_RB, bt->any));
+        case ANYTREE_SPLAY: return node_item(anytree_static_first(ANYTREE_SPLAY, bt->any));
+        case ANYTREE_BTREE: return node_item(anytree_static_first(ANYTREE_BTREE, bt->any));
+        case ANYTREE_INTTREE: return node_item(anytree_static_first(ANYTREE_INTTREE, bt->any));
+        case ANYTREE_TREAP: return node_item(anytree_static_first(ANYTREE_TREAP, bt->any));
+        default:            break;
+        }
+        return NULL;
+    }
+
+    switch (bt->type) {
+    case ANYTREE_AVL:   return node_item(avltree_first(&bt->u.avl));
+    case ANYTREE_BS:    return node_item(bstree_first(&bt->u.bs));
+    case ANYTREE_RB:    return node_item(rbtree_first(&bt->u.rb));
+    case ANYTREE_SPLAY: return node_item(splaytree_first(&bt->u.splay));
+    case ANYTREE_BTREE: return node_item(btree_first(&bt->u.btree));
+    case ANYTREE_INTTREE: return node_item(inttree_first(&bt->u.inttree));
+    case ANYTREE_TREAP: return node_item(treap_first(&bt->u.treap));
+    default:            break;
+    }
+    return NULL;
+}
+
+static inline struct item *bt_next(struct bench_tree *bt, struct item *it)
+{
+    if (bt->api == API_ANY) {
+        struct anytree_node *node = &it->node;
+        return node_item(anytree_next_in(node, bt->any));
+    }
+    if (bt->api == API_STATIC) {
+        switch (bt->type) {
+        case ANYTREE_AVL:   return node_item(anytree_static_next(ANYTREE_AVL, &it->node));
+        case ANYTREE_BS:    return node_item(anytree_static_next(ANYTREE_BS, &it->node));
+        case ANYTREE_RB:    return node_item(anytree_static_next(ANYTREE_RB, &it->node));
+        case ANYTREE_SPLAY: return node_item(anytree_static_next(ANYTREE_SPLAY, &it->node));
+        case ANYTREE_BTREE: return node_item(anytree_static_next(ANYTREE_BTREE, &it->node));
+        case ANYTREE_INTTREE: return node_item(anytree_static_next(ANYTREE_INTTREE, &it->node));
+        case ANYTREE_TREAP: return node_item(anytree_static_next(ANYTREE_TREAP, &it->node));
+        default:            break;
+        }
+        return NULL;
+    }
+    switch (bt->type) {
+    case ANYTREE_AVL:   return node_item(avltree_next(&it->node.avl));
+    case ANYTREE_BS:    return node_item(bstree_next(&it->node.bs));
+    case ANYTREE_RB:    return node_item(rbtree_next(&it->node.rb));
+    case ANYTREE_SPLAY: return node_item(splaytree_next(&it->node.splay));
+    case ANYTREE_BTREE: return node_item(btree_next(&it->node.btree));
+    case ANYTREE_INTTREE: return node_item(inttree_next(&it->node.inttree));
+    case ANYTREE_TREAP: return node_item(treap_next(&it->node.treap));
+    default:            break;
+    }
+    return NULL;
+}
+
+
+/* Van Emde Boas relayout of the items array, -1 for the types without one */
+static int bt_relayout(struct bench_tree *bt, struct item *items, unsigned long count)
+{
+    switch (bt->type) {
+    case ANYTREE_AVL:
+        return AVLTREE_RELAYOUT(bt->any ? &bt->any->avl : &bt->u.avl, items, node.avl, count);
+    case ANYTREE_RB:
+        return RBTREE_RELAYOUT(bt->any ? &bt->any->rb : &bt->u.rb, items, node.rb, count);
+    default:
+        break;
+    }
+    return -1;
+}
+
+/*
+ * Range removal of the items by_key[lo..hi) and their return. The treap
+ * cuts the range out into 'cut' with treap_remove_range() and merges it
+ * back with treap_union(); the other types remove and insert the items
+ * one by one, spared the searches since the items are at hand.
+ */
+static void bt_cut(struct bench_tree *bt, struct item **by_key, unsigned long lo, unsigned long hi, unsigned long n, struct treap *cut)
+{
+    unsigned long i;
+
+    if (bt->type == ANYTREE_TREAP) {
+        treap_remove_range(&by_key[lo]->node.treap, hi < n ? &by_key[hi]->node.treap : NULL,
+                           bt->any ? &bt->any->treap : &bt->u.treap, cut);
+        return;
+    }
+    for (i = lo; i < hi; i++)
+        bt_remove(bt, by_key[i]);
+}
+
+static void bt_paste(struct bench_tree *bt, struct item **by_key, unsigned long lo, unsigned long hi, struct treap *cut)
+{
+    unsigned long i;
+
+    if (bt->type == ANYTREE_TREAP) {
+        treap_union(bt->any ? &bt->any->treap : &bt->u.treap, cut);
+        return;
+    }
+    for (i = lo; i < hi; i++)
+        bt_insert(bt, by_key[i]);
+}
+
+/*
+ * Random numbers
+ */
+static uint64_t rng_state = 0x9e3779b97f4a7c15ULL;
+
+static inline uint64_t rng_next(void)
+{
+    uint64_t z = (rng_state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+static inline double rng_double(void)
+{
+    return (rng_next() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static void shuffle_keys(struct item *items, size_t n)
+{
+    size_t i;
+
+    for (i = n; i > 1; i--) {
+        size_t j = rng_next() % i;
+        uint64_t key = items[i - 1].key;
+        items[i - 1].key = items[j].key;
+        items[j].key = key;
+    }
+}
+
+/* YCSB style zipfian generator over ranks [0, n) */
+struct zipf {
+    unsigned long n;
+    double theta, alpha, zetan, eta, half_pow_theta;
+};
+
+static void zipf_init(struct zipf *z, unsigned long n, double theta)
+{
+    double zeta2 = 1.0 + pow(0.5, theta);
+    unsigned long i;
+
+    z->n = n;
+    z->theta = theta;
+    z->alpha = 1.0 / (1.0 - theta);
+    z->zetan = 0;
+    for (i = 1; i <= n; i++)
+        z->zetan += 1.0 / pow((double)i, theta);
+    z->eta = (1.0 - pow(2.0 / n, 1.0 - theta)) / (1.0 - zeta2 / z->zetan);
+    z->half_pow_theta = pow(0.5, theta);
+}
+
+static inline unsigned long zipf_next(const struct zipf *z)
+{
+    double u = rng_double();
+    double uz = u * z->zetan;
+    unsigned long rank;
+
+    if (uz < 1.0)
+        return 0;
+    if (uz < 1.0 + z->half_pow_theta)
+        return 1;
+    rank = (unsigned long)(z->n * pow(z->eta * u - z->eta + 1.0, z->alpha));
+    return rank < z->n ? rank : z->n - 1;
+}
+
+
+/*
+ * Measurement and output
+ */
+enum bench_format {
+    FORMAT_CSV,
+    FORMAT_JSON
+};
+
+static enum bench_format format = FORMAT_CSV;
+static int rows_printed;
+
+static const char *api_names[] = { "direct", "any", "static" };
+#define API_COUNT (sizeof(api_names) / sizeof(api_names[0]))
+static const char *type_names[] = {
+    [ANYTREE_AVL] = "avl", [ANYTREE_BS] = "bs", [ANYTREE_RB] = "rb", [ANYTREE_SPLAY] = "splay",
+    [ANYTREE_BTREE] = "btree", [ANYTREE_INTTREE] = "inttree", [ANYTREE_TREAP] = "treap"
+};
+#define TYPE_COUNT (sizeof(type_names) / sizeof(type_names[0]))
+
+static inline double now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* Resets the kernel's high-water mark so each case reports its own peak (Linux only). */
+static void reset_peak_rss(void)
+{
+    FILE *f = fopen("/proc/self/clear_refs", "w");
+
+    if (f) {
+        fputs("5", f);
+        fclose(f);
+    }
+}
+
+static long peak_rss_kb(void)
+{
+    struct rusage usage;
+    char line[256];
+    long kb = -1;
+    FILE *f = fopen("/proc/self/status", "r");
+
+    if (f) {
+        while (fgets(line, sizeof(line), f))
+            if (sscanf(line, "VmHWM: %ld", &kb) == 1)
+                break;
+        fclose(f);
+    }
+    if (kb < 0 && getrusage(RUSAGE_SELF, &usage) == 0)
+        kb = usage.ru_maxrss;
+    return kb;
+}
+
+struct bench_case {
+    struct bench_tree tree;
+    const char *workload;
+    struct item *items;
+    unsigned long n;
+
+    double start;
+    unsigned long long cmp_start;
+};
+
+static void phase_begin(struct bench_case *c)
+{
+    c->cmp_start = cmp_count;
+    c->start = now_ns();
+}
+
+static void phase_end(struct bench_case *c, const char *op, unsigned long ops)
+{
+    double ns = now_ns() - c->start;
+    double cmps = (double)(cmp_count - c->cmp_start);
+    long rss = peak_rss_kb();
+
+    if (ops == 0)
+        ops = 1;
+    if (format == FORMAT_CSV) {
+        if (!rows_printed)
+            printf("api,tree,workload,op,n,ops,ns_per_op,cmp_per_op,peak_rss_kb\n");
+        printf("%s,%s,%s,%s,%lu,%lu,%.2f,%.2f,%ld\n",
+               api_names[c->tree.api], type_names[c->tree.type], c->workload, op,
+               c->n, ops, ns / ops, cmps / ops, rss);
+    } else {
+        printf("%s\n  {\"api\": \"%s\", \"tree\": \"%s\", \"workload\": \"%s\", \"op\": \"%s\", "
+               "\"n\": %lu, \"ops\": %lu, \"ns_per_op\": %.2f, \"cmp_per_op\": %.2f, "
+               "\"peak_rss_kb\": %ld}",
+               rows_printed ? "," : "[",
+               api_names[c->tree.api], type_names[c->tree.type], c->workload, op,
+               c->n, ops, ns / ops, cmps / ops, rss);
+    }
+    rows_printed++;
+    fflush(stdout);
+}
+
+static void fill_tree(struct bench_case *c, unsigned long count)
+{
+    unsigned long i;
+
+    for (i = 0; i < count; i++) {
+        bt_insert(&c->tree, &c->items[i]);
+        c->items[i].in_tree = 1;
+    }
+}
+
+static void run_iterate(struct bench_case *c)
+{
+    struct item *it;
+    unsigned long count = 0;
+
+    phase_begin(c);
+    for (it = bt_first(&c->tree); it; it = bt_next(&c->tree, it))
+        count++;
+    phase_end(c, "iterate", count);
+}
+
+
+/*
+ * Workloads
+ */
+static void run_ordered(struct bench_case *c, int shuffle)
+{
+    unsigned long i, hits = 0;
+
+    for (i = 0; i < c->n; i++)
+        c->items[i].key = i;
+    if (shuffle)
+        shuffle_keys(c->items, c->n);
+
+    phase_begin(c);
+    fill_tree(c, c->n);
+    phase_end(c, "insert", c->n);
+
+    phase_begin(c);
+    for (i = 0; i < c->n; i++)
+        hits += bt_lookup(&c->tree, &c->items[i]) != NULL;
+    phase_end(c, "lookup", c->n);
+    if (hits != c->n)
+        fprintf(stderr, "%s/%s: %lu of %lu lookups missed\n",
+                type_names[c->tree.type], c->workload, c->n - hits, c->n);
+
+    run_iterate(c);
+
+    phase_begin(c);
+    for (i = 0; i < c->n; i++)
+        bt_remove(&c->tree, &c->items[i]);
+    phase_end(c, "remove", c->n);
+}
+
+static void run_seq(struct bench_case *c)
+{
+    run_ordered(c, 0);
+}
+
+static void run_random(struct bench_case *c)
+{
+    run_ordered(c, 1);
+}
+
+static void run_zipf(struct bench_case *c)
+{
+    struct zipf z;
+    unsigned long i;
+
+    for (i = 0; i < c->n; i++)
+        c->items[i].key = i;
+    shuffle_keys(c->items, c->n);
+    fill_tree(c, c->n);
+    zipf_init(&z, c->n, 0.99);
+
+    phase_begin(c);
+    for (i = 0; i < c->n; i++)
+        bt_lookup(&c->tree, &c->items[zipf_next(&z)]);
+    phase_end(c, "lookup", c->n);
+}
+
+static void run_timestamp(struct bench_case *c)
+{
+    unsigned long i;
+
+    for (i = 0; i < 2 * c->n; i++)
+        c->items[i].key = i * 16 + (rng_next() & 15);
+    fill_tree(c, c->n);
+
+    phase_begin(c);
+    for (i = c->n; i < 2 * c->n; i++) {
+        bt_insert(&c->tree, &c->items[i]);
+        bt_remove(&c->tree, bt_first(&c->tree));
+    }
+    phase_end(c, "slide", c->n);
+}
+
+/*
+ * Random lookups on a tree whose nodes sit in the items array in insertion
+ * order, then again once the array is relaid out in van Emde Boas order.
+ */
+static void run_lookups(struct bench_case *c, const char *op)
+{
+    struct item key;
+    unsigned long i, hits = 0;
+
+    phase_begin(c);
+    for (i = 0; i < c->n; i++) {
+        key.key = rng_next() % c->n;
+        hits += bt_lookup(&c->tree, &key) != NULL;
+    }
+    phase_end(c, op, c->n);
+    if (hits != c->n)
+        fprintf(stderr, "%s/%s: %lu of %lu lookups missed\n",
+                type_names[c->tree.type], c->workload, c->n - hits, c->n);
+}
+
+static void run_relayout(struct bench_case *c)
+{
+    unsigned long i;
+
+    for (i = 0; i < c->n; i++)
+        c->items[i].key = i;
+    shuffle_keys(c->items, c->n);
+    fill_tree(c, c->n);
+    run_lookups(c, "lookup");
+
+    phase_begin(c);
+    if (bt_relayout(&c->tree, c->items, c->n)) {
+        fprintf(stderr, "%s/%s: no relayout at n=%lu: not supported by the type or out of memory\n",
+                type_names[c->tree.type], c->workload, c->n);
+        return;
+    }
+    phase_end(c, "relayout", c->n);
+    run_lookups(c, "lookup_veb");
+}
+
+/*
+ * Half of the keys leave the tree in ranges of RANGE_KEYS consecutive
+ * keys taken in random order, then come back range by range.
+ */
+#define RANGE_KEYS 16
+
+static void run_ranges(struct bench_case *c)
+{
+    unsigned long i, ranges = c->n / RANGE_KEYS, cuts = ranges / 2;
+    struct item **by_key = malloc(c->n * sizeof(*by_key));
+    unsigned long *order = malloc((ranges + 1) * sizeof(*order));
+    struct treap *cut = malloc((cuts + 1) * sizeof(*cut));
+
+    if (!by_key || !order || !cut) {
+        fprintf(stderr, "%s/%s: out of memory\n", type_names[c->tree.type], c->workload);
+        goto out;
+    }
+    for (i = 0; i < c->n; i++)
+        c->items[i].key = i;
+    shuffle_keys(c->items, c->n);
+    for (i = 0; i < c->n; i++)
+        by_key[c->items[i].key] = &c->items[i];
+    for (i = 0; i < ranges; i++)
+        order[i] = i;
+    for (i = ranges; i > 1; i--) {
+        unsigned long j = rng_next() % i, tmp = order[i - 1];
+        order[i - 1] = order[j];
+        order[j] = tmp;
+    }
+    fill_tree(c, c->n);
+
+    phase_begin(c);
+    for (i = 0; i < cuts; i++)
+        bt_cut(&c->tree, by_key, order[i] * RANGE_KEYS, (order[i] + 1) * RANGE_KEYS, c->n, &cut[i]);
+    phase_end(c, "cut", cuts);
+
+    phase_begin(c);
+    for (i = 0; i < cuts; i++)
+        bt_paste(&c->tree, by_key, order[i] * RANGE_KEYS, (order[i] + 1) * RANGE_KEYS, &cut[i]);
+    phase_end(c, "paste", cuts);
+
+    run_lookups(c, "lookup");
+out:
+    free(by_key);
+    free(order);
+    free(cut);
+}
+
+/* Operations on 2n random keys of which about n are present at any time. */
+static void run_mixed(struct bench_case *c, double read_ratio)
+{
+    unsigned long i, slots = 2 * c->n;
+
+    for (i = 0; i < slots; i++) {
+        c->items[i].key = i;
+        c->items[i].in_tree = 0;
+    }
+    shuffle_keys(c->items, slots);
+    fill_tree(c, c->n);
+
+    phase_begin(c);
+    for (i = 0; i < c->n; i++) {
+        struct item *it = &c->items[rng_next() % slots];
+
+        if (rng_double() < read_ratio)
+            bt_lookup(&c->tree, it);
+        else if (it->in_tree) {
+            bt_remove(&c->tree, it);
+            it->in_tree = 0;
+        } else {
+            bt_insert(&c->tree, it);
+            it->in_tree = 1;
+        }
+    }
+    phase_end(c, "mixed", c->n);
+}
+
+static void run_readheavy(struct bench_case *c)
+{
+    run_mixed(c, 0.95);
+}
+
+static void run_churn(struct bench_case *c)
+{
+    run_mixed(c, 0.0);
+}
+
+struct workload {
+    const char *name;
+    void (*run)(struct bench_case *c);
+    unsigned items_per_node;
+    int sorted;
+};
+
+static const struct workload workloads[] = {
+    { "seq",       run_seq,       1, 1 },
+    { "random",    run_random,    1, 0 },
+    { "zipf",      run_zipf,      1, 0 },
+    { "timestamp", run_timestamp, 2, 1 },
+    { "readheavy", run_readheavy, 2, 0 },
+    { "churn",     run_churn,     2, 0 },
+    { "relayout",  run_relayout,  1, 0 },
+    { "ranges",    run_ranges,    1, 0 },
+};
+#define WORKLOAD_COUNT (sizeof(workloads) / sizeof(workloads[0]))
+
+
+/*
+ * Driver
+ */
+static unsigned parse_list(const char *arg, const char *const *names, unsigned count)
+{
+    unsigned mask = 0, i;
+    char *copy = strdup(arg), *tok, *save = NULL;
+
+    for (tok = strtok_r(copy, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+        for (i = 0; i < count; i++)
+            if (names[i] && strcmp(tok, names[i]) == 0)
+                break;
+        if (i == count) {
+            fprintf(stderr, "unknown name '%s'\n", tok);
+            exit(2);
+        }
+        mask |= 1u << i;
+    }
+    free(copy);
+    return mask;
+}
+
+static void print_names(FILE *out, const char *const *names, unsigned count)
+{
+    const char *sep = "";
+    unsigned i;
+
+    for (i = 0; i < count; i++)
+        if (names[i]) {
+            fprintf(out, "%s%s", sep, names[i]);
+            sep = ",";
+        }
+    fputc('\n', out);
+}
+
+/* -h prints the option list to stdout and succeeds, a bad option gets the usage line only */
+static void usage(const char *prog, int help)
+{
+    FILE *out = help ? stdout : stderr;
+    const char *workload_names[WORKLOAD_COUNT];
+    unsigned w;
+
+    fprintf(out, "usage: %s [-t types] [-a apis] [-w workloads] [-m exp] [-M exp] "
+            "[-f csv|json] [-s seed] [-x] [-h]\n", prog);
+    if (!help)
+        exit(2);
+
+    for (w = 0; w < WORKLOAD_COUNT; w++)
+        workload_names[w] = workloads[w].name;
+    fprintf(out, "  -t  comma separated tree types (default: all): ");
+    print_names(out, type_names, TYPE_COUNT);
+    fprintf(out, "  -a  comma separated apis (default: all): ");
+    print_names(out, api_names, API_COUNT);
+    fprintf(out, "  -w  comma separated workloads (default: all): ");
+    print_names(out, workload_names, WORKLOAD_COUNT);
+    fprintf(out, "  -m  smallest size as a power of ten (default 3)\n"
+            "  -M  largest size as a power of ten (default 6, up to 9)\n"
+            "  -f  output format (default csv)\n"
+            "  -s  random seed\n"
+            "  -x  do not skip sorted workloads on the unbalanced bs tree above 10^4\n"
+            "  -h  print this list\n");
+    exit(0);
+}
+
+int main(int argc, char **argv)
+{
+    const char *workload_names[WORKLOAD_COUNT];
+    unsigned types = ~0u, apis = ~0u, loads = ~0u;
+    int min_exp = 3, max_exp = 6, no_skip = 0;
+    int opt, e;
+    unsigned w, t, a;
+
+    for (w = 0; w < WORKLOAD_COUNT; w++)
+        workload_names[w] = workloads[w].name;
+
+    while ((opt = getopt(argc, argv, "t:a:w:m:M:f:s:xh")) != -1) {
+        switch (opt) {
+        case 't': types = parse_list(optarg, type_names, TYPE_COUNT); break;
+        case 'a': apis = parse_list(optarg, api_names, API_COUNT); break;
+        case 'w': loads = parse_list(optarg, workload_names, WORKLOAD_COUNT); break;
+        case 'm': min_exp = atoi(optarg); break;
+        case 'M': max_exp = atoi(optarg); break;
+        case 'f':
+            if (strcmp(optarg, "csv") == 0)
+                format = FORMAT_CSV;
+            else if (strcmp(optarg, "json") == 0)
+                format = FORMAT_JSON;
+            else
+                usage(argv[0], 0);
+            break;
+        case 's': rng_state = strtoull(optarg, NULL, 0); break;
+        case 'x': no_skip = 1; break;
+        case 'h': usage(argv[0], 1);
+        default: usage(argv[0], 0);
+        }
+    }
+    if (min_exp < 0 || max_exp > 9 || min_exp > max_exp)
+        usage(argv[0], 0);
+
+    for (e = min_exp; e <= max_exp; e++) {
+        unsigned long n = 1;
+        int i;
+
+        for (i = 0; i < e; i++)
+            n *= 10;
+
+        for (w = 0; w < WORKLOAD_COUNT; w++) {
+            if (!(loads & (1u << w)))
+                continue;
+            for (t = 0; t < TYPE_COUNT; t++) {
+                if (!type_names[t] || !(types & (1u << t)))
+                    continue;
+                if (t == ANYTREE_BS && workloads[w].sorted && n > 10000 && !no_skip) {
+                    fprintf(stderr, "skipping bs/%s at n=%lu: sorted input degenerates it into a list\n",
+                            workloads[w].name, n);
+                    continue;
+                }
+                for (a = 0; a < API_COUNT; a++) {
+                    struct bench_case c;
+
+                    if (!(apis & (1u << a)))
+                        continue;
+                    memset(&c, 0, sizeof(c));
+                    c.workload = workloads[w].name;
+                    c.n = n;
+                    c.items = calloc(n * workloads[w].items_per_node, sizeof(struct item));
+                    if (!c.items || bt_init(&c.tree, t, a)) {
+                        fprintf(stderr, "out of memory at n=%lu\n", n);
+                        return 1;
+                    }
+                    reset_peak_rss();
+                    workloads[w].run(&c);
+                    bt_release(&c.tree);
+                    free(c.items);
+                }
+            }
+        }
+    }
+    if (format == FORMAT_JSON)
+        printf("%s\n", rows_printed ? "\n]" : "[]");
+    return 0;
+}
@@ -0,0 +1,528 @@
+/*
+ * anytree_bench_mt - throughput of the concurrent trees from 1 to 64 threads.
+ *
+ * Every thread runs a mix of lookups on random keys and insertions or
+ * removals of the keys it owns (key modulo the thread count) for a fixed
+ * time, and one row is printed per tree, workload and thread count: the
+ * total operations and millions of operations per second. Half of the keys
+ * are present at the start. The lock-free structures retire removed nodes
+ * through an epoch, the locked tree frees them at once.
+ *
+ * Usage: anytree_bench_mt [-t trees] [-w workloads] [-T threads] [-m exp]
+ *                         [-d ms] [-f csv|json] [-s seed]
+ *
+ *   -t  comma separated trees (default: all):
+ *         locked     avltree under a global mutex
+ *         latch      rbtree_latch: lockless lookups, writers under a mutex
+ *         skiplist   lock-free skip list
+ *         avlcc      optimistic concurrent avl tree
+ *   -w  comma separated workloads (default: all):
+ *         read       lookups only
+ *         readheavy  95% lookups, 5% inserts/removes
+ *         mixed      50% lookups, 50% inserts/removes
+ *         churn      inserts/removes only
+ *   -T  largest thread count, doubling from 1 (default 64)
+ *   -m  number of keys as a power of ten (default 5)
+ *   -d  duration of each case in milliseconds (default 200)
+ *   -f  output format (default csv)
+ *   -s  random seed
+ */
+
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "avl.h"
+#include "avlcc.h"
+#include "epoch.h"
+#include "rblatch.h"
+#include "skiplist.h"
+
+
+/* The node comes last: a skip list node is followed by its tower */
+struct item {
+    struct anytree_epoch_entry retire;
+    uint64_t key;
+    union {
+        struct avltree_node avl;
+        struct rbtree_latch_node latch;
+        struct skiplist_node skiplist;
+        struct avltree_cc_node avlcc;
+    } node;
+};
+
+static inline struct item *node_item(const void *node)
+{
+    return node ? (struct item *)((char *)node - offsetof(struct item, node)) : NULL;
+}
+
+static inline int item_cmp(const void *a, const void *b)
+{
+    uint64_t x = node_item(a)->key, y = node_item(b)->key;
+
+    return (x > y) - (x < y);
+}
+
+static inline int key_cmp(const void *key, const void *node)
+{
+    uint64_t x = *(const uint64_t *)key, y = node_item(node)->key;
+
+    return (x > y) - (x < y);
+}
+
+static int avl_cmp(const struct avltree_node *a, const struct avltree_node *b)
+{
+    return item_cmp(a, b);
+}
+
+static int avl_key_cmp(const void *key, const struct avltree_node *node)
+{
+    return key_cmp(key, node);
+}
+
+static int latch_cmp(const struct rbtree_latch_node *a, const struct rbtree_latch_node *b)
+{
+    return item_cmp(a, b);
+}
+
+static int latch_key_cmp(const void *key, const struct rbtree_latch_node *node)
+{
+    return key_cmp(key, node);
+}
+
+static int skiplist_cmp(const struct skiplist_node *a, const struct skiplist_node *b)
+{
+    return item_cmp(a, b);
+}
+
+static int skiplist_key_cmp(const void *key, const struct skiplist_node *node)
+{
+    return key_cmp(key, node);
+}
+
+static int avlcc_cmp(const struct avltree_cc_node *a, const struct avltree_cc_node *b)
+{
+    return item_cmp(a, b);
+}
+
+static int avlcc_key_cmp(const void *key, const struct avltree_cc_node *node)
+{
+    return key_cmp(key, node);
+}
+
+static void free_item(struct anytree_epoch_entry *entry)
+{
+    free(anytree_epoch_container_of(entry, struct item, retire));
+}
+
+
+/*
+ * Tree wrapper, one switch per operation as in bench.c
+ */
+enum mt_tree {
+    TREE_LOCKED,
+    TREE_LATCH,
+    TREE_SKIPLIST,
+    TREE_AVLCC
+};
+
+static const char *tree_names[] = { "locked", "latch", "skiplist", "avlcc" };
+#define TREE_COUNT (sizeof(tree_names) / sizeof(tree_names[0]))
+
+struct mt_tree_state {
+    enum mt_tree type;
+    pthread_mutex_t lock;       /* the whole tree, or the latch writers */
+    struct anytree_epoch epoch;
+    union {
+        struct avltree avl;
+        struct rbtree_latch latch;
+        struct skiplist skiplist;
+        struct avltree_cc avlcc;
+    } u;
+};
+
+static void mt_init(struct mt_tree_state *t, enum mt_tree type)
+{
+    t->type = type;
+    pthread_mutex_init(&t->lock, NULL);
+    anytree_epoch_init(&t->epoch);
+
+    switch (type) {
+    case TREE_LOCKED:   avltree_init(&t->u.avl, avl_cmp); break;
+    case TREE_LATCH:    rbtree_latch_init(&t->u.latch, latch_cmp); break;
+    case TREE_SKIPLIST: skiplist_init(&t->u.skiplist, skiplist_cmp); break;
+    case TREE_AVLCC:    avltree_cc_init(&t->u.avlcc, avlcc_cmp); break;
+    }
+}
+
+static inline struct item *mt_lookup(struct mt_tree_state *t, uint64_t key)
+{
+    struct item *it = NULL;
+
+    switch (t->type) {
+    case TREE_LOCKED:
+        pthread_mutex_lock(&t->lock);
+        it = node_item(avltree_lookup_key(&key, avl_key_cmp, &t->u.avl));
+        pthread_mutex_unlock(&t->lock);
+        break;
+    case TREE_LATCH:
+        it = node_item(rbtree_latch_lookup_key(&key, latch_key_cmp, &t->u.latch));
+        break;
+    case TREE_SKIPLIST:
+        it = node_item(skiplist_lookup_key(&key, skiplist_key_cmp, &t->u.skiplist));
+        break;
+    case TREE_AVLCC:
+        it = node_item(avltree_cc_lookup_key(&key, avlcc_key_cmp, &t->u.avlcc));
+        break;
+    }
+    return it;
+}
+
+static inline void mt_insert(struct mt_tree_state *t, struct item *it)
+{
+    switch (t->type) {
+    case TREE_LOCKED:
+        pthread_mutex_lock(&t->lock);
+        avltree_insert(&it->node.avl, &t->u.avl);
+        pthread_mutex_unlock(&t->lock);
+        break;
+    case TREE_LATCH:
+        pthread_mutex_lock(&t->lock);
+        rbtree_latch_insert(&it->node.latch, &t->u.latch);
+        pthread_mutex_unlock(&t->lock);
+        break;
+    case TREE_SKIPLIST:
+        skiplist_insert(&it->node.skiplist, &t->u.skiplist);
+        break;
+    case TREE_AVLCC:
+        avltree_cc_insert(&it->node.avlcc, &t->u.avlcc);
+        break;
+    }
+}
+
+/* The caller owns the item: it is freed or retired */
+static inline void mt_remove(struct mt_tree_state *t, struct item *it)
+{
+    switch (t->type) {
+    case TREE_LOCKED:
+        pthread_mutex_lock(&t->lock);
+        avltree_remove(&it->node.avl, &t->u.avl);
+        pthread_mutex_unlock(&t->lock);
+        free(it);
+        return;
+    case TREE_LATCH:
+        pthread_mutex_lock(&t->lock);
+        rbtree_latch_remove(&it->node.latch, &t->u.latch);
+        pthread_mutex_unlock(&t->lock);
+        break;
+    case TREE_SKIPLIST:
+        skiplist_remove(&it->node.skiplist, &t->u.skiplist);
+        break;
+    case TREE_AVLCC:
+        avltree_cc_remove(&it->node.avlcc, &t->u.avlcc);
+        break;
+    }
+    anytree_epoch_retire(&t->epoch, &it->retire, free_item);
+}
+
+
+/*
+ * Workers
+ */
+struct workload {
+    const char *name;
+    unsigned read_percent;
+};
+
+static const struct workload workloads[] = {
+    { "read",      100 },
+    { "readheavy", 95 },
+    { "mixed",     50 },
+    { "churn",     0 },
+};
+#define WORKLOAD_COUNT (sizeof(workloads) / sizeof(workloads[0]))
+
+struct bench_case {
+    struct mt_tree_state tree;
+    const struct workload *workload;
+    unsigned long keys;
+    unsigned threads;
+    int stop;
+};
+
+struct worker {
+    pthread_t thread;
+    struct bench_case *c;
+    unsigned id;
+    uint64_t rng;
+    unsigned long ops;
+    struct item **owned;        /* owned[i] holds key i * threads + id */
+    unsigned long owned_count;
+};
+
+static uint64_t seed = 0x9e3779b97f4a7c15ULL;
+
+static inline uint64_t rng_next(uint64_t *state)
+{
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+static struct item *new_item(const struct mt_tree_state *t, uint64_t key)
+{
+    unsigned height = t->type == TREE_SKIPLIST ? skiplist_random_height() : 0;
+    struct item *it = malloc(sizeof(*it) + skiplist_tower_size(height));
+
+    if (!it) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    it->key = key;
+    if (height)
+        skiplist_node_init(&it->node.skiplist, height);
+    return it;
+}
+
+/* Operations are counted by batches, the stop flag is checked between them */
+#define BATCH 64
+
+static void *worker_run(void *arg)
+{
+    struct worker *w = (struct worker *)arg;
+    struct bench_case *c = w->c;
+    struct mt_tree_state *t = &c->tree;
+    struct anytree_epoch_reader *reader = NULL;
+    unsigned i;
+
+    if (t->type != TREE_LOCKED && !(reader = anytree_epoch_register(&t->epoch))) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+
+    while (!__atomic_load_n(&c->stop, __ATOMIC_RELAXED)) {
+        for (i = 0; i < BATCH; i++) {
+            uint64_t r = rng_next(&w->rng);
+
+            if (reader)
+                anytree_epoch_enter(&t->epoch, reader);
+            if (r % 100 < c->workload->read_percent)
+                mt_lookup(t, (r >> 8) % c->keys);
+            else {
+                unsigned long slot = (r >> 8) % w->owned_count;
+
+                if (w->owned[slot]) {
+                    mt_remove(t, w->owned[slot]);
+                    w->owned[slot] = NULL;
+                } else {
+                    w->owned[slot] = new_item(t, slot * c->threads + w->id);
+                    mt_insert(t, w->owned[slot]);
+                }
+            }
+            if (reader)
+                anytree_epoch_exit(reader);
+        }
+        w->ops += BATCH;
+        if (reader)
+            anytree_epoch_collect(&t->epoch);
+    }
+
+    if (reader)
+        anytree_epoch_unregister(reader);
+    return NULL;
+}
+
+
+/*
+ * Measurement and output
+ */
+enum bench_format {
+    FORMAT_CSV,
+    FORMAT_JSON
+};
+
+static enum bench_format format = FORMAT_CSV;
+static int rows_printed;
+
+static inline double now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void print_row(const struct bench_case *c, unsigned long long ops, double ns)
+{
+    double mops = ops / ns * 1e3;
+
+    if (format == FORMAT_CSV) {
+        if (!rows_printed)
+            printf("tree,workload,threads,keys,ops,mops_per_s\n");
+        printf("%s,%s,%u,%lu,%llu,%.3f\n",
+               tree_names[c->tree.type], c->workload->name, c->threads, c->keys, ops, mops);
+    } else {
+        printf("%s\n  {\"tree\": \"%s\", \"workload\": \"%s\", \"threads\": %u, \"keys\": %lu, "
+               "\"ops\": %llu, \"mops_per_s\": %.3f}",
+               rows_printed ? "," : "[",
+               tree_names[c->tree.type], c->workload->name, c->threads, c->keys, ops, mops);
+    }
+    rows_printed++;
+    fflush(stdout);
+}
+
+static void run_case(enum mt_tree type, const struct workload *workload, unsigned threads, unsigned long keys, unsigned duration_ms)
+{
+    struct bench_case c;
+    struct worker *workers = calloc(threads, sizeof(*workers));
+    struct timespec pause;
+    unsigned long long ops = 0;
+    unsigned long k, slot;
+    double start;
+    unsigned i;
+
+    if (!workers) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    memset(&c, 0, sizeof(c));
+    mt_init(&c.tree, type);
+    c.workload = workload;
+    c.keys = keys;
+    c.threads = threads;
+
+    /* every other key of each thread is present to begin with */
+    for (i = 0; i < threads; i++) {
+        struct worker *w = &workers[i];
+
+        w->c = &c;
+        w->id = i;
+        w->rng = seed + i;
+        w->owned_count = (keys + threads - 1 - i) / threads;
+        if (w->owned_count == 0)
+            w->owned_count = 1;
+        w->owned = calloc(w->owned_count, sizeof(*w->owned));
+        if (!w->owned) {
+            fprintf(stderr, "out of memory\n");
+            exit(1);
+        }
+        for (slot = 0; slot < w->owned_count; slot += 2) {
+            w->owned[slot] = new_item(&c.tree, slot * threads + i);
+            mt_insert(&c.tree, w->owned[slot]);
+        }
+    }
+
+    start = now_ns();
+    for (i = 0; i < threads; i++)
+        if (pthread_create(&workers[i].thread, NULL, worker_run, &workers[i])) {
+            fprintf(stderr, "cannot start thread %u\n", i);
+            exit(1);
+        }
+    pause.tv_sec = duration_ms / 1000;
+    pause.tv_nsec = (duration_ms % 1000) * 1000000L;
+    nanosleep(&pause, NULL);
+    __atomic_store_n(&c.stop, 1, __ATOMIC_RELAXED);
+    for (i = 0; i < threads; i++) {
+        pthread_join(workers[i].thread, NULL);
+        ops += workers[i].ops;
+    }
+    print_row(&c, ops, now_ns() - start);
+
+    /* single threaded again: no reader left */
+    for (i = 0; i < threads; i++) {
+        for (k = 0; k < workers[i].owned_count; k++)
+            if (workers[i].owned[k])
+                mt_remove(&c.tree, workers[i].owned[k]);
+        free(workers[i].owned);
+    }
+    anytree_epoch_destroy(&c.tree.epoch);
+    pthread_mutex_destroy(&c.tree.lock);
+    free(workers);
+}
+
+
+/*
+ * Driver
+ */
+static unsigned parse_list(const char *arg, const char *const *names, unsigned count)
+{
+    unsigned mask = 0, i;
+    char *copy = strdup(arg), *tok, *save = NULL;
+
+    for (tok = strtok_r(copy, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+        for (i = 0; i < count; i++)
+            if (strcmp(tok, names[i]) == 0)
+                break;
+        if (i == count) {
+            fprintf(stderr, "unknown name '%s'\n", tok);
+            exit(2);
+        }
+        mask |= 1u << i;
+    }
+    free(copy);
+    return mask;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-t trees] [-w workloads] [-T threads] [-m exp] [-d ms] "
+            "[-f csv|json] [-s seed]\n", prog);
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    const char *workload_names[WORKLOAD_COUNT];
+    unsigned trees = ~0u, loads = ~0u;
+    int max_threads = 64, exp = 5, duration_ms = 200;
+    unsigned long keys = 1;
+    int opt, i;
+    unsigned w, t, threads;
+
+    for (w = 0; w < WORKLOAD_COUNT; w++)
+        workload_names[w] = workloads[w].name;
+
+    while ((opt = getopt(argc, argv, "t:w:T:m:d:f:s:")) != -1) {
+        switch (opt) {
+        case 't': trees = parse_list(optarg, tree_names, TREE_COUNT); break;
+        case 'w': loads = parse_list(optarg, workload_names, WORKLOAD_COUNT); break;
+        case 'T': max_threads = atoi(optarg); break;
+        case 'm': exp = atoi(optarg); break;
+        case 'd': duration_ms = atoi(optarg); break;
+        case 'f':
+            if (strcmp(optarg, "csv") == 0)
+                format = FORMAT_CSV;
+            else if (strcmp(optarg, "json") == 0)
+                format = FORMAT_JSON;
+            else
+                usage(argv[0]);
+            break;
+        case 's': seed = strtoull(optarg, NULL, 0); break;
+        default: usage(argv[0]);
+        }
+    }
+    if (max_threads < 1 || exp < 1 || exp > 8 || duration_ms < 1)
+        usage(argv[0]);
+    for (i = 0; i < exp; i++)
+        keys *= 10;
+
+    for (w = 0; w < WORKLOAD_COUNT; w++) {
+        if (!(loads & (1u << w)))
+            continue;
+        for (t = 0; t < TREE_COUNT; t++) {
+            if (!(trees & (1u << t)))
+                continue;
+            for (threads = 1; threads <= (unsigned)max_threads; threads *= 2)
+                run_case(t, &workloads[w], threads, keys, duration_ms);
+        }
+    }
+    if (format == FORMAT_JSON)
+        printf("%s\n", rows_printed ? "\n]" : "[]");
+    return 0;
+}
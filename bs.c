@@ -1,11 +1,98 @@
 #include "bs.h"
 
+/* Tree back-pointer, see avl.c */
+#ifdef ANYTREE_NO_TREE_POINTER
+static inline void set_tree(struct bstree *tree, struct bstree_node *node)
+{
+    (void)tree;
+    (void)node;
+}
+
+static inline int in_tree(const struct bstree_node *node, const struct bstree *tree)
+{
+    (void)node;
+    (void)tree;
+    return 1;
+}
+#else
+static inline void set_tree(struct bstree *tree, struct bstree_node *node)
+{
+    node->tree = tree;
+}
+
+static inline int in_tree(const struct bstree_node *node, const struct bstree *tree)
+{
+    return node->tree == tree;
+}
+#endif
+
+
+#ifdef ANYTREE_COMPACT_NODES
+
+#define THREAD ((uintptr_t)1)
+
+static inline void INIT_NODE(struct bstree_node *node, struct bstree *tree)
+{
+    node->left = 0;
+    node->right = 0;
+    set_tree(tree, node);
+}
+
+static inline void set_left(struct bstree_node *l, struct bstree_node *n)
+{
+    n->left = (uintptr_t)l;
+}
+
+static inline void set_right(struct bstree_node *r, struct bstree_node *n)
+{
+    n->right = (uintptr_t)r;
+}
+
+static inline void set_prev(struct bstree_node *t, struct bstree_node *n)
+{
+    n->left = (uintptr_t)t | THREAD;
+}
+
+static inline void set_next(struct bstree_node *t, struct bstree_node *n)
+{
+    n->right = (uintptr_t)t | THREAD;
+}
+
+static inline struct bstree_node *get_left(const struct bstree_node *n)
+{
+    if (n->left & THREAD)
+        return NULL;
+    return (struct bstree_node *)n->left;
+}
+
+static inline struct bstree_node *get_right(const struct bstree_node *n)
+{
+    if (n->right & THREAD)
+        return NULL;
+    return (struct bstree_node *)n->right;
+}
+
+static inline struct bstree_node *get_prev(const struct bstree_node *n)
+{
+    if (!(n->left & THREAD))
+        return NULL;
+    return (struct bstree_node *)(n->left & ~THREAD);
+}
+
+static inline struct bstree_node *get_next(const struct bstree_node *n)
+{
+    if (!(n->right & THREAD))
+        return NULL;
+    return (struct bstree_node *)(n->right & ~THREAD);
+}
+
+#else
 
 static inline void INIT_NODE(struct bstree_node *node, struct bstree *tree)
 {
     node->left = NULL;
     node->right = NULL;
-    node->tree = tree;
+    set_tree(tree, node);
     node->left_is_thread = 0;
     node->right_is_thread = 0;
 }
@@ -62,6 +149,8 @@ static inline struct bstree_node *get_next(const struct bstree_node *n)
     return n->right;
 }
 
+#endif
+
 
 
 static inline struct bstree_node *get_first(struct bstree_node *node)
@@ -139,22 +228,154 @@ struct bstree_node *bstree_lookup(const struct bstree_node *key, const struct bs
     return do_lookup(key, tree, &parent, &is_left);
 }
 
-struct bstree_node *bstree_insert(struct bstree_node *node, struct bstree *tree)
+/*
+ * Bounded searches: a single descent remembering the closest node seen on
+ * the requested side of the key.
+ */
+static struct bstree_node *do_bound(const struct bstree_node *key, const struct bstree *tree, int after, int strict)
 {
-    struct bstree_node *key, *parent;
+    struct bstree_node *node = tree->root;
+    struct bstree_node *bound = NULL;
+
+    while (node) {
+        int res = tree->cmp_fn(node, key);
+        if (res == 0 && !strict)
+            return node;
+        if (after) {
+            if (res > 0) {
+                bound = node;
+                node = get_left(node);
+            } else
+                node = get_right(node);
+        } else {
+            if (res < 0) {
+                bound = node;
+                node = get_right(node);
+            } else
+                node = get_left(node);
+        }
+    }
+    return bound;
+}
+
+struct bstree_node *bstree_lower_bound(const struct bstree_node *key, const struct bstree *tree)
+{
+    return do_bound(key, tree, 1, 0);
+}
+
+struct bstree_node *bstree_upper_bound(const struct bstree_node *key, const struct bstree *tree)
+{
+    return do_bound(key, tree, 1, 1);
+}
+
+struct bstree_node *bstree_floor(const struct bstree_node *key, const struct bstree *tree)
+{
+    return do_bound(key, tree, 0, 0);
+}
+
+/* Range [lo, hi), see avltree_range() */
+struct bstree_node *bstree_range(const struct bstree_node *lo, const struct bstree_node *hi, const struct bstree *tree, struct bstree_node **end)
+{
+    *end = NULL;
+    if (!tree->root || (lo && hi && tree->cmp_fn(lo, hi) >= 0))
+        return NULL;
+
+    if (hi && tree->cmp_fn(tree->last, hi) >= 0)
+        *end = bstree_lower_bound(hi, tree);
+    if (!lo || tree->cmp_fn(tree->first, lo) >= 0)
+        return tree->first;
+    return bstree_lower_bound(lo, tree);
+}
+
+unsigned bstree_range_count(const struct bstree_node *lo, const struct bstree_node *hi, const struct bstree *tree)
+{
+    struct bstree_node *node, *end;
+    unsigned count = 0;
+
+    for (node = bstree_range(lo, hi, tree, &end); node != end; node = bstree_next(node))
+        count++;
+    return count;
+}
+
+/* Searches by key, cmp(key, node) orders a bare key against the nodes */
+static struct bstree_node *do_lookup_key(const void *key, bstree_key_cmp_fn_t cmp, const struct bstree *tree, struct bstree_node **pparent, int *is_left)
+{
+    struct bstree_node *node = tree->root;
+
+    *pparent = NULL;
+    *is_left = 0;
+
+    while (node) {
+        int res = cmp(key, node);
+        if (res == 0)
+            return node;
+        *pparent = node;
+        if ((*is_left = res < 0))
+            node = get_left(node);
+        else
+            node = get_right(node);
+    }
+    return NULL;
+}
+
+static struct bstree_node *do_bound_key(const void *key, bstree_key_cmp_fn_t cmp, const struct bstree *tree, int after, int strict)
+{
+    struct bstree_node *node = tree->root;
+    struct bstree_node *bound = NULL;
+
+    while (node) {
+        int res = cmp(key, node);
+        if (res == 0 && !strict)
+            return node;
+        if (after) {
+            if (res < 0) {
+                bound = node;
+                node = get_left(node);
+            } else
+                node = get_right(node);
+        } else {
+            if (res > 0) {
+                bound = node;
+                node = get_right(node);
+            } else
+                node = get_left(node);
+        }
+    }
+    return bound;
+}
+
+struct bstree_node *bstree_lookup_key(const void *key, bstree_key_cmp_fn_t cmp, const struct bstree *tree)
+{
+    struct bstree_node *parent;
     int is_left;
 
-    key = do_lookup(node, tree, &parent, &is_left);
-    if (key)
-        return key;
+    return do_lookup_key(key, cmp, tree, &parent, &is_left);
+}
 
+struct bstree_node *bstree_lower_bound_key(const void *key, bstree_key_cmp_fn_t cmp, const struct bstree *tree)
+{
+    return do_bound_key(key, cmp, tree, 1, 0);
+}
+
+struct bstree_node *bstree_upper_bound_key(const void *key, bstree_key_cmp_fn_t cmp, const struct bstree *tree)
+{
+    return do_bound_key(key, cmp, tree, 1, 1);
+}
+
+struct bstree_node *bstree_floor_key(const void *key, bstree_key_cmp_fn_t cmp, const struct bstree *tree)
+{
+    return do_bound_key(key, cmp, tree, 0, 0);
+}
+
+static void do_insert(struct bstree_node *node, struct bstree_node *parent, int is_left, struct bstree *tree)
+{
     ++tree->size;
 
     INIT_NODE(node, tree);
 
     if (!parent) {
         tree->root = tree->first = tree->last = node;
-        return NULL;
+        return;
     }
     if (is_left) {
         if (parent == tree->first)
@@ -169,9 +390,68 @@ struct bstree_node *bstree_insert(struct bstree_node *node, struct bstree *tree)
         set_next(get_next(parent), node);
         set_right(node, parent);
     }
+}
+
+struct bstree_node *bstree_insert(struct bstree_node *node, struct bstree *tree)
+{
+    struct bstree_node *key, *parent;
+    int is_left;
+
+    key = do_lookup(node, tree, &parent, &is_left);
+    if (key)
+        return key;
+
+    do_insert(node, parent, is_left, tree);
     return NULL;
 }
 
+/* Links 'node' at a free child slot of 'parent', see avl.c */
+void bstree_link(struct bstree_node *node, struct bstree_node *parent, int is_left, struct bstree *tree)
+{
+    do_insert(node, parent, is_left, tree);
+}
+
+/* Hinted insertion between two neighbours, see avl.c */
+static struct bstree_node *insert_between(struct bstree_node *node, struct bstree_node *prev, struct bstree_node *next, struct bstree *tree)
+{
+    int res;
+
+    if (prev) {
+        res = tree->cmp_fn(prev, node);
+        if (res == 0)
+            return prev;
+        if (res > 0)
+            return bstree_insert(node, tree);
+    }
+    if (next) {
+        res = tree->cmp_fn(next, node);
+        if (res == 0)
+            return next;
+        if (res < 0)
+            return bstree_insert(node, tree);
+    }
+
+    if (prev && !get_right(prev))
+        do_insert(node, prev, 0, tree);
+    else
+        do_insert(node, next, 1, tree);
+    return NULL;
+}
+
+struct bstree_node *bstree_insert_after(struct bstree_node *node, struct bstree_node *hint, struct bstree *tree)
+{
+    if (hint && !in_tree(hint, tree))
+        return bstree_insert(node, tree);
+    return insert_between(node, hint, hint ? bstree_next(hint) : bstree_first(tree), tree);
+}
+
+struct bstree_node *bstree_insert_before(struct bstree_node *node, struct bstree_node *hint, struct bstree *tree)
+{
+    if (hint && !in_tree(hint, tree))
+        return bstree_insert(node, tree);
+    return insert_between(node, hint ? bstree_prev(hint) : bstree_last(tree), hint, tree);
+}
+
 static void set_child(struct bstree_node *child, struct bstree_node *node, int left)
 {
     if (left)
@@ -180,19 +460,13 @@ static void set_child(struct bstree_node *child, struct bstree_node *node, int l
         set_right(child, node);
 }
 
-void bstree_remove(struct bstree_node *node, struct bstree *tree)
+static void do_remove(struct bstree_node *node, struct bstree_node *parent, int is_left, struct bstree *tree)
 {
     struct bstree_node *left, *right, *next;
-    struct bstree_node fake_parent, *parent;
-    int is_left;
-
-    if (tree && (node->tree != tree))
-        return;
+    struct bstree_node fake_parent;
 
     --tree->size;
 
-    do_lookup(node, tree, &parent, &is_left);
-
     if (!parent) {
         INIT_NODE(&fake_parent, tree);
         parent = &fake_parent;
@@ -249,6 +523,35 @@ update_first_last:
     goto out;
 }
 
+/* Unlinks 'node', the left (is_left) or right child of 'parent' */
+void bstree_unlink(struct bstree_node *node, struct bstree_node *parent, int is_left, struct bstree *tree)
+{
+    do_remove(node, parent, is_left, tree);
+}
+
+void bstree_remove(struct bstree_node *node, struct bstree *tree)
+{
+    struct bstree_node *parent;
+    int is_left;
+
+    if (tree && !in_tree(node, tree))
+        return;
+
+    do_lookup(node, tree, &parent, &is_left);
+    do_remove(node, parent, is_left, tree);
+}
+
+struct bstree_node *bstree_remove_key(const void *key, bstree_key_cmp_fn_t cmp, struct bstree *tree)
+{
+    struct bstree_node *node, *parent;
+    int is_left;
+
+    node = do_lookup_key(key, cmp, tree, &parent, &is_left);
+    if (node)
+        do_remove(node, parent, is_left, tree);
+    return node;
+}
+
 void bstree_replace(struct bstree_node *old, struct bstree_node *node, struct bstree *tree)
 {
     struct bstree_node *parent;
@@ -268,6 +571,45 @@ void bstree_replace(struct bstree_node *old, struct bstree_node *node, struct bs
     *node = *old;
 }
 
+/*
+ * Bulk build from nodes sorted in strictly ascending order, see avl.c.
+ * Missing children become threads to the neighbours of the subrange.
+ */
+static struct bstree_node *build_sorted(struct bstree_node **nodes, unsigned count, struct bstree_node *prev, struct bstree_node *next, struct bstree *tree)
+{
+    struct bstree_node *node, *left, *right;
+    unsigned mid = count / 2;
+
+    if (!count)
+        return NULL;
+    node = nodes[mid];
+    INIT_NODE(node, tree);
+
+    left = build_sorted(nodes, mid, prev, node, tree);
+    right = build_sorted(nodes + mid + 1, count - mid - 1, node, next, tree);
+    if (left)
+        set_left(left, node);
+    else
+        set_prev(prev, node);
+    if (right)
+        set_right(right, node);
+    else
+        set_next(next, node);
+    return node;
+}
+
+int bstree_build_sorted(struct bstree_node **nodes, unsigned count, struct bstree *tree)
+{
+    if (tree->size)
+        return -1;
+
+    tree->root = build_sorted(nodes, count, NULL, NULL, tree);
+    tree->size = count;
+    tree->first = count ? nodes[0] : NULL;
+    tree->last = count ? nodes[count - 1] : NULL;
+    return 0;
+}
+
 int bstree_init(struct bstree *tree, bstree_cmp_fn_t cmp)
 {
     tree->cmp_fn = cmp;
@@ -280,7 +622,7 @@ void bstree_clean(struct bstree *tree)
 {
     struct bstree_node *i;
     for (i = bstree_first(tree); i; i = bstree_next(i))
-        i->tree = NULL;
+        set_tree(NULL, i);
     bstree_init(tree, tree->cmp_fn);
 }
 
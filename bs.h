@@ -15,14 +15,32 @@
 
 struct bstree;
 
+#ifdef ANYTREE_COMPACT_NODES
+/* Child or thread links, the low bit is set for threads */
 struct bstree_node {
+#ifndef ANYTREE_NO_TREE_POINTER
     struct bstree *tree;
+#endif
+    uintptr_t left, right;
+};
+/* Children, NULL where the link is a thread */
+#  define bstree_left(NODE) ((NODE)->left & 1 ? NULL : (struct bstree_node *)(NODE)->left)
+#  define bstree_right(NODE) ((NODE)->right & 1 ? NULL : (struct bstree_node *)(NODE)->right)
+#else
+struct bstree_node {
+#ifndef ANYTREE_NO_TREE_POINTER
+    struct bstree *tree;
+#endif
     struct bstree_node *left, *right;
     unsigned left_is_thread:1;
     unsigned right_is_thread:1;
 };
+#  define bstree_left(NODE) ((NODE)->left_is_thread ? NULL : (NODE)->left)
+#  define bstree_right(NODE) ((NODE)->right_is_thread ? NULL : (NODE)->right)
+#endif
 
 typedef int (*bstree_cmp_fn_t)(const struct bstree_node *, const struct bstree_node *);
+typedef int (*bstree_key_cmp_fn_t)(const void *key, const struct bstree_node *);
 
 struct bstree {
     bstree_cmp_fn_t cmp_fn;
@@ -38,9 +56,28 @@ struct bstree_node *bstree_next(const struct bstree_node *node);
 struct bstree_node *bstree_prev(const struct bstree_node *node);
 
 struct bstree_node *bstree_lookup(const struct bstree_node *key, const struct bstree *tree);
+struct bstree_node *bstree_lower_bound(const struct bstree_node *key, const struct bstree *tree);
+struct bstree_node *bstree_upper_bound(const struct bstree_node *key, const struct bstree *tree);
+struct bstree_node *bstree_floor(const struct bstree_node *key, const struct bstree *tree);
+#define bstree_ceil(KEY, TREE) bstree_lower_bound(KEY, TREE)
+
+struct bstree_node *bstree_range(const struct bstree_node *lo, const struct bstree_node *hi, const struct bstree *tree, struct bstree_node **end);
+unsigned bstree_range_count(const struct bstree_node *lo, const struct bstree_node *hi, const struct bstree *tree);
+
+struct bstree_node *bstree_lookup_key(const void *key, bstree_key_cmp_fn_t cmp, const struct bstree *tree);
+struct bstree_node *bstree_lower_bound_key(const void *key, bstree_key_cmp_fn_t cmp, const struct bstree *tree);
+struct bstree_node *bstree_upper_bound_key(const void *key, bstree_key_cmp_fn_t cmp, const struct bstree *tree);
+struct bstree_node *bstree_floor_key(const void *key, bstree_key_cmp_fn_t cmp, const struct bstree *tree);
+struct bstree_node *bstree_remove_key(const void *key, bstree_key_cmp_fn_t cmp, struct bstree *tree);
 struct bstree_node *bstree_insert(struct bstree_node *node, struct bstree *tree);
+struct bstree_node *bstree_insert_after(struct bstree_node *node, struct bstree_node *hint, struct bstree *tree);
+struct bstree_node *bstree_insert_before(struct bstree_node *node, struct bstree_node *hint, struct bstree *tree);
+void bstree_link(struct bstree_node *node, struct bstree_node *parent, int is_left, struct bstree *tree);
+/* Unlinks 'node', the left (is_left) or right child of 'parent' or the root */
+void bstree_unlink(struct bstree_node *node, struct bstree_node *parent, int is_left, struct bstree *tree);
 void bstree_remove(struct bstree_node *node, struct bstree *tree);
 void bstree_replace(struct bstree_node *old, struct bstree_node *node, struct bstree *tree);
+int bstree_build_sorted(struct bstree_node **nodes, unsigned count, struct bstree *tree);
 
 #define bstree_is_empty(TREE) (TREE->size == 0)
 #define bstree_size(TREE) (TREE->size)
@@ -52,4 +89,99 @@ typedef void (*bstree_call_fn_t)(const struct bstree_node *);
 void bstree_foreach(struct bstree *tree, bstree_call_fn_t call);
 void bstree_foreach_backward(struct bstree *tree, bstree_call_fn_t call);
 
+/* Type-specialized front end with an inlined comparator, see avl.h */
+#define BSTREE_GENERATE(NAME, TYPE, FIELD, CMP)                                                     \
+static inline TYPE *NAME##_entry(const struct bstree_node *node)                                    \
+{                                                                                                   \
+    return node ? bstree_container_of(node, TYPE, FIELD) : NULL;                                    \
+}                                                                                                   \
+static inline TYPE *NAME##_first(const struct bstree *tree)                                         \
+{                                                                                                   \
+    return NAME##_entry(bstree_first(tree));                                                        \
+}                                                                                                   \
+static inline TYPE *NAME##_last(const struct bstree *tree)                                          \
+{                                                                                                   \
+    return NAME##_entry(bstree_last(tree));                                                         \
+}                                                                                                   \
+static inline TYPE *NAME##_next(const TYPE *elm)                                                    \
+{                                                                                                   \
+    return NAME##_entry(bstree_next(&elm->FIELD));                                                  \
+}                                                                                                   \
+static inline TYPE *NAME##_prev(const TYPE *elm)                                                    \
+{                                                                                                   \
+    return NAME##_entry(bstree_prev(&elm->FIELD));                                                  \
+}                                                                                                   \
+static inline TYPE *NAME##_lookup(const TYPE *key, const struct bstree *tree)                       \
+{                                                                                                   \
+    const struct bstree_node *node = tree->root;                                                    \
+    while (node) {                                                                                  \
+        int res = CMP(key, NAME##_entry(node));                                                     \
+        if (res == 0)                                                                               \
+            return NAME##_entry(node);                                                              \
+        node = res < 0 ? bstree_left(node) : bstree_right(node);                                    \
+    }                                                                                               \
+    return NULL;                                                                                    \
+}                                                                                                   \
+static inline TYPE *NAME##_bound(const TYPE *key, const struct bstree *tree, int after, int strict) \
+{                                                                                                   \
+    const struct bstree_node *node = tree->root, *bound = NULL;                                     \
+    while (node) {                                                                                  \
+        int res = CMP(key, NAME##_entry(node));                                                     \
+        if (res == 0 && !strict)                                                                    \
+            return NAME##_entry(node);                                                              \
+        if (after) {                                                                                \
+            if (res < 0) {                                                                          \
+                bound = node;                                                                       \
+                node = bstree_left(node);                                                           \
+            } else                                                                                  \
+                node = bstree_right(node);                                                          \
+        } else {                                                                                    \
+            if (res > 0) {                                                                          \
+                bound = node;                                                                       \
+                node = bstree_right(node);                                                          \
+            } else                                                                                  \
+                node = bstree_left(node);                                                           \
+        }                                                                                           \
+    }                                                                                               \
+    return NAME##_entry(bound);                                                                     \
+}                                                                                                   \
+static inline TYPE *NAME##_lower_bound(const TYPE *key, const struct bstree *tree)                  \
+{                                                                                                   \
+    return NAME##_bound(key, tree, 1, 0);                                                           \
+}                                                                                                   \
+static inline TYPE *NAME##_upper_bound(const TYPE *key, const struct bstree *tree)                  \
+{                                                                                                   \
+    return NAME##_bound(key, tree, 1, 1);                                                           \
+}                                                                                                   \
+static inline TYPE *NAME##_floor(const TYPE *key, const struct bstree *tree)                        \
+{                                                                                                   \
+    return NAME##_bound(key, tree, 0, 0);                                                           \
+}                                                                                                   \
+static inline TYPE *NAME##_insert(TYPE *elm, struct bstree *tree)                                   \
+{                                                                                                   \
+    struct bstree_node *node = tree->root, *parent = NULL;                                          \
+    int res = 0;                                                                                    \
+    while (node) {                                                                                  \
+        res = CMP(elm, NAME##_entry(node));                                                         \
+        if (res == 0)                                                                               \
+            return NAME##_entry(node);                                                              \
+        parent = node;                                                                              \
+        node = res < 0 ? bstree_left(node) : bstree_right(node);                                    \
+    }                                                                                               \
+    bstree_link(&elm->FIELD, parent, res < 0, tree);                                                \
+    return NULL;                                                                                    \
+}                                                                                                   \
+static inline void NAME##_remove(TYPE *elm, struct bstree *tree)                                    \
+{                                                                                                   \
+    struct bstree_node *node = tree->root, *parent = NULL;                                          \
+    int res, is_left = 0;                                                                           \
+    while (node && (res = CMP(elm, NAME##_entry(node))) != 0) {                                     \
+        parent = node;                                                                              \
+        is_left = res < 0;                                                                          \
+        node = is_left ? bstree_left(node) : bstree_right(node);                                    \
+    }                                                                                               \
+    if (node == &elm->FIELD)    /* absent, or an equal element that is not 'elm' */                 \
+        bstree_unlink(node, parent, is_left, tree);                                                 \
+}
+
 #endif 
\ No newline at end of file
@@ -0,0 +1,858 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "btree.h"
+
+
+#define CACHE_LINE 64
+#define MAX_HEIGHT 16       /* inner nodes have 8 children or more, this covers any unsigned size */
+
+#define LEAF_SLOTS ((BTREE_NODE_SIZE - 3 * sizeof(void *)) / sizeof(void *))
+#define LEAF_MIN (LEAF_SLOTS / 2)
+#define INNER_KEYS ((BTREE_NODE_SIZE - 2 * sizeof(void *)) / (2 * sizeof(void *)))
+#define INNER_MIN (INNER_KEYS / 2)
+
+struct btree_leaf {
+    unsigned count;
+    struct btree_leaf *prev, *next;
+    struct btree_node *slots[LEAF_SLOTS];
+};
+
+/* keys[i] is the first node under children[i + 1] */
+struct btree_inner {
+    unsigned count;                         /* keys, one less than children */
+    struct btree_node *keys[INNER_KEYS];
+    void *children[INNER_KEYS + 1];
+};
+
+typedef char btree_leaf_fits[sizeof(struct btree_leaf) <= BTREE_NODE_SIZE ? 1 : -1];
+typedef char btree_inner_fits[sizeof(struct btree_inner) <= BTREE_NODE_SIZE && INNER_MIN >= 2 ? 1 : -1];
+
+/* The inner nodes from the root down to a leaf, and the child taken in each */
+struct path {
+    struct btree_inner *nodes[MAX_HEIGHT];
+    unsigned index[MAX_HEIGHT];
+};
+
+#ifdef __GNUC__
+#  define prefetch(ADDR) __builtin_prefetch(ADDR)
+#else
+#  define prefetch(ADDR) ((void)(ADDR))
+#endif
+
+
+#ifdef ANYTREE_NO_TREE_POINTER
+static inline void set_tree(struct btree *tree, struct btree_node *node)
+{
+    (void)tree;
+    (void)node;
+}
+
+static inline int in_tree(const struct btree_node *node, const struct btree *tree)
+{
+    (void)node;
+    (void)tree;
+    return 1;
+}
+#else
+static inline void set_tree(struct btree *tree, struct btree_node *node)
+{
+    node->tree = tree;
+}
+
+static inline int in_tree(const struct btree_node *node, const struct btree *tree)
+{
+    return node->tree == tree;
+}
+#endif
+
+
+static void *alloc_block(struct btree *tree)
+{
+    void *mem;
+
+    if (tree->pool)
+        return anytree_pool_alloc_aligned(tree->pool, BTREE_NODE_SIZE);
+    if (posix_memalign(&mem, CACHE_LINE, BTREE_NODE_SIZE))
+        return NULL;
+    return mem;
+}
+
+static void free_block(struct btree *tree, void *block)
+{
+    if (tree->pool)
+        anytree_pool_free_aligned(tree->pool, block, BTREE_NODE_SIZE);
+    else
+        free(block);
+}
+
+/*
+ * Orders 'node' against the key: the tree comparator for a node key,
+ * otherwise the caller's key comparator with its sign flipped.
+ */
+static inline int order(const struct btree_node *node, const void *key, btree_key_cmp_fn_t cmp, const struct btree *tree)
+{
+    int res;
+
+    if (!cmp)
+        return tree->cmp_fn(node, (const struct btree_node *)key);
+    res = cmp(key, node);
+    return (res < 0) - (res > 0);
+}
+
+/*
+ * Number of keys ordered before 'key', or before or equal to it when
+ * 'strict'. The keys are the caller's nodes, out of the tree node's cache
+ * lines: they are all prefetched first so that the probes of the binary
+ * search do not miss one after the other.
+ */
+static unsigned search(struct btree_node *const *keys, unsigned count, const void *key, btree_key_cmp_fn_t cmp, const struct btree *tree, int strict)
+{
+    unsigned lo = 0, hi = count, mid, i;
+    int res;
+
+    for (i = 0; i < count; i++)
+        prefetch(keys[i]);
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        res = order(keys[mid], key, cmp, tree);
+        if (res < 0 || (strict && res == 0))
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/* The leaf that holds the key or would; the tree must not be empty */
+static struct btree_leaf *descend(const void *key, btree_key_cmp_fn_t cmp, const struct btree *tree, struct path *path)
+{
+    void *block = tree->root;
+    struct btree_inner *inner;
+    unsigned i;
+    int level;
+
+    for (level = 0; level < tree->height; level++) {
+        inner = (struct btree_inner *)block;
+        i = search(inner->keys, inner->count, key, cmp, tree, 1);
+        if (path) {
+            path->nodes[level] = inner;
+            path->index[level] = i;
+        }
+        block = inner->children[i];
+    }
+    return (struct btree_leaf *)block;
+}
+
+static unsigned slot_of(const struct btree_leaf *leaf, const struct btree_node *node)
+{
+    unsigned i = 0;
+
+    while (leaf->slots[i] != node)
+        i++;
+    return i;
+}
+
+/* The node at 'pos' in the leaf, or the one after the leaf past its end */
+static struct btree_node *node_at(const struct btree_leaf *leaf, unsigned pos)
+{
+    if (pos < leaf->count)
+        return leaf->slots[pos];
+    return leaf->next ? leaf->next->slots[0] : NULL;
+}
+
+static struct btree_node *node_before(const struct btree_leaf *leaf, unsigned pos)
+{
+    if (pos > 0)
+        return leaf->slots[pos - 1];
+    return leaf->prev ? leaf->prev->slots[leaf->prev->count - 1] : NULL;
+}
+
+static void *subtree_first(void *block, int height)
+{
+    while (height--)
+        block = ((struct btree_inner *)block)->children[0];
+    return ((struct btree_leaf *)block)->slots[0];
+}
+
+
+/*
+ * Navigation
+ */
+struct btree_node *btree_first(const struct btree *tree)
+{
+    return tree->first ? tree->first->slots[0] : NULL;
+}
+
+struct btree_node *btree_last(const struct btree *tree)
+{
+    return tree->last ? tree->last->slots[tree->last->count - 1] : NULL;
+}
+
+struct btree_node *btree_next(const struct btree_node *node)
+{
+    return node_at(node->leaf, slot_of(node->leaf, node) + 1);
+}
+
+struct btree_node *btree_prev(const struct btree_node *node)
+{
+    return node_before(node->leaf, slot_of(node->leaf, node));
+}
+
+
+/*
+ * Searches
+ */
+static struct btree_node *do_bound(const void *key, btree_key_cmp_fn_t cmp, const struct btree *tree, int strict)
+{
+    struct btree_leaf *leaf;
+
+    if (!tree->root)
+        return NULL;
+    leaf = descend(key, cmp, tree, NULL);
+    return node_at(leaf, search(leaf->slots, leaf->count, key, cmp, tree, strict));
+}
+
+static struct btree_node *do_lookup(const void *key, btree_key_cmp_fn_t cmp, const struct btree *tree)
+{
+    struct btree_node *node = do_bound(key, cmp, tree, 0);
+
+    if (node && order(node, key, cmp, tree) == 0)
+        return node;
+    return NULL;
+}
+
+static struct btree_node *do_floor(const void *key, btree_key_cmp_fn_t cmp, const struct btree *tree)
+{
+    struct btree_leaf *leaf;
+
+    if (!tree->root)
+        return NULL;
+    leaf = descend(key, cmp, tree, NULL);
+    return node_before(leaf, search(leaf->slots, leaf->count, key, cmp, tree, 1));
+}
+
+struct btree_node *btree_lookup(const struct btree_node *key, const struct btree *tree)
+{
+    return do_lookup(key, NULL, tree);
+}
+
+struct btree_node *btree_lower_bound(const struct btree_node *key, const struct btree *tree)
+{
+    return do_bound(key, NULL, tree, 0);
+}
+
+struct btree_node *btree_upper_bound(const struct btree_node *key, const struct btree *tree)
+{
+    return do_bound(key, NULL, tree, 1);
+}
+
+struct btree_node *btree_floor(const struct btree_node *key, const struct btree *tree)
+{
+    return do_floor(key, NULL, tree);
+}
+
+struct btree_node *btree_lookup_key(const void *key, btree_key_cmp_fn_t cmp, const struct btree *tree)
+{
+    return do_lookup(key, cmp, tree);
+}
+
+struct btree_node *btree_lower_bound_key(const void *key, btree_key_cmp_fn_t cmp, const struct btree *tree)
+{
+    return do_bound(key, cmp, tree, 0);
+}
+
+struct btree_node *btree_upper_bound_key(const void *key, btree_key_cmp_fn_t cmp, const struct btree *tree)
+{
+    return do_bound(key, cmp, tree, 1);
+}
+
+struct btree_node *btree_floor_key(const void *key, btree_key_cmp_fn_t cmp, const struct btree *tree)
+{
+    return do_floor(key, cmp, tree);
+}
+
+/* Range [lo, hi), see avltree_range() */
+struct btree_node *btree_range(const struct btree_node *lo, const struct btree_node *hi, const struct btree *tree, struct btree_node **end)
+{
+    *end = NULL;
+    if (!tree->root || (lo && hi && tree->cmp_fn(lo, hi) >= 0))
+        return NULL;
+
+    if (hi)
+        *end = btree_lower_bound(hi, tree);
+    if (!lo)
+        return btree_first(tree);
+    return btree_lower_bound(lo, tree);
+}
+
+/* Whole leaves in between are counted without being walked */
+unsigned btree_range_count(const struct btree_node *lo, const struct btree_node *hi, const struct btree *tree)
+{
+    struct btree_node *node, *end;
+    const struct btree_leaf *leaf;
+    unsigned count;
+
+    node = btree_range(lo, hi, tree, &end);
+    if (!node || node == end)
+        return 0;
+
+    leaf = node->leaf;
+    count = 0 - slot_of(leaf, node);
+    for (; leaf != (end ? end->leaf : NULL); leaf = leaf->next)
+        count += leaf->count;
+    if (end)
+        count += slot_of(leaf, end);
+    return count;
+}
+
+
+/*
+ * Insertion
+ */
+static void leaf_insert(struct btree_leaf *leaf, unsigned pos, struct btree_node *node)
+{
+    memmove(leaf->slots + pos + 1, leaf->slots + pos, (leaf->count - pos) * sizeof(leaf->slots[0]));
+    leaf->slots[pos] = node;
+    leaf->count++;
+    node->leaf = leaf;
+}
+
+static void leaf_move(struct btree_leaf *to, struct btree_node *const *slots, unsigned count)
+{
+    unsigned i;
+
+    memcpy(to->slots + to->count, slots, count * sizeof(slots[0]));
+    for (i = 0; i < count; i++)
+        to->slots[to->count + i]->leaf = to;
+    to->count += count;
+}
+
+static void inner_insert(struct btree_inner *inner, unsigned pos, struct btree_node *key, void *child)
+{
+    memmove(inner->keys + pos + 1, inner->keys + pos, (inner->count - pos) * sizeof(inner->keys[0]));
+    memmove(inner->children + pos + 2, inner->children + pos + 1, (inner->count - pos) * sizeof(inner->children[0]));
+    inner->keys[pos] = key;
+    inner->children[pos + 1] = child;
+    inner->count++;
+}
+
+/*
+ * Splits 'inner' around the new key and child, which go at 'pos': the
+ * middle key moves up into '*key' and the right half into 'right'.
+ */
+static void split_inner(struct btree_inner *inner, unsigned pos, struct btree_node **key, void **child, struct btree_inner *right)
+{
+    struct btree_node *keys[INNER_KEYS + 1];
+    void *children[INNER_KEYS + 2];
+    unsigned mid = (INNER_KEYS + 1) / 2;
+
+    memcpy(keys, inner->keys, pos * sizeof(keys[0]));
+    keys[pos] = *key;
+    memcpy(keys + pos + 1, inner->keys + pos, (INNER_KEYS - pos) * sizeof(keys[0]));
+    memcpy(children, inner->children, (pos + 1) * sizeof(children[0]));
+    children[pos + 1] = *child;
+    memcpy(children + pos + 2, inner->children + pos + 1, (INNER_KEYS - pos) * sizeof(children[0]));
+
+    inner->count = mid;
+    memcpy(inner->keys, keys, mid * sizeof(keys[0]));
+    memcpy(inner->children, children, (mid + 1) * sizeof(children[0]));
+    right->count = INNER_KEYS - mid;
+    memcpy(right->keys, keys + mid + 1, right->count * sizeof(keys[0]));
+    memcpy(right->children, children + mid + 1, (right->count + 1) * sizeof(children[0]));
+
+    *key = keys[mid];
+    *child = right;
+}
+
+/*
+ * Inserts into a full leaf: every block the splits will need is allocated
+ * up front, so that running out of memory leaves the tree as it was.
+ */
+static int split_insert(struct btree_node *node, struct btree_leaf *leaf, unsigned pos, const struct path *path, struct btree *tree)
+{
+    void *blocks[MAX_HEIGHT + 2];
+    struct btree_leaf *right;
+    struct btree_inner *root;
+    struct btree_node *key;
+    unsigned mid = (LEAF_SLOTS + 1) / 2;
+    int needed = 1, level, i;
+    void *child;
+
+    for (level = tree->height - 1; level >= 0 && path->nodes[level]->count == INNER_KEYS; level--)
+        needed++;
+    if (level < 0)
+        needed++;
+    for (i = 0; i < needed; i++) {
+        blocks[i] = alloc_block(tree);
+        if (!blocks[i]) {
+            while (i--)
+                free_block(tree, blocks[i]);
+            return -1;
+        }
+    }
+
+    right = (struct btree_leaf *)blocks[0];
+    right->count = 0;
+    if (pos < mid) {
+        leaf_move(right, leaf->slots + mid - 1, LEAF_SLOTS - mid + 1);
+        leaf->count = mid - 1;
+        leaf_insert(leaf, pos, node);
+    } else {
+        leaf_move(right, leaf->slots + mid, LEAF_SLOTS - mid);
+        leaf->count = mid;
+        leaf_insert(right, pos - mid, node);
+    }
+    right->prev = leaf;
+    right->next = leaf->next;
+    if (leaf->next)
+        leaf->next->prev = right;
+    else
+        tree->last = right;
+    leaf->next = right;
+
+    key = right->slots[0];
+    child = right;
+    for (level = tree->height - 1, i = 1; level >= 0; level--) {
+        if (path->nodes[level]->count < INNER_KEYS) {
+            inner_insert(path->nodes[level], path->index[level], key, child);
+            return 0;
+        }
+        split_inner(path->nodes[level], path->index[level], &key, &child, (struct btree_inner *)blocks[i++]);
+    }
+
+    root = (struct btree_inner *)blocks[i];
+    root->count = 1;
+    root->keys[0] = key;
+    root->children[0] = tree->root;
+    root->children[1] = child;
+    tree->root = root;
+    tree->height++;
+    return 0;
+}
+
+static struct btree_node *insert_first(struct btree_node *node, struct btree *tree)
+{
+    struct btree_leaf *leaf = (struct btree_leaf *)alloc_block(tree);
+
+    if (!leaf)
+        return node;
+    leaf->count = 0;
+    leaf->prev = leaf->next = NULL;
+    leaf_insert(leaf, 0, node);
+    tree->root = tree->first = tree->last = leaf;
+    return NULL;
+}
+
+struct btree_node *btree_insert(struct btree_node *node, struct btree *tree)
+{
+    struct btree_leaf *leaf;
+    struct path path;
+    unsigned pos;
+
+    if (!tree->root) {
+        if (insert_first(node, tree))
+            return node;
+    } else {
+        leaf = descend(node, NULL, tree, &path);
+        pos = search(leaf->slots, leaf->count, node, NULL, tree, 0);
+        if (pos < leaf->count && tree->cmp_fn(leaf->slots[pos], node) == 0)
+            return leaf->slots[pos];
+
+        if (leaf->count < LEAF_SLOTS)
+            leaf_insert(leaf, pos, node);
+        else if (split_insert(node, leaf, pos, &path, tree))
+            return node;
+    }
+    set_tree(tree, node);
+    tree->size++;
+    return NULL;
+}
+
+/*
+ * A node placed right after 'prev' never becomes the first of a leaf other
+ * than the first one, so no separator changes and, short of a split, no
+ * path is needed.
+ */
+static struct btree_node *insert_between(struct btree_node *node, struct btree_node *prev, struct btree_node *next, struct btree *tree)
+{
+    struct btree_leaf *leaf;
+    int res;
+
+    if (prev) {
+        res = tree->cmp_fn(prev, node);
+        if (res == 0)
+            return prev;
+        if (res > 0)
+            return btree_insert(node, tree);
+    }
+    if (next) {
+        res = tree->cmp_fn(next, node);
+        if (res == 0)
+            return next;
+        if (res < 0)
+            return btree_insert(node, tree);
+    }
+
+    leaf = prev ? prev->leaf : tree->first;
+    if (!leaf || leaf->count == LEAF_SLOTS)
+        return btree_insert(node, tree);
+    leaf_insert(leaf, prev ? slot_of(leaf, prev) + 1 : 0, node);
+    set_tree(tree, node);
+    tree->size++;
+    return NULL;
+}
+
+struct btree_node *btree_insert_after(struct btree_node *node, struct btree_node *hint, struct btree *tree)
+{
+    if (hint && !in_tree(hint, tree))
+        return btree_insert(node, tree);
+    return insert_between(node, hint, hint ? btree_next(hint) : btree_first(tree), tree);
+}
+
+struct btree_node *btree_insert_before(struct btree_node *node, struct btree_node *hint, struct btree *tree)
+{
+    if (hint && !in_tree(hint, tree))
+        return btree_insert(node, tree);
+    return insert_between(node, hint ? btree_prev(hint) : btree_last(tree), hint, tree);
+}
+
+
+/*
+ * Removal
+ */
+static void leaf_erase(struct btree_leaf *leaf, unsigned pos)
+{
+    leaf->count--;
+    memmove(leaf->slots + pos, leaf->slots + pos + 1, (leaf->count - pos) * sizeof(leaf->slots[0]));
+}
+
+/* Drops keys[pos] and children[pos + 1] */
+static void inner_erase(struct btree_inner *inner, unsigned pos)
+{
+    inner->count--;
+    memmove(inner->keys + pos, inner->keys + pos + 1, (inner->count - pos) * sizeof(inner->keys[0]));
+    memmove(inner->children + pos + 1, inner->children + pos + 2, (inner->count - pos) * sizeof(inner->children[0]));
+}
+
+/* Points the separator that is 'old', if any, at 'node' */
+static void replace_key(const struct path *path, const struct btree_node *old, struct btree_node *node, const struct btree *tree)
+{
+    int level;
+
+    for (level = 0; level < tree->height; level++) {
+        if (path->index[level] && path->nodes[level]->keys[path->index[level] - 1] == old) {
+            path->nodes[level]->keys[path->index[level] - 1] = node;
+            return;
+        }
+    }
+}
+
+/* Appends 'right' to 'left' and frees it */
+static void merge_leaves(struct btree_leaf *left, struct btree_leaf *right, struct btree *tree)
+{
+    leaf_move(left, right->slots, right->count);
+    left->next = right->next;
+    if (right->next)
+        right->next->prev = left;
+    else
+        tree->last = left;
+    free_block(tree, right);
+}
+
+static void merge_inner(struct btree_inner *left, struct btree_node *key, struct btree_inner *right, struct btree *tree)
+{
+    left->keys[left->count] = key;
+    memcpy(left->keys + left->count + 1, right->keys, right->count * sizeof(right->keys[0]));
+    memcpy(left->children + left->count + 1, right->children, (right->count + 1) * sizeof(right->children[0]));
+    left->count += right->count + 1;
+    free_block(tree, right);
+}
+
+/* Refills the inner nodes on the path from 'level' up, then shrinks the root */
+static void fix_inner(int level, const struct path *path, struct btree *tree)
+{
+    struct btree_inner *node, *parent, *left, *right;
+    unsigned i;
+
+    for (; level > 0; level--) {
+        node = path->nodes[level];
+        if (node->count >= INNER_MIN)
+            return;
+        parent = path->nodes[level - 1];
+        i = path->index[level - 1];
+        left = i > 0 ? (struct btree_inner *)parent->children[i - 1] : NULL;
+        right = i < parent->count ? (struct btree_inner *)parent->children[i + 1] : NULL;
+
+        if (left && left->count > INNER_MIN) {
+            memmove(node->keys + 1, node->keys, node->count * sizeof(node->keys[0]));
+            memmove(node->children + 1, node->children, (node->count + 1) * sizeof(node->children[0]));
+            node->keys[0] = parent->keys[i - 1];
+            node->children[0] = left->children[left->count];
+            node->count++;
+            parent->keys[i - 1] = left->keys[--left->count];
+            return;
+        }
+        if (right && right->count > INNER_MIN) {
+            node->keys[node->count] = parent->keys[i];
+            node->children[node->count + 1] = right->children[0];
+            node->count++;
+            parent->keys[i] = right->keys[0];
+            right->count--;
+            memmove(right->keys, right->keys + 1, right->count * sizeof(right->keys[0]));
+            memmove(right->children, right->children + 1, (right->count + 1) * sizeof(right->children[0]));
+            return;
+        }
+        if (left) {
+            merge_inner(left, parent->keys[i - 1], node, tree);
+            inner_erase(parent, i - 1);
+        } else {
+            merge_inner(node, parent->keys[i], right, tree);
+            inner_erase(parent, i);
+        }
+    }
+
+    node = path->nodes[0];
+    if (!node->count) {
+        tree->root = node->children[0];
+        tree->height--;
+        free_block(tree, node);
+    }
+}
+
+/* Refills a leaf that fell under half full from a sibling, or merges it */
+static void fix_leaf(struct btree_leaf *leaf, const struct path *path, struct btree *tree)
+{
+    int level = tree->height - 1;
+    struct btree_inner *parent = path->nodes[level];
+    unsigned i = path->index[level];
+    struct btree_leaf *left = i > 0 ? (struct btree_leaf *)parent->children[i - 1] : NULL;
+    struct btree_leaf *right = i < parent->count ? (struct btree_leaf *)parent->children[i + 1] : NULL;
+
+    if (left && left->count > LEAF_MIN) {
+        leaf_insert(leaf, 0, left->slots[--left->count]);
+        parent->keys[i - 1] = leaf->slots[0];
+        return;
+    }
+    if (right && right->count > LEAF_MIN) {
+        leaf_insert(leaf, leaf->count, right->slots[0]);
+        leaf_erase(right, 0);
+        parent->keys[i] = right->slots[0];
+        return;
+    }
+    if (left) {
+        merge_leaves(left, leaf, tree);
+        inner_erase(parent, i - 1);
+    } else {
+        merge_leaves(leaf, right, tree);
+        inner_erase(parent, i);
+    }
+    fix_inner(level, path, tree);
+}
+
+/*
+ * Most removals only close the gap in the leaf. The path from the root is
+ * needed when the node may be a separator, being first in its leaf, or
+ * when the leaf falls under half full.
+ */
+static void do_remove(struct btree_node *node, struct btree *tree)
+{
+    struct btree_leaf *leaf = node->leaf;
+    unsigned pos = slot_of(leaf, node);
+    struct path path;
+
+    --tree->size;
+
+    if (!tree->height || ((pos > 0 || leaf == tree->first) && leaf->count > LEAF_MIN)) {
+        leaf_erase(leaf, pos);
+        if (!leaf->count) {
+            free_block(tree, leaf);
+            tree->root = tree->first = tree->last = NULL;
+        }
+        return;
+    }
+
+    descend(node, NULL, tree, &path);
+    if (pos == 0)
+        replace_key(&path, node, node_at(leaf, 1), tree);
+    leaf_erase(leaf, pos);
+    if (leaf->count < LEAF_MIN)
+        fix_leaf(leaf, &path, tree);
+}
+
+void btree_remove(struct btree_node *node, struct btree *tree)
+{
+    if (tree && !in_tree(node, tree))
+        return;
+    do_remove(node, tree);
+}
+
+struct btree_node *btree_remove_key(const void *key, btree_key_cmp_fn_t cmp, struct btree *tree)
+{
+    struct btree_node *node = btree_lookup_key(key, cmp, tree);
+
+    if (node)
+        do_remove(node, tree);
+    return node;
+}
+
+void btree_replace(struct btree_node *old, struct btree_node *node, struct btree *tree)
+{
+    struct btree_leaf *leaf = old->leaf;
+    unsigned pos = slot_of(leaf, old);
+    struct path path;
+
+    leaf->slots[pos] = node;
+    node->leaf = leaf;
+    set_tree(tree, node);
+    if (pos == 0 && leaf != tree->first) {
+        descend(node, NULL, tree, &path);
+        replace_key(&path, old, node, tree);
+    }
+}
+
+
+/*
+ * Bulk loading: leaves are filled evenly, then each level of inner nodes
+ * over the one below, so every node is at least half full.
+ */
+static void free_blocks(void **blocks, unsigned count, struct btree *tree)
+{
+    while (count--)
+        free_block(tree, blocks[count]);
+    free(blocks);
+}
+
+int btree_build_sorted(struct btree_node **nodes, unsigned count, struct btree *tree)
+{
+    struct btree_leaf *leaf, *prev = NULL;
+    struct btree_inner *inner;
+    void **blocks;
+    unsigned total, n, groups, base, used, i, j, k, take;
+    int height = 0;
+
+    if (tree->size)
+        return -1;
+    if (!count)
+        return 0;
+
+    n = (count + LEAF_SLOTS - 1) / LEAF_SLOTS;
+    for (total = n; n > 1; total += n)
+        n = (n + INNER_KEYS) / (INNER_KEYS + 1);
+    blocks = (void **)malloc(total * sizeof(void *));
+    if (!blocks)
+        return -1;
+    for (i = 0; i < total; i++) {
+        blocks[i] = alloc_block(tree);
+        if (!blocks[i]) {
+            free_blocks(blocks, i, tree);
+            return -1;
+        }
+    }
+
+    n = (count + LEAF_SLOTS - 1) / LEAF_SLOTS;
+    for (j = 0, k = 0; j < n; j++) {
+        leaf = (struct btree_leaf *)blocks[j];
+        take = (count - k) / (n - j);
+        leaf->count = 0;
+        leaf_move(leaf, nodes + k, take);
+        for (i = 0; i < take; i++)
+            set_tree(tree, nodes[k + i]);
+        k += take;
+        leaf->prev = prev;
+        leaf->next = NULL;
+        if (prev)
+            prev->next = leaf;
+        prev = leaf;
+    }
+    tree->first = (struct btree_leaf *)blocks[0];
+    tree->last = prev;
+
+    for (base = 0, used = n; n > 1; base = used, used += groups, n = groups, height++) {
+        groups = (n + INNER_KEYS) / (INNER_KEYS + 1);
+        for (j = 0, k = 0; j < groups; j++) {
+            inner = (struct btree_inner *)blocks[used + j];
+            take = (n - k) / (groups - j);
+            inner->count = take - 1;
+            for (i = 0; i < take; i++) {
+                inner->children[i] = blocks[base + k + i];
+                if (i)
+                    inner->keys[i - 1] = (struct btree_node *)subtree_first(inner->children[i], height);
+            }
+            k += take;
+        }
+    }
+
+    tree->root = blocks[base];
+    tree->height = height;
+    tree->size = count;
+    free(blocks);
+    return 0;
+}
+
+
+int btree_init(struct btree *tree, btree_cmp_fn_t cmp)
+{
+    return btree_init_with_pool(tree, cmp, NULL);
+}
+
+int btree_init_with_pool(struct btree *tree, btree_cmp_fn_t cmp, struct anytree_pool *pool)
+{
+    tree->cmp_fn = cmp;
+    tree->size = 0;
+    tree->root = NULL;
+    tree->first = tree->last = NULL;
+    tree->height = 0;
+    tree->pool = pool;
+    return 0;
+}
+
+static void free_subtree(void *block, int height, struct btree *tree)
+{
+    struct btree_inner *inner = (struct btree_inner *)block;
+    unsigned i;
+
+    if (height)
+        for (i = 0; i <= inner->count; i++)
+            free_subtree(inner->children[i], height - 1, tree);
+    free_block(tree, block);
+}
+
+void btree_release(struct btree *tree)
+{
+    if (tree->root)
+        free_subtree(tree->root, tree->height, tree);
+    btree_init_with_pool(tree, tree->cmp_fn, tree->pool);
+}
+
+void btree_clean(struct btree *tree)
+{
+    struct btree_node *i;
+    for (i = btree_first(tree); i; i = btree_next(i))
+        set_tree(NULL, i);
+    btree_release(tree);
+}
+
+void btree_foreach(struct btree *tree, btree_call_fn_t call)
+{
+    struct btree_node * i;
+    struct btree_node * n;
+    for (i = btree_first(tree); i; )
+    {
+        n = btree_next(i);
+        call(i);
+        i = n;
+    }
+}
+
+void btree_foreach_backward(struct btree *tree, btree_call_fn_t call)
+{
+    struct btree_node * i;
+    struct btree_node * n;
+    for (i = btree_last(tree); i; )
+    {
+        n = btree_prev(i);
+        call(i);
+        i = n;
+    }
+}
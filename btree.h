@@ -0,0 +1,102 @@
+#ifndef ANYTREE__BTREE__INCLUDED
+#define ANYTREE__BTREE__INCLUDED
+
+#include <stddef.h>
+
+#include "pool.h"
+
+
+#ifdef __GNUC__
+#  define btree_container_of(node, type, member) ({      \
+    const struct btree_node *__mptr = (node);            \
+    (type *)( (char *)__mptr - offsetof(type,member) );})
+#else
+#  define btree_container_of(node, type, member)         \
+    ((type *)((char *)(node) - offsetof(type, member)))
+#endif
+
+
+/*
+ * B+tree holding pointers to the caller's nodes. Inner nodes and leaves
+ * are BTREE_NODE_SIZE bytes, cache line aligned: with the default of four
+ * lines an inner node has 16 children and a leaf 29 nodes (on 64-bit
+ * targets), so a lookup touches a handful of tree nodes instead of one
+ * caller node per level. The separators in inner nodes are the caller's
+ * nodes themselves, each the first node of the subtree on its right.
+ *
+ * The tree allocates its own nodes, from the pool given at init or with
+ * malloc(): btree_insert() returns 'node' itself when out of memory, and
+ * btree_release() frees them without touching the caller's nodes.
+ *
+ * The caller's node only points back at its leaf; next and prev find the
+ * node's slot by scanning that leaf, and leaves are chained both ways.
+ */
+#ifndef BTREE_NODE_SIZE
+#  define BTREE_NODE_SIZE 256
+#endif
+
+struct btree;
+struct btree_leaf;
+
+struct btree_node {
+#ifndef ANYTREE_NO_TREE_POINTER
+    struct btree *tree;
+#endif
+    struct btree_leaf *leaf;
+};
+
+typedef int (*btree_cmp_fn_t)(const struct btree_node *, const struct btree_node *);
+typedef int (*btree_key_cmp_fn_t)(const void *key, const struct btree_node *);
+
+struct btree {
+    btree_cmp_fn_t cmp_fn;
+    unsigned size;
+
+    void *root;                     /* a leaf when 'height' is 0 */
+    struct btree_leaf *first, *last;
+
+    int height;                     /* levels of inner nodes */
+    struct anytree_pool *pool;      /* the tree nodes' allocator, NULL for malloc */
+};
+
+struct btree_node *btree_first(const struct btree *tree);
+struct btree_node *btree_last(const struct btree *tree);
+struct btree_node *btree_next(const struct btree_node *node);
+struct btree_node *btree_prev(const struct btree_node *node);
+
+struct btree_node *btree_lookup(const struct btree_node *key, const struct btree *tree);
+struct btree_node *btree_lower_bound(const struct btree_node *key, const struct btree *tree);
+struct btree_node *btree_upper_bound(const struct btree_node *key, const struct btree *tree);
+struct btree_node *btree_floor(const struct btree_node *key, const struct btree *tree);
+#define btree_ceil(KEY, TREE) btree_lower_bound(KEY, TREE)
+
+struct btree_node *btree_range(const struct btree_node *lo, const struct btree_node *hi, const struct btree *tree, struct btree_node **end);
+unsigned btree_range_count(const struct btree_node *lo, const struct btree_node *hi, const struct btree *tree);
+
+struct btree_node *btree_lookup_key(const void *key, btree_key_cmp_fn_t cmp, const struct btree *tree);
+struct btree_node *btree_lower_bound_key(const void *key, btree_key_cmp_fn_t cmp, const struct btree *tree);
+struct btree_node *btree_upper_bound_key(const void *key, btree_key_cmp_fn_t cmp, const struct btree *tree);
+struct btree_node *btree_floor_key(const void *key, btree_key_cmp_fn_t cmp, const struct btree *tree);
+struct btree_node *btree_remove_key(const void *key, btree_key_cmp_fn_t cmp, struct btree *tree);
+/* Returns the equal node already in the tree, 'node' itself when out of memory, NULL once inserted */
+struct btree_node *btree_insert(struct btree_node *node, struct btree *tree);
+struct btree_node *btree_insert_after(struct btree_node *node, struct btree_node *hint, struct btree *tree);
+struct btree_node *btree_insert_before(struct btree_node *node, struct btree_node *hint, struct btree *tree);
+void btree_remove(struct btree_node *node, struct btree *tree);
+void btree_replace(struct btree_node *old, struct btree_node *node, struct btree *tree);
+int btree_build_sorted(struct btree_node **nodes, unsigned count, struct btree *tree);
+
+#define btree_is_empty(TREE) (TREE->size == 0)
+#define btree_size(TREE) (TREE->size)
+
+int btree_init(struct btree *tree, btree_cmp_fn_t cmp);
+int btree_init_with_pool(struct btree *tree, btree_cmp_fn_t cmp, struct anytree_pool *pool);
+void btree_clean(struct btree *tree);
+/* Frees the tree nodes only: the caller's nodes may already be gone */
+void btree_release(struct btree *tree);
+
+typedef void (*btree_call_fn_t)(const struct btree_node *);
+void btree_foreach(struct btree *tree, btree_call_fn_t call);
+void btree_foreach_backward(struct btree *tree, btree_call_fn_t call);
+
+#endif
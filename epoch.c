@@ -0,0 +1,136 @@
+#include <sched.h>
+#include <stdlib.h>
+
+#include "epoch.h"
+
+
+#define LOAD(P, ORDER) __atomic_load_n(P, ORDER)
+#define STORE(P, V, ORDER) __atomic_store_n(P, V, ORDER)
+
+void anytree_epoch_init(struct anytree_epoch *epoch)
+{
+    epoch->global = 0;
+    epoch->collecting = 0;
+    epoch->readers = NULL;
+    epoch->retired[0] = NULL;
+    epoch->retired[1] = NULL;
+    epoch->retired[2] = NULL;
+}
+
+static void free_list(struct anytree_epoch_entry *entry)
+{
+    struct anytree_epoch_entry *next;
+
+    for (; entry; entry = next) {
+        next = entry->next;
+        entry->free_fn(entry);
+    }
+}
+
+void anytree_epoch_destroy(struct anytree_epoch *epoch)
+{
+    struct anytree_epoch_reader *reader, *next;
+    int i;
+
+    for (i = 0; i < 3; i++)
+        free_list(__atomic_exchange_n(&epoch->retired[i], NULL, __ATOMIC_ACQUIRE));
+    for (reader = epoch->readers; reader; reader = next) {
+        next = reader->next;
+        free(reader);
+    }
+    anytree_epoch_init(epoch);
+}
+
+/* Slots are reused once unregistered and only freed with the epoch */
+struct anytree_epoch_reader *anytree_epoch_register(struct anytree_epoch *epoch)
+{
+    struct anytree_epoch_reader *reader;
+    void *mem;
+
+    for (reader = LOAD(&epoch->readers, __ATOMIC_ACQUIRE); reader; reader = reader->next) {
+        int unused = 0;
+
+        if (!LOAD(&reader->in_use, __ATOMIC_RELAXED) &&
+            __atomic_compare_exchange_n(&reader->in_use, &unused, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            return reader;
+    }
+
+    if (posix_memalign(&mem, ANYTREE_EPOCH_CACHE_LINE, sizeof(struct anytree_epoch_reader)))
+        return NULL;
+    reader = (struct anytree_epoch_reader *)mem;
+    reader->state = 0;
+    reader->in_use = 1;
+    reader->next = LOAD(&epoch->readers, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&epoch->readers, &reader->next, reader, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+        ;
+    return reader;
+}
+
+void anytree_epoch_unregister(struct anytree_epoch_reader *reader)
+{
+    STORE(&reader->state, 0, __ATOMIC_RELEASE);
+    STORE(&reader->in_use, 0, __ATOMIC_RELEASE);
+}
+
+void anytree_epoch_enter(struct anytree_epoch *epoch, struct anytree_epoch_reader *reader)
+{
+    unsigned long global = LOAD(&epoch->global, __ATOMIC_SEQ_CST);
+
+    STORE(&reader->state, global << 1 | 1, __ATOMIC_SEQ_CST);
+    /* the slot must be visible before any node is read */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+void anytree_epoch_exit(struct anytree_epoch_reader *reader)
+{
+    STORE(&reader->state, 0, __ATOMIC_RELEASE);
+}
+
+/*
+ * A retirer that read a stale epoch pushes onto a list freed later than
+ * needed, never earlier: the epoch cannot move two steps past one it has
+ * loaded while the entry is still reachable.
+ */
+void anytree_epoch_retire(struct anytree_epoch *epoch, struct anytree_epoch_entry *entry, anytree_epoch_free_fn_t free_fn)
+{
+    struct anytree_epoch_entry **head = &epoch->retired[LOAD(&epoch->global, __ATOMIC_SEQ_CST) % 3];
+
+    entry->free_fn = free_fn;
+    entry->next = LOAD(head, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(head, &entry->next, entry, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+        ;
+}
+
+int anytree_epoch_collect(struct anytree_epoch *epoch)
+{
+    struct anytree_epoch_reader *reader;
+    unsigned long global;
+
+    if (__atomic_exchange_n(&epoch->collecting, 1, __ATOMIC_ACQUIRE))
+        return 0;
+
+    global = LOAD(&epoch->global, __ATOMIC_SEQ_CST);
+    for (reader = LOAD(&epoch->readers, __ATOMIC_ACQUIRE); reader; reader = reader->next) {
+        unsigned long state = LOAD(&reader->state, __ATOMIC_SEQ_CST);
+
+        if ((state & 1) && (state >> 1) != global) {
+            STORE(&epoch->collecting, 0, __ATOMIC_RELEASE);
+            return 0;
+        }
+    }
+    STORE(&epoch->global, global + 1, __ATOMIC_SEQ_CST);
+
+    /* retired in global - 1, every reader that could see them has left */
+    free_list(__atomic_exchange_n(&epoch->retired[(global + 2) % 3], NULL, __ATOMIC_ACQUIRE));
+    STORE(&epoch->collecting, 0, __ATOMIC_RELEASE);
+    return 1;
+}
+
+void anytree_epoch_synchronize(struct anytree_epoch *epoch)
+{
+    unsigned long target = LOAD(&epoch->global, __ATOMIC_SEQ_CST) + 2;
+
+    while ((long)(LOAD(&epoch->global, __ATOMIC_SEQ_CST) - target) < 0)
+        if (!anytree_epoch_collect(epoch))
+            sched_yield();
+}
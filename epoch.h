@@ -0,0 +1,78 @@
+#ifndef ANYTREE__EPOCH__INCLUDED
+#define ANYTREE__EPOCH__INCLUDED
+
+#include <stddef.h>
+
+
+#ifdef __GNUC__
+#  define anytree_epoch_container_of(node, type, member) ({      \
+    const struct anytree_epoch_entry *__mptr = (node);           \
+    (type *)( (char *)__mptr - offsetof(type,member) );})
+#else
+#  define anytree_epoch_container_of(node, type, member)         \
+    ((type *)((char *)(node) - offsetof(type, member)))
+#endif
+
+
+/*
+ * Epoch based reclamation for the trees with lockless readers. A reader
+ * thread registers once and brackets each lookup, and its use of the nodes
+ * found, with anytree_epoch_enter() and anytree_epoch_exit(). A writer
+ * retires an unlinked node instead of freeing it; the node is handed to its
+ * free function once every reader that could still see it has left.
+ *
+ * The global epoch only advances when all readers inside a section have
+ * observed the current one, so a node retired in epoch e is freed once the
+ * epoch reaches e + 2. Readers only write their own slot.
+ */
+#define ANYTREE_EPOCH_CACHE_LINE 64
+
+struct anytree_epoch_entry;
+typedef void (*anytree_epoch_free_fn_t)(struct anytree_epoch_entry *entry);
+
+/* Embedded in the retired object, like the tree nodes */
+struct anytree_epoch_entry {
+    struct anytree_epoch_entry *next;
+    anytree_epoch_free_fn_t free_fn;
+};
+
+struct anytree_epoch_reader {
+    unsigned long state;        /* epoch << 1 | 1 inside a section, 0 outside */
+    int in_use;
+    struct anytree_epoch_reader *next;
+}
+#ifdef __GNUC__
+__attribute__((aligned(ANYTREE_EPOCH_CACHE_LINE)))
+#endif
+;
+
+struct anytree_epoch {
+    unsigned long global;
+    int collecting;
+    struct anytree_epoch_reader *readers;
+    struct anytree_epoch_entry *retired[3];     /* by epoch modulo 3 */
+};
+
+void anytree_epoch_init(struct anytree_epoch *epoch);
+/* Frees every retired entry; no reader may be inside a section */
+void anytree_epoch_destroy(struct anytree_epoch *epoch);
+
+/* Returns the calling thread's slot, NULL when out of memory */
+struct anytree_epoch_reader *anytree_epoch_register(struct anytree_epoch *epoch);
+void anytree_epoch_unregister(struct anytree_epoch_reader *reader);
+
+void anytree_epoch_enter(struct anytree_epoch *epoch, struct anytree_epoch_reader *reader);
+void anytree_epoch_exit(struct anytree_epoch_reader *reader);
+
+/* Safe to call from several threads, and from inside a section */
+void anytree_epoch_retire(struct anytree_epoch *epoch, struct anytree_epoch_entry *entry, anytree_epoch_free_fn_t free_fn);
+/*
+ * Advances the epoch if possible and frees what became unreachable.
+ * Returns non-zero when it advanced. Must not be called from inside a
+ * section, which would keep the epoch from advancing.
+ */
+int anytree_epoch_collect(struct anytree_epoch *epoch);
+/* Collects until everything retired before the call is freed */
+void anytree_epoch_synchronize(struct anytree_epoch *epoch);
+
+#endif
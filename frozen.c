@@ -0,0 +1,406 @@
+#include <stdlib.h>
+
+#include "frozen.h"
+
+
+#define CACHE_LINE 64
+#define SLOTS_PER_LINE (CACHE_LINE / sizeof(void *))
+
+#ifdef __GNUC__
+#  define prefetch(ADDR) __builtin_prefetch(ADDR)
+#else
+#  define prefetch(ADDR) ((void)(ADDR))
+#endif
+
+
+/*
+ * Slot arithmetic: the children of slot k are 2k and 2k + 1, so the slots
+ * d levels below k start at k << d and the parent is a right shift.
+ */
+
+/* Climbs past the right child links, then one left child link */
+static inline unsigned long up_from_right(unsigned long k)
+{
+#ifdef __GNUC__
+    return k >> __builtin_ffsl((long)~k);
+#else
+    while (k & 1)
+        k >>= 1;
+    return k >> 1;
+#endif
+}
+
+/* Climbs past the left child links, then one right child link */
+static inline unsigned long up_from_left(unsigned long k)
+{
+#ifdef __GNUC__
+    return k >> __builtin_ffsl((long)k);
+#else
+    while (!(k & 1))
+        k >>= 1;
+    return k >> 1;
+#endif
+}
+
+static unsigned long first_slot(unsigned long k, unsigned long n)
+{
+    while (2 * k <= n)
+        k = 2 * k;
+    return k;
+}
+
+static unsigned long last_slot(unsigned long k, unsigned long n)
+{
+    while (2 * k + 1 <= n)
+        k = 2 * k + 1;
+    return k;
+}
+
+static unsigned long next_slot(unsigned long k, unsigned long n)
+{
+    if (2 * k + 1 <= n)
+        return first_slot(2 * k + 1, n);
+    return up_from_right(k);
+}
+
+static unsigned long prev_slot(unsigned long k, unsigned long n)
+{
+    if (2 * k <= n)
+        return last_slot(2 * k, n);
+    return up_from_left(k);
+}
+
+static inline struct frozentree_node *at(unsigned long k, const struct frozentree *tree)
+{
+    return k ? tree->slots[k] : NULL;
+}
+
+
+/*
+ * Orders 'node' against the key: the tree comparator for a node key,
+ * otherwise the caller's key comparator with its sign flipped.
+ */
+static inline int order(const struct frozentree_node *node, const void *key, frozentree_key_cmp_fn_t cmp, const struct frozentree *tree)
+{
+    int res;
+
+    if (!cmp)
+        return tree->cmp_fn(node, (const struct frozentree_node *)key);
+    res = cmp(key, node);
+    return (res < 0) - (res > 0);
+}
+
+/*
+ * Both descents go right past every node ordered before the key, or before
+ * or equal to it when 'strict', and return the slot of the first node not
+ * passed, 0 if none. The outcome of a comparison only feeds arithmetic.
+ * The slots three levels down fill the cache line at slot 8k, which is
+ * prefetched at each step; the next level's caller nodes are prefetched
+ * too, their pointers being in lines fetched earlier.
+ */
+static unsigned long descend(const void *key, frozentree_key_cmp_fn_t cmp, const struct frozentree *tree, int strict)
+{
+    struct frozentree_node *const *slots = tree->slots;
+    unsigned long k = 1, n = tree->size;
+
+    while (k <= n) {
+        prefetch(slots + SLOTS_PER_LINE * k);
+        if (2 * k < n) {
+            prefetch(slots[2 * k]);
+            prefetch(slots[2 * k + 1]);
+        }
+        k = 2 * k + (order(slots[k], key, cmp, tree) < strict);
+    }
+    return up_from_right(k);
+}
+
+static unsigned long descend_keyed(uint64_t key, const struct frozentree *tree, int strict)
+{
+    const uint64_t *keys = tree->keys;
+    unsigned long k = 1, n = tree->size;
+
+    while (k <= n) {
+        prefetch(keys + CACHE_LINE / sizeof(keys[0]) * k);
+        k = 2 * k + ((keys[k] < key) | (strict & (keys[k] == key)));
+    }
+    return up_from_right(k);
+}
+
+static unsigned long bound_slot(const struct frozentree_node *key, const struct frozentree *tree, int strict)
+{
+    if (tree->keys)
+        return descend_keyed(tree->key_fn(key), tree, strict);
+    return descend(key, NULL, tree, strict);
+}
+
+
+/*
+ * Navigation
+ */
+struct frozentree_node *frozentree_first(const struct frozentree *tree)
+{
+    return tree->size ? tree->slots[first_slot(1, tree->size)] : NULL;
+}
+
+struct frozentree_node *frozentree_last(const struct frozentree *tree)
+{
+    return tree->size ? tree->slots[last_slot(1, tree->size)] : NULL;
+}
+
+struct frozentree_node *frozentree_next(const struct frozentree_node *node)
+{
+    return at(next_slot(node->slot, node->tree->size), node->tree);
+}
+
+struct frozentree_node *frozentree_prev(const struct frozentree_node *node)
+{
+    return at(prev_slot(node->slot, node->tree->size), node->tree);
+}
+
+
+/*
+ * Searches
+ */
+struct frozentree_node *frozentree_lookup(const struct frozentree_node *key, const struct frozentree *tree)
+{
+    unsigned long k;
+    uint64_t ikey;
+
+    if (tree->keys) {
+        ikey = tree->key_fn(key);
+        k = descend_keyed(ikey, tree, 0);
+        return k && tree->keys[k] == ikey ? tree->slots[k] : NULL;
+    }
+    k = descend(key, NULL, tree, 0);
+    return k && tree->cmp_fn(tree->slots[k], key) == 0 ? tree->slots[k] : NULL;
+}
+
+struct frozentree_node *frozentree_lower_bound(const struct frozentree_node *key, const struct frozentree *tree)
+{
+    return at(bound_slot(key, tree, 0), tree);
+}
+
+struct frozentree_node *frozentree_upper_bound(const struct frozentree_node *key, const struct frozentree *tree)
+{
+    return at(bound_slot(key, tree, 1), tree);
+}
+
+/* The node before the upper bound, the last one if there is no bound */
+static struct frozentree_node *floor_of(unsigned long k, const struct frozentree *tree)
+{
+    if (!tree->size)
+        return NULL;
+    return at(k ? prev_slot(k, tree->size) : last_slot(1, tree->size), tree);
+}
+
+struct frozentree_node *frozentree_floor(const struct frozentree_node *key, const struct frozentree *tree)
+{
+    return floor_of(bound_slot(key, tree, 1), tree);
+}
+
+struct frozentree_node *frozentree_lookup_key(const void *key, frozentree_key_cmp_fn_t cmp, const struct frozentree *tree)
+{
+    unsigned long k = descend(key, cmp, tree, 0);
+
+    if (k && cmp(key, tree->slots[k]) == 0)
+        return tree->slots[k];
+    return NULL;
+}
+
+struct frozentree_node *frozentree_lower_bound_key(const void *key, frozentree_key_cmp_fn_t cmp, const struct frozentree *tree)
+{
+    return at(descend(key, cmp, tree, 0), tree);
+}
+
+struct frozentree_node *frozentree_upper_bound_key(const void *key, frozentree_key_cmp_fn_t cmp, const struct frozentree *tree)
+{
+    return at(descend(key, cmp, tree, 1), tree);
+}
+
+struct frozentree_node *frozentree_floor_key(const void *key, frozentree_key_cmp_fn_t cmp, const struct frozentree *tree)
+{
+    return floor_of(descend(key, cmp, tree, 1), tree);
+}
+
+/* Range [lo, hi), see avltree_range() */
+struct frozentree_node *frozentree_range(const struct frozentree_node *lo, const struct frozentree_node *hi, const struct frozentree *tree, struct frozentree_node **end)
+{
+    *end = NULL;
+    if (!tree->size || (lo && hi && tree->cmp_fn(lo, hi) >= 0))
+        return NULL;
+
+    if (hi)
+        *end = frozentree_lower_bound(hi, tree);
+    if (!lo)
+        return frozentree_first(tree);
+    return frozentree_lower_bound(lo, tree);
+}
+
+unsigned frozentree_range_count(const struct frozentree_node *lo, const struct frozentree_node *hi, const struct frozentree *tree)
+{
+    struct frozentree_node *node, *end;
+    unsigned count = 0;
+
+    for (node = frozentree_range(lo, hi, tree, &end); node && node != end; node = frozentree_next(node))
+        count++;
+    return count;
+}
+
+
+/*
+ * Updates: the tree is read-only, apart from swapping equal nodes
+ */
+struct frozentree_node *frozentree_remove_key(const void *key, frozentree_key_cmp_fn_t cmp, struct frozentree *tree)
+{
+    (void)key;
+    (void)cmp;
+    (void)tree;
+    return NULL;
+}
+
+struct frozentree_node *frozentree_insert(struct frozentree_node *node, struct frozentree *tree)
+{
+    (void)tree;
+    return node;
+}
+
+struct frozentree_node *frozentree_insert_after(struct frozentree_node *node, struct frozentree_node *hint, struct frozentree *tree)
+{
+    (void)hint;
+    (void)tree;
+    return node;
+}
+
+struct frozentree_node *frozentree_insert_before(struct frozentree_node *node, struct frozentree_node *hint, struct frozentree *tree)
+{
+    (void)hint;
+    (void)tree;
+    return node;
+}
+
+void frozentree_remove(struct frozentree_node *node, struct frozentree *tree)
+{
+    (void)node;
+    (void)tree;
+}
+
+void frozentree_replace(struct frozentree_node *old, struct frozentree_node *node, struct frozentree *tree)
+{
+    node->tree = tree;
+    node->slot = old->slot;
+    tree->slots[node->slot] = node;
+}
+
+/*
+ * Walking the slots in order places the sorted nodes: no recursion, and
+ * the in-order walk is linear overall.
+ */
+int frozentree_build_sorted(struct frozentree_node **nodes, unsigned count, struct frozentree *tree)
+{
+    struct frozentree_node **slots;
+    uint64_t *keys = NULL;
+    void *mem;
+    unsigned long k;
+    unsigned i;
+
+    if (tree->size)
+        return -1;
+    if (!count)
+        return 0;
+
+    if (posix_memalign(&mem, CACHE_LINE, (count + 1UL) * sizeof(slots[0])))
+        return -1;
+    slots = (struct frozentree_node **)mem;
+    if (tree->key_fn) {
+        if (posix_memalign(&mem, CACHE_LINE, (count + 1UL) * sizeof(keys[0]))) {
+            free(slots);
+            return -1;
+        }
+        keys = (uint64_t *)mem;
+    }
+
+    for (i = 0, k = first_slot(1, count); i < count; i++, k = next_slot(k, count)) {
+        slots[k] = nodes[i];
+        if (keys)
+            keys[k] = tree->key_fn(nodes[i]);
+        nodes[i]->tree = tree;
+        nodes[i]->slot = k;
+    }
+    tree->slots = slots;
+    tree->keys = keys;
+    tree->size = count;
+    return 0;
+}
+
+int frozentree_freeze(struct frozentree *tree, struct frozentree_node *first, frozentree_next_fn_t next, unsigned count)
+{
+    struct frozentree_node **nodes, *node;
+    unsigned i = 0;
+    int res;
+
+    if (tree->size)
+        return -1;
+    nodes = (struct frozentree_node **)malloc((count + 1UL) * sizeof(nodes[0]));
+    if (!nodes)
+        return -1;
+    for (node = first; node && i < count; node = next(node))
+        nodes[i++] = node;
+    res = frozentree_build_sorted(nodes, i, tree);
+    free(nodes);
+    return res;
+}
+
+
+int frozentree_init(struct frozentree *tree, frozentree_cmp_fn_t cmp)
+{
+    return frozentree_init_keyed(tree, cmp, NULL);
+}
+
+int frozentree_init_keyed(struct frozentree *tree, frozentree_cmp_fn_t cmp, frozentree_key_fn_t key)
+{
+    tree->cmp_fn = cmp;
+    tree->size = 0;
+    tree->slots = NULL;
+    tree->keys = NULL;
+    tree->key_fn = key;
+    return 0;
+}
+
+void frozentree_release(struct frozentree *tree)
+{
+    free(tree->slots);
+    free(tree->keys);
+    frozentree_init_keyed(tree, tree->cmp_fn, tree->key_fn);
+}
+
+void frozentree_clean(struct frozentree *tree)
+{
+    unsigned long k;
+    for (k = 1; k <= tree->size; k++)
+        tree->slots[k]->tree = NULL;
+    frozentree_release(tree);
+}
+
+void frozentree_foreach(struct frozentree *tree, frozentree_call_fn_t call)
+{
+    struct frozentree_node * i;
+    struct frozentree_node * n;
+    for (i = frozentree_first(tree); i; )
+    {
+        n = frozentree_next(i);
+        call(i);
+        i = n;
+    }
+}
+
+void frozentree_foreach_backward(struct frozentree *tree, frozentree_call_fn_t call)
+{
+    struct frozentree_node * i;
+    struct frozentree_node * n;
+    for (i = frozentree_last(tree); i; )
+    {
+        n = frozentree_prev(i);
+        call(i);
+        i = n;
+    }
+}
@@ -0,0 +1,114 @@
+#ifndef ANYTREE__FROZEN__INCLUDED
+#define ANYTREE__FROZEN__INCLUDED
+
+#include <stdint.h>
+#include <stddef.h>
+
+
+#ifdef __GNUC__
+#  define frozentree_container_of(node, type, member) ({      \
+    const struct frozentree_node *__mptr = (node);            \
+    (type *)( (char *)__mptr - offsetof(type,member) );})
+#else
+#  define frozentree_container_of(node, type, member)         \
+    ((type *)((char *)(node) - offsetof(type, member)))
+#endif
+
+
+/*
+ * Read-only snapshot of a sorted set: the node pointers are laid out in
+ * Eytzinger (breadth-first) order in one cache line aligned array, where
+ * the children of slot k are 2k and 2k + 1. A search goes down without
+ * branching on the comparisons, and since the slots three levels further
+ * down share a cache line, it prefetches that line at each step and the
+ * caller's nodes of the next level: successive misses overlap instead of
+ * following each other.
+ *
+ * With a key function, which maps each node to an integer ordered as the
+ * comparator orders the nodes, the keys are cached in a second array and
+ * node lookups do not call the comparator nor read the caller's nodes.
+ *
+ * The tree is filled once, by frozentree_build_sorted() or by freezing
+ * another tree, and is then immutable: insert returns 'node' itself and
+ * remove does nothing. Only replace, by an equal node, is allowed.
+ *
+ * As in the skip list, the tree back-pointer is kept in every layout: next
+ * and prev need the array.
+ */
+struct frozentree;
+
+struct frozentree_node {
+    struct frozentree *tree;
+    unsigned slot;
+};
+
+typedef int (*frozentree_cmp_fn_t)(const struct frozentree_node *, const struct frozentree_node *);
+typedef int (*frozentree_key_cmp_fn_t)(const void *key, const struct frozentree_node *);
+typedef uint64_t (*frozentree_key_fn_t)(const struct frozentree_node *);
+typedef struct frozentree_node * (*frozentree_next_fn_t)(const struct frozentree_node *);
+
+struct frozentree {
+    frozentree_cmp_fn_t cmp_fn;
+    unsigned size;
+
+    struct frozentree_node **slots;     /* slots[1] is the root, slots[0] is unused */
+    uint64_t *keys;                     /* the cached keys, in the same order */
+    frozentree_key_fn_t key_fn;
+};
+
+struct frozentree_node *frozentree_first(const struct frozentree *tree);
+struct frozentree_node *frozentree_last(const struct frozentree *tree);
+struct frozentree_node *frozentree_next(const struct frozentree_node *node);
+struct frozentree_node *frozentree_prev(const struct frozentree_node *node);
+
+struct frozentree_node *frozentree_lookup(const struct frozentree_node *key, const struct frozentree *tree);
+struct frozentree_node *frozentree_lower_bound(const struct frozentree_node *key, const struct frozentree *tree);
+struct frozentree_node *frozentree_upper_bound(const struct frozentree_node *key, const struct frozentree *tree);
+struct frozentree_node *frozentree_floor(const struct frozentree_node *key, const struct frozentree *tree);
+#define frozentree_ceil(KEY, TREE) frozentree_lower_bound(KEY, TREE)
+
+struct frozentree_node *frozentree_range(const struct frozentree_node *lo, const struct frozentree_node *hi, const struct frozentree *tree, struct frozentree_node **end);
+unsigned frozentree_range_count(const struct frozentree_node *lo, const struct frozentree_node *hi, const struct frozentree *tree);
+
+struct frozentree_node *frozentree_lookup_key(const void *key, frozentree_key_cmp_fn_t cmp, const struct frozentree *tree);
+struct frozentree_node *frozentree_lower_bound_key(const void *key, frozentree_key_cmp_fn_t cmp, const struct frozentree *tree);
+struct frozentree_node *frozentree_upper_bound_key(const void *key, frozentree_key_cmp_fn_t cmp, const struct frozentree *tree);
+struct frozentree_node *frozentree_floor_key(const void *key, frozentree_key_cmp_fn_t cmp, const struct frozentree *tree);
+/* The tree is read-only: these change nothing */
+struct frozentree_node *frozentree_remove_key(const void *key, frozentree_key_cmp_fn_t cmp, struct frozentree *tree);
+struct frozentree_node *frozentree_insert(struct frozentree_node *node, struct frozentree *tree);
+struct frozentree_node *frozentree_insert_after(struct frozentree_node *node, struct frozentree_node *hint, struct frozentree *tree);
+struct frozentree_node *frozentree_insert_before(struct frozentree_node *node, struct frozentree_node *hint, struct frozentree *tree);
+void frozentree_remove(struct frozentree_node *node, struct frozentree *tree);
+void frozentree_replace(struct frozentree_node *old, struct frozentree_node *node, struct frozentree *tree);
+int frozentree_build_sorted(struct frozentree_node **nodes, unsigned count, struct frozentree *tree);
+
+/*
+ * Takes over the 'count' nodes of another tree, walked from 'first' with
+ * 'next': each frozentree_node overlays the start of the tree's own node,
+ * whose links are overwritten, so that tree must not be used afterwards.
+ * frozentree_freeze_tree(&snapshot, avltree, &tree) freezes an avltree,
+ * and the same goes for the other types with a first/next pair whose
+ * node is at least as large. That leaves out btree_node and inttree_node
+ * without the tree pointer, 8 bytes each: frozentree_freeze_tree() does
+ * not compile for them.
+ */
+int frozentree_freeze(struct frozentree *tree, struct frozentree_node *first, frozentree_next_fn_t next, unsigned count);
+#define frozentree_freeze_tree(SNAPSHOT, PREFIX, TREE) \
+    ((void)sizeof(char[sizeof(struct PREFIX##_node) >= sizeof(struct frozentree_node) ? 1 : -1]), \
+     frozentree_freeze(SNAPSHOT, (struct frozentree_node *)PREFIX##_first(TREE), (frozentree_next_fn_t)PREFIX##_next, (TREE)->size))
+
+#define frozentree_is_empty(TREE) (TREE->size == 0)
+#define frozentree_size(TREE) (TREE->size)
+
+int frozentree_init(struct frozentree *tree, frozentree_cmp_fn_t cmp);
+int frozentree_init_keyed(struct frozentree *tree, frozentree_cmp_fn_t cmp, frozentree_key_fn_t key);
+void frozentree_clean(struct frozentree *tree);
+/* Frees the arrays only: the caller's nodes may already be gone */
+void frozentree_release(struct frozentree *tree);
+
+typedef void (*frozentree_call_fn_t)(const struct frozentree_node *);
+void frozentree_foreach(struct frozentree *tree, frozentree_call_fn_t call);
+void frozentree_foreach_backward(struct frozentree *tree, frozentree_call_fn_t call);
+
+#endif
@@ -0,0 +1,170 @@
+#include "interval.h"
+
+static inline struct intervaltree_node *get_interval(const struct rbtree_node *node)
+{
+    return node ? rbtree_container_of(node, struct intervaltree_node, node) : NULL;
+}
+
+static inline int compute_max_last(struct intervaltree_node *node, int exit)
+{
+    intervaltree_key_t max = node->last;
+    struct intervaltree_node *child;
+
+    if ((child = get_interval(node->node.left)) && child->max_last > max)
+        max = child->max_last;
+    if ((child = get_interval(node->node.right)) && child->max_last > max)
+        max = child->max_last;
+    if (exit && node->max_last == max)
+        return 1;
+    node->max_last = max;
+    return 0;
+}
+
+RBTREE_AUGMENT_CALLBACKS(max_last_callbacks, struct intervaltree_node, node, max_last, compute_max_last);
+
+static int interval_cmp(const struct rbtree_node *a, const struct rbtree_node *b)
+{
+    const struct intervaltree_node *p = get_interval(a);
+    const struct intervaltree_node *q = get_interval(b);
+
+    if (p->start != q->start)
+        return p->start < q->start ? -1 : 1;
+    if (p->last != q->last)
+        return p->last < q->last ? -1 : 1;
+    return 0;
+}
+
+struct intervaltree_node *intervaltree_first(const struct intervaltree *tree)
+{
+    return get_interval(rbtree_first(&tree->rb));
+}
+
+struct intervaltree_node *intervaltree_last(const struct intervaltree *tree)
+{
+    return get_interval(rbtree_last(&tree->rb));
+}
+
+struct intervaltree_node *intervaltree_next(const struct intervaltree_node *node)
+{
+    return get_interval(rbtree_next(&node->node));
+}
+
+struct intervaltree_node *intervaltree_prev(const struct intervaltree_node *node)
+{
+    return get_interval(rbtree_prev(&node->node));
+}
+
+/* Equal intervals are the same key: the one already in the tree is returned */
+struct intervaltree_node *intervaltree_insert(struct intervaltree_node *node, struct intervaltree *tree)
+{
+    return get_interval(rbtree_insert(&node->node, &tree->rb));
+}
+
+void intervaltree_remove(struct intervaltree_node *node, struct intervaltree *tree)
+{
+    rbtree_remove(&node->node, &tree->rb);
+}
+
+/*
+ * Leftmost interval of the subtree overlapping [start, last]. Only subtrees
+ * whose max_last reaches start are entered, and everything right of a node
+ * starting after last is skipped.
+ */
+static struct intervaltree_node *subtree_overlap(struct intervaltree_node *node, intervaltree_key_t start, intervaltree_key_t last)
+{
+    struct intervaltree_node *child;
+
+    for (;;) {
+        child = get_interval(node->node.left);
+        if (child && child->max_last >= start) {
+            node = child;
+            continue;
+        }
+        if (node->start > last)
+            return NULL;
+        if (node->last >= start)
+            return node;
+        child = get_interval(node->node.right);
+        if (!child || child->max_last < start)
+            return NULL;
+        node = child;
+    }
+}
+
+/*
+ * The first overlap costs O(log n). Overlaps starting inside [start, last]
+ * are consecutive in order and cost O(1) each on average; the walk to
+ * overlaps starting before 'start' only enters subtrees that hold one.
+ */
+struct intervaltree_node *intervaltree_overlap_first(intervaltree_key_t start, intervaltree_key_t last, const struct intervaltree *tree)
+{
+    struct intervaltree_node *root = get_interval(tree->rb.root);
+
+    if (!root || root->max_last < start || start > last)
+        return NULL;
+    if (get_interval(tree->rb.first)->start > last)
+        return NULL;
+    return subtree_overlap(root, start, last);
+}
+
+struct intervaltree_node *intervaltree_overlap_next(const struct intervaltree_node *node, intervaltree_key_t start, intervaltree_key_t last)
+{
+    struct intervaltree_node *right, *parent;
+
+    for (;;) {
+        right = get_interval(node->node.right);
+        if (right && right->max_last >= start)
+            return subtree_overlap(right, start, last);
+
+        /* climb until coming up from a left child */
+        do {
+            parent = get_interval(rbtree_parent(&node->node));
+            if (!parent)
+                return NULL;
+            right = get_interval(parent->node.right);
+            if (right != node)
+                break;
+            node = parent;
+        } while (1);
+        node = parent;
+
+        if (node->start > last)
+            return NULL;
+        if (node->last >= start)
+            return (struct intervaltree_node *)node;
+    }
+}
+
+int intervaltree_init(struct intervaltree *tree)
+{
+    return rbtree_init_augmented(&tree->rb, interval_cmp, &max_last_callbacks);
+}
+
+void intervaltree_clean(struct intervaltree *tree)
+{
+    rbtree_clean(&tree->rb);
+}
+
+void intervaltree_foreach(struct intervaltree *tree, intervaltree_call_fn_t call)
+{
+    struct intervaltree_node * i;
+    struct intervaltree_node * n;
+    for (i = intervaltree_first(tree); i; )
+    {
+        n = intervaltree_next(i);
+        call(i);
+        i = n;
+    }
+}
+
+void intervaltree_foreach_backward(struct intervaltree *tree, intervaltree_call_fn_t call)
+{
+    struct intervaltree_node * i;
+    struct intervaltree_node * n;
+    for (i = intervaltree_last(tree); i; )
+    {
+        n = intervaltree_prev(i);
+        call(i);
+        i = n;
+    }
+}
@@ -0,0 +1,65 @@
+#ifndef ANYTREE__INTERVAL__INCLUDED
+#define ANYTREE__INTERVAL__INCLUDED
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "rb.h"
+
+
+#ifdef __GNUC__
+#  define intervaltree_container_of(node, type, member) ({      \
+    const struct intervaltree_node *__mptr = (node);            \
+    (type *)( (char *)__mptr - offsetof(type,member) );})
+#else
+#  define intervaltree_container_of(node, type, member)         \
+    ((type *)((char *)(node) - offsetof(type, member)))
+#endif    /* __GNUC__ */
+
+
+typedef uint64_t intervaltree_key_t;
+
+/*
+ * Red-black tree node holding the closed interval [start, last], ordered by
+ * start then last. The caller sets start and last before inserting and must
+ * not change them while the node is in a tree; max_last is maintained by
+ * the tree.
+ */
+struct intervaltree_node {
+    struct rbtree_node node;
+    intervaltree_key_t start, last;
+    intervaltree_key_t max_last;
+};
+
+struct intervaltree {
+    struct rbtree rb;
+};
+
+struct intervaltree_node *intervaltree_first(const struct intervaltree *tree);
+struct intervaltree_node *intervaltree_last(const struct intervaltree *tree);
+struct intervaltree_node *intervaltree_next(const struct intervaltree_node *node);
+struct intervaltree_node *intervaltree_prev(const struct intervaltree_node *node);
+
+struct intervaltree_node *intervaltree_insert(struct intervaltree_node *node, struct intervaltree *tree);
+void intervaltree_remove(struct intervaltree_node *node, struct intervaltree *tree);
+
+/*
+ * Iterate the intervals overlapping [start, last] in order:
+ *
+ *     for (n = intervaltree_overlap_first(a, b, tree); n;
+ *          n = intervaltree_overlap_next(n, a, b))
+ */
+struct intervaltree_node *intervaltree_overlap_first(intervaltree_key_t start, intervaltree_key_t last, const struct intervaltree *tree);
+struct intervaltree_node *intervaltree_overlap_next(const struct intervaltree_node *node, intervaltree_key_t start, intervaltree_key_t last);
+
+#define intervaltree_is_empty(TREE) (TREE->rb.size == 0)
+#define intervaltree_size(TREE) (TREE->rb.size)
+
+int intervaltree_init(struct intervaltree *tree);
+void intervaltree_clean(struct intervaltree *tree);
+
+typedef void (*intervaltree_call_fn_t)(const struct intervaltree_node *);
+void intervaltree_foreach(struct intervaltree *tree, intervaltree_call_fn_t call);
+void intervaltree_foreach_backward(struct intervaltree *tree, intervaltree_call_fn_t call);
+
+#endif
@@ -0,0 +1,1062 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "inttree.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#  define INTTREE_X86
+#  include <immintrin.h>
+#endif
+
+
+#define CACHE_LINE 64
+#define KEYS 16             /* keys per leaf and per inner node, one mask bit each */
+#define LEAF_MIN (KEYS / 2)
+#define INNER_MIN (KEYS / 2)
+#define MAX_HEIGHT 16       /* inner nodes have 9 children or more, this covers any unsigned size */
+
+/*
+ * Keys are stored with the sign bit flipped, so that the signed 64-bit
+ * compares of the vector units order them as unsigned integers.
+ */
+#define SIGN ((uint64_t)1 << 63)
+
+struct inttree_leaf {
+    uint64_t keys[KEYS];
+    struct inttree_node *slots[KEYS];
+    unsigned count;
+    struct inttree_leaf *prev, *next;
+};
+
+/* keys[i] and seps[i] are the key and the node first under children[i + 1] */
+struct inttree_inner {
+    uint64_t keys[KEYS];
+    unsigned count;                         /* keys, one less than children */
+    struct inttree_node *seps[KEYS];
+    void *children[KEYS + 1];
+};
+
+#define BLOCK_SIZE(TYPE) ((sizeof(TYPE) + CACHE_LINE - 1) & ~(size_t)(CACHE_LINE - 1))
+#define LEAF_SIZE BLOCK_SIZE(struct inttree_leaf)
+#define INNER_SIZE BLOCK_SIZE(struct inttree_inner)
+
+/* The inner nodes from the root down to a leaf, and the child taken in each */
+struct path {
+    struct inttree_inner *nodes[MAX_HEIGHT];
+    unsigned index[MAX_HEIGHT];
+};
+
+#ifdef __GNUC__
+#  define prefetch(ADDR) __builtin_prefetch(ADDR)
+#else
+#  define prefetch(ADDR) ((void)(ADDR))
+#endif
+
+
+#ifdef ANYTREE_NO_TREE_POINTER
+static inline void set_tree(struct inttree *tree, struct inttree_node *node)
+{
+    (void)tree;
+    (void)node;
+}
+
+static inline int in_tree(const struct inttree_node *node, const struct inttree *tree)
+{
+    (void)node;
+    (void)tree;
+    return 1;
+}
+#else
+static inline void set_tree(struct inttree *tree, struct inttree_node *node)
+{
+    node->tree = tree;
+}
+
+static inline int in_tree(const struct inttree_node *node, const struct inttree *tree)
+{
+    return node->tree == tree;
+}
+#endif
+
+
+/*
+ * Key search within a tree node: the number of the first 'count' keys
+ * below 'key', or below or equal to it when 'strict'. Each variant
+ * compares all KEYS keys, whatever 'count', and masks off the unused ones;
+ * blocks are zeroed when allocated so those are never uninitialized.
+ */
+typedef unsigned (*rank_fn_t)(const uint64_t *keys, unsigned count, uint64_t key, int strict);
+
+static unsigned rank_scalar(const uint64_t *keys, unsigned count, uint64_t key, int strict)
+{
+    unsigned i, n = 0;
+
+    for (i = 0; i < count; i++)
+        n += ((int64_t)keys[i] < (int64_t)key) | (strict & (keys[i] == key));
+    return n;
+}
+
+#ifdef INTTREE_X86
+static inline unsigned mask_rank(unsigned mask, unsigned count, int strict)
+{
+    mask &= (1u << count) - 1;
+    return strict ? count - __builtin_popcount(mask) : (unsigned)__builtin_popcount(mask);
+}
+
+/*
+ * SSE2 has no 64-bit compare: a > b on the high halves, signed, or equal
+ * high halves and a > b on the low ones, unsigned, the low halves having
+ * their own sign bit flipped for the 32-bit compare.
+ */
+__attribute__((target("sse2")))
+static inline __m128i cmpgt_epi64_sse2(__m128i a, __m128i b)
+{
+    const __m128i low_sign = _mm_set_epi32(0, (int)0x80000000, 0, (int)0x80000000);
+    __m128i gt = _mm_cmpgt_epi32(_mm_xor_si128(a, low_sign), _mm_xor_si128(b, low_sign));
+    __m128i eq = _mm_cmpeq_epi32(a, b);
+    __m128i high_gt = _mm_shuffle_epi32(gt, _MM_SHUFFLE(3, 3, 1, 1));
+    __m128i high_eq = _mm_shuffle_epi32(eq, _MM_SHUFFLE(3, 3, 1, 1));
+    __m128i low_gt = _mm_shuffle_epi32(gt, _MM_SHUFFLE(2, 2, 0, 0));
+
+    return _mm_or_si128(high_gt, _mm_and_si128(high_eq, low_gt));
+}
+
+/* Below 'key' is key > keys[i]; below or equal is not keys[i] > key */
+__attribute__((target("sse2")))
+static unsigned rank_sse2(const uint64_t *keys, unsigned count, uint64_t key, int strict)
+{
+    __m128i k = _mm_set1_epi64x((long long)key), v, c;
+    unsigned mask = 0, i;
+
+    for (i = 0; i < KEYS; i += 2) {
+        v = _mm_loadu_si128((const __m128i *)(keys + i));
+        c = strict ? cmpgt_epi64_sse2(v, k) : cmpgt_epi64_sse2(k, v);
+        mask |= (unsigned)_mm_movemask_pd(_mm_castsi128_pd(c)) << i;
+    }
+    return mask_rank(mask, count, strict);
+}
+
+__attribute__((target("avx2")))
+static unsigned rank_avx2(const uint64_t *keys, unsigned count, uint64_t key, int strict)
+{
+    __m256i k = _mm256_set1_epi64x((long long)key), v, c;
+    unsigned mask = 0, i;
+
+    for (i = 0; i < KEYS; i += 4) {
+        v = _mm256_loadu_si256((const __m256i *)(keys + i));
+        c = strict ? _mm256_cmpgt_epi64(v, k) : _mm256_cmpgt_epi64(k, v);
+        mask |= (unsigned)_mm256_movemask_pd(_mm256_castsi256_pd(c)) << i;
+    }
+    return mask_rank(mask, count, strict);
+}
+
+/*
+ * Picked once at load time, before any thread can search: __builtin_cpu_init()
+ * is meant to be called from a constructor, and 'rank' is never written again
+ */
+static rank_fn_t rank = rank_scalar;
+
+__attribute__((constructor))
+static void pick_rank(void)
+{
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        rank = rank_avx2;
+    else if (__builtin_cpu_supports("sse2"))
+        rank = rank_sse2;
+}
+#else
+static rank_fn_t rank = rank_scalar;
+#endif
+
+const char *inttree_search_isa(void)
+{
+#ifdef INTTREE_X86
+    if (rank == rank_avx2)
+        return "avx2";
+    if (rank == rank_sse2)
+        return "sse2";
+#endif
+    return "scalar";
+}
+
+
+static void *alloc_block(struct inttree *tree, size_t size)
+{
+    void *mem;
+
+    if (tree->pool)
+        mem = anytree_pool_alloc_aligned(tree->pool, size);
+    else if (posix_memalign(&mem, CACHE_LINE, size))
+        mem = NULL;
+    if (mem)
+        memset(mem, 0, size);
+    return mem;
+}
+
+static void free_block(struct inttree *tree, void *block, size_t size)
+{
+    if (tree->pool)
+        anytree_pool_free_aligned(tree->pool, block, size);
+    else
+        free(block);
+}
+
+static inline uint64_t key_of(const struct inttree_node *node, const struct inttree *tree)
+{
+    return tree->key_fn(node) ^ SIGN;
+}
+
+/* The caller's key comparator with its sign flipped, as order() in btree.c */
+static inline int order(const struct inttree_node *node, const void *key, inttree_key_cmp_fn_t cmp)
+{
+    int res = cmp(key, node);
+    return (res < 0) - (res > 0);
+}
+
+/* Number of nodes ordered before 'key' by 'cmp', see search() in btree.c */
+static unsigned search(struct inttree_node *const *nodes, unsigned count, const void *key, inttree_key_cmp_fn_t cmp, int strict)
+{
+    unsigned lo = 0, hi = count, mid, i;
+    int res;
+
+    for (i = 0; i < count; i++)
+        prefetch(nodes[i]);
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        res = order(nodes[mid], key, cmp);
+        if (res < 0 || (strict && res == 0))
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/*
+ * The leaf that holds the key or would, found by the stored keys or, with
+ * 'cmp', through the separators; the tree must not be empty
+ */
+static struct inttree_leaf *descend(uint64_t key, const void *ckey, inttree_key_cmp_fn_t cmp, const struct inttree *tree, struct path *path)
+{
+    void *block = tree->root;
+    struct inttree_inner *inner;
+    unsigned i;
+    int level;
+
+    for (level = 0; level < tree->height; level++) {
+        inner = (struct inttree_inner *)block;
+        if (cmp)
+            i = search(inner->seps, inner->count, ckey, cmp, 1);
+        else
+            i = rank(inner->keys, inner->count, key, 1);
+        if (path) {
+            path->nodes[level] = inner;
+            path->index[level] = i;
+        }
+        block = inner->children[i];
+    }
+    return (struct inttree_leaf *)block;
+}
+
+static unsigned slot_of(const struct inttree_leaf *leaf, const struct inttree_node *node)
+{
+    unsigned i = 0;
+
+    while (leaf->slots[i] != node)
+        i++;
+    return i;
+}
+
+/* The node at 'pos' in the leaf, or the one after the leaf past its end */
+static struct inttree_node *node_at(const struct inttree_leaf *leaf, unsigned pos)
+{
+    if (pos < leaf->count)
+        return leaf->slots[pos];
+    return leaf->next ? leaf->next->slots[0] : NULL;
+}
+
+static struct inttree_node *node_before(const struct inttree_leaf *leaf, unsigned pos)
+{
+    if (pos > 0)
+        return leaf->slots[pos - 1];
+    return leaf->prev ? leaf->prev->slots[leaf->prev->count - 1] : NULL;
+}
+
+static struct inttree_leaf *subtree_first(void *block, int height)
+{
+    while (height--)
+        block = ((struct inttree_inner *)block)->children[0];
+    return (struct inttree_leaf *)block;
+}
+
+
+/*
+ * Navigation
+ */
+struct inttree_node *inttree_first(const struct inttree *tree)
+{
+    return tree->first ? tree->first->slots[0] : NULL;
+}
+
+struct inttree_node *inttree_last(const struct inttree *tree)
+{
+    return tree->last ? tree->last->slots[tree->last->count - 1] : NULL;
+}
+
+struct inttree_node *inttree_next(const struct inttree_node *node)
+{
+    return node_at(node->leaf, slot_of(node->leaf, node) + 1);
+}
+
+struct inttree_node *inttree_prev(const struct inttree_node *node)
+{
+    return node_before(node->leaf, slot_of(node->leaf, node));
+}
+
+
+/*
+ * Searches
+ */
+static struct inttree_node *bound_int(uint64_t key, const struct inttree *tree, int strict)
+{
+    struct inttree_leaf *leaf;
+
+    if (!tree->root)
+        return NULL;
+    leaf = descend(key, NULL, NULL, tree, NULL);
+    return node_at(leaf, rank(leaf->keys, leaf->count, key, strict));
+}
+
+static struct inttree_node *lookup_int(uint64_t key, const struct inttree *tree)
+{
+    struct inttree_leaf *leaf;
+    unsigned pos;
+
+    if (!tree->root)
+        return NULL;
+    leaf = descend(key, NULL, NULL, tree, NULL);
+    pos = rank(leaf->keys, leaf->count, key, 0);
+    return pos < leaf->count && leaf->keys[pos] == key ? leaf->slots[pos] : NULL;
+}
+
+static struct inttree_node *floor_int(uint64_t key, const struct inttree *tree)
+{
+    struct inttree_leaf *leaf;
+
+    if (!tree->root)
+        return NULL;
+    leaf = descend(key, NULL, NULL, tree, NULL);
+    return node_before(leaf, rank(leaf->keys, leaf->count, key, 1));
+}
+
+struct inttree_node *inttree_lookup(const struct inttree_node *key, const struct inttree *tree)
+{
+    return lookup_int(key_of(key, tree), tree);
+}
+
+struct inttree_node *inttree_lower_bound(const struct inttree_node *key, const struct inttree *tree)
+{
+    return bound_int(key_of(key, tree), tree, 0);
+}
+
+struct inttree_node *inttree_upper_bound(const struct inttree_node *key, const struct inttree *tree)
+{
+    return bound_int(key_of(key, tree), tree, 1);
+}
+
+struct inttree_node *inttree_floor(const struct inttree_node *key, const struct inttree *tree)
+{
+    return floor_int(key_of(key, tree), tree);
+}
+
+struct inttree_node *inttree_lookup_int(uint64_t key, const struct inttree *tree)
+{
+    return lookup_int(key ^ SIGN, tree);
+}
+
+struct inttree_node *inttree_lower_bound_int(uint64_t key, const struct inttree *tree)
+{
+    return bound_int(key ^ SIGN, tree, 0);
+}
+
+struct inttree_node *inttree_upper_bound_int(uint64_t key, const struct inttree *tree)
+{
+    return bound_int(key ^ SIGN, tree, 1);
+}
+
+struct inttree_node *inttree_floor_int(uint64_t key, const struct inttree *tree)
+{
+    return floor_int(key ^ SIGN, tree);
+}
+
+static struct inttree_node *bound_key(const void *key, inttree_key_cmp_fn_t cmp, const struct inttree *tree, int strict)
+{
+    struct inttree_leaf *leaf;
+
+    if (!tree->root)
+        return NULL;
+    leaf = descend(0, key, cmp, tree, NULL);
+    return node_at(leaf, search(leaf->slots, leaf->count, key, cmp, strict));
+}
+
+struct inttree_node *inttree_lookup_key(const void *key, inttree_key_cmp_fn_t cmp, const struct inttree *tree)
+{
+    struct inttree_node *node = bound_key(key, cmp, tree, 0);
+
+    if (node && cmp(key, node) == 0)
+        return node;
+    return NULL;
+}
+
+struct inttree_node *inttree_lower_bound_key(const void *key, inttree_key_cmp_fn_t cmp, const struct inttree *tree)
+{
+    return bound_key(key, cmp, tree, 0);
+}
+
+struct inttree_node *inttree_upper_bound_key(const void *key, inttree_key_cmp_fn_t cmp, const struct inttree *tree)
+{
+    return bound_key(key, cmp, tree, 1);
+}
+
+struct inttree_node *inttree_floor_key(const void *key, inttree_key_cmp_fn_t cmp, const struct inttree *tree)
+{
+    struct inttree_leaf *leaf;
+
+    if (!tree->root)
+        return NULL;
+    leaf = descend(0, key, cmp, tree, NULL);
+    return node_before(leaf, search(leaf->slots, leaf->count, key, cmp, 1));
+}
+
+/* Range [lo, hi), see avltree_range() */
+struct inttree_node *inttree_range(const struct inttree_node *lo, const struct inttree_node *hi, const struct inttree *tree, struct inttree_node **end)
+{
+    *end = NULL;
+    if (!tree->root || (lo && hi && tree->key_fn(lo) >= tree->key_fn(hi)))
+        return NULL;
+
+    if (hi)
+        *end = inttree_lower_bound(hi, tree);
+    if (!lo)
+        return inttree_first(tree);
+    return inttree_lower_bound(lo, tree);
+}
+
+/* Whole leaves in between are counted without being walked */
+unsigned inttree_range_count(const struct inttree_node *lo, const struct inttree_node *hi, const struct inttree *tree)
+{
+    struct inttree_node *node, *end;
+    const struct inttree_leaf *leaf;
+    unsigned count;
+
+    node = inttree_range(lo, hi, tree, &end);
+    if (!node || node == end)
+        return 0;
+
+    leaf = node->leaf;
+    count = 0 - slot_of(leaf, node);
+    for (; leaf != (end ? end->leaf : NULL); leaf = leaf->next)
+        count += leaf->count;
+    if (end)
+        count += slot_of(leaf, end);
+    return count;
+}
+
+
+/*
+ * Insertion
+ */
+static void leaf_insert(struct inttree_leaf *leaf, unsigned pos, struct inttree_node *node, uint64_t key)
+{
+    memmove(leaf->keys + pos + 1, leaf->keys + pos, (leaf->count - pos) * sizeof(leaf->keys[0]));
+    memmove(leaf->slots + pos + 1, leaf->slots + pos, (leaf->count - pos) * sizeof(leaf->slots[0]));
+    leaf->keys[pos] = key;
+    leaf->slots[pos] = node;
+    leaf->count++;
+    node->leaf = leaf;
+}
+
+static void leaf_move(struct inttree_leaf *to, const struct inttree_leaf *from, unsigned pos, unsigned count)
+{
+    unsigned i;
+
+    memcpy(to->keys + to->count, from->keys + pos, count * sizeof(to->keys[0]));
+    memcpy(to->slots + to->count, from->slots + pos, count * sizeof(to->slots[0]));
+    for (i = 0; i < count; i++)
+        to->slots[to->count + i]->leaf = to;
+    to->count += count;
+}
+
+static void inner_insert(struct inttree_inner *inner, unsigned pos, uint64_t key, struct inttree_node *sep, void *child)
+{
+    memmove(inner->keys + pos + 1, inner->keys + pos, (inner->count - pos) * sizeof(inner->keys[0]));
+    memmove(inner->seps + pos + 1, inner->seps + pos, (inner->count - pos) * sizeof(inner->seps[0]));
+    memmove(inner->children + pos + 2, inner->children + pos + 1, (inner->count - pos) * sizeof(inner->children[0]));
+    inner->keys[pos] = key;
+    inner->seps[pos] = sep;
+    inner->children[pos + 1] = child;
+    inner->count++;
+}
+
+/* A separator on its way up: the key, its node and the block on its right */
+struct split {
+    uint64_t key;
+    struct inttree_node *sep;
+    void *child;
+};
+
+/*
+ * Splits 'inner' around the new separator, which goes at 'pos': the middle
+ * one moves up into 'up' and the right half into 'right'.
+ */
+static void split_inner(struct inttree_inner *inner, unsigned pos, struct split *up, struct inttree_inner *right)
+{
+    uint64_t keys[KEYS + 1];
+    struct inttree_node *seps[KEYS + 1];
+    void *children[KEYS + 2];
+    unsigned mid = (KEYS + 1) / 2;
+
+    memcpy(keys, inner->keys, pos * sizeof(keys[0]));
+    keys[pos] = up->key;
+    memcpy(keys + pos + 1, inner->keys + pos, (KEYS - pos) * sizeof(keys[0]));
+    memcpy(seps, inner->seps, pos * sizeof(seps[0]));
+    seps[pos] = up->sep;
+    memcpy(seps + pos + 1, inner->seps + pos, (KEYS - pos) * sizeof(seps[0]));
+    memcpy(children, inner->children, (pos + 1) * sizeof(children[0]));
+    children[pos + 1] = up->child;
+    memcpy(children + pos + 2, inner->children + pos + 1, (KEYS - pos) * sizeof(children[0]));
+
+    inner->count = mid;
+    memcpy(inner->keys, keys, mid * sizeof(keys[0]));
+    memcpy(inner->seps, seps, mid * sizeof(seps[0]));
+    memcpy(inner->children, children, (mid + 1) * sizeof(children[0]));
+    right->count = KEYS - mid;
+    memcpy(right->keys, keys + mid + 1, right->count * sizeof(keys[0]));
+    memcpy(right->seps, seps + mid + 1, right->count * sizeof(seps[0]));
+    memcpy(right->children, children + mid + 1, (right->count + 1) * sizeof(children[0]));
+
+    up->key = keys[mid];
+    up->sep = seps[mid];
+    up->child = right;
+}
+
+/*
+ * Inserts into a full leaf: every block the splits will need is allocated
+ * up front, so that running out of memory leaves the tree as it was.
+ */
+static int split_insert(struct inttree_node *node, uint64_t key, struct inttree_leaf *leaf, unsigned pos, const struct path *path, struct inttree *tree)
+{
+    void *blocks[MAX_HEIGHT + 2];
+    struct inttree_leaf *right;
+    struct inttree_inner *root;
+    struct split up;
+    unsigned mid = (KEYS + 1) / 2;
+    int needed = 0, level, i;
+
+    for (level = tree->height - 1; level >= 0 && path->nodes[level]->count == KEYS; level--)
+        needed++;
+    if (level < 0)
+        needed++;
+    right = (struct inttree_leaf *)alloc_block(tree, LEAF_SIZE);
+    if (!right)
+        return -1;
+    for (i = 0; i < needed; i++) {
+        blocks[i] = alloc_block(tree, INNER_SIZE);
+        if (!blocks[i]) {
+            while (i--)
+                free_block(tree, blocks[i], INNER_SIZE);
+            free_block(tree, right, LEAF_SIZE);
+            return -1;
+        }
+    }
+
+    if (pos < mid) {
+        leaf_move(right, leaf, mid - 1, KEYS - mid + 1);
+        leaf->count = mid - 1;
+        leaf_insert(leaf, pos, node, key);
+    } else {
+        leaf_move(right, leaf, mid, KEYS - mid);
+        leaf->count = mid;
+        leaf_insert(right, pos - mid, node, key);
+    }
+    right->prev = leaf;
+    right->next = leaf->next;
+    if (leaf->next)
+        leaf->next->prev = right;
+    else
+        tree->last = right;
+    leaf->next = right;
+
+    up.key = right->keys[0];
+    up.sep = right->slots[0];
+    up.child = right;
+    for (level = tree->height - 1, i = 0; level >= 0; level--) {
+        if (path->nodes[level]->count < KEYS) {
+            inner_insert(path->nodes[level], path->index[level], up.key, up.sep, up.child);
+            return 0;
+        }
+        split_inner(path->nodes[level], path->index[level], &up, (struct inttree_inner *)blocks[i++]);
+    }
+
+    root = (struct inttree_inner *)blocks[i];
+    root->count = 1;
+    root->keys[0] = up.key;
+    root->seps[0] = up.sep;
+    root->children[0] = tree->root;
+    root->children[1] = up.child;
+    tree->root = root;
+    tree->height++;
+    return 0;
+}
+
+static struct inttree_node *insert_first(struct inttree_node *node, uint64_t key, struct inttree *tree)
+{
+    struct inttree_leaf *leaf = (struct inttree_leaf *)alloc_block(tree, LEAF_SIZE);
+
+    if (!leaf)
+        return node;
+    leaf_insert(leaf, 0, node, key);
+    tree->root = tree->first = tree->last = leaf;
+    return NULL;
+}
+
+struct inttree_node *inttree_insert(struct inttree_node *node, struct inttree *tree)
+{
+    uint64_t key = key_of(node, tree);
+    struct inttree_leaf *leaf;
+    struct path path;
+    unsigned pos;
+
+    if (!tree->root) {
+        if (insert_first(node, key, tree))
+            return node;
+    } else {
+        leaf = descend(key, NULL, NULL, tree, &path);
+        pos = rank(leaf->keys, leaf->count, key, 0);
+        if (pos < leaf->count && leaf->keys[pos] == key)
+            return leaf->slots[pos];
+
+        if (leaf->count < KEYS)
+            leaf_insert(leaf, pos, node, key);
+        else if (split_insert(node, key, leaf, pos, &path, tree))
+            return node;
+    }
+    set_tree(tree, node);
+    tree->size++;
+    return NULL;
+}
+
+/* See insert_between() in btree.c: no separator changes short of a split */
+static struct inttree_node *insert_between(struct inttree_node *node, struct inttree_node *prev, struct inttree_node *next, struct inttree *tree)
+{
+    uint64_t key = key_of(node, tree);
+    struct inttree_leaf *leaf;
+    unsigned pos;
+
+    if (prev) {
+        pos = slot_of(prev->leaf, prev);
+        if (prev->leaf->keys[pos] == key)
+            return prev;
+        if ((int64_t)prev->leaf->keys[pos] > (int64_t)key)
+            return inttree_insert(node, tree);
+    }
+    if (next) {
+        pos = slot_of(next->leaf, next);
+        if (next->leaf->keys[pos] == key)
+            return next;
+        if ((int64_t)next->leaf->keys[pos] < (int64_t)key)
+            return inttree_insert(node, tree);
+    }
+
+    leaf = prev ? prev->leaf : tree->first;
+    if (!leaf || leaf->count == KEYS)
+        return inttree_insert(node, tree);
+    leaf_insert(leaf, prev ? slot_of(leaf, prev) + 1 : 0, node, key);
+    set_tree(tree, node);
+    tree->size++;
+    return NULL;
+}
+
+struct inttree_node *inttree_insert_after(struct inttree_node *node, struct inttree_node *hint, struct inttree *tree)
+{
+    if (hint && !in_tree(hint, tree))
+        return inttree_insert(node, tree);
+    return insert_between(node, hint, hint ? inttree_next(hint) : inttree_first(tree), tree);
+}
+
+struct inttree_node *inttree_insert_before(struct inttree_node *node, struct inttree_node *hint, struct inttree *tree)
+{
+    if (hint && !in_tree(hint, tree))
+        return inttree_insert(node, tree);
+    return insert_between(node, hint ? inttree_prev(hint) : inttree_last(tree), hint, tree);
+}
+
+
+/*
+ * Removal
+ */
+static void leaf_erase(struct inttree_leaf *leaf, unsigned pos)
+{
+    leaf->count--;
+    memmove(leaf->keys + pos, leaf->keys + pos + 1, (leaf->count - pos) * sizeof(leaf->keys[0]));
+    memmove(leaf->slots + pos, leaf->slots + pos + 1, (leaf->count - pos) * sizeof(leaf->slots[0]));
+}
+
+/* Drops keys[pos] and children[pos + 1] */
+static void inner_erase(struct inttree_inner *inner, unsigned pos)
+{
+    inner->count--;
+    memmove(inner->keys + pos, inner->keys + pos + 1, (inner->count - pos) * sizeof(inner->keys[0]));
+    memmove(inner->seps + pos, inner->seps + pos + 1, (inner->count - pos) * sizeof(inner->seps[0]));
+    memmove(inner->children + pos + 1, inner->children + pos + 2, (inner->count - pos) * sizeof(inner->children[0]));
+}
+
+/* Points the separator that is 'old', if any, at 'node' */
+static void replace_sep(const struct path *path, const struct inttree_node *old, struct inttree_node *node, uint64_t key, const struct inttree *tree)
+{
+    struct inttree_inner *inner;
+    unsigned i;
+    int level;
+
+    for (level = 0; level < tree->height; level++) {
+        inner = path->nodes[level];
+        i = path->index[level];
+        if (i && inner->seps[i - 1] == old) {
+            inner->keys[i - 1] = key;
+            inner->seps[i - 1] = node;
+            return;
+        }
+    }
+}
+
+/* Appends 'right' to 'left' and frees it */
+static void merge_leaves(struct inttree_leaf *left, struct inttree_leaf *right, struct inttree *tree)
+{
+    leaf_move(left, right, 0, right->count);
+    left->next = right->next;
+    if (right->next)
+        right->next->prev = left;
+    else
+        tree->last = left;
+    free_block(tree, right, LEAF_SIZE);
+}
+
+static void merge_inner(struct inttree_inner *left, const struct inttree_inner *parent, unsigned i, struct inttree_inner *right, struct inttree *tree)
+{
+    left->keys[left->count] = parent->keys[i];
+    left->seps[left->count] = parent->seps[i];
+    memcpy(left->keys + left->count + 1, right->keys, right->count * sizeof(right->keys[0]));
+    memcpy(left->seps + left->count + 1, right->seps, right->count * sizeof(right->seps[0]));
+    memcpy(left->children + left->count + 1, right->children, (right->count + 1) * sizeof(right->children[0]));
+    left->count += right->count + 1;
+    free_block(tree, right, INNER_SIZE);
+}
+
+/* Refills the inner nodes on the path from 'level' up, then shrinks the root */
+static void fix_inner(int level, const struct path *path, struct inttree *tree)
+{
+    struct inttree_inner *node, *parent, *left, *right;
+    unsigned i;
+
+    for (; level > 0; level--) {
+        node = path->nodes[level];
+        if (node->count >= INNER_MIN)
+            return;
+        parent = path->nodes[level - 1];
+        i = path->index[level - 1];
+        left = i > 0 ? (struct inttree_inner *)parent->children[i - 1] : NULL;
+        right = i < parent->count ? (struct inttree_inner *)parent->children[i + 1] : NULL;
+
+        if (left && left->count > INNER_MIN) {
+            memmove(node->keys + 1, node->keys, node->count * sizeof(node->keys[0]));
+            memmove(node->seps + 1, node->seps, node->count * sizeof(node->seps[0]));
+            memmove(node->children + 1, node->children, (node->count + 1) * sizeof(node->children[0]));
+            node->keys[0] = parent->keys[i - 1];
+            node->seps[0] = parent->seps[i - 1];
+            node->children[0] = left->children[left->count];
+            node->count++;
+            left->count--;
+            parent->keys[i - 1] = left->keys[left->count];
+            parent->seps[i - 1] = left->seps[left->count];
+            return;
+        }
+        if (right && right->count > INNER_MIN) {
+            node->keys[node->count] = parent->keys[i];
+            node->seps[node->count] = parent->seps[i];
+            node->children[node->count + 1] = right->children[0];
+            node->count++;
+            parent->keys[i] = right->keys[0];
+            parent->seps[i] = right->seps[0];
+            right->count--;
+            memmove(right->keys, right->keys + 1, right->count * sizeof(right->keys[0]));
+            memmove(right->seps, right->seps + 1, right->count * sizeof(right->seps[0]));
+            memmove(right->children, right->children + 1, (right->count + 1) * sizeof(right->children[0]));
+            return;
+        }
+        if (left) {
+            merge_inner(left, parent, i - 1, node, tree);
+            inner_erase(parent, i - 1);
+        } else {
+            merge_inner(node, parent, i, right, tree);
+            inner_erase(parent, i);
+        }
+    }
+
+    node = path->nodes[0];
+    if (!node->count) {
+        tree->root = node->children[0];
+        tree->height--;
+        free_block(tree, node, INNER_SIZE);
+    }
+}
+
+/* Refills a leaf that fell under half full from a sibling, or merges it */
+static void fix_leaf(struct inttree_leaf *leaf, const struct path *path, struct inttree *tree)
+{
+    int level = tree->height - 1;
+    struct inttree_inner *parent = path->nodes[level];
+    unsigned i = path->index[level];
+    struct inttree_leaf *left = i > 0 ? (struct inttree_leaf *)parent->children[i - 1] : NULL;
+    struct inttree_leaf *right = i < parent->count ? (struct inttree_leaf *)parent->children[i + 1] : NULL;
+
+    if (left && left->count > LEAF_MIN) {
+        left->count--;
+        leaf_insert(leaf, 0, left->slots[left->count], left->keys[left->count]);
+        parent->keys[i - 1] = leaf->keys[0];
+        parent->seps[i - 1] = leaf->slots[0];
+        return;
+    }
+    if (right && right->count > LEAF_MIN) {
+        leaf_insert(leaf, leaf->count, right->slots[0], right->keys[0]);
+        leaf_erase(right, 0);
+        parent->keys[i] = right->keys[0];
+        parent->seps[i] = right->slots[0];
+        return;
+    }
+    if (left) {
+        merge_leaves(left, leaf, tree);
+        inner_erase(parent, i - 1);
+    } else {
+        merge_leaves(leaf, right, tree);
+        inner_erase(parent, i);
+    }
+    fix_inner(level, path, tree);
+}
+
+/*
+ * As in btree.c, most removals only close the gap in the leaf. Below the
+ * root a leaf holds LEAF_MIN nodes or more, so when the first node of one
+ * goes, the second takes its place as separator.
+ */
+static void do_remove(struct inttree_node *node, struct inttree *tree)
+{
+    struct inttree_leaf *leaf = node->leaf;
+    unsigned pos = slot_of(leaf, node);
+    struct path path;
+
+    --tree->size;
+
+    if (!tree->height || ((pos > 0 || leaf == tree->first) && leaf->count > LEAF_MIN)) {
+        leaf_erase(leaf, pos);
+        if (!leaf->count) {
+            free_block(tree, leaf, LEAF_SIZE);
+            tree->root = tree->first = tree->last = NULL;
+        }
+        return;
+    }
+
+    descend(leaf->keys[pos], NULL, NULL, tree, &path);
+    if (pos == 0)
+        replace_sep(&path, node, leaf->slots[1], leaf->keys[1], tree);
+    leaf_erase(leaf, pos);
+    if (leaf->count < LEAF_MIN)
+        fix_leaf(leaf, &path, tree);
+}
+
+void inttree_remove(struct inttree_node *node, struct inttree *tree)
+{
+    if (tree && !in_tree(node, tree))
+        return;
+    do_remove(node, tree);
+}
+
+struct inttree_node *inttree_remove_key(const void *key, inttree_key_cmp_fn_t cmp, struct inttree *tree)
+{
+    struct inttree_node *node = inttree_lookup_key(key, cmp, tree);
+
+    if (node)
+        do_remove(node, tree);
+    return node;
+}
+
+void inttree_replace(struct inttree_node *old, struct inttree_node *node, struct inttree *tree)
+{
+    struct inttree_leaf *leaf = old->leaf;
+    unsigned pos = slot_of(leaf, old);
+    struct path path;
+
+    leaf->slots[pos] = node;
+    node->leaf = leaf;
+    set_tree(tree, node);
+    if (pos == 0 && leaf != tree->first) {
+        descend(leaf->keys[0], NULL, NULL, tree, &path);
+        replace_sep(&path, old, node, leaf->keys[0], tree);
+    }
+}
+
+
+/*
+ * Bulk loading, as in btree.c: leaves are filled evenly, then each level
+ * of inner nodes over the one below.
+ */
+static void free_blocks(void **blocks, unsigned leaves, unsigned count, struct inttree *tree)
+{
+    while (count--)
+        free_block(tree, blocks[count], count < leaves ? LEAF_SIZE : INNER_SIZE);
+    free(blocks);
+}
+
+int inttree_build_sorted(struct inttree_node **nodes, unsigned count, struct inttree *tree)
+{
+    struct inttree_leaf *leaf, *prev = NULL, *first;
+    struct inttree_inner *inner;
+    void **blocks;
+    unsigned total, leaves, n, groups, base, used, i, j, k, take;
+    int height = 0;
+
+    if (tree->size)
+        return -1;
+    if (!count)
+        return 0;
+
+    leaves = n = (count + KEYS - 1) / KEYS;
+    for (total = n; n > 1; total += n)
+        n = (n + KEYS) / (KEYS + 1);
+    blocks = (void **)malloc(total * sizeof(void *));
+    if (!blocks)
+        return -1;
+    for (i = 0; i < total; i++) {
+        blocks[i] = alloc_block(tree, i < leaves ? LEAF_SIZE : INNER_SIZE);
+        if (!blocks[i]) {
+            free_blocks(blocks, leaves, i, tree);
+            return -1;
+        }
+    }
+
+    for (j = 0, k = 0; j < leaves; j++) {
+        leaf = (struct inttree_leaf *)blocks[j];
+        take = (count - k) / (leaves - j);
+        for (i = 0; i < take; i++) {
+            leaf->keys[i] = key_of(nodes[k + i], tree);
+            leaf->slots[i] = nodes[k + i];
+            nodes[k + i]->leaf = leaf;
+            set_tree(tree, nodes[k + i]);
+        }
+        leaf->count = take;
+        k += take;
+        leaf->prev = prev;
+        leaf->next = NULL;
+        if (prev)
+            prev->next = leaf;
+        prev = leaf;
+    }
+    tree->first = (struct inttree_leaf *)blocks[0];
+    tree->last = prev;
+
+    for (base = 0, used = n = leaves; n > 1; base = used, used += groups, n = groups, height++) {
+        groups = (n + KEYS) / (KEYS + 1);
+        for (j = 0, k = 0; j < groups; j++) {
+            inner = (struct inttree_inner *)blocks[used + j];
+            take = (n - k) / (groups - j);
+            inner->count = take - 1;
+            for (i = 0; i < take; i++) {
+                inner->children[i] = blocks[base + k + i];
+                if (i) {
+                    first = subtree_first(inner->children[i], height);
+                    inner->keys[i - 1] = first->keys[0];
+                    inner->seps[i - 1] = first->slots[0];
+                }
+            }
+            k += take;
+        }
+    }
+
+    tree->root = blocks[base];
+    tree->height = height;
+    tree->size = count;
+    free(blocks);
+    return 0;
+}
+
+
+int inttree_init(struct inttree *tree, inttree_cmp_fn_t cmp, inttree_key_fn_t key)
+{
+    return inttree_init_with_pool(tree, cmp, key, NULL);
+}
+
+/* Fails without a key function, leaving an empty tree that may be released */
+int inttree_init_with_pool(struct inttree *tree, inttree_cmp_fn_t cmp, inttree_key_fn_t key, struct anytree_pool *pool)
+{
+    tree->cmp_fn = cmp;
+    tree->size = 0;
+    tree->root = NULL;
+    tree->first = tree->last = NULL;
+    tree->height = 0;
+    tree->key_fn = key;
+    tree->pool = pool;
+    return key ? 0 : -1;
+}
+
+static void free_subtree(void *block, int height, struct inttree *tree)
+{
+    struct inttree_inner *inner = (struct inttree_inner *)block;
+    unsigned i;
+
+    if (!height) {
+        free_block(tree, block, LEAF_SIZE);
+        return;
+    }
+    for (i = 0; i <= inner->count; i++)
+        free_subtree(inner->children[i], height - 1, tree);
+    free_block(tree, block, INNER_SIZE);
+}
+
+void inttree_release(struct inttree *tree)
+{
+    if (tree->root)
+        free_subtree(tree->root, tree->height, tree);
+    inttree_init_with_pool(tree, tree->cmp_fn, tree->key_fn, tree->pool);
+}
+
+void inttree_clean(struct inttree *tree)
+{
+    struct inttree_node *i;
+    for (i = inttree_first(tree); i; i = inttree_next(i))
+        set_tree(NULL, i);
+    inttree_release(tree);
+}
+
+void inttree_foreach(struct inttree *tree, inttree_call_fn_t call)
+{
+    struct inttree_node * i;
+    struct inttree_node * n;
+    for (i = inttree_first(tree); i; )
+    {
+        n = inttree_next(i);
+        call(i);
+        i = n;
+    }
+}
+
+void inttree_foreach_backward(struct inttree *tree, inttree_call_fn_t call)
+{
+    struct inttree_node * i;
+    struct inttree_node * n;
+    for (i = inttree_last(tree); i; )
+    {
+        n = inttree_prev(i);
+        call(i);
+        i = n;
+    }
+}
@@ -0,0 +1,113 @@
+#ifndef ANYTREE__INTTREE__INCLUDED
+#define ANYTREE__INTTREE__INCLUDED
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "pool.h"
+
+
+#ifdef __GNUC__
+#  define inttree_container_of(node, type, member) ({      \
+    const struct inttree_node *__mptr = (node);            \
+    (type *)( (char *)__mptr - offsetof(type,member) );})
+#else
+#  define inttree_container_of(node, type, member)         \
+    ((type *)((char *)(node) - offsetof(type, member)))
+#endif
+
+
+/*
+ * B+tree over integer keys: the key function maps each node to a uint64_t
+ * (a uint32_t widens as is), and the tree nodes keep the keys of the
+ * caller's nodes next to the pointers. A search compares the key with all
+ * 16 keys of a tree node at once, with AVX2 or SSE2 compares turned into a
+ * bit mask, so it takes one data-dependent step per level and no branch on
+ * a comparison. The instruction set is picked at run time from the CPU's
+ * features; other targets get a branchless scalar loop.
+ *
+ * Keys are unique, as with the comparator of the other trees. The
+ * *_key() searches take a key comparator instead, and go down through the
+ * caller's nodes like btree.h does. As in btree.h the tree allocates its
+ * own nodes, from the pool given at init or with malloc(): inttree_insert()
+ * returns 'node' itself when out of memory, and inttree_release() frees
+ * them. The caller's node only points back at its leaf.
+ */
+struct inttree;
+struct inttree_leaf;
+
+struct inttree_node {
+#ifndef ANYTREE_NO_TREE_POINTER
+    struct inttree *tree;
+#endif
+    struct inttree_leaf *leaf;
+};
+
+typedef int (*inttree_cmp_fn_t)(const struct inttree_node *, const struct inttree_node *);
+typedef int (*inttree_key_cmp_fn_t)(const void *key, const struct inttree_node *);
+typedef uint64_t (*inttree_key_fn_t)(const struct inttree_node *);
+
+struct inttree {
+    inttree_cmp_fn_t cmp_fn;        /* unused by the tree, may be NULL */
+    unsigned size;
+
+    void *root;                     /* a leaf when 'height' is 0 */
+    struct inttree_leaf *first, *last;
+
+    int height;                     /* levels of inner nodes */
+    inttree_key_fn_t key_fn;
+    struct anytree_pool *pool;      /* the tree nodes' allocator, NULL for malloc */
+};
+
+struct inttree_node *inttree_first(const struct inttree *tree);
+struct inttree_node *inttree_last(const struct inttree *tree);
+struct inttree_node *inttree_next(const struct inttree_node *node);
+struct inttree_node *inttree_prev(const struct inttree_node *node);
+
+struct inttree_node *inttree_lookup(const struct inttree_node *key, const struct inttree *tree);
+struct inttree_node *inttree_lower_bound(const struct inttree_node *key, const struct inttree *tree);
+struct inttree_node *inttree_upper_bound(const struct inttree_node *key, const struct inttree *tree);
+struct inttree_node *inttree_floor(const struct inttree_node *key, const struct inttree *tree);
+#define inttree_ceil(KEY, TREE) inttree_lower_bound(KEY, TREE)
+
+/* The same searches given the integer itself */
+struct inttree_node *inttree_lookup_int(uint64_t key, const struct inttree *tree);
+struct inttree_node *inttree_lower_bound_int(uint64_t key, const struct inttree *tree);
+struct inttree_node *inttree_upper_bound_int(uint64_t key, const struct inttree *tree);
+struct inttree_node *inttree_floor_int(uint64_t key, const struct inttree *tree);
+
+struct inttree_node *inttree_range(const struct inttree_node *lo, const struct inttree_node *hi, const struct inttree *tree, struct inttree_node **end);
+unsigned inttree_range_count(const struct inttree_node *lo, const struct inttree_node *hi, const struct inttree *tree);
+
+struct inttree_node *inttree_lookup_key(const void *key, inttree_key_cmp_fn_t cmp, const struct inttree *tree);
+struct inttree_node *inttree_lower_bound_key(const void *key, inttree_key_cmp_fn_t cmp, const struct inttree *tree);
+struct inttree_node *inttree_upper_bound_key(const void *key, inttree_key_cmp_fn_t cmp, const struct inttree *tree);
+struct inttree_node *inttree_floor_key(const void *key, inttree_key_cmp_fn_t cmp, const struct inttree *tree);
+struct inttree_node *inttree_remove_key(const void *key, inttree_key_cmp_fn_t cmp, struct inttree *tree);
+/* Returns the node with the same key already in the tree, 'node' itself when out of memory, NULL once inserted */
+struct inttree_node *inttree_insert(struct inttree_node *node, struct inttree *tree);
+struct inttree_node *inttree_insert_after(struct inttree_node *node, struct inttree_node *hint, struct inttree *tree);
+struct inttree_node *inttree_insert_before(struct inttree_node *node, struct inttree_node *hint, struct inttree *tree);
+void inttree_remove(struct inttree_node *node, struct inttree *tree);
+/* 'node' must have the key of 'old' */
+void inttree_replace(struct inttree_node *old, struct inttree_node *node, struct inttree *tree);
+int inttree_build_sorted(struct inttree_node **nodes, unsigned count, struct inttree *tree);
+
+#define inttree_is_empty(TREE) (TREE->size == 0)
+#define inttree_size(TREE) (TREE->size)
+
+/* 'key' is required; 'cmp', if given, must order the nodes as their keys */
+int inttree_init(struct inttree *tree, inttree_cmp_fn_t cmp, inttree_key_fn_t key);
+int inttree_init_with_pool(struct inttree *tree, inttree_cmp_fn_t cmp, inttree_key_fn_t key, struct anytree_pool *pool);
+void inttree_clean(struct inttree *tree);
+/* Frees the tree nodes only: the caller's nodes may already be gone */
+void inttree_release(struct inttree *tree);
+
+/* The key search in use: "avx2", "sse2" or "scalar" */
+const char *inttree_search_isa(void);
+
+typedef void (*inttree_call_fn_t)(const struct inttree_node *);
+void inttree_foreach(struct inttree *tree, inttree_call_fn_t call);
+void inttree_foreach_backward(struct inttree *tree, inttree_call_fn_t call);
+
+#endif
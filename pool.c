@@ -0,0 +1,221 @@
+#include <malloc.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __linux__
+#  include <sys/mman.h>
+#endif
+
+#include "pool.h"
+
+
+#define DEFAULT_CHUNK_SIZE ((size_t)64 << 10)
+#define HUGEPAGE_SIZE ((size_t)2 << 20)
+
+struct anytree_pool_chunk {
+    struct anytree_pool_chunk *next;
+    size_t size;
+    int mapped;
+};
+
+#define CHUNK_HEADER_SIZE round_up(sizeof(struct anytree_pool_chunk), ANYTREE_POOL_ALIGN)
+/* Most that aligning a block to a line skips */
+#define LINE_SLACK (ANYTREE_POOL_LINE - ANYTREE_POOL_ALIGN)
+
+static inline size_t round_up(size_t size, size_t align)
+{
+    return (size + align - 1) & ~(align - 1);
+}
+
+static struct anytree_pool_chunk *map_chunk(size_t size, int flags)
+{
+    struct anytree_pool_chunk *chunk = NULL;
+
+#ifdef __linux__
+    if (flags & ANYTREE_POOL_HUGEPAGES) {
+        void *mem = MAP_FAILED;
+
+        size = round_up(size, HUGEPAGE_SIZE);
+#  ifdef MAP_HUGETLB
+        mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#  endif
+        /* no reserved hugepages, ask for transparent ones instead */
+        if (mem == MAP_FAILED) {
+            mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+#  ifdef MADV_HUGEPAGE
+            if (mem != MAP_FAILED)
+                madvise(mem, size, MADV_HUGEPAGE);
+#  endif
+        }
+        if (mem != MAP_FAILED) {
+            chunk = (struct anytree_pool_chunk *)mem;
+            chunk->mapped = 1;
+        }
+    }
+#else
+    (void)flags;
+#endif
+    if (!chunk) {
+        chunk = (struct anytree_pool_chunk *)malloc(size);
+        if (!chunk)
+            return NULL;
+        chunk->mapped = 0;
+    }
+    chunk->size = size;
+    return chunk;
+}
+
+static void unmap_chunk(struct anytree_pool_chunk *chunk)
+{
+#ifdef __linux__
+    if (chunk->mapped) {
+        munmap((void *)chunk, chunk->size);
+        return;
+    }
+#endif
+    free((void *)chunk);
+}
+
+static struct anytree_pool_chunk *add_chunk(struct anytree_pool *pool, size_t size)
+{
+    struct anytree_pool_chunk *chunk = map_chunk(size, pool->flags);
+
+    if (!chunk)
+        return NULL;
+    chunk->next = pool->chunks;
+    pool->chunks = chunk;
+    return chunk;
+}
+
+int anytree_pool_init(struct anytree_pool *pool, size_t chunk_size, int flags)
+{
+    if (!chunk_size)
+        chunk_size = (flags & ANYTREE_POOL_HUGEPAGES) ? HUGEPAGE_SIZE : DEFAULT_CHUNK_SIZE;
+    if (chunk_size < CHUNK_HEADER_SIZE + LINE_SLACK + ANYTREE_POOL_MAX_CLASS_SIZE)
+        return -1;
+
+    pool->chunks = NULL;
+    pool->cur = NULL;
+    pool->end = NULL;
+    pool->chunk_size = chunk_size;
+    pool->flags = flags;
+    memset(pool->freelists, 0, sizeof(pool->freelists));
+    memset(pool->line_freelists, 0, sizeof(pool->line_freelists));
+    return 0;
+}
+
+void *anytree_pool_alloc(struct anytree_pool *pool, size_t size)
+{
+    struct anytree_pool_chunk *chunk;
+    void **head;
+    char *block;
+
+    size = round_up(size ? size : 1, ANYTREE_POOL_ALIGN);
+    if (size > ANYTREE_POOL_MAX_CLASS_SIZE) {
+        chunk = add_chunk(pool, CHUNK_HEADER_SIZE + size);
+        return chunk ? (char *)chunk + CHUNK_HEADER_SIZE : NULL;
+    }
+
+    head = &pool->freelists[size / ANYTREE_POOL_ALIGN - 1];
+    if (*head) {
+        block = (char *)*head;
+        *head = *(void **)block;
+        return block;
+    }
+
+    if ((size_t)(pool->end - pool->cur) < size) {
+        chunk = add_chunk(pool, pool->chunk_size);
+        if (!chunk)
+            return NULL;
+        pool->cur = (char *)chunk + CHUNK_HEADER_SIZE;
+        pool->end = (char *)chunk + chunk->size;
+    }
+    block = pool->cur;
+    pool->cur += size;
+    return block;
+}
+
+void anytree_pool_free(struct anytree_pool *pool, void *ptr, size_t size)
+{
+    void **head;
+
+    if (!ptr)
+        return;
+    size = round_up(size ? size : 1, ANYTREE_POOL_ALIGN);
+    if (size > ANYTREE_POOL_MAX_CLASS_SIZE)
+        return;
+
+    head = &pool->freelists[size / ANYTREE_POOL_ALIGN - 1];
+    *(void **)ptr = *head;
+    *head = ptr;
+}
+
+static inline size_t line_gap(const char *ptr)
+{
+    return round_up((uintptr_t)ptr, ANYTREE_POOL_LINE) - (uintptr_t)ptr;
+}
+
+void *anytree_pool_alloc_aligned(struct anytree_pool *pool, size_t size)
+{
+    struct anytree_pool_chunk *chunk;
+    void **head;
+    char *block;
+    size_t gap;
+
+    size = round_up(size ? size : 1, ANYTREE_POOL_LINE);
+    if (size > ANYTREE_POOL_MAX_CLASS_SIZE) {
+        chunk = add_chunk(pool, CHUNK_HEADER_SIZE + LINE_SLACK + size);
+        if (!chunk)
+            return NULL;
+        block = (char *)chunk + CHUNK_HEADER_SIZE;
+        return block + line_gap(block);
+    }
+
+    head = &pool->line_freelists[size / ANYTREE_POOL_LINE - 1];
+    if (*head) {
+        block = (char *)*head;
+        *head = *(void **)block;
+        return block;
+    }
+
+    gap = line_gap(pool->cur);
+    if ((size_t)(pool->end - pool->cur) < gap + size) {
+        chunk = add_chunk(pool, pool->chunk_size);
+        if (!chunk)
+            return NULL;
+        pool->cur = (char *)chunk + CHUNK_HEADER_SIZE;
+        pool->end = (char *)chunk + chunk->size;
+        gap = line_gap(pool->cur);
+    }
+    if (gap)
+        anytree_pool_free(pool, pool->cur, gap);
+    block = pool->cur + gap;
+    pool->cur = block + size;
+    return block;
+}
+
+void anytree_pool_free_aligned(struct anytree_pool *pool, void *ptr, size_t size)
+{
+    void **head;
+
+    if (!ptr)
+        return;
+    size = round_up(size ? size : 1, ANYTREE_POOL_LINE);
+    if (size > ANYTREE_POOL_MAX_CLASS_SIZE)
+        return;
+
+    head = &pool->line_freelists[size / ANYTREE_POOL_LINE - 1];
+    *(void **)ptr = *head;
+    *head = ptr;
+}
+
+void anytree_pool_release(struct anytree_pool *pool)
+{
+    struct anytree_pool_chunk *chunk, *next;
+
+    for (chunk = pool->chunks; chunk; chunk = next) {
+        next = chunk->next;
+        unmap_chunk(chunk);
+    }
+    anytree_pool_init(pool, pool->chunk_size, pool->flags);
+}
@@ -0,0 +1,56 @@
+#ifndef ANYTREE__POOL__INCLUDED
+#define ANYTREE__POOL__INCLUDED
+
+#include <stddef.h>
+
+
+/*
+ * Arena allocator for tree handles and the containers embedding the nodes.
+ * Memory is carved from large chunks; freed blocks go to a freelist per
+ * 16 byte size class and are reused by later allocations of that class.
+ * anytree_pool_release() hands all chunks back at once, without walking
+ * the blocks, so a tree and everything allocated for it go together.
+ *
+ * Blocks above ANYTREE_POOL_MAX_CLASS_SIZE get a chunk of their own and are
+ * only returned by anytree_pool_release(). A pool is not thread-safe.
+ *
+ * anytree_pool_alloc_aligned() returns blocks aligned to a cache line, for
+ * nodes searched a line at a time. Their sizes are rounded up to a multiple
+ * of the line and they have freelists of their own; the gap skipped to align
+ * a new block goes to the freelist of its size.
+ */
+#define ANYTREE_POOL_ALIGN 16
+#define ANYTREE_POOL_MAX_CLASS_SIZE 1024
+#define ANYTREE_POOL_CLASSES (ANYTREE_POOL_MAX_CLASS_SIZE / ANYTREE_POOL_ALIGN)
+#define ANYTREE_POOL_LINE 64
+#define ANYTREE_POOL_LINE_CLASSES (ANYTREE_POOL_MAX_CLASS_SIZE / ANYTREE_POOL_LINE)
+
+/* Flags */
+#define ANYTREE_POOL_HUGEPAGES 1    /* back chunks with 2 MiB pages where the system allows */
+
+struct anytree_pool_chunk;
+
+struct anytree_pool {
+    struct anytree_pool_chunk *chunks;
+    char *cur, *end;                /* unused part of the newest chunk */
+    size_t chunk_size;
+    int flags;
+
+    void *freelists[ANYTREE_POOL_CLASSES];
+    void *line_freelists[ANYTREE_POOL_LINE_CLASSES];
+};
+
+/* A chunk_size of 0 picks a default */
+int anytree_pool_init(struct anytree_pool *pool, size_t chunk_size, int flags);
+void *anytree_pool_alloc(struct anytree_pool *pool, size_t size);
+/* 'size' must be the one passed to anytree_pool_alloc() */
+void anytree_pool_free(struct anytree_pool *pool, void *ptr, size_t size);
+void *anytree_pool_alloc_aligned(struct anytree_pool *pool, size_t size);
+/* 'size' must be the one passed to anytree_pool_alloc_aligned() */
+void anytree_pool_free_aligned(struct anytree_pool *pool, void *ptr, size_t size);
+void anytree_pool_release(struct anytree_pool *pool);
+
+#define anytree_pool_new(POOL, TYPE) ((TYPE *)anytree_pool_alloc(POOL, sizeof(TYPE)))
+#define anytree_pool_delete(POOL, PTR) anytree_pool_free(POOL, PTR, sizeof(*(PTR)))
+
+#endif
@@ -1,4 +1,55 @@
 #include "rb.h"
+#include "veb.h"
+
+/* Tree back-pointer, see avl.c */
+#ifdef ANYTREE_NO_TREE_POINTER
+static inline void set_tree(struct rbtree *tree, struct rbtree_node *node)
+{
+    (void)tree;
+    (void)node;
+}
+
+static inline int in_tree(const struct rbtree_node *node, const struct rbtree *tree)
+{
+    (void)node;
+    (void)tree;
+    return 1;
+}
+#else
+static inline void set_tree(struct rbtree *tree, struct rbtree_node *node)
+{
+    node->tree = tree;
+}
+
+static inline int in_tree(const struct rbtree_node *node, const struct rbtree *tree)
+{
+    return node->tree == tree;
+}
+#endif
+
+#ifdef ANYTREE_COMPACT_NODES
+
+static inline enum rb_color get_color(const struct rbtree_node *node)
+{
+    return (node->parent_color & 1) ? RB_RED : RB_BLACK;
+}
+
+static inline void set_color(enum rb_color color, struct rbtree_node *node)
+{
+    node->parent_color = (node->parent_color & ~(uintptr_t)1) | (color == RB_BLACK ? 0 : 1);
+}
+
+static inline struct rbtree_node *get_parent(const struct rbtree_node *node)
+{
+    return rbtree_parent(node);
+}
+
+static inline void set_parent(struct rbtree_node *parent, struct rbtree_node *node)
+{
+    node->parent_color = (uintptr_t)parent | (node->parent_color & 1);
+}
+
+#else
 
 static inline enum rb_color get_color(const struct rbtree_node *node)
 {
@@ -20,6 +71,42 @@ static inline void set_parent(struct rbtree_node *parent, struct rbtree_node *no
     node->parent = parent;
 }
 
+#endif
+
+/* Subtree sizes, only present in ranked trees */
+static inline unsigned get_count(const struct rbtree_node *node)
+{
+    if (!node)
+        return 0;
+    return rbtree_container_of(node, struct rbtree_ranked_node, node)->count;
+}
+
+static inline void set_count(unsigned count, struct rbtree_node *node)
+{
+    rbtree_container_of(node, struct rbtree_ranked_node, node)->count = count;
+}
+
+static inline void update_count(struct rbtree_node *node)
+{
+    set_count(get_count(node->left) + get_count(node->right) + 1, node);
+}
+
+static inline void update_counts(struct rbtree_node *node)
+{
+    for (; node; node = get_parent(node))
+        update_count(node);
+}
+
+/* A freshly linked node's stale aggregate is computed before propagating, see avl.c */
+static inline void augment_linked(struct rbtree_node *node, struct rbtree *tree)
+{
+    struct rbtree_node *parent = get_parent(node);
+
+    tree->augment->propagate(node, parent);
+    if (parent)
+        tree->augment->propagate(parent, NULL);
+}
+
 
 static inline int is_root(struct rbtree_node *node)
 {
@@ -36,11 +123,27 @@ static inline int is_red(struct rbtree_node *node)
     return !is_black(node);
 }
 
+/*
+ * Stores of child and root links. The copies of a latch tree are walked by
+ * lockless readers while the writer changes them (see rblatch.c), so their
+ * links are stored whole and with release order, as rb_link_node_rcu()
+ * does: a reader following a link sees the node's own links and the
+ * caller's key as they were before it was linked. Other trees get plain
+ * stores.
+ */
+static inline void write_link(struct rbtree_node **link, struct rbtree_node *node, const struct rbtree *tree)
+{
+    if (tree->lockless)
+        __atomic_store_n(link, node, __ATOMIC_RELEASE);
+    else
+        *link = node;
+}
+
 static inline void INIT_NODE(struct rbtree_node *node, struct rbtree *tree)
 {
-    node->left = NULL;
-    node->right = NULL;
-    node->tree = tree;
+    write_link(&node->left, NULL, tree);
+    write_link(&node->right, NULL, tree);
+    set_tree(tree, node);
     set_color(RB_RED, node);
 }
 
@@ -115,7 +218,6 @@ static inline struct rbtree_node *do_lookup(const struct rbtree_node *key, const
     return NULL;
 }
 
-
 static void rotate_left(struct rbtree_node *node, struct rbtree *tree)
 {
     struct rbtree_node *p = node;
@@ -124,18 +226,25 @@ static void rotate_left(struct rbtree_node *node, struct rbtree *tree)
 
     if (!is_root(p)) {
         if (parent->left == p)
-            parent->left = q;
+            write_link(&parent->left, q, tree);
         else
-            parent->right = q;
+            write_link(&parent->right, q, tree);
     } else
-        tree->root = q;
+        write_link(&tree->root, q, tree);
     set_parent(parent, q);
     set_parent(q, p);
 
-    p->right = q->left;
+    write_link(&p->right, q->left, tree);
     if (p->right)
         set_parent(p, p->right);
-    q->left = p;
+    write_link(&q->left, p, tree);
+
+    if (tree->ranked) {
+        update_count(p);
+        update_count(q);
+    }
+    if (tree->augment)
+        tree->augment->rotate(p, q);
 }
 
 static void rotate_right(struct rbtree_node *node, struct rbtree *tree)
@@ -146,18 +255,25 @@ static void rotate_right(struct rbtree_node *node, struct rbtree *tree)
 
     if (!is_root(p)) {
         if (parent->left == p)
-            parent->left = q;
+            write_link(&parent->left, q, tree);
         else
-            parent->right = q;
+            write_link(&parent->right, q, tree);
     } else
-        tree->root = q;
+        write_link(&tree->root, q, tree);
     set_parent(parent, q);
     set_parent(q, p);
 
-    p->left = q->right;
+    write_link(&p->left, q->right, tree);
     if (p->left)
         set_parent(p, p->left);
-    q->right = p;
+    write_link(&q->right, p, tree);
+
+    if (tree->ranked) {
+        update_count(p);
+        update_count(q);
+    }
+    if (tree->augment)
+        tree->augment->rotate(p, q);
 }
 
 struct rbtree_node *rbtree_lookup(const struct rbtree_node *key, const struct rbtree *tree)
@@ -168,26 +284,201 @@ struct rbtree_node *rbtree_lookup(const struct rbtree_node *key, const struct rb
     return do_lookup(key, tree, &parent, &is_left);
 }
 
-static void set_child(struct rbtree_node *child, struct rbtree_node *node, int left)
+/*
+ * Bounded searches: a single descent remembering the closest node seen on
+ * the requested side of the key.
+ */
+static struct rbtree_node *do_bound(const struct rbtree_node *key, const struct rbtree *tree, int after, int strict)
 {
-    if (left)
-        node->left = child;
-    else
-        node->right = child;
+    struct rbtree_node *node = tree->root;
+    struct rbtree_node *bound = NULL;
+
+    while (node) {
+        int res = tree->cmp_fn(node, key);
+        if (res == 0 && !strict)
+            return node;
+        if (after) {
+            if (res > 0) {
+                bound = node;
+                node = node->left;
+            } else
+                node = node->right;
+        } else {
+            if (res < 0) {
+                bound = node;
+                node = node->right;
+            } else
+                node = node->left;
+        }
+    }
+    return bound;
 }
 
-struct rbtree_node *rbtree_insert(struct rbtree_node *node, struct rbtree *tree)
+struct rbtree_node *rbtree_lower_bound(const struct rbtree_node *key, const struct rbtree *tree)
 {
-    struct rbtree_node *key, *parent;
-    int is_left;
+    return do_bound(key, tree, 1, 0);
+}
 
-    key = do_lookup(node, tree, &parent, &is_left);
-    if (key)
-        return key;
+struct rbtree_node *rbtree_upper_bound(const struct rbtree_node *key, const struct rbtree *tree)
+{
+    return do_bound(key, tree, 1, 1);
+}
+
+struct rbtree_node *rbtree_floor(const struct rbtree_node *key, const struct rbtree *tree)
+{
+    return do_bound(key, tree, 0, 0);
+}
+
+/* Range [lo, hi), see avltree_range() */
+struct rbtree_node *rbtree_range(const struct rbtree_node *lo, const struct rbtree_node *hi, const struct rbtree *tree, struct rbtree_node **end)
+{
+    *end = NULL;
+    if (!tree->root || (lo && hi && tree->cmp_fn(lo, hi) >= 0))
+        return NULL;
+
+    if (hi && tree->cmp_fn(tree->last, hi) >= 0)
+        *end = rbtree_lower_bound(hi, tree);
+    if (!lo || tree->cmp_fn(tree->first, lo) >= 0)
+        return tree->first;
+    return rbtree_lower_bound(lo, tree);
+}
+
+unsigned rbtree_range_count(const struct rbtree_node *lo, const struct rbtree_node *hi, const struct rbtree *tree)
+{
+    struct rbtree_node *node, *end;
+    unsigned count = 0;
+
+    if (tree->ranked) {
+        node = rbtree_range(lo, hi, tree, &end);
+        if (node == end)
+            return 0;
+        return (end ? rbtree_rank(end, tree) : tree->size) - rbtree_rank(node, tree);
+    }
+    for (node = rbtree_range(lo, hi, tree, &end); node != end; node = rbtree_next(node))
+        count++;
+    return count;
+}
+
+/* Order statistics, see avl.c */
+struct rbtree_node *rbtree_select(unsigned k, const struct rbtree *tree)
+{
+    struct rbtree_node *node;
+    unsigned left;
+
+    if (k >= tree->size)
+        return NULL;
+
+    if (!tree->ranked) {
+        for (node = tree->first; k--; )
+            node = rbtree_next(node);
+        return node;
+    }
+    node = tree->root;
+    for (;;) {
+        left = get_count(node->left);
+        if (k == left)
+            return node;
+        if (k < left)
+            node = node->left;
+        else {
+            k -= left + 1;
+            node = node->right;
+        }
+    }
+}
+
+unsigned rbtree_rank(const struct rbtree_node *node, const struct rbtree *tree)
+{
+    const struct rbtree_node *parent;
+    unsigned rank = 0;
+
+    if (!tree->ranked) {
+        while ((node = rbtree_prev(node)))
+            rank++;
+        return rank;
+    }
+    rank = get_count(node->left);
+    for (; (parent = get_parent(node)); node = parent)
+        if (parent->right == node)
+            rank += get_count(parent->left) + 1;
+    return rank;
+}
+
+/*
+ * Searches by key: cmp(key, node) orders a bare key against the nodes, so
+ * callers need not wrap the key into a node of their own.
+ */
+static struct rbtree_node *do_bound_key(const void *key, rbtree_key_cmp_fn_t cmp, const struct rbtree *tree, int after, int strict)
+{
+    struct rbtree_node *node = tree->root;
+    struct rbtree_node *bound = NULL;
+
+    while (node) {
+        int res = cmp(key, node);
+        if (res == 0 && !strict)
+            return node;
+        if (after) {
+            if (res < 0) {
+                bound = node;
+                node = node->left;
+            } else
+                node = node->right;
+        } else {
+            if (res > 0) {
+                bound = node;
+                node = node->right;
+            } else
+                node = node->left;
+        }
+    }
+    return bound;
+}
+
+struct rbtree_node *rbtree_lookup_key(const void *key, rbtree_key_cmp_fn_t cmp, const struct rbtree *tree)
+{
+    struct rbtree_node *node = tree->root;
+
+    while (node) {
+        int res = cmp(key, node);
+        if (res == 0)
+            return node;
+        if (res < 0)
+            node = node->left;
+        else
+            node = node->right;
+    }
+    return NULL;
+}
+
+struct rbtree_node *rbtree_lower_bound_key(const void *key, rbtree_key_cmp_fn_t cmp, const struct rbtree *tree)
+{
+    return do_bound_key(key, cmp, tree, 1, 0);
+}
+
+struct rbtree_node *rbtree_upper_bound_key(const void *key, rbtree_key_cmp_fn_t cmp, const struct rbtree *tree)
+{
+    return do_bound_key(key, cmp, tree, 1, 1);
+}
 
+struct rbtree_node *rbtree_floor_key(const void *key, rbtree_key_cmp_fn_t cmp, const struct rbtree *tree)
+{
+    return do_bound_key(key, cmp, tree, 0, 0);
+}
+
+static void set_child(struct rbtree_node *child, struct rbtree_node *node, int left, const struct rbtree *tree)
+{
+    write_link(left ? &node->left : &node->right, child, tree);
+}
+
+static void insert_fixup(struct rbtree_node *node, struct rbtree *tree);
+
+static void do_insert(struct rbtree_node *node, struct rbtree_node *parent, int is_left, struct rbtree *tree)
+{
     ++tree->size;
 
     INIT_NODE(node, tree);
+    if (tree->ranked)
+        set_count(1, node);
 
     set_parent(parent, node);
 
@@ -199,12 +490,25 @@ struct rbtree_node *rbtree_insert(struct rbtree_node *node, struct rbtree *tree)
             if (parent == tree->last)
                 tree->last = node;
         }
-        set_child(node, parent, is_left);
+        set_child(node, parent, is_left, tree);
+        if (tree->ranked)
+            update_counts(parent);
     } else {
-        tree->root = node;
+        write_link(&tree->root, node, tree);
         tree->first = node;
         tree->last = node;
     }
+    if (tree->augment)
+        augment_linked(node, tree);
+
+    insert_fixup(node, tree);
+    set_color(RB_BLACK, tree->root);
+}
+
+/* Restores the red-black properties above the red 'node'; the root may be left red. */
+static void insert_fixup(struct rbtree_node *node, struct rbtree *tree)
+{
+    struct rbtree_node *parent;
 
     while ((parent = get_parent(node)) && is_red(parent)) {
         struct rbtree_node *grandpa = get_parent(parent);
@@ -247,10 +551,68 @@ struct rbtree_node *rbtree_insert(struct rbtree_node *node, struct rbtree *tree)
             }
         }
     }
-    set_color(RB_BLACK, tree->root);
+}
+
+struct rbtree_node *rbtree_insert(struct rbtree_node *node, struct rbtree *tree)
+{
+    struct rbtree_node *key, *parent;
+    int is_left;
+
+    key = do_lookup(node, tree, &parent, &is_left);
+    if (key)
+        return key;
+
+    do_insert(node, parent, is_left, tree);
+    return NULL;
+}
+
+/* Links 'node' at a free child slot of 'parent', see avl.c */
+void rbtree_link(struct rbtree_node *node, struct rbtree_node *parent, int is_left, struct rbtree *tree)
+{
+    do_insert(node, parent, is_left, tree);
+}
+
+/* Hinted insertion between two neighbours, see avl.c */
+static struct rbtree_node *insert_between(struct rbtree_node *node, struct rbtree_node *prev, struct rbtree_node *next, struct rbtree *tree)
+{
+    int res;
+
+    if (prev) {
+        res = tree->cmp_fn(prev, node);
+        if (res == 0)
+            return prev;
+        if (res > 0)
+            return rbtree_insert(node, tree);
+    }
+    if (next) {
+        res = tree->cmp_fn(next, node);
+        if (res == 0)
+            return next;
+        if (res < 0)
+            return rbtree_insert(node, tree);
+    }
+
+    if (prev && !prev->right)
+        do_insert(node, prev, 0, tree);
+    else
+        do_insert(node, next, 1, tree);
     return NULL;
 }
 
+struct rbtree_node *rbtree_insert_after(struct rbtree_node *node, struct rbtree_node *hint, struct rbtree *tree)
+{
+    if (hint && !in_tree(hint, tree))
+        return rbtree_insert(node, tree);
+    return insert_between(node, hint, hint ? rbtree_next(hint) : tree->first, tree);
+}
+
+struct rbtree_node *rbtree_insert_before(struct rbtree_node *node, struct rbtree_node *hint, struct rbtree *tree)
+{
+    if (hint && !in_tree(hint, tree))
+        return rbtree_insert(node, tree);
+    return insert_between(node, hint ? rbtree_prev(hint) : tree->last, hint, tree);
+}
+
 void rbtree_remove(struct rbtree_node *node, struct rbtree *tree)
 {
     struct rbtree_node *parent = get_parent(node);
@@ -259,7 +621,7 @@ void rbtree_remove(struct rbtree_node *node, struct rbtree *tree)
     struct rbtree_node *next;
     enum rb_color color;
 
-    if (tree && (node->tree != tree))
+    if (tree && !in_tree(node, tree))
         return;
 
     --tree->size;
@@ -277,15 +639,17 @@ void rbtree_remove(struct rbtree_node *node, struct rbtree *tree)
         next = get_first(right);
 
     if (parent)
-        set_child(next, parent, parent->left == node);
+        set_child(next, parent, parent->left == node, tree);
     else
-        tree->root = next;
+        write_link(&tree->root, next, tree);
 
     if (left && right) {
         color = get_color(next);
         set_color(get_color(node), next);
+        if (tree->augment)
+            tree->augment->copy(node, next);
 
-        next->left = left;
+        write_link(&next->left, left, tree);
         set_parent(next, left);
 
         if (next != right) {
@@ -293,9 +657,9 @@ void rbtree_remove(struct rbtree_node *node, struct rbtree *tree)
             set_parent(get_parent(node), next);
 
             node = next->right;
-            parent->left = node;
+            write_link(&parent->left, node, tree);
 
-            next->right = right;
+            write_link(&next->right, right, tree);
             set_parent(next, right);
         } else {
             set_parent(parent, next);
@@ -309,8 +673,17 @@ void rbtree_remove(struct rbtree_node *node, struct rbtree *tree)
     
     if (node)
         set_parent(parent, node);
+    if (tree->ranked)
+        update_counts(parent);
+    if (tree->augment) {
+        if (left && right) {
+            if (parent != next)
+                tree->augment->propagate(parent, next);
+            tree->augment->propagate(next, NULL);
+        } else if (parent)
+            tree->augment->propagate(parent, NULL);
+    }
 
-    
     if (color == RB_RED)
         return;
     if (node && is_red(node)) {
@@ -385,14 +758,23 @@ void rbtree_remove(struct rbtree_node *node, struct rbtree *tree)
         set_color(RB_BLACK, node);
 }
 
+struct rbtree_node *rbtree_remove_key(const void *key, rbtree_key_cmp_fn_t cmp, struct rbtree *tree)
+{
+    struct rbtree_node *node = rbtree_lookup_key(key, cmp, tree);
+
+    if (node)
+        rbtree_remove(node, tree);
+    return node;
+}
+
 void rbtree_replace(struct rbtree_node *old, struct rbtree_node *node, struct rbtree *tree)
 {
     struct rbtree_node *parent = get_parent(old);
 
     if (parent)
-        set_child(node, parent, parent->left == old);
+        set_child(node, parent, parent->left == old, tree);
     else
-        tree->root = node;
+        write_link(&tree->root, node, tree);
 
     if (old->left)
         set_parent(node, old->left);
@@ -405,6 +787,321 @@ void rbtree_replace(struct rbtree_node *old, struct rbtree_node *node, struct rb
         tree->last = node;
 
     *node = *old;
+    if (tree->ranked)
+        set_count(get_count(old), node);
+    if (tree->augment)
+        tree->augment->copy(old, node);
+}
+
+/*
+ * Bulk build from nodes sorted in strictly ascending order, see avl.c.
+ * All external paths of the balanced tree end on the last two levels, so
+ * colouring the deepest level red (except a lone root) and everything else
+ * black gives every path the same black height.
+ */
+static struct rbtree_node *build_sorted(struct rbtree_node **nodes, unsigned count, struct rbtree_node *parent, int depth, int red_depth, struct rbtree *tree)
+{
+    struct rbtree_node *node;
+    unsigned mid = count / 2;
+
+    if (!count)
+        return NULL;
+    node = nodes[mid];
+    INIT_NODE(node, tree);
+    set_parent(parent, node);
+    set_color(depth == red_depth ? RB_RED : RB_BLACK, node);
+    if (tree->ranked)
+        set_count(count, node);
+
+    node->left = build_sorted(nodes, mid, node, depth + 1, red_depth, tree);
+    node->right = build_sorted(nodes + mid + 1, count - mid - 1, node, depth + 1, red_depth, tree);
+    if (tree->augment)
+        tree->augment->propagate(node, parent);
+    return node;
+}
+
+int rbtree_build_sorted(struct rbtree_node **nodes, unsigned count, struct rbtree *tree)
+{
+    unsigned c;
+    int red_depth = 0;
+
+    if (tree->size)
+        return -1;
+
+    for (c = count; c > 1; c >>= 1)
+        red_depth++;
+    tree->root = build_sorted(nodes, count, NULL, 0, red_depth ? red_depth : -1, tree);
+    tree->size = count;
+    tree->first = count ? nodes[0] : NULL;
+    tree->last = count ? nodes[count - 1] : NULL;
+    return 0;
+}
+
+static void *veb_child(const void *node, int right)
+{
+    const struct rbtree_node *n = (const struct rbtree_node *)node;
+    return right ? n->right : n->left;
+}
+
+static inline struct rbtree_node *moved(const struct anytree_veb *veb, const struct rbtree_node *node)
+{
+    return (struct rbtree_node *)anytree_veb_moved(veb, node);
+}
+
+int rbtree_relayout(struct rbtree *tree, void *array, unsigned count, size_t stride, size_t offset)
+{
+    struct anytree_veb veb;
+    struct rbtree_node *node;
+    unsigned i;
+
+    if (anytree_veb_plan(&veb, array, count, stride, offset, tree->root, tree->size, veb_child))
+        return -1;
+    anytree_veb_move(&veb);
+
+    for (i = 0; i < tree->size; i++) {
+        node = (struct rbtree_node *)anytree_veb_node(&veb, i);
+        node->left = moved(&veb, node->left);
+        node->right = moved(&veb, node->right);
+        set_parent(moved(&veb, get_parent(node)), node);
+    }
+    tree->root = moved(&veb, tree->root);
+    tree->first = moved(&veb, tree->first);
+    tree->last = moved(&veb, tree->last);
+
+    anytree_veb_done(&veb);
+    return 0;
+}
+
+/* Empties 'tree', giving it the comparator and options of 'like' */
+static void init_like(struct rbtree *tree, const struct rbtree *like)
+{
+    int ranked = like->ranked;
+    const struct rbtree_augment_callbacks *augment = like->augment;
+
+    rbtree_init(tree, like->cmp_fn);
+    tree->ranked = ranked;
+    tree->augment = augment;
+}
+
+/*
+ * Join and split. do_join() links two detached subtrees of black heights
+ * 'lbh' and 'rbh' under 'pivot': the pivot replaces a black node of the
+ * shorter height on the inner spine of the taller subtree and is fixed up
+ * like a freshly inserted red node. The result is rooted in scratch->root
+ * and its black height is returned.
+ */
+static int do_join(struct rbtree_node *left, int lbh, struct rbtree_node *pivot, struct rbtree_node *right, int rbh, struct rbtree *scratch)
+{
+    struct rbtree_node *parent = NULL, *node;
+    int bh;
+
+    if (left && is_red(left)) {
+        set_color(RB_BLACK, left);
+        lbh++;
+    }
+    if (right && is_red(right)) {
+        set_color(RB_BLACK, right);
+        rbh++;
+    }
+    if (left)
+        set_parent(NULL, left);
+    if (right)
+        set_parent(NULL, right);
+
+    if (lbh == rbh) {
+        pivot->left = left;
+        pivot->right = right;
+        if (left)
+            set_parent(pivot, left);
+        if (right)
+            set_parent(pivot, right);
+        set_parent(NULL, pivot);
+        set_color(RB_BLACK, pivot);
+        if (scratch->ranked)
+            update_count(pivot);
+        if (scratch->augment)
+            augment_linked(pivot, scratch);
+        scratch->root = pivot;
+        return lbh + 1;
+    }
+
+    if (lbh > rbh) {
+        for (node = left, bh = lbh; bh > rbh || (node && is_red(node)); node = node->right) {
+            bh -= is_black(node);
+            parent = node;
+        }
+        pivot->left = node;
+        pivot->right = right;
+        parent->right = pivot;
+        scratch->root = left;
+        bh = lbh;
+    } else {
+        for (node = right, bh = rbh; bh > lbh || (node && is_red(node)); node = node->left) {
+            bh -= is_black(node);
+            parent = node;
+        }
+        pivot->left = left;
+        pivot->right = node;
+        parent->left = pivot;
+        scratch->root = right;
+        bh = rbh;
+    }
+    if (pivot->left)
+        set_parent(pivot, pivot->left);
+    if (pivot->right)
+        set_parent(pivot, pivot->right);
+    set_parent(parent, pivot);
+    set_color(RB_RED, pivot);
+    if (scratch->ranked)
+        update_counts(pivot);
+    if (scratch->augment)
+        augment_linked(pivot, scratch);
+
+    insert_fixup(pivot, scratch);
+    if (is_red(scratch->root)) {
+        set_color(RB_BLACK, scratch->root);
+        bh++;
+    }
+    return bh;
+}
+
+static int black_height(struct rbtree_node *node)
+{
+    int bh = 0;
+
+    for (; node; node = node->left)
+        bh += is_black(node);
+    return bh;
+}
+
+/* Moves the nodes of a detached subtree over to 'tree' and counts them. */
+static unsigned adopt(struct rbtree_node *root, struct rbtree *tree)
+{
+    struct rbtree_node *node;
+    unsigned count = 0;
+
+    if (!root)
+        return 0;
+#ifdef ANYTREE_NO_TREE_POINTER
+    if (tree->ranked)
+        return get_count(root);
+#endif
+    for (node = get_first(root); node; node = rbtree_next(node)) {
+        set_tree(tree, node);
+        count++;
+    }
+    return count;
+}
+
+/*
+ * Keys in 'left' must precede 'pivot', which must precede the keys in
+ * 'right'. A NULL pivot is taken from the front of 'right'. All nodes end
+ * up in 'left' and 'right' is left empty. Linking is O(log n), but the
+ * nodes coming from 'right' are walked to update their tree pointer, so
+ * that join costs O(log n + size of 'right'). Built with
+ * ANYTREE_NO_TREE_POINTER there is no walk and join is O(log n).
+ */
+void rbtree_join(struct rbtree *left, struct rbtree_node *pivot, struct rbtree *right)
+{
+    struct rbtree scratch;
+    unsigned size;
+
+    scratch.ranked = left->ranked;
+    scratch.lockless = 0;
+    scratch.augment = left->augment;
+    if (!pivot) {
+        pivot = right->first;
+        if (!pivot)
+            return;
+        rbtree_remove(pivot, right);
+    }
+    size = left->size + right->size + 1;
+#ifndef ANYTREE_NO_TREE_POINTER
+    adopt(right->root, left);
+    set_tree(left, pivot);
+#endif
+
+    do_join(left->root, black_height(left->root), pivot, right->root, black_height(right->root), &scratch);
+
+    left->root = scratch.root;
+    left->size = size;
+    if (!left->first)
+        left->first = pivot;
+    left->last = right->last ? right->last : pivot;
+    init_like(right, right);
+}
+
+static void do_split(struct rbtree_node *node, int bh, const struct rbtree_node *key, const struct rbtree *tree,
+                     struct rbtree_node **left, int *lbh, struct rbtree_node **right, int *rbh)
+{
+    struct rbtree scratch;
+    struct rbtree_node *sub;
+    int res;
+
+    scratch.ranked = tree->ranked;
+    scratch.lockless = 0;
+    scratch.augment = tree->augment;
+    if (!node) {
+        *left = *right = NULL;
+        *lbh = *rbh = 0;
+        return;
+    }
+    bh -= is_black(node);
+    res = tree->cmp_fn(node, key);
+    if (res < 0) {
+        sub = node->left;
+        do_split(node->right, bh, key, tree, left, lbh, right, rbh);
+        *lbh = do_join(sub, bh, node, *left, *lbh, &scratch);
+        *left = scratch.root;
+    } else {
+        if (res == 0) {
+            *left = node->left;
+            *lbh = bh;
+            *right = NULL;
+            *rbh = 0;
+        } else
+            do_split(node->left, bh, key, tree, left, lbh, right, rbh);
+        sub = node->right;
+        *rbh = do_join(*right, *rbh, node, sub, bh, &scratch);
+        *right = scratch.root;
+    }
+}
+
+/*
+ * Moves every node not less than 'key' into 'right', which is
+ * (re)initialized with the comparator of 'tree'. Relinking is O(log n),
+ * but the nodes moving to 'right' are walked to update their tree pointer
+ * and to count them, so that split costs O(log n + nodes moved). Built
+ * with ANYTREE_NO_TREE_POINTER a ranked tree takes the count from the
+ * root and splits in O(log n); a plain one still walks to count.
+ */
+void rbtree_split(const struct rbtree_node *key, struct rbtree *tree, struct rbtree *right)
+{
+    struct rbtree_node *l, *r, *first = tree->first, *last = tree->last;
+    int lbh, rbh;
+
+    init_like(right, tree);
+    if (!tree->root)
+        return;
+
+    do_split(tree->root, black_height(tree->root), key, tree, &l, &lbh, &r, &rbh);
+    if (l) {
+        set_parent(NULL, l);
+        set_color(RB_BLACK, l);
+    }
+    if (r) {
+        set_parent(NULL, r);
+        set_color(RB_BLACK, r);
+    }
+
+    tree->root = l;
+    tree->first = l ? first : NULL;
+    tree->last = l ? get_last(l) : NULL;
+    right->root = r;
+    right->first = r ? get_first(r) : NULL;
+    right->last = r ? last : NULL;
+    right->size = adopt(r, right);
+    tree->size -= right->size;
 }
 
 int rbtree_init(struct rbtree *tree, rbtree_cmp_fn_t fn)
@@ -414,6 +1111,23 @@ int rbtree_init(struct rbtree *tree, rbtree_cmp_fn_t fn)
     tree->root = NULL;
     tree->first = NULL;
     tree->last = NULL;
+    tree->ranked = 0;
+    tree->lockless = 0;
+    tree->augment = NULL;
+    return 0;
+}
+
+int rbtree_init_ranked(struct rbtree *tree, rbtree_cmp_fn_t fn)
+{
+    rbtree_init(tree, fn);
+    tree->ranked = 1;
+    return 0;
+}
+
+int rbtree_init_augmented(struct rbtree *tree, rbtree_cmp_fn_t fn, const struct rbtree_augment_callbacks *augment)
+{
+    rbtree_init(tree, fn);
+    tree->augment = augment;
     return 0;
 }
 
@@ -421,8 +1135,8 @@ void rbtree_clean(struct rbtree *tree)
 {
     struct rbtree_node *i;
     for (i = rbtree_first(tree); i; i = rbtree_next(i))
-        i->tree = NULL;
-    rbtree_init(tree, tree->cmp_fn);
+        set_tree(NULL, i);
+    init_like(tree, tree);
 }
 
 void rbtree_foreach(struct rbtree *tree, rbtree_call_fn_t call)
@@ -22,14 +22,66 @@ enum rb_color {
 
 struct rbtree;
 
+#ifdef ANYTREE_COMPACT_NODES
+/* The color lives in the low bit of the parent pointer */
 struct rbtree_node {
+#ifndef ANYTREE_NO_TREE_POINTER
     struct rbtree *tree;
+#endif
+    struct rbtree_node *left, *right;
+    uintptr_t parent_color;
+};
+#  define rbtree_parent(NODE) ((struct rbtree_node *)((NODE)->parent_color & ~(uintptr_t)1))
+#else
+struct rbtree_node {
+#ifndef ANYTREE_NO_TREE_POINTER
+    struct rbtree *tree;
+#endif
     struct rbtree_node *left, *right;
     struct rbtree_node *parent;
     unsigned red_color:1;
 };
+#  define rbtree_parent(NODE) ((NODE)->parent)
+#endif
+
+/* Node of a tree set up with rbtree_init_ranked(), which keeps subtree sizes */
+struct rbtree_ranked_node {
+    struct rbtree_node node;
+    unsigned count;
+};
 
 typedef int (*rbtree_cmp_fn_t)(const struct rbtree_node *, const struct rbtree_node *);
+typedef int (*rbtree_key_cmp_fn_t)(const void *key, const struct rbtree_node *);
+
+/* Augmentation callbacks, see avl.h */
+struct rbtree_augment_callbacks {
+    void (*propagate)(struct rbtree_node *node, struct rbtree_node *stop);
+    void (*copy)(struct rbtree_node *old, struct rbtree_node *node);
+    void (*rotate)(struct rbtree_node *old, struct rbtree_node *node);
+};
+
+#define RBTREE_AUGMENT_CALLBACKS(NAME, TYPE, MEMBER, FIELD, COMPUTE)                 \
+static void NAME##_propagate(struct rbtree_node *node, struct rbtree_node *stop)    \
+{                                                                                   \
+    while (node != stop) {                                                          \
+        if (COMPUTE(rbtree_container_of(node, TYPE, MEMBER), 1))                    \
+            break;                                                                  \
+        node = rbtree_parent(node);                                                 \
+    }                                                                               \
+}                                                                                   \
+static void NAME##_copy(struct rbtree_node *old, struct rbtree_node *node)          \
+{                                                                                   \
+    rbtree_container_of(node, TYPE, MEMBER)->FIELD =                                \
+        rbtree_container_of(old, TYPE, MEMBER)->FIELD;                              \
+}                                                                                   \
+static void NAME##_rotate(struct rbtree_node *old, struct rbtree_node *node)        \
+{                                                                                   \
+    NAME##_copy(old, node);                                                         \
+    COMPUTE(rbtree_container_of(old, TYPE, MEMBER), 0);                             \
+}                                                                                   \
+static const struct rbtree_augment_callbacks NAME = {                               \
+    NAME##_propagate, NAME##_copy, NAME##_rotate                                    \
+}
 
 struct rbtree {
     rbtree_cmp_fn_t cmp_fn;
@@ -37,6 +89,10 @@ struct rbtree {
 
     struct rbtree_node *root;
     struct rbtree_node *first, *last;
+
+    int ranked;
+    int lockless;               /* set by rblatch.h, see write_link() in rb.c */
+    const struct rbtree_augment_callbacks *augment;
 };
 
 struct rbtree_node *rbtree_first(const struct rbtree *tree);
@@ -45,18 +101,142 @@ struct rbtree_node *rbtree_next(const struct rbtree_node *node);
 struct rbtree_node *rbtree_prev(const struct rbtree_node *node);
 
 struct rbtree_node *rbtree_lookup(const struct rbtree_node *key, const struct rbtree *tree);
+struct rbtree_node *rbtree_lower_bound(const struct rbtree_node *key, const struct rbtree *tree);
+struct rbtree_node *rbtree_upper_bound(const struct rbtree_node *key, const struct rbtree *tree);
+struct rbtree_node *rbtree_floor(const struct rbtree_node *key, const struct rbtree *tree);
+#define rbtree_ceil(KEY, TREE) rbtree_lower_bound(KEY, TREE)
+
+struct rbtree_node *rbtree_range(const struct rbtree_node *lo, const struct rbtree_node *hi, const struct rbtree *tree, struct rbtree_node **end);
+unsigned rbtree_range_count(const struct rbtree_node *lo, const struct rbtree_node *hi, const struct rbtree *tree);
+
+struct rbtree_node *rbtree_lookup_key(const void *key, rbtree_key_cmp_fn_t cmp, const struct rbtree *tree);
+struct rbtree_node *rbtree_lower_bound_key(const void *key, rbtree_key_cmp_fn_t cmp, const struct rbtree *tree);
+struct rbtree_node *rbtree_upper_bound_key(const void *key, rbtree_key_cmp_fn_t cmp, const struct rbtree *tree);
+struct rbtree_node *rbtree_floor_key(const void *key, rbtree_key_cmp_fn_t cmp, const struct rbtree *tree);
+struct rbtree_node *rbtree_remove_key(const void *key, rbtree_key_cmp_fn_t cmp, struct rbtree *tree);
 struct rbtree_node *rbtree_insert(struct rbtree_node *node, struct rbtree *tree);
+struct rbtree_node *rbtree_insert_after(struct rbtree_node *node, struct rbtree_node *hint, struct rbtree *tree);
+struct rbtree_node *rbtree_insert_before(struct rbtree_node *node, struct rbtree_node *hint, struct rbtree *tree);
+void rbtree_link(struct rbtree_node *node, struct rbtree_node *parent, int is_left, struct rbtree *tree);
 void rbtree_remove(struct rbtree_node *node, struct rbtree *tree);
 void rbtree_replace(struct rbtree_node *old, struct rbtree_node *node, struct rbtree *tree);
+int rbtree_build_sorted(struct rbtree_node **nodes, unsigned count, struct rbtree *tree);
+
+/*
+ * Relayout during a quiet period: the tree's nodes are embedded in
+ * 'array', 'count' elements of 'stride' bytes with the node at 'offset'.
+ * The elements are moved so that the tree's come first, in van Emde Boas
+ * order, and the others after them, and the links are fixed up. Pointers
+ * to elements held outside the tree are stale afterwards. Fails, moving
+ * nothing, when a node is not in the array or when out of memory.
+ */
+int rbtree_relayout(struct rbtree *tree, void *array, unsigned count, size_t stride, size_t offset);
+#define RBTREE_RELAYOUT(TREE, ARRAY, MEMBER, COUNT) \
+    rbtree_relayout(TREE, ARRAY, COUNT, sizeof((ARRAY)[0]), (size_t)((char *)&(ARRAY)[0].MEMBER - (char *)&(ARRAY)[0]))
+
+struct rbtree_node *rbtree_select(unsigned k, const struct rbtree *tree);
+unsigned rbtree_rank(const struct rbtree_node *node, const struct rbtree *tree);
+
+void rbtree_join(struct rbtree *left, struct rbtree_node *pivot, struct rbtree *right);
+void rbtree_split(const struct rbtree_node *key, struct rbtree *tree, struct rbtree *right);
 
 #define rbtree_is_empty(TREE) (TREE->size == 0)
 #define rbtree_size(TREE) (TREE->size)
 
 int rbtree_init(struct rbtree *tree, rbtree_cmp_fn_t cmp);
+int rbtree_init_ranked(struct rbtree *tree, rbtree_cmp_fn_t cmp);
+int rbtree_init_augmented(struct rbtree *tree, rbtree_cmp_fn_t cmp, const struct rbtree_augment_callbacks *augment);
 void rbtree_clean(struct rbtree *tree);
 
 typedef void (*rbtree_call_fn_t)(const struct rbtree_node *);
 void rbtree_foreach(struct rbtree *tree, rbtree_call_fn_t call);
 void rbtree_foreach_backward(struct rbtree *tree, rbtree_call_fn_t call);
 
+/* Type-specialized front end with an inlined comparator, see avl.h */
+#define RBTREE_GENERATE(NAME, TYPE, FIELD, CMP)                                                     \
+static inline TYPE *NAME##_entry(const struct rbtree_node *node)                                    \
+{                                                                                                   \
+    return node ? rbtree_container_of(node, TYPE, FIELD) : NULL;                                    \
+}                                                                                                   \
+static inline TYPE *NAME##_first(const struct rbtree *tree)                                         \
+{                                                                                                   \
+    return NAME##_entry(rbtree_first(tree));                                                        \
+}                                                                                                   \
+static inline TYPE *NAME##_last(const struct rbtree *tree)                                          \
+{                                                                                                   \
+    return NAME##_entry(rbtree_last(tree));                                                         \
+}                                                                                                   \
+static inline TYPE *NAME##_next(const TYPE *elm)                                                    \
+{                                                                                                   \
+    return NAME##_entry(rbtree_next(&elm->FIELD));                                                  \
+}                                                                                                   \
+static inline TYPE *NAME##_prev(const TYPE *elm)                                                    \
+{                                                                                                   \
+    return NAME##_entry(rbtree_prev(&elm->FIELD));                                                  \
+}                                                                                                   \
+static inline TYPE *NAME##_lookup(const TYPE *key, const struct rbtree *tree)                       \
+{                                                                                                   \
+    const struct rbtree_node *node = tree->root;                                                    \
+    while (node) {                                                                                  \
+        int res = CMP(key, NAME##_entry(node));                                                     \
+        if (res == 0)                                                                               \
+            return NAME##_entry(node);                                                              \
+        node = res < 0 ? node->left : node->right;                                                  \
+    }                                                                                               \
+    return NULL;                                                                                    \
+}                                                                                                   \
+static inline TYPE *NAME##_bound(const TYPE *key, const struct rbtree *tree, int after, int strict) \
+{                                                                                                   \
+    const struct rbtree_node *node = tree->root, *bound = NULL;                                     \
+    while (node) {                                                                                  \
+        int res = CMP(key, NAME##_entry(node));                                                     \
+        if (res == 0 && !strict)                                                                    \
+            return NAME##_entry(node);                                                              \
+        if (after) {                                                                                \
+            if (res < 0) {                                                                          \
+                bound = node;                                                                       \
+                node = node->left;                                                                  \
+            } else                                                                                  \
+                node = node->right;                                                                 \
+        } else {                                                                                    \
+            if (res > 0) {                                                                          \
+                bound = node;                                                                       \
+                node = node->right;                                                                 \
+            } else                                                                                  \
+                node = node->left;                                                                  \
+        }                                                                                           \
+    }                                                                                               \
+    return NAME##_entry(bound);                                                                     \
+}                                                                                                   \
+static inline TYPE *NAME##_lower_bound(const TYPE *key, const struct rbtree *tree)                  \
+{                                                                                                   \
+    return NAME##_bound(key, tree, 1, 0);                                                           \
+}                                                                                                   \
+static inline TYPE *NAME##_upper_bound(const TYPE *key, const struct rbtree *tree)                  \
+{                                                                                                   \
+    return NAME##_bound(key, tree, 1, 1);                                                           \
+}                                                                                                   \
+static inline TYPE *NAME##_floor(const TYPE *key, const struct rbtree *tree)                        \
+{                                                                                                   \
+    return NAME##_bound(key, tree, 0, 0);                                                           \
+}                                                                                                   \
+static inline TYPE *NAME##_insert(TYPE *elm, struct rbtree *tree)                                   \
+{                                                                                                   \
+    struct rbtree_node *node = tree->root, *parent = NULL;                                          \
+    int res = 0;                                                                                    \
+    while (node) {                                                                                  \
+        res = CMP(elm, NAME##_entry(node));                                                         \
+        if (res == 0)                                                                               \
+            return NAME##_entry(node);                                                              \
+        parent = node;                                                                              \
+        node = res < 0 ? node->left : node->right;                                                  \
+    }                                                                                               \
+    rbtree_link(&elm->FIELD, parent, res < 0, tree);                                                \
+    return NULL;                                                                                    \
+}                                                                                                   \
+static inline void NAME##_remove(TYPE *elm, struct rbtree *tree)                                    \
+{                                                                                                   \
+    rbtree_remove(&elm->FIELD, tree);                                                               \
+}
+
 #endif 
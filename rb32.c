@@ -0,0 +1,514 @@
+#include <assert.h>
+
+#include "rb32.h"
+
+/* The algorithms of rb.c over indices, see avl32.c */
+#define NIL RBTREE32_NIL
+#define PARENT_NIL (NIL >> 1)
+
+#define NODE(I) rbtree32_node_at(tree, I)
+#define LEFT(I) (NODE(I)->left)
+#define RIGHT(I) (NODE(I)->right)
+
+enum rb32_color {
+    RB32_BLACK,
+    RB32_RED
+};
+
+
+static inline enum rb32_color get_color(uint32_t node, const struct rbtree32 *tree)
+{
+    return (NODE(node)->parent_color & 1) ? RB32_RED : RB32_BLACK;
+}
+
+static inline void set_color(enum rb32_color color, uint32_t node, const struct rbtree32 *tree)
+{
+    NODE(node)->parent_color = (NODE(node)->parent_color & ~(uint32_t)1) | (color == RB32_BLACK ? 0 : 1);
+}
+
+static inline uint32_t get_parent(uint32_t node, const struct rbtree32 *tree)
+{
+    uint32_t parent = NODE(node)->parent_color >> 1;
+    return parent == PARENT_NIL ? NIL : parent;
+}
+
+static inline void set_parent(uint32_t parent, uint32_t node, const struct rbtree32 *tree)
+{
+    NODE(node)->parent_color = (parent << 1) | (NODE(node)->parent_color & 1);
+}
+
+static inline int is_root(uint32_t node, const struct rbtree32 *tree)
+{
+    return get_parent(node, tree) == NIL;
+}
+
+static inline int is_black(uint32_t node, const struct rbtree32 *tree)
+{
+    return get_color(node, tree) == RB32_BLACK;
+}
+
+static inline int is_red(uint32_t node, const struct rbtree32 *tree)
+{
+    return !is_black(node, tree);
+}
+
+/* NIL children count as black */
+static inline int is_nil_or_black(uint32_t node, const struct rbtree32 *tree)
+{
+    return node == NIL || is_black(node, tree);
+}
+
+static inline void INIT_NODE(uint32_t node, const struct rbtree32 *tree)
+{
+    LEFT(node) = NIL;
+    RIGHT(node) = NIL;
+    set_color(RB32_RED, node, tree);
+}
+
+
+static inline uint32_t get_first(uint32_t node, const struct rbtree32 *tree)
+{
+    while (LEFT(node) != NIL)
+        node = LEFT(node);
+    return node;
+}
+
+static inline uint32_t get_last(uint32_t node, const struct rbtree32 *tree)
+{
+    while (RIGHT(node) != NIL)
+        node = RIGHT(node);
+    return node;
+}
+
+uint32_t rbtree32_first(const struct rbtree32 *tree)
+{
+    return tree->first;
+}
+
+uint32_t rbtree32_last(const struct rbtree32 *tree)
+{
+    return tree->last;
+}
+
+uint32_t rbtree32_next(uint32_t node, const struct rbtree32 *tree)
+{
+    uint32_t parent;
+
+    if (RIGHT(node) != NIL)
+        return get_first(RIGHT(node), tree);
+
+    while ((parent = get_parent(node, tree)) != NIL && RIGHT(parent) == node)
+        node = parent;
+    return parent;
+}
+
+uint32_t rbtree32_prev(uint32_t node, const struct rbtree32 *tree)
+{
+    uint32_t parent;
+
+    if (LEFT(node) != NIL)
+        return get_last(LEFT(node), tree);
+
+    while ((parent = get_parent(node, tree)) != NIL && LEFT(parent) == node)
+        node = parent;
+    return parent;
+}
+
+static inline uint32_t do_lookup(const struct rbtree32_node *key, const struct rbtree32 *tree, uint32_t *pparent, int *is_left)
+{
+    uint32_t node = tree->root;
+
+    *pparent = NIL;
+    *is_left = 0;
+
+    while (node != NIL) {
+        int res = tree->cmp_fn(NODE(node), key);
+        if (res == 0)
+            return node;
+        *pparent = node;
+        if ((*is_left = res > 0))
+            node = LEFT(node);
+        else
+            node = RIGHT(node);
+    }
+    return NIL;
+}
+
+static void rotate_left(uint32_t node, struct rbtree32 *tree)
+{
+    uint32_t p = node;
+    uint32_t q = RIGHT(node); /* can't be NIL */
+    uint32_t parent = get_parent(p, tree);
+
+    if (!is_root(p, tree)) {
+        if (LEFT(parent) == p)
+            LEFT(parent) = q;
+        else
+            RIGHT(parent) = q;
+    } else
+        tree->root = q;
+    set_parent(parent, q, tree);
+    set_parent(q, p, tree);
+
+    RIGHT(p) = LEFT(q);
+    if (RIGHT(p) != NIL)
+        set_parent(p, RIGHT(p), tree);
+    LEFT(q) = p;
+}
+
+static void rotate_right(uint32_t node, struct rbtree32 *tree)
+{
+    uint32_t p = node;
+    uint32_t q = LEFT(node); /* can't be NIL */
+    uint32_t parent = get_parent(p, tree);
+
+    if (!is_root(p, tree)) {
+        if (LEFT(parent) == p)
+            LEFT(parent) = q;
+        else
+            RIGHT(parent) = q;
+    } else
+        tree->root = q;
+    set_parent(parent, q, tree);
+    set_parent(q, p, tree);
+
+    LEFT(p) = RIGHT(q);
+    if (LEFT(p) != NIL)
+        set_parent(p, LEFT(p), tree);
+    RIGHT(q) = p;
+}
+
+uint32_t rbtree32_lookup(const struct rbtree32_node *key, const struct rbtree32 *tree)
+{
+    uint32_t parent;
+    int is_left;
+
+    return do_lookup(key, tree, &parent, &is_left);
+}
+
+/* Bounded searches, see avl.c */
+static uint32_t do_bound(const struct rbtree32_node *key, const struct rbtree32 *tree, int after, int strict)
+{
+    uint32_t node = tree->root;
+    uint32_t bound = NIL;
+
+    while (node != NIL) {
+        int res = tree->cmp_fn(NODE(node), key);
+        if (res == 0 && !strict)
+            return node;
+        if (after) {
+            if (res > 0) {
+                bound = node;
+                node = LEFT(node);
+            } else
+                node = RIGHT(node);
+        } else {
+            if (res < 0) {
+                bound = node;
+                node = RIGHT(node);
+            } else
+                node = LEFT(node);
+        }
+    }
+    return bound;
+}
+
+uint32_t rbtree32_lower_bound(const struct rbtree32_node *key, const struct rbtree32 *tree)
+{
+    return do_bound(key, tree, 1, 0);
+}
+
+uint32_t rbtree32_upper_bound(const struct rbtree32_node *key, const struct rbtree32 *tree)
+{
+    return do_bound(key, tree, 1, 1);
+}
+
+uint32_t rbtree32_floor(const struct rbtree32_node *key, const struct rbtree32 *tree)
+{
+    return do_bound(key, tree, 0, 0);
+}
+
+uint32_t rbtree32_lookup_key(const void *key, rbtree32_key_cmp_fn_t cmp, const struct rbtree32 *tree)
+{
+    uint32_t node = tree->root;
+
+    while (node != NIL) {
+        int res = cmp(key, NODE(node));
+        if (res == 0)
+            return node;
+        if (res < 0)
+            node = LEFT(node);
+        else
+            node = RIGHT(node);
+    }
+    return NIL;
+}
+
+static void set_child(uint32_t child, uint32_t node, int left, const struct rbtree32 *tree)
+{
+    if (left)
+        LEFT(node) = child;
+    else
+        RIGHT(node) = child;
+}
+
+/* Restores the red-black properties above the red 'node'; the root may be left red. */
+static void insert_fixup(uint32_t node, struct rbtree32 *tree)
+{
+    uint32_t parent;
+
+    while ((parent = get_parent(node, tree)) != NIL && is_red(parent, tree)) {
+        uint32_t grandpa = get_parent(parent, tree);
+
+        if (parent == LEFT(grandpa)) {
+            uint32_t uncle = RIGHT(grandpa);
+
+            if (uncle != NIL && is_red(uncle, tree)) {
+                set_color(RB32_BLACK, parent, tree);
+                set_color(RB32_BLACK, uncle, tree);
+                set_color(RB32_RED, grandpa, tree);
+                node = grandpa;
+            } else {
+                if (node == RIGHT(parent)) {
+                    rotate_left(parent, tree);
+                    node = parent;
+                    parent = get_parent(node, tree);
+                }
+                set_color(RB32_BLACK, parent, tree);
+                set_color(RB32_RED, grandpa, tree);
+                rotate_right(grandpa, tree);
+            }
+        } else {
+            uint32_t uncle = LEFT(grandpa);
+
+            if (uncle != NIL && is_red(uncle, tree)) {
+                set_color(RB32_BLACK, parent, tree);
+                set_color(RB32_BLACK, uncle, tree);
+                set_color(RB32_RED, grandpa, tree);
+                node = grandpa;
+            } else {
+                if (node == LEFT(parent)) {
+                    rotate_right(parent, tree);
+                    node = parent;
+                    parent = get_parent(node, tree);
+                }
+                set_color(RB32_BLACK, parent, tree);
+                set_color(RB32_RED, grandpa, tree);
+                rotate_left(grandpa, tree);
+            }
+        }
+    }
+}
+
+static void do_insert(uint32_t node, uint32_t parent, int is_left, struct rbtree32 *tree)
+{
+    ++tree->size;
+
+    INIT_NODE(node, tree);
+    set_parent(parent, node, tree);
+
+    if (parent != NIL) {
+        if (is_left) {
+            if (parent == tree->first)
+                tree->first = node;
+        } else {
+            if (parent == tree->last)
+                tree->last = node;
+        }
+        set_child(node, parent, is_left, tree);
+    } else {
+        tree->root = node;
+        tree->first = node;
+        tree->last = node;
+    }
+
+    insert_fixup(node, tree);
+    set_color(RB32_BLACK, tree->root, tree);
+}
+
+/* Returns the index of an equal node already in the tree, NIL otherwise */
+uint32_t rbtree32_insert(uint32_t node, struct rbtree32 *tree)
+{
+    uint32_t key, parent;
+    int is_left;
+
+    assert(node <= RBTREE32_MAX_INDEX);
+    key = do_lookup(NODE(node), tree, &parent, &is_left);
+    if (key != NIL)
+        return key;
+
+    do_insert(node, parent, is_left, tree);
+    return NIL;
+}
+
+/* Nodes carry no tree pointer: 'node' must be in 'tree' */
+void rbtree32_remove(uint32_t node, struct rbtree32 *tree)
+{
+    uint32_t parent = get_parent(node, tree);
+    uint32_t left = LEFT(node);
+    uint32_t right = RIGHT(node);
+    uint32_t next;
+    enum rb32_color color;
+
+    --tree->size;
+
+    if (node == tree->first)
+        tree->first = rbtree32_next(node, tree);
+    if (node == tree->last)
+        tree->last = rbtree32_prev(node, tree);
+
+    if (left == NIL)
+        next = right;
+    else if (right == NIL)
+        next = left;
+    else
+        next = get_first(right, tree);
+
+    if (parent != NIL)
+        set_child(next, parent, LEFT(parent) == node, tree);
+    else
+        tree->root = next;
+
+    if (left != NIL && right != NIL) {
+        color = get_color(next, tree);
+        set_color(get_color(node, tree), next, tree);
+
+        LEFT(next) = left;
+        set_parent(next, left, tree);
+
+        if (next != right) {
+            parent = get_parent(next, tree);
+            set_parent(get_parent(node, tree), next, tree);
+
+            node = RIGHT(next);
+            LEFT(parent) = node;
+
+            RIGHT(next) = right;
+            set_parent(next, right, tree);
+        } else {
+            set_parent(parent, next, tree);
+            parent = next;
+            node = RIGHT(next);
+        }
+    } else {
+        color = get_color(node, tree);
+        node = next;
+    }
+
+    if (node != NIL)
+        set_parent(parent, node, tree);
+
+    if (color == RB32_RED)
+        return;
+    if (node != NIL && is_red(node, tree)) {
+        set_color(RB32_BLACK, node, tree);
+        return;
+    }
+
+    do {
+        if (node == tree->root)
+            break;
+
+        if (node == LEFT(parent)) {
+            uint32_t sibling = RIGHT(parent);
+
+            if (is_red(sibling, tree)) {
+                set_color(RB32_BLACK, sibling, tree);
+                set_color(RB32_RED, parent, tree);
+                rotate_left(parent, tree);
+                sibling = RIGHT(parent);
+            }
+            if (is_nil_or_black(LEFT(sibling), tree) &&
+                is_nil_or_black(RIGHT(sibling), tree)) {
+                set_color(RB32_RED, sibling, tree);
+                node = parent;
+                parent = get_parent(parent, tree);
+                continue;
+            }
+            if (is_nil_or_black(RIGHT(sibling), tree)) {
+                set_color(RB32_BLACK, LEFT(sibling), tree);
+                set_color(RB32_RED, sibling, tree);
+                rotate_right(sibling, tree);
+                sibling = RIGHT(parent);
+            }
+            set_color(get_color(parent, tree), sibling, tree);
+            set_color(RB32_BLACK, parent, tree);
+            set_color(RB32_BLACK, RIGHT(sibling), tree);
+            rotate_left(parent, tree);
+            node = tree->root;
+            break;
+        } else {
+            uint32_t sibling = LEFT(parent);
+
+            if (is_red(sibling, tree)) {
+                set_color(RB32_BLACK, sibling, tree);
+                set_color(RB32_RED, parent, tree);
+                rotate_right(parent, tree);
+                sibling = LEFT(parent);
+            }
+            if (is_nil_or_black(LEFT(sibling), tree) &&
+                is_nil_or_black(RIGHT(sibling), tree)) {
+                set_color(RB32_RED, sibling, tree);
+                node = parent;
+                parent = get_parent(parent, tree);
+                continue;
+            }
+            if (is_nil_or_black(LEFT(sibling), tree)) {
+                set_color(RB32_BLACK, RIGHT(sibling), tree);
+                set_color(RB32_RED, sibling, tree);
+                rotate_left(sibling, tree);
+                sibling = LEFT(parent);
+            }
+            set_color(get_color(parent, tree), sibling, tree);
+            set_color(RB32_BLACK, parent, tree);
+            set_color(RB32_BLACK, LEFT(sibling), tree);
+            rotate_right(parent, tree);
+            node = tree->root;
+            break;
+        }
+    } while (is_nil_or_black(node, tree));
+
+    if (node != NIL)
+        set_color(RB32_BLACK, node, tree);
+}
+
+int rbtree32_init(struct rbtree32 *tree, rbtree32_cmp_fn_t cmp, void *base, size_t stride)
+{
+    tree->cmp_fn = cmp;
+    tree->size = 0;
+    tree->root = NIL;
+    tree->first = NIL;
+    tree->last = NIL;
+    tree->base = (char *)base;
+    tree->stride = stride;
+    return 0;
+}
+
+void rbtree32_clean(struct rbtree32 *tree)
+{
+    rbtree32_init(tree, tree->cmp_fn, tree->base, tree->stride);
+}
+
+void rbtree32_foreach(struct rbtree32 *tree, rbtree32_call_fn_t call)
+{
+    uint32_t i;
+    uint32_t n;
+    for (i = rbtree32_first(tree); i != NIL; )
+    {
+        n = rbtree32_next(i, tree);
+        call(i, tree);
+        i = n;
+    }
+}
+
+void rbtree32_foreach_backward(struct rbtree32 *tree, rbtree32_call_fn_t call)
+{
+    uint32_t i;
+    uint32_t n;
+    for (i = rbtree32_last(tree); i != NIL; )
+    {
+        n = rbtree32_prev(i, tree);
+        call(i, tree);
+        i = n;
+    }
+}
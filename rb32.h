@@ -0,0 +1,75 @@
+#ifndef ANYTREE__RB32__INCLUDED
+#define ANYTREE__RB32__INCLUDED
+
+#include <stdint.h>
+#include <stddef.h>
+
+
+#ifdef __GNUC__
+#  define rbtree32_container_of(node, type, member) ({      \
+    const struct rbtree32_node *__mptr = (node);            \
+    (type *)( (char *)__mptr - offsetof(type,member) );})
+#else
+#  define rbtree32_container_of(node, type, member)         \
+    ((type *)((char *)(node) - offsetof(type, member)))
+#endif
+
+
+/*
+ * Red-black tree over a caller-provided array, linked by 32-bit indices;
+ * see avl32.h. The color shares a word with the parent index.
+ */
+#define RBTREE32_NIL ((uint32_t)0xffffffff)
+#define RBTREE32_MAX_INDEX ((uint32_t)0x7ffffffe)
+
+struct rbtree32_node {
+    uint32_t left, right;
+    uint32_t parent_color;      /* parent index << 1 | red */
+};
+
+typedef int (*rbtree32_cmp_fn_t)(const struct rbtree32_node *, const struct rbtree32_node *);
+typedef int (*rbtree32_key_cmp_fn_t)(const void *key, const struct rbtree32_node *);
+
+struct rbtree32 {
+    rbtree32_cmp_fn_t cmp_fn;
+    unsigned size;
+
+    uint32_t root;
+    uint32_t first, last;
+
+    char *base;         /* node of element 0 */
+    size_t stride;      /* element size */
+};
+
+#define rbtree32_node_at(TREE, INDEX) ((struct rbtree32_node *)((TREE)->base + (size_t)(INDEX) * (TREE)->stride))
+#define rbtree32_index_of(TREE, NODE) ((uint32_t)(((const char *)(NODE) - (TREE)->base) / (TREE)->stride))
+
+uint32_t rbtree32_first(const struct rbtree32 *tree);
+uint32_t rbtree32_last(const struct rbtree32 *tree);
+uint32_t rbtree32_next(uint32_t index, const struct rbtree32 *tree);
+uint32_t rbtree32_prev(uint32_t index, const struct rbtree32 *tree);
+
+uint32_t rbtree32_lookup(const struct rbtree32_node *key, const struct rbtree32 *tree);
+uint32_t rbtree32_lower_bound(const struct rbtree32_node *key, const struct rbtree32 *tree);
+uint32_t rbtree32_upper_bound(const struct rbtree32_node *key, const struct rbtree32 *tree);
+uint32_t rbtree32_floor(const struct rbtree32_node *key, const struct rbtree32 *tree);
+uint32_t rbtree32_lookup_key(const void *key, rbtree32_key_cmp_fn_t cmp, const struct rbtree32 *tree);
+uint32_t rbtree32_insert(uint32_t index, struct rbtree32 *tree);
+void rbtree32_remove(uint32_t index, struct rbtree32 *tree);
+
+#define rbtree32_is_empty(TREE) (TREE->size == 0)
+#define rbtree32_size(TREE) (TREE->size)
+
+/* 'base' is the node of element 0 of an array of 'stride' sized elements */
+int rbtree32_init(struct rbtree32 *tree, rbtree32_cmp_fn_t cmp, void *base, size_t stride);
+#define RBTREE32_INIT(TREE, CMP, ARRAY, MEMBER) \
+    rbtree32_init(TREE, CMP, &(ARRAY)[0].MEMBER, sizeof((ARRAY)[0]))
+/* Points the tree at a copy or another mapping of its array */
+#define rbtree32_rebase(TREE, BASE) ((TREE)->base = (char *)(BASE))
+void rbtree32_clean(struct rbtree32 *tree);
+
+typedef void (*rbtree32_call_fn_t)(uint32_t index, const struct rbtree32 *tree);
+void rbtree32_foreach(struct rbtree32 *tree, rbtree32_call_fn_t call);
+void rbtree32_foreach_backward(struct rbtree32 *tree, rbtree32_call_fn_t call);
+
+#endif
@@ -0,0 +1,191 @@
+#include "rblatch.h"
+
+
+/* Red-black height is at most 2 log2(n + 1), deeper means a torn view */
+#define MAX_DEPTH 128
+
+static inline struct rbtree_latch_node *get_latch(const struct rbtree_node *node, int idx)
+{
+    if (!node)
+        return NULL;
+    return (struct rbtree_latch_node *)((char *)node - idx * sizeof(struct rbtree_node));
+}
+
+/*
+ * Moves readers over to the other copy. The first release orders the
+ * updates of the copy just finished before the count, the fence orders the
+ * count before the updates to come, as the smp_wmb() pair of
+ * raw_write_seqcount_latch().
+ */
+static inline void latch_flip(struct rbtree_latch *latch)
+{
+    __atomic_store_n(&latch->seq, latch->seq + 1, __ATOMIC_RELEASE);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline unsigned read_begin(const struct rbtree_latch *latch)
+{
+    return __atomic_load_n(&latch->seq, __ATOMIC_ACQUIRE);
+}
+
+static inline int read_retry(const struct rbtree_latch *latch, unsigned seq)
+{
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&latch->seq, __ATOMIC_RELAXED) != seq;
+}
+
+/* Pairs with the release stores of write_link() in rb.c */
+static inline struct rbtree_node *load_child(struct rbtree_node *const *link)
+{
+    return __atomic_load_n(link, __ATOMIC_ACQUIRE);
+}
+
+/*
+ * Lockless descents in copy 'idx', which the writer may start changing
+ * under our feet: a link is loaded once, and a torn view can at worst lead
+ * to a wrong answer, which read_retry() catches, or a cycle, which the
+ * depth bound cuts.
+ */
+static struct rbtree_latch_node *find_key(const void *key, rbtree_latch_key_cmp_fn_t cmp, const struct rbtree_latch *latch, int idx, int lower_bound)
+{
+    struct rbtree_node *node = load_child(&latch->tree[idx].root);
+    struct rbtree_latch_node *bound = NULL;
+    int depth = 0;
+
+    while (node && depth++ < MAX_DEPTH) {
+        struct rbtree_latch_node *n = get_latch(node, idx);
+        int res = cmp(key, n);
+
+        if (res == 0)
+            return n;
+        if (res < 0) {
+            bound = n;
+            node = load_child(&node->left);
+        } else
+            node = load_child(&node->right);
+    }
+    return lower_bound ? bound : NULL;
+}
+
+static struct rbtree_latch_node *find_node(const struct rbtree_latch_node *key, const struct rbtree_latch *latch, int idx)
+{
+    struct rbtree_node *node = load_child(&latch->tree[idx].root);
+    int depth = 0;
+
+    while (node && depth++ < MAX_DEPTH) {
+        struct rbtree_latch_node *n = get_latch(node, idx);
+        int res = latch->cmp_fn(n, key);
+
+        if (res == 0)
+            return n;
+        node = load_child(res > 0 ? &node->left : &node->right);
+    }
+    return NULL;
+}
+
+struct rbtree_latch_node *rbtree_latch_lookup(const struct rbtree_latch_node *key, const struct rbtree_latch *latch)
+{
+    struct rbtree_latch_node *node;
+    unsigned seq;
+
+    do {
+        seq = read_begin(latch);
+        node = find_node(key, latch, seq & 1);
+    } while (read_retry(latch, seq));
+    return node;
+}
+
+struct rbtree_latch_node *rbtree_latch_lookup_key(const void *key, rbtree_latch_key_cmp_fn_t cmp, const struct rbtree_latch *latch)
+{
+    struct rbtree_latch_node *node;
+    unsigned seq;
+
+    do {
+        seq = read_begin(latch);
+        node = find_key(key, cmp, latch, seq & 1, 0);
+    } while (read_retry(latch, seq));
+    return node;
+}
+
+struct rbtree_latch_node *rbtree_latch_lower_bound_key(const void *key, rbtree_latch_key_cmp_fn_t cmp, const struct rbtree_latch *latch)
+{
+    struct rbtree_latch_node *node;
+    unsigned seq;
+
+    do {
+        seq = read_begin(latch);
+        node = find_key(key, cmp, latch, seq & 1, 1);
+    } while (read_retry(latch, seq));
+    return node;
+}
+
+/* Writer side: the copy being changed is only read by the writer itself */
+static struct rbtree_latch_node *do_lookup(const struct rbtree_latch_node *key, struct rbtree_latch *latch, int idx, struct rbtree_node **pparent, int *is_left)
+{
+    struct rbtree_node *node = latch->tree[idx].root;
+
+    *pparent = NULL;
+    *is_left = 0;
+
+    while (node) {
+        int res = latch->cmp_fn(get_latch(node, idx), key);
+        if (res == 0)
+            return get_latch(node, idx);
+        *pparent = node;
+        if ((*is_left = res > 0))
+            node = node->left;
+        else
+            node = node->right;
+    }
+    return NULL;
+}
+
+struct rbtree_latch_node *rbtree_latch_insert(struct rbtree_latch_node *node, struct rbtree_latch *latch)
+{
+    struct rbtree_latch_node *key;
+    struct rbtree_node *parent;
+    int idx, is_left;
+
+    key = do_lookup(node, latch, 0, &parent, &is_left);
+    if (key)
+        return key;
+
+    for (idx = 0; idx < 2; idx++) {
+        latch_flip(latch);
+        if (idx)
+            do_lookup(node, latch, idx, &parent, &is_left);
+        rbtree_link(&node->node[idx], parent, is_left, &latch->tree[idx]);
+    }
+    return NULL;
+}
+
+void rbtree_latch_remove(struct rbtree_latch_node *node, struct rbtree_latch *latch)
+{
+    int idx;
+
+    for (idx = 0; idx < 2; idx++) {
+        latch_flip(latch);
+        rbtree_remove(&node->node[idx], &latch->tree[idx]);
+    }
+}
+
+struct rbtree_latch_node *rbtree_latch_first(const struct rbtree_latch *latch)
+{
+    return get_latch(rbtree_first(&latch->tree[0]), 0);
+}
+
+struct rbtree_latch_node *rbtree_latch_next(const struct rbtree_latch_node *node)
+{
+    return get_latch(rbtree_next(&node->node[0]), 0);
+}
+
+int rbtree_latch_init(struct rbtree_latch *latch, rbtree_latch_cmp_fn_t cmp)
+{
+    latch->cmp_fn = cmp;
+    latch->seq = 0;
+    rbtree_init(&latch->tree[0], NULL);
+    rbtree_init(&latch->tree[1], NULL);
+    latch->tree[0].lockless = 1;
+    latch->tree[1].lockless = 1;
+    return 0;
+}
@@ -0,0 +1,64 @@
+#ifndef ANYTREE__RBLATCH__INCLUDED
+#define ANYTREE__RBLATCH__INCLUDED
+
+#include <stddef.h>
+
+#include "epoch.h"
+#include "rb.h"
+
+
+#ifdef __GNUC__
+#  define rbtree_latch_container_of(node, type, member) ({      \
+    const struct rbtree_latch_node *__mptr = (node);            \
+    (type *)( (char *)__mptr - offsetof(type,member) );})
+#else
+#  define rbtree_latch_container_of(node, type, member)         \
+    ((type *)((char *)(node) - offsetof(type, member)))
+#endif
+
+
+/*
+ * Red-black tree with lockless readers, after the Linux latch tree: every
+ * element sits in two copies of the tree and a sequence count tells the
+ * readers which copy is stable. The writer updates one copy while readers
+ * use the other, then the other way round; a reader that sees the count
+ * move retries. Lookups never take a lock nor write shared memory, and
+ * never miss an element present for the whole lookup.
+ *
+ * Writers must be serialized by the caller. Readers call the lookups inside
+ * an epoch section (see epoch.h) and keep using the nodes found only until
+ * they leave it; a removed node is handed to anytree_epoch_retire() rather
+ * than freed.
+ */
+struct rbtree_latch_node {
+    struct rbtree_node node[2];
+    struct anytree_epoch_entry retire;  /* free for the caller's use, see above */
+};
+
+typedef int (*rbtree_latch_cmp_fn_t)(const struct rbtree_latch_node *, const struct rbtree_latch_node *);
+typedef int (*rbtree_latch_key_cmp_fn_t)(const void *key, const struct rbtree_latch_node *);
+
+struct rbtree_latch {
+    rbtree_latch_cmp_fn_t cmp_fn;
+    unsigned seq;               /* odd while tree[0] is written */
+    struct rbtree tree[2];
+};
+
+/* Lockless, from any thread inside an epoch section */
+struct rbtree_latch_node *rbtree_latch_lookup(const struct rbtree_latch_node *key, const struct rbtree_latch *latch);
+struct rbtree_latch_node *rbtree_latch_lookup_key(const void *key, rbtree_latch_key_cmp_fn_t cmp, const struct rbtree_latch *latch);
+struct rbtree_latch_node *rbtree_latch_lower_bound_key(const void *key, rbtree_latch_key_cmp_fn_t cmp, const struct rbtree_latch *latch);
+
+/* Writer side */
+struct rbtree_latch_node *rbtree_latch_insert(struct rbtree_latch_node *node, struct rbtree_latch *latch);
+void rbtree_latch_remove(struct rbtree_latch_node *node, struct rbtree_latch *latch);
+/* In-order iteration, on the writer side only */
+struct rbtree_latch_node *rbtree_latch_first(const struct rbtree_latch *latch);
+struct rbtree_latch_node *rbtree_latch_next(const struct rbtree_latch_node *node);
+
+#define rbtree_latch_is_empty(LATCH) ((LATCH)->tree[0].size == 0)
+#define rbtree_latch_size(LATCH) ((LATCH)->tree[0].size)
+
+int rbtree_latch_init(struct rbtree_latch *latch, rbtree_latch_cmp_fn_t cmp);
+
+#endif
@@ -0,0 +1,470 @@
+#include "skiplist.h"
+
+
+#define MARK ((uintptr_t)1)
+
+static inline struct skiplist_node *get_ptr(uintptr_t link)
+{
+    return (struct skiplist_node *)(link & ~MARK);
+}
+
+static inline int is_marked(uintptr_t link)
+{
+    return link & MARK;
+}
+
+/*
+ * Links are reached through towers, the list head's or a node's, so that
+ * the head needs no node header
+ */
+static inline uintptr_t get_next(const uintptr_t *tower, unsigned level)
+{
+    return __atomic_load_n(&tower[level], __ATOMIC_ACQUIRE);
+}
+
+static inline void set_next(uintptr_t *tower, unsigned level, uintptr_t link)
+{
+    __atomic_store_n(&tower[level], link, __ATOMIC_RELAXED);
+}
+
+static inline int cas_next(uintptr_t *tower, unsigned level, uintptr_t expected, uintptr_t link)
+{
+    return __atomic_compare_exchange_n(&tower[level], &expected, link, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+
+static inline unsigned get_height(const struct skiplist *list)
+{
+    return __atomic_load_n(&list->height, __ATOMIC_RELAXED);
+}
+
+/* Per-thread xorshift, a level needs no better randomness */
+unsigned skiplist_random_height(void)
+{
+    static __thread uint64_t state;
+    unsigned height = 1;
+    uint64_t r;
+
+    if (!state)
+        state = (uint64_t)(uintptr_t)&state * 0x9e3779b97f4a7c15ULL | 1;
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    for (r = state; (r & 3) == 0 && height < SKIPLIST_MAX_LEVEL; r >>= 2)
+        height++;
+    return height;
+}
+
+void skiplist_node_init(struct skiplist_node *node, unsigned height)
+{
+    node->list = NULL;
+    node->height = height < 1 ? 1 : height > SKIPLIST_MAX_LEVEL ? SKIPLIST_MAX_LEVEL : height;
+}
+
+/*
+ * Orders 'node' against the key: the tree comparator for a node key,
+ * otherwise the caller's key comparator with its sign flipped.
+ */
+static inline int order(const struct skiplist_node *node, const void *key, skiplist_key_cmp_fn_t cmp, const struct skiplist *list)
+{
+    int res;
+
+    if (!cmp)
+        return list->cmp_fn(node, (const struct skiplist_node *)key);
+    res = cmp(key, node);
+    return (res < 0) - (res > 0);
+}
+
+
+/*
+ * Read-only descent: leaves in '*pred' the last node ordered before the key
+ * (or equal to it when 'strict'), NULL if none, and returns the node after
+ * it. Removed nodes are stepped over, not unlinked.
+ */
+static struct skiplist_node *do_descend(const void *key, skiplist_key_cmp_fn_t cmp, const struct skiplist *list, int strict, const struct skiplist_node **pred)
+{
+    const struct skiplist_node *p = NULL;
+    const uintptr_t *tower = list->head;
+    struct skiplist_node *curr = NULL;
+    int level;
+
+    for (level = (int)get_height(list) - 1; level >= 0; level--) {
+        curr = get_ptr(get_next(tower, level));
+        while (curr) {
+            uintptr_t succ = get_next(curr->next, level);
+            int res;
+
+            if (is_marked(succ)) {
+                curr = get_ptr(succ);
+                continue;
+            }
+            res = order(curr, key, cmp, list);
+            if (res > 0 || (res == 0 && !strict))
+                break;
+            p = curr;
+            tower = curr->next;
+            curr = get_ptr(succ);
+        }
+    }
+    *pred = p;
+    return curr;
+}
+
+/*
+ * Search for inserting and removing: fills on every level the tower to
+ * link from in preds and the node after it in succs, and unlinks the
+ * removed nodes met on the way.
+ */
+static struct skiplist_node *do_find(const struct skiplist_node *key, struct skiplist *list, uintptr_t **preds, struct skiplist_node **succs)
+{
+    struct skiplist_node *curr;
+    uintptr_t *pred, succ;
+    int level;
+
+retry:
+    pred = list->head;
+    for (level = SKIPLIST_MAX_LEVEL - 1; level >= 0; level--) {
+        curr = get_ptr(get_next(pred, level));
+        while (curr) {
+            succ = get_next(curr->next, level);
+            if (is_marked(succ)) {
+                if (!cas_next(pred, level, (uintptr_t)curr, (uintptr_t)get_ptr(succ)))
+                    goto retry;
+                curr = get_ptr(succ);
+                continue;
+            }
+            if (list->cmp_fn(curr, key) >= 0)
+                break;
+            pred = curr->next;
+            curr = get_ptr(succ);
+        }
+        preds[level] = pred;
+        succs[level] = curr;
+    }
+    curr = succs[0];
+    if (curr && list->cmp_fn(curr, key) == 0)
+        return curr;
+    return NULL;
+}
+
+
+/*
+ * Iterators
+ */
+static struct skiplist_node *skip_removed(struct skiplist_node *node)
+{
+    while (node) {
+        uintptr_t succ = get_next(node->next, 0);
+        if (!is_marked(succ))
+            break;
+        node = get_ptr(succ);
+    }
+    return node;
+}
+
+struct skiplist_node *skiplist_first(const struct skiplist *list)
+{
+    return skip_removed(get_ptr(get_next(list->head, 0)));
+}
+
+struct skiplist_node *skiplist_last(const struct skiplist *list)
+{
+    const struct skiplist_node *p = NULL;
+    int level;
+
+    for (level = (int)get_height(list) - 1; level >= 0; level--) {
+        struct skiplist_node *curr = get_ptr(get_next(p ? p->next : list->head, level));
+
+        while (curr) {
+            uintptr_t succ = get_next(curr->next, level);
+
+            if (!is_marked(succ))
+                p = curr;
+            curr = get_ptr(succ);
+        }
+    }
+    return (struct skiplist_node *)p;
+}
+
+struct skiplist_node *skiplist_next(const struct skiplist_node *node)
+{
+    return skip_removed(get_ptr(get_next(node->next, 0)));
+}
+
+struct skiplist_node *skiplist_prev(const struct skiplist_node *node)
+{
+    const struct skiplist_node *pred;
+
+    do_descend(node, NULL, node->list, 0, &pred);
+    return (struct skiplist_node *)pred;
+}
+
+
+/*
+ * Searches
+ */
+static struct skiplist_node *do_lookup(const void *key, skiplist_key_cmp_fn_t cmp, const struct skiplist *list)
+{
+    const struct skiplist_node *pred;
+    struct skiplist_node *node = do_descend(key, cmp, list, 0, &pred);
+
+    if (node && order(node, key, cmp, list) == 0)
+        return node;
+    return NULL;
+}
+
+static struct skiplist_node *do_floor(const void *key, skiplist_key_cmp_fn_t cmp, const struct skiplist *list)
+{
+    const struct skiplist_node *pred;
+
+    do_descend(key, cmp, list, 1, &pred);
+    return (struct skiplist_node *)pred;
+}
+
+struct skiplist_node *skiplist_lookup(const struct skiplist_node *key, const struct skiplist *list)
+{
+    return do_lookup(key, NULL, list);
+}
+
+struct skiplist_node *skiplist_lower_bound(const struct skiplist_node *key, const struct skiplist *list)
+{
+    const struct skiplist_node *pred;
+
+    return do_descend(key, NULL, list, 0, &pred);
+}
+
+struct skiplist_node *skiplist_upper_bound(const struct skiplist_node *key, const struct skiplist *list)
+{
+    const struct skiplist_node *pred;
+
+    return do_descend(key, NULL, list, 1, &pred);
+}
+
+struct skiplist_node *skiplist_floor(const struct skiplist_node *key, const struct skiplist *list)
+{
+    return do_floor(key, NULL, list);
+}
+
+struct skiplist_node *skiplist_lookup_key(const void *key, skiplist_key_cmp_fn_t cmp, const struct skiplist *list)
+{
+    return do_lookup(key, cmp, list);
+}
+
+struct skiplist_node *skiplist_lower_bound_key(const void *key, skiplist_key_cmp_fn_t cmp, const struct skiplist *list)
+{
+    const struct skiplist_node *pred;
+
+    return do_descend(key, cmp, list, 0, &pred);
+}
+
+struct skiplist_node *skiplist_upper_bound_key(const void *key, skiplist_key_cmp_fn_t cmp, const struct skiplist *list)
+{
+    const struct skiplist_node *pred;
+
+    return do_descend(key, cmp, list, 1, &pred);
+}
+
+struct skiplist_node *skiplist_floor_key(const void *key, skiplist_key_cmp_fn_t cmp, const struct skiplist *list)
+{
+    return do_floor(key, cmp, list);
+}
+
+/* Range [lo, hi), see avltree_range() */
+struct skiplist_node *skiplist_range(const struct skiplist_node *lo, const struct skiplist_node *hi, const struct skiplist *list, struct skiplist_node **end)
+{
+    *end = NULL;
+    if (lo && hi && list->cmp_fn(lo, hi) >= 0)
+        return NULL;
+
+    if (hi)
+        *end = skiplist_lower_bound(hi, list);
+    if (!lo)
+        return skiplist_first(list);
+    return skiplist_lower_bound(lo, list);
+}
+
+unsigned skiplist_range_count(const struct skiplist_node *lo, const struct skiplist_node *hi, const struct skiplist *list)
+{
+    struct skiplist_node *node, *end;
+    unsigned count = 0;
+
+    for (node = skiplist_range(lo, hi, list, &end); node && node != end; node = skiplist_next(node))
+        count++;
+    return count;
+}
+
+
+/*
+ * Updates
+ */
+static void raise_height(struct skiplist *list, unsigned height)
+{
+    unsigned old = get_height(list);
+
+    while (old < height &&
+           !__atomic_compare_exchange_n(&list->height, &old, height, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+/*
+ * The node becomes present when linked on the lowest level; the upper
+ * levels are shortcuts added afterwards, given up as soon as a concurrent
+ * removal marks them. A removal may mark a level between our check and our
+ * link, and its search may already have passed that level: the link is
+ * checked again once made, and a search unlinks the node if it was marked.
+ */
+struct skiplist_node *skiplist_insert(struct skiplist_node *node, struct skiplist *list)
+{
+    uintptr_t *preds[SKIPLIST_MAX_LEVEL];
+    struct skiplist_node *succs[SKIPLIST_MAX_LEVEL];
+    struct skiplist_node *key;
+    unsigned height = node->height, level;
+
+    node->list = list;
+    for (;;) {
+        key = do_find(node, list, preds, succs);
+        if (key)
+            return key;
+        for (level = 0; level < height; level++)
+            set_next(node->next, level, (uintptr_t)succs[level]);
+        if (cas_next(preds[0], 0, (uintptr_t)succs[0], (uintptr_t)node))
+            break;
+    }
+    __atomic_fetch_add(&list->size, 1, __ATOMIC_RELAXED);
+    raise_height(list, height);
+
+    for (level = 1; level < height; level++) {
+        for (;;) {
+            uintptr_t link = get_next(node->next, level);
+
+            if (is_marked(link))
+                return NULL;
+            if (get_ptr(link) != succs[level] &&
+                !cas_next(node->next, level, link, (uintptr_t)succs[level]))
+                return NULL;
+            if (cas_next(preds[level], level, (uintptr_t)succs[level], (uintptr_t)node)) {
+                if (is_marked(get_next(node->next, level))) {
+                    do_find(node, list, preds, succs);
+                    return NULL;
+                }
+                break;
+            }
+            if (do_find(node, list, preds, succs) != node)
+                return NULL;
+        }
+    }
+    return NULL;
+}
+
+struct skiplist_node *skiplist_insert_after(struct skiplist_node *node, struct skiplist_node *hint, struct skiplist *list)
+{
+    (void)hint;
+    return skiplist_insert(node, list);
+}
+
+struct skiplist_node *skiplist_insert_before(struct skiplist_node *node, struct skiplist_node *hint, struct skiplist *list)
+{
+    (void)hint;
+    return skiplist_insert(node, list);
+}
+
+/* Marks the node top-down; whoever marks the lowest level removed it */
+static int do_remove(struct skiplist_node *node, struct skiplist *list)
+{
+    uintptr_t *preds[SKIPLIST_MAX_LEVEL];
+    struct skiplist_node *succs[SKIPLIST_MAX_LEVEL];
+    uintptr_t link;
+    unsigned level;
+
+    for (level = node->height - 1; level > 0; level--) {
+        link = get_next(node->next, level);
+        while (!is_marked(link) && !cas_next(node->next, level, link, link | MARK))
+            link = get_next(node->next, level);
+    }
+    for (;;) {
+        link = get_next(node->next, 0);
+        if (is_marked(link))
+            return 0;
+        if (cas_next(node->next, 0, link, link | MARK))
+            break;
+    }
+    __atomic_fetch_sub(&list->size, 1, __ATOMIC_RELAXED);
+    do_find(node, list, preds, succs);
+    return 1;
+}
+
+void skiplist_remove(struct skiplist_node *node, struct skiplist *list)
+{
+    if (list && node->list != list)
+        return;
+    do_remove(node, list);
+}
+
+struct skiplist_node *skiplist_remove_key(const void *key, skiplist_key_cmp_fn_t cmp, struct skiplist *list)
+{
+    struct skiplist_node *node = skiplist_lookup_key(key, cmp, list);
+
+    if (node && do_remove(node, list))
+        return node;
+    return NULL;
+}
+
+void skiplist_replace(struct skiplist_node *old, struct skiplist_node *node, struct skiplist *list)
+{
+    skiplist_remove(old, list);
+    skiplist_insert(node, list);
+}
+
+int skiplist_build_sorted(struct skiplist_node **nodes, unsigned count, struct skiplist *list)
+{
+    unsigned i;
+
+    if (skiplist_size(list))
+        return -1;
+    for (i = 0; i < count; i++)
+        skiplist_insert(nodes[i], list);
+    return 0;
+}
+
+int skiplist_init(struct skiplist *list, skiplist_cmp_fn_t cmp)
+{
+    unsigned level;
+
+    list->cmp_fn = cmp;
+    list->size = 0;
+    list->height = 1;
+    for (level = 0; level < SKIPLIST_MAX_LEVEL; level++)
+        list->head[level] = 0;
+    return 0;
+}
+
+void skiplist_clean(struct skiplist *list)
+{
+    struct skiplist_node *i;
+    for (i = skiplist_first(list); i; i = skiplist_next(i))
+        i->list = NULL;
+    skiplist_init(list, list->cmp_fn);
+}
+
+void skiplist_foreach(struct skiplist *list, skiplist_call_fn_t call)
+{
+    struct skiplist_node *i;
+    struct skiplist_node *n;
+    for (i = skiplist_first(list); i; )
+    {
+        n = skiplist_next(i);
+        call(i);
+        i = n;
+    }
+}
+
+void skiplist_foreach_backward(struct skiplist *list, skiplist_call_fn_t call)
+{
+    struct skiplist_node *i;
+    struct skiplist_node *n;
+    for (i = skiplist_last(list); i; )
+    {
+        n = skiplist_prev(i);
+        call(i);
+        i = n;
+    }
+}
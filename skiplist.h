@@ -0,0 +1,108 @@
+#ifndef ANYTREE__SKIPLIST__INCLUDED
+#define ANYTREE__SKIPLIST__INCLUDED
+
+#include <stdint.h>
+#include <stddef.h>
+
+
+#ifdef __GNUC__
+#  define skiplist_container_of(node, type, member) ({      \
+    const struct skiplist_node *__mptr = (node);            \
+    (type *)( (char *)__mptr - offsetof(type,member) );})
+#else
+#  define skiplist_container_of(node, type, member)         \
+    ((type *)((char *)(node) - offsetof(type, member)))
+#endif
+
+
+/*
+ * Lock-free ordered skip list (Harris, Herlihy and Shavit): every operation
+ * may run concurrently with any other. A node is removed by marking its
+ * links, lowest level last, and unlinked by whichever search meets it next.
+ * Levels are drawn with p = 1/4, so SKIPLIST_MAX_LEVEL levels stay
+ * logarithmic up to 4^SKIPLIST_MAX_LEVEL nodes.
+ *
+ * Traversals may still be looking at a node after it was removed: it must
+ * not be freed nor inserted again until they are all over, e.g. by running
+ * the operations inside epoch sections and retiring removed nodes (see
+ * epoch.h). Iteration sees each node present for its whole duration.
+ *
+ * Unlike in the trees, the list back-pointer is kept in every layout:
+ * skiplist_prev() searches from the head.
+ *
+ * A node carries one link per level after its header, so it must be the
+ * last member of its containing struct, which is allocated with
+ * skiplist_tower_size(height) more bytes, and set up with
+ * skiplist_node_init() before it is first inserted. Heights drawn by
+ * skiplist_random_height() average 4/3 links per node.
+ */
+#ifndef SKIPLIST_MAX_LEVEL
+#  define SKIPLIST_MAX_LEVEL 16
+#endif
+
+struct skiplist;
+
+struct skiplist_node {
+    struct skiplist *list;
+    unsigned height;
+    uintptr_t next[];               /* 'height' links, low bit marks the node as removed */
+};
+
+#define skiplist_tower_size(HEIGHT) ((size_t)(HEIGHT) * sizeof(uintptr_t))
+
+typedef int (*skiplist_cmp_fn_t)(const struct skiplist_node *, const struct skiplist_node *);
+typedef int (*skiplist_key_cmp_fn_t)(const void *key, const struct skiplist_node *);
+
+struct skiplist {
+    skiplist_cmp_fn_t cmp_fn;
+    unsigned size;
+    unsigned height;                /* levels in use */
+
+    uintptr_t head[SKIPLIST_MAX_LEVEL];
+};
+
+unsigned skiplist_random_height(void);
+/* The node keeps its height across removals and insertions */
+void skiplist_node_init(struct skiplist_node *node, unsigned height);
+
+struct skiplist_node *skiplist_first(const struct skiplist *list);
+struct skiplist_node *skiplist_last(const struct skiplist *list);
+struct skiplist_node *skiplist_next(const struct skiplist_node *node);
+struct skiplist_node *skiplist_prev(const struct skiplist_node *node);
+
+struct skiplist_node *skiplist_lookup(const struct skiplist_node *key, const struct skiplist *list);
+struct skiplist_node *skiplist_lower_bound(const struct skiplist_node *key, const struct skiplist *list);
+struct skiplist_node *skiplist_upper_bound(const struct skiplist_node *key, const struct skiplist *list);
+struct skiplist_node *skiplist_floor(const struct skiplist_node *key, const struct skiplist *list);
+#define skiplist_ceil(KEY, LIST) skiplist_lower_bound(KEY, LIST)
+
+struct skiplist_node *skiplist_range(const struct skiplist_node *lo, const struct skiplist_node *hi, const struct skiplist *list, struct skiplist_node **end);
+unsigned skiplist_range_count(const struct skiplist_node *lo, const struct skiplist_node *hi, const struct skiplist *list);
+
+struct skiplist_node *skiplist_lookup_key(const void *key, skiplist_key_cmp_fn_t cmp, const struct skiplist *list);
+struct skiplist_node *skiplist_lower_bound_key(const void *key, skiplist_key_cmp_fn_t cmp, const struct skiplist *list);
+struct skiplist_node *skiplist_upper_bound_key(const void *key, skiplist_key_cmp_fn_t cmp, const struct skiplist *list);
+struct skiplist_node *skiplist_floor_key(const void *key, skiplist_key_cmp_fn_t cmp, const struct skiplist *list);
+/* Returns the node this call removed, NULL if none or another remover won */
+struct skiplist_node *skiplist_remove_key(const void *key, skiplist_key_cmp_fn_t cmp, struct skiplist *list);
+struct skiplist_node *skiplist_insert(struct skiplist_node *node, struct skiplist *list);
+/* A skip list has no use for hints, these are regular insertions */
+struct skiplist_node *skiplist_insert_after(struct skiplist_node *node, struct skiplist_node *hint, struct skiplist *list);
+struct skiplist_node *skiplist_insert_before(struct skiplist_node *node, struct skiplist_node *hint, struct skiplist *list);
+void skiplist_remove(struct skiplist_node *node, struct skiplist *list);
+/* Not atomic: concurrent readers may miss the key in between */
+void skiplist_replace(struct skiplist_node *old, struct skiplist_node *node, struct skiplist *list);
+int skiplist_build_sorted(struct skiplist_node **nodes, unsigned count, struct skiplist *list);
+
+#define skiplist_is_empty(LIST) (skiplist_size(LIST) == 0)
+#define skiplist_size(LIST) __atomic_load_n(&(LIST)->size, __ATOMIC_RELAXED)
+
+/* Neither is thread-safe */
+int skiplist_init(struct skiplist *list, skiplist_cmp_fn_t cmp);
+void skiplist_clean(struct skiplist *list);
+
+typedef void (*skiplist_call_fn_t)(const struct skiplist_node *);
+void skiplist_foreach(struct skiplist *list, skiplist_call_fn_t call);
+void skiplist_foreach_backward(struct skiplist *list, skiplist_call_fn_t call);
+
+#endif
@@ -3,68 +3,50 @@
 
 #include "splay.h"
 
-
-#define NODE_INIT    { NULL, }
-
-static inline void INIT_NODE(struct splaytree_node *node, struct splaytree *tree)
-{
-    node->left = NULL;
-    node->right = NULL;
-    node->tree = tree;
-    node->left_is_thread = 0;
-    node->right_is_thread = 0;
-}
-
-static inline void set_left(struct splaytree_node *l, struct splaytree_node *n)
+/* Tree back-pointer, see avl.c */
+#ifdef ANYTREE_NO_TREE_POINTER
+static inline void set_tree(struct splaytree *tree, struct splaytree_node *node)
 {
-    n->left = l;
-    n->left_is_thread = 0;
+    (void)tree;
+    (void)node;
 }
 
-static inline void set_right(struct splaytree_node *r, struct splaytree_node *n)
+static inline int in_tree(const struct splaytree_node *node, const struct splaytree *tree)
 {
-    n->right = r;
-    n->right_is_thread = 0;
+    (void)node;
+    (void)tree;
+    return 1;
 }
-
-static inline void set_prev(struct splaytree_node *t, struct splaytree_node *n)
+#else
+static inline void set_tree(struct splaytree *tree, struct splaytree_node *node)
 {
-    n->left = t;
-    n->left_is_thread = 1;
+    node->tree = tree;
 }
 
-static inline void set_next(struct splaytree_node *t, struct splaytree_node *n)
+static inline int in_tree(const struct splaytree_node *node, const struct splaytree *tree)
 {
-    n->right = t;
-    n->right_is_thread = 1;
+    return node->tree == tree;
 }
+#endif
 
-static inline struct splaytree_node *get_left(const struct splaytree_node *n)
-{
-    if (!n->left_is_thread)
-        return n->left;
-    return NULL;
-}
 
-static inline struct splaytree_node *get_right(const struct splaytree_node *n)
-{
-    if (!n->right_is_thread)
-        return n->right;
-    return NULL;
-}
+#define NODE_INIT    { NULL, }
 
-static inline struct splaytree_node *get_prev(const struct splaytree_node *n)
-{
-    if (n->left_is_thread)
-        return n->left;
-    return NULL;
-}
+/* Link accessors live in splay.h, SPLAYTREE_SPLAY() needs them too */
+#define get_left splaytree__get_left
+#define get_right splaytree__get_right
+#define get_prev splaytree__get_prev
+#define get_next splaytree__get_next
+#define set_left splaytree__set_left
+#define set_right splaytree__set_right
+#define set_prev splaytree__set_prev
+#define set_next splaytree__set_next
 
-static inline struct splaytree_node *get_next(const struct splaytree_node *n)
+static inline void INIT_NODE(struct splaytree_node *node, struct splaytree *tree)
 {
-    if (n->right_is_thread)
-        return n->right;
-    return NULL;
+    set_left(NULL, node);
+    set_right(NULL, node);
+    set_tree(tree, node);
 }
 
 
@@ -113,103 +95,105 @@ struct splaytree_node *splaytree_prev(const struct splaytree_node *node)
     return get_prev(node);
 }
 
-static inline void rotate_right(struct splaytree_node *node)
+/*
+ * cmp(key, node) orders the key against the nodes; the tree's own node
+ * comparator is used the same way with a node as the key.
+ */
+static int do_splay_key(const void *key, splaytree_key_cmp_fn_t cmp, struct splaytree *tree)
 {
-    struct splaytree_node *left = get_left(node); /* can't be NULL */
-    struct splaytree_node *r = get_right(left);
+    int rv;
 
-    if (r)
-        set_left(r, node);
-    else
-        set_prev(left, node);
-    set_right(node, left);
+    SPLAYTREE_SPLAY(key, cmp, tree, rv);
+    return rv;
 }
 
-static inline void rotate_left(struct splaytree_node *node)
+static inline int do_splay(const struct splaytree_node *key, struct splaytree *tree)
 {
-    struct splaytree_node *right = get_right(node); /* can't be NULL */
-    struct splaytree_node *l = get_left(right);
-
-    if (l)
-        set_right(l, node);
-    else
-        set_next(right, node);
-    set_left(node, right);
+    return do_splay_key(key, (splaytree_key_cmp_fn_t)tree->cmp_fn, tree);
 }
 
-static int do_splay(const struct splaytree_node *key, struct splaytree *tree)
+struct splaytree_node *splaytree_lookup_key(const void *key, splaytree_key_cmp_fn_t cmp, struct splaytree *tree)
 {
-    struct splaytree_node subroots;
-    memset(&subroots, 0, sizeof(struct splaytree_node));
-    struct splaytree_node *subleft = &subroots, *subright = &subroots;
-    struct splaytree_node *root = tree->root;
-    splaytree_cmp_fn_t cmp = tree->cmp_fn;
-    int rv;
+    if (!tree->root)
+        return NULL;
+    if (do_splay_key(key, cmp, tree) != 0)
+        return NULL;
+    return tree->root;
+}
 
-    for (;;) {
-        rv = cmp(key, root);
-        if (rv == 0)
-            break;
-        if (rv < 0) {
-            struct splaytree_node *left;
-
-            left = get_left(root);
-            if (!left)
-                break;
-            if ((rv = cmp(key, left)) < 0) {
-                rotate_right(root);
-                root = left;
-                left = get_left(root);
-                if (!left)
-                    break;
-            }
-            /* link left */
-            set_left(root, subright);
-            subright = root;
-            root = left;
-        } else {
-            struct splaytree_node *right;
-
-            right = get_right(root);
-            if (!right)
-                break;
-            if ((rv = cmp(key, right)) > 0) {
-                rotate_left(root);
-                root = right;
-                right = get_right(root);
-                if (!right)
-                    break;
-            }
-            /* link right */
-            set_right(root, subleft);
-            subleft = root;
-            root = right;
-        }
-    }
-    /* assemble */
-    if (get_left(root))
-        set_right(get_left(root), subleft);
-    else
-        set_next(root, subleft);
+struct splaytree_node *splaytree_lookup(const struct splaytree_node *key, struct splaytree *tree)
+{
+    return splaytree_lookup_key(key, (splaytree_key_cmp_fn_t)tree->cmp_fn, tree);
+}
 
-    if (get_right(root))
-        set_left(get_right(root), subright);
-    else
-        set_prev(root, subright);
+/*
+ * Bounded searches: splaying leaves the last node of the search path at the
+ * root, which is the key itself or one of its two neighbours.
+ */
+struct splaytree_node *splaytree_lower_bound_key(const void *key, splaytree_key_cmp_fn_t cmp, struct splaytree *tree)
+{
+    if (!tree->root)
+        return NULL;
+    if (do_splay_key(key, cmp, tree) <= 0)
+        return tree->root;
+    return splaytree_next(tree->root);
+}
 
-    set_left(get_right(&subroots), root);
-    set_right(get_left(&subroots), root);
-    tree->root = root;
-    return rv;
+struct splaytree_node *splaytree_upper_bound_key(const void *key, splaytree_key_cmp_fn_t cmp, struct splaytree *tree)
+{
+    if (!tree->root)
+        return NULL;
+    if (do_splay_key(key, cmp, tree) < 0)
+        return tree->root;
+    return splaytree_next(tree->root);
 }
 
-struct splaytree_node *splaytree_lookup(const struct splaytree_node *key, struct splaytree *tree)
+struct splaytree_node *splaytree_floor_key(const void *key, splaytree_key_cmp_fn_t cmp, struct splaytree *tree)
 {
     if (!tree->root)
         return NULL;
-    if (do_splay(key, tree) != 0)
+    if (do_splay_key(key, cmp, tree) >= 0)
+        return tree->root;
+    return splaytree_prev(tree->root);
+}
+
+struct splaytree_node *splaytree_lower_bound(const struct splaytree_node *key, struct splaytree *tree)
+{
+    return splaytree_lower_bound_key(key, (splaytree_key_cmp_fn_t)tree->cmp_fn, tree);
+}
+
+struct splaytree_node *splaytree_upper_bound(const struct splaytree_node *key, struct splaytree *tree)
+{
+    return splaytree_upper_bound_key(key, (splaytree_key_cmp_fn_t)tree->cmp_fn, tree);
+}
+
+struct splaytree_node *splaytree_floor(const struct splaytree_node *key, struct splaytree *tree)
+{
+    return splaytree_floor_key(key, (splaytree_key_cmp_fn_t)tree->cmp_fn, tree);
+}
+
+/* Range [lo, hi), see avltree_range() */
+struct splaytree_node *splaytree_range(const struct splaytree_node *lo, const struct splaytree_node *hi, struct splaytree *tree, struct splaytree_node **end)
+{
+    *end = NULL;
+    if (!tree->root || (lo && hi && tree->cmp_fn(lo, hi) >= 0))
         return NULL;
-    return tree->root;
+
+    if (hi && tree->cmp_fn(tree->last, hi) >= 0)
+        *end = splaytree_lower_bound(hi, tree);
+    if (!lo || tree->cmp_fn(tree->first, lo) >= 0)
+        return tree->first;
+    return splaytree_lower_bound(lo, tree);
+}
+
+unsigned splaytree_range_count(const struct splaytree_node *lo, const struct splaytree_node *hi, struct splaytree *tree)
+{
+    struct splaytree_node *node, *end;
+    unsigned count = 0;
+
+    for (node = splaytree_range(lo, hi, tree, &end); node != end; node = splaytree_next(node))
+        count++;
+    return count;
 }
 
 struct splaytree_node *splaytree_insert(struct splaytree_node *node, struct splaytree *tree)
@@ -231,11 +215,18 @@ struct splaytree_node *splaytree_insert(struct splaytree_node *node, struct spla
     if (res == 0)
         return tree->root;
 
+    splaytree_link(node, res, tree);
+    return NULL;
+}
+
+void splaytree_link(struct splaytree_node *node, int res, struct splaytree *tree)
+{
+    struct splaytree_node *root = tree->root;
+
     ++tree->size;
 
     INIT_NODE(node, tree);
 
-    root = tree->root;
     if (res < 0) {
         struct splaytree_node *left = get_left(root);
 
@@ -258,20 +249,35 @@ struct splaytree_node *splaytree_insert(struct splaytree_node *node, struct spla
         set_next(node, root);
     }
     tree->root = node;
-    return NULL;
 }
 
-void splaytree_remove(struct splaytree_node *node, struct splaytree *tree)
+/*
+ * Every access restructures a splay tree and a new node always becomes the
+ * root, so there is no descent to skip: the hint is ignored and the
+ * insertion is a regular one.
+ */
+struct splaytree_node *splaytree_insert_after(struct splaytree_node *node, struct splaytree_node *hint, struct splaytree *tree)
 {
-    struct splaytree_node *right, *left, *prev;
+    (void)hint;
+    return splaytree_insert(node, tree);
+}
 
-    if (tree && (node->tree != tree))
-        return;
+struct splaytree_node *splaytree_insert_before(struct splaytree_node *node, struct splaytree_node *hint, struct splaytree *tree)
+{
+    (void)hint;
+    return splaytree_insert(node, tree);
+}
 
-    --tree->size;
+/* Every node of the left subtree orders before the key, splay its maximum */
+#define AFTER_ALL(KEY, NODE) 1
+
+void splaytree_unlink(struct splaytree_node *node, struct splaytree *tree)
+{
+    struct splaytree_node *right, *left, *prev;
+    int rv;
 
-    do_splay(node, tree);
     assert(tree->root == node); /* 'node' must be present */
+    --tree->size;
 
     right = get_right(node);
     left  = get_left(node);
@@ -281,7 +287,8 @@ void splaytree_remove(struct splaytree_node *node, struct splaytree *tree)
         prev = NULL;
     } else {
         tree->root = left;
-        do_splay(node, tree);
+        SPLAYTREE_SPLAY(node, AFTER_ALL, tree, rv);
+        (void)rv;
         set_right(right, tree->root);
         prev = tree->root;
     }
@@ -291,6 +298,24 @@ void splaytree_remove(struct splaytree_node *node, struct splaytree *tree)
         tree->last = prev;
 }
 
+void splaytree_remove(struct splaytree_node *node, struct splaytree *tree)
+{
+    if (tree && !in_tree(node, tree))
+        return;
+
+    do_splay(node, tree);
+    splaytree_unlink(node, tree);
+}
+
+struct splaytree_node *splaytree_remove_key(const void *key, splaytree_key_cmp_fn_t cmp, struct splaytree *tree)
+{
+    struct splaytree_node *node = splaytree_lookup_key(key, cmp, tree);
+
+    if (node)
+        splaytree_remove(node, tree);
+    return node;
+}
+
 void splaytree_replace(struct splaytree_node *old, struct splaytree_node *node, struct splaytree *tree)
 {
     do_splay(old, tree);
@@ -305,6 +330,42 @@ void splaytree_replace(struct splaytree_node *old, struct splaytree_node *node,
     *node = *old;
 }
 
+/* Bulk build from nodes sorted in strictly ascending order, see bs.c */
+static struct splaytree_node *build_sorted(struct splaytree_node **nodes, unsigned count, struct splaytree_node *prev, struct splaytree_node *next, struct splaytree *tree)
+{
+    struct splaytree_node *node, *left, *right;
+    unsigned mid = count / 2;
+
+    if (!count)
+        return NULL;
+    node = nodes[mid];
+    INIT_NODE(node, tree);
+
+    left = build_sorted(nodes, mid, prev, node, tree);
+    right = build_sorted(nodes + mid + 1, count - mid - 1, node, next, tree);
+    if (left)
+        set_left(left, node);
+    else
+        set_prev(prev, node);
+    if (right)
+        set_right(right, node);
+    else
+        set_next(next, node);
+    return node;
+}
+
+int splaytree_build_sorted(struct splaytree_node **nodes, unsigned count, struct splaytree *tree)
+{
+    if (tree->size)
+        return -1;
+
+    tree->root = build_sorted(nodes, count, NULL, NULL, tree);
+    tree->size = count;
+    tree->first = count ? nodes[0] : NULL;
+    tree->last = count ? nodes[count - 1] : NULL;
+    return 0;
+}
+
 int splaytree_init(struct splaytree *tree, splaytree_cmp_fn_t cmp)
 {
     tree->cmp_fn = cmp;
@@ -319,7 +380,7 @@ void splaytree_clean(struct splaytree *tree)
 {
     struct splaytree_node *i;
     for (i = splaytree_first(tree); i; i = splaytree_next(i))
-        i->tree = NULL;
+        set_tree(NULL, i);
     splaytree_init(tree, tree->cmp_fn);
 }
 
@@ -3,6 +3,7 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include <string.h>
 
 
 #ifdef __GNUC__
@@ -17,14 +18,227 @@
 
 struct splaytree;
 
+#ifdef ANYTREE_COMPACT_NODES
+/* Child or thread links, the low bit is set for threads */
 struct splaytree_node {
+#ifndef ANYTREE_NO_TREE_POINTER
     struct splaytree *tree;
+#endif
+    uintptr_t left, right;
+};
+#else
+struct splaytree_node {
+#ifndef ANYTREE_NO_TREE_POINTER
+    struct splaytree *tree;
+#endif
     struct splaytree_node *left, *right;
     unsigned left_is_thread:1;
     unsigned right_is_thread:1;
 };
+#endif
+
+/*
+ * Link accessors, shared by splay.c and the code SPLAYTREE_GENERATE()
+ * expands to: get_left/get_right give NULL where the link is a thread,
+ * get_prev/get_next give NULL where it is a child.
+ */
+#ifdef ANYTREE_COMPACT_NODES
+
+#define SPLAYTREE__THREAD ((uintptr_t)1)
+
+static inline void splaytree__set_left(struct splaytree_node *l, struct splaytree_node *n)
+{
+    n->left = (uintptr_t)l;
+}
+
+static inline void splaytree__set_right(struct splaytree_node *r, struct splaytree_node *n)
+{
+    n->right = (uintptr_t)r;
+}
+
+static inline void splaytree__set_prev(struct splaytree_node *t, struct splaytree_node *n)
+{
+    n->left = (uintptr_t)t | SPLAYTREE__THREAD;
+}
+
+static inline void splaytree__set_next(struct splaytree_node *t, struct splaytree_node *n)
+{
+    n->right = (uintptr_t)t | SPLAYTREE__THREAD;
+}
+
+static inline struct splaytree_node *splaytree__get_left(const struct splaytree_node *n)
+{
+    if (n->left & SPLAYTREE__THREAD)
+        return NULL;
+    return (struct splaytree_node *)n->left;
+}
+
+static inline struct splaytree_node *splaytree__get_right(const struct splaytree_node *n)
+{
+    if (n->right & SPLAYTREE__THREAD)
+        return NULL;
+    return (struct splaytree_node *)n->right;
+}
+
+static inline struct splaytree_node *splaytree__get_prev(const struct splaytree_node *n)
+{
+    if (!(n->left & SPLAYTREE__THREAD))
+        return NULL;
+    return (struct splaytree_node *)(n->left & ~SPLAYTREE__THREAD);
+}
+
+static inline struct splaytree_node *splaytree__get_next(const struct splaytree_node *n)
+{
+    if (!(n->right & SPLAYTREE__THREAD))
+        return NULL;
+    return (struct splaytree_node *)(n->right & ~SPLAYTREE__THREAD);
+}
+
+#else
+
+static inline void splaytree__set_left(struct splaytree_node *l, struct splaytree_node *n)
+{
+    n->left = l;
+    n->left_is_thread = 0;
+}
+
+static inline void splaytree__set_right(struct splaytree_node *r, struct splaytree_node *n)
+{
+    n->right = r;
+    n->right_is_thread = 0;
+}
+
+static inline void splaytree__set_prev(struct splaytree_node *t, struct splaytree_node *n)
+{
+    n->left = t;
+    n->left_is_thread = 1;
+}
+
+static inline void splaytree__set_next(struct splaytree_node *t, struct splaytree_node *n)
+{
+    n->right = t;
+    n->right_is_thread = 1;
+}
+
+static inline struct splaytree_node *splaytree__get_left(const struct splaytree_node *n)
+{
+    if (!n->left_is_thread)
+        return n->left;
+    return NULL;
+}
+
+static inline struct splaytree_node *splaytree__get_right(const struct splaytree_node *n)
+{
+    if (!n->right_is_thread)
+        return n->right;
+    return NULL;
+}
+
+static inline struct splaytree_node *splaytree__get_prev(const struct splaytree_node *n)
+{
+    if (n->left_is_thread)
+        return n->left;
+    return NULL;
+}
+
+static inline struct splaytree_node *splaytree__get_next(const struct splaytree_node *n)
+{
+    if (n->right_is_thread)
+        return n->right;
+    return NULL;
+}
+
+#endif
+
+static inline void splaytree__rotate_right(struct splaytree_node *node)
+{
+    struct splaytree_node *left = splaytree__get_left(node); /* can't be NULL */
+    struct splaytree_node *r = splaytree__get_right(left);
+
+    if (r)
+        splaytree__set_left(r, node);
+    else
+        splaytree__set_prev(left, node);
+    splaytree__set_right(node, left);
+}
+
+static inline void splaytree__rotate_left(struct splaytree_node *node)
+{
+    struct splaytree_node *right = splaytree__get_right(node); /* can't be NULL */
+    struct splaytree_node *l = splaytree__get_left(right);
+
+    if (l)
+        splaytree__set_right(l, node);
+    else
+        splaytree__set_next(right, node);
+    splaytree__set_left(node, right);
+}
+
+/*
+ * Top-down splay of the non-empty TREE around KEY, leaving the result of
+ * the last CMP(KEY, node) in RV: 0 when the root is now the key, otherwise
+ * the root is one of its neighbours. CMP may be a function, a function
+ * pointer or a macro, which is what lets generated trees inline it.
+ */
+#define SPLAYTREE_SPLAY(KEY, CMP, TREE, RV) do {                                    \
+    struct splaytree_node splay_subroots;                                           \
+    struct splaytree_node *splay_subleft = &splay_subroots;                         \
+    struct splaytree_node *splay_subright = &splay_subroots;                        \
+    struct splaytree_node *splay_root = (TREE)->root;                               \
+                                                                                    \
+    memset(&splay_subroots, 0, sizeof(struct splaytree_node));                      \
+    for (;;) {                                                                      \
+        (RV) = CMP(KEY, splay_root);                                                \
+        if ((RV) == 0)                                                              \
+            break;                                                                  \
+        if ((RV) < 0) {                                                             \
+            struct splaytree_node *splay_left = splaytree__get_left(splay_root);    \
+            if (!splay_left)                                                        \
+                break;                                                              \
+            if (((RV) = CMP(KEY, splay_left)) < 0) {                                \
+                splaytree__rotate_right(splay_root);                                \
+                splay_root = splay_left;                                            \
+                splay_left = splaytree__get_left(splay_root);                       \
+                if (!splay_left)                                                    \
+                    break;                                                          \
+            }                                                                       \
+            /* link left */                                                         \
+            splaytree__set_left(splay_root, splay_subright);                        \
+            splay_subright = splay_root;                                            \
+            splay_root = splay_left;                                                \
+        } else {                                                                    \
+            struct splaytree_node *splay_right = splaytree__get_right(splay_root);  \
+            if (!splay_right)                                                       \
+                break;                                                              \
+            if (((RV) = CMP(KEY, splay_right)) > 0) {                               \
+                splaytree__rotate_left(splay_root);                                 \
+                splay_root = splay_right;                                           \
+                splay_right = splaytree__get_right(splay_root);                     \
+                if (!splay_right)                                                   \
+                    break;                                                          \
+            }                                                                       \
+            /* link right */                                                        \
+            splaytree__set_right(splay_root, splay_subleft);                        \
+            splay_subleft = splay_root;                                             \
+            splay_root = splay_right;                                               \
+        }                                                                           \
+    }                                                                               \
+    /* assemble */                                                                  \
+    if (splaytree__get_left(splay_root))                                            \
+        splaytree__set_right(splaytree__get_left(splay_root), splay_subleft);       \
+    else                                                                            \
+        splaytree__set_next(splay_root, splay_subleft);                             \
+    if (splaytree__get_right(splay_root))                                           \
+        splaytree__set_left(splaytree__get_right(splay_root), splay_subright);      \
+    else                                                                            \
+        splaytree__set_prev(splay_root, splay_subright);                            \
+    splaytree__set_left(splaytree__get_right(&splay_subroots), splay_root);         \
+    splaytree__set_right(splaytree__get_left(&splay_subroots), splay_root);         \
+    (TREE)->root = splay_root;                                                      \
+} while (0)
 
 typedef int (*splaytree_cmp_fn_t)(const struct splaytree_node *, const struct splaytree_node *);
+typedef int (*splaytree_key_cmp_fn_t)(const void *key, const struct splaytree_node *);
 
 struct splaytree {
     splaytree_cmp_fn_t cmp_fn;
@@ -40,9 +254,29 @@ struct splaytree_node *splaytree_next(const struct splaytree_node *node);
 struct splaytree_node *splaytree_prev(const struct splaytree_node *node);
 
 struct splaytree_node *splaytree_lookup(const struct splaytree_node *key, struct splaytree *tree);
+struct splaytree_node *splaytree_lower_bound(const struct splaytree_node *key, struct splaytree *tree);
+struct splaytree_node *splaytree_upper_bound(const struct splaytree_node *key, struct splaytree *tree);
+struct splaytree_node *splaytree_floor(const struct splaytree_node *key, struct splaytree *tree);
+#define splaytree_ceil(KEY, TREE) splaytree_lower_bound(KEY, TREE)
+
+struct splaytree_node *splaytree_range(const struct splaytree_node *lo, const struct splaytree_node *hi, struct splaytree *tree, struct splaytree_node **end);
+unsigned splaytree_range_count(const struct splaytree_node *lo, const struct splaytree_node *hi, struct splaytree *tree);
+
+struct splaytree_node *splaytree_lookup_key(const void *key, splaytree_key_cmp_fn_t cmp, struct splaytree *tree);
+struct splaytree_node *splaytree_lower_bound_key(const void *key, splaytree_key_cmp_fn_t cmp, struct splaytree *tree);
+struct splaytree_node *splaytree_upper_bound_key(const void *key, splaytree_key_cmp_fn_t cmp, struct splaytree *tree);
+struct splaytree_node *splaytree_floor_key(const void *key, splaytree_key_cmp_fn_t cmp, struct splaytree *tree);
+struct splaytree_node *splaytree_remove_key(const void *key, splaytree_key_cmp_fn_t cmp, struct splaytree *tree);
 struct splaytree_node *splaytree_insert( struct splaytree_node *node, struct splaytree *tree);
+/* Links 'node' as the new root after a splay around it that returned 'res' != 0 */
+void splaytree_link(struct splaytree_node *node, int res, struct splaytree *tree);
+struct splaytree_node *splaytree_insert_after(struct splaytree_node *node, struct splaytree_node *hint, struct splaytree *tree);
+struct splaytree_node *splaytree_insert_before(struct splaytree_node *node, struct splaytree_node *hint, struct splaytree *tree);
+/* Unlinks 'node', which must be the root, as left by a splay around it */
+void splaytree_unlink(struct splaytree_node *node, struct splaytree *tree);
 void splaytree_remove(struct splaytree_node *node, struct splaytree *tree);
 void splaytree_replace(struct splaytree_node *old, struct splaytree_node *node, struct splaytree *tree);
+int splaytree_build_sorted(struct splaytree_node **nodes, unsigned count, struct splaytree *tree);
 
 #define splaytree_is_empty(TREE) (TREE->size == 0)
 #define splaytree_size(TREE) (TREE->size)
@@ -54,4 +288,87 @@ typedef void (*splaytree_call_fn_t)(const struct splaytree_node *);
 void splaytree_foreach(struct splaytree *tree, splaytree_call_fn_t call);
 void splaytree_foreach_backward(struct splaytree *tree, splaytree_call_fn_t call);
 
+/*
+ * Type-specialized front end with an inlined comparator, see avl.h. The
+ * whole splay is expanded from SPLAYTREE_SPLAY(); only linking a new root
+ * and unlinking the old one are library calls.
+ */
+#define SPLAYTREE_GENERATE(NAME, TYPE, FIELD, CMP)                                                  \
+static inline TYPE *NAME##_entry(const struct splaytree_node *node)                                 \
+{                                                                                                   \
+    return node ? splaytree_container_of(node, TYPE, FIELD) : NULL;                                 \
+}                                                                                                   \
+static inline TYPE *NAME##_first(const struct splaytree *tree)                                      \
+{                                                                                                   \
+    return NAME##_entry(splaytree_first(tree));                                                     \
+}                                                                                                   \
+static inline TYPE *NAME##_last(const struct splaytree *tree)                                       \
+{                                                                                                   \
+    return NAME##_entry(splaytree_last(tree));                                                      \
+}                                                                                                   \
+static inline TYPE *NAME##_next(const TYPE *elm)                                                    \
+{                                                                                                   \
+    return NAME##_entry(splaytree_next(&elm->FIELD));                                               \
+}                                                                                                   \
+static inline TYPE *NAME##_prev(const TYPE *elm)                                                    \
+{                                                                                                   \
+    return NAME##_entry(splaytree_prev(&elm->FIELD));                                               \
+}                                                                                                   \
+static inline int NAME##_cmp_node(const TYPE *key, const struct splaytree_node *node)               \
+{                                                                                                   \
+    return CMP(key, splaytree_container_of(node, TYPE, FIELD));                                     \
+}                                                                                                   \
+static inline int NAME##_splay(const TYPE *key, struct splaytree *tree)                             \
+{                                                                                                   \
+    int res;                                                                                        \
+    SPLAYTREE_SPLAY(key, NAME##_cmp_node, tree, res);                                               \
+    return res;                                                                                     \
+}                                                                                                   \
+static inline TYPE *NAME##_lookup(const TYPE *key, struct splaytree *tree)                          \
+{                                                                                                   \
+    if (!tree->root || NAME##_splay(key, tree) != 0)                                                \
+        return NULL;                                                                                \
+    return NAME##_entry(tree->root);                                                                \
+}                                                                                                   \
+static inline TYPE *NAME##_lower_bound(const TYPE *key, struct splaytree *tree)                     \
+{                                                                                                   \
+    if (!tree->root)                                                                                \
+        return NULL;                                                                                \
+    if (NAME##_splay(key, tree) <= 0)                                                               \
+        return NAME##_entry(tree->root);                                                            \
+    return NAME##_entry(splaytree_next(tree->root));                                                \
+}                                                                                                   \
+static inline TYPE *NAME##_upper_bound(const TYPE *key, struct splaytree *tree)                     \
+{                                                                                                   \
+    if (!tree->root)                                                                                \
+        return NULL;                                                                                \
+    if (NAME##_splay(key, tree) < 0)                                                                \
+        return NAME##_entry(tree->root);                                                            \
+    return NAME##_entry(splaytree_next(tree->root));                                                \
+}                                                                                                   \
+static inline TYPE *NAME##_floor(const TYPE *key, struct splaytree *tree)                           \
+{                                                                                                   \
+    if (!tree->root)                                                                                \
+        return NULL;                                                                                \
+    if (NAME##_splay(key, tree) >= 0)                                                               \
+        return NAME##_entry(tree->root);                                                            \
+    return NAME##_entry(splaytree_prev(tree->root));                                                \
+}                                                                                                   \
+static inline TYPE *NAME##_insert(TYPE *elm, struct splaytree *tree)                                \
+{                                                                                                   \
+    int res;                                                                                        \
+    if (!tree->root)                                                                                \
+        return NAME##_entry(splaytree_insert(&elm->FIELD, tree));                                   \
+    res = NAME##_splay(elm, tree);                                                                  \
+    if (res == 0)                                                                                   \
+        return NAME##_entry(tree->root);                                                            \
+    splaytree_link(&elm->FIELD, res, tree);                                                         \
+    return NULL;                                                                                    \
+}                                                                                                   \
+static inline void NAME##_remove(TYPE *elm, struct splaytree *tree)                                 \
+{                                                                                                   \
+    NAME##_splay(elm, tree);                                                                        \
+    splaytree_unlink(&elm->FIELD, tree);                                                            \
+}
+
 #endif 
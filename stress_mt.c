@@ -0,0 +1,514 @@
+/*
+ * anytree_stress_mt - multi-threaded correctness check of the concurrent
+ * trees, meant to run under -fsanitize=thread as well as plainly.
+ *
+ * Every thread inserts and removes the keys it owns (key modulo the thread
+ * count) and keeps a model of them: an insertion or removal of its own key
+ * must agree with the model, and so must a lookup. On the lock-free trees
+ * a thread also removes its previously removed node again, after others
+ * have changed the tree around it, which must change nothing. Lookups of the other
+ * threads' keys may find them or not, but what they find must carry the
+ * key looked up. A second range of keys is inserted at the start and
+ * never removed: lookups of those must always succeed. Once the threads are
+ * done, an in-order walk must find exactly the keys of the models and of
+ * the pinned range, in ascending order. The exit status is the number of
+ * failed checks, capped at 1.
+ *
+ * Usage: anytree_stress_mt [-t trees] [-T threads] [-m exp] [-n ops] [-s seed]
+ *
+ *   -t  comma separated trees (default: all):
+ *         latch      rbtree_latch: lockless lookups, writers under a mutex
+ *         skiplist   lock-free skip list
+ *         avlcc      optimistic concurrent avl tree
+ *   -T  number of threads (default 4)
+ *   -m  number of keys per range as a power of ten (default 3)
+ *   -n  operations per thread (default 200000)
+ *   -s  random seed
+ */
+
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "avlcc.h"
+#include "epoch.h"
+#include "rblatch.h"
+#include "skiplist.h"
+
+
+/* The node comes last: a skip list node is followed by its tower */
+struct item {
+    struct anytree_epoch_entry retire;
+    uint64_t key;
+    union {
+        struct rbtree_latch_node latch;
+        struct avltree_cc_node avlcc;
+        struct skiplist_node skiplist;
+    } node;
+};
+
+static inline struct item *node_item(const void *node)
+{
+    return node ? (struct item *)((char *)node - offsetof(struct item, node)) : NULL;
+}
+
+static inline int item_cmp(const void *a, const void *b)
+{
+    uint64_t x = node_item(a)->key, y = node_item(b)->key;
+
+    return (x > y) - (x < y);
+}
+
+static inline int key_cmp(const void *key, const void *node)
+{
+    uint64_t x = *(const uint64_t *)key, y = node_item(node)->key;
+
+    return (x > y) - (x < y);
+}
+
+static int latch_cmp(const struct rbtree_latch_node *a, const struct rbtree_latch_node *b)
+{
+    return item_cmp(a, b);
+}
+
+static int latch_key_cmp(const void *key, const struct rbtree_latch_node *node)
+{
+    return key_cmp(key, node);
+}
+
+static int skiplist_cmp(const struct skiplist_node *a, const struct skiplist_node *b)
+{
+    return item_cmp(a, b);
+}
+
+static int skiplist_key_cmp(const void *key, const struct skiplist_node *node)
+{
+    return key_cmp(key, node);
+}
+
+static int avlcc_cmp(const struct avltree_cc_node *a, const struct avltree_cc_node *b)
+{
+    return item_cmp(a, b);
+}
+
+static int avlcc_key_cmp(const void *key, const struct avltree_cc_node *node)
+{
+    return key_cmp(key, node);
+}
+
+static void free_item(struct anytree_epoch_entry *entry)
+{
+    free(anytree_epoch_container_of(entry, struct item, retire));
+}
+
+
+/*
+ * Tree wrapper, one switch per operation as in bench_mt.c
+ */
+enum mt_tree {
+    TREE_LATCH,
+    TREE_SKIPLIST,
+    TREE_AVLCC
+};
+
+static const char *tree_names[] = { "latch", "skiplist", "avlcc" };
+#define TREE_COUNT (sizeof(tree_names) / sizeof(tree_names[0]))
+
+struct mt_tree_state {
+    enum mt_tree type;
+    pthread_mutex_t lock;       /* the latch writers */
+    struct anytree_epoch epoch;
+    union {
+        struct rbtree_latch latch;
+        struct skiplist skiplist;
+        struct avltree_cc avlcc;
+    } u;
+};
+
+static void mt_init(struct mt_tree_state *t, enum mt_tree type)
+{
+    t->type = type;
+    pthread_mutex_init(&t->lock, NULL);
+    anytree_epoch_init(&t->epoch);
+
+    switch (type) {
+    case TREE_LATCH:    rbtree_latch_init(&t->u.latch, latch_cmp); break;
+    case TREE_SKIPLIST: skiplist_init(&t->u.skiplist, skiplist_cmp); break;
+    case TREE_AVLCC:    avltree_cc_init(&t->u.avlcc, avlcc_cmp); break;
+    }
+}
+
+static inline struct item *mt_lookup(struct mt_tree_state *t, uint64_t key)
+{
+    struct item *it = NULL;
+
+    switch (t->type) {
+    case TREE_LATCH:
+        it = node_item(rbtree_latch_lookup_key(&key, latch_key_cmp, &t->u.latch));
+        break;
+    case TREE_SKIPLIST:
+        it = node_item(skiplist_lookup_key(&key, skiplist_key_cmp, &t->u.skiplist));
+        break;
+    case TREE_AVLCC:
+        it = node_item(avltree_cc_lookup_key(&key, avlcc_key_cmp, &t->u.avlcc));
+        break;
+    }
+    return it;
+}
+
+/* Returns the item with the same key already present, NULL once inserted */
+static inline struct item *mt_insert(struct mt_tree_state *t, struct item *it)
+{
+    struct item *found = NULL;
+
+    switch (t->type) {
+    case TREE_LATCH:
+        pthread_mutex_lock(&t->lock);
+        found = node_item(rbtree_latch_insert(&it->node.latch, &t->u.latch));
+        pthread_mutex_unlock(&t->lock);
+        break;
+    case TREE_SKIPLIST:
+        found = node_item(skiplist_insert(&it->node.skiplist, &t->u.skiplist));
+        break;
+    case TREE_AVLCC:
+        found = node_item(avltree_cc_insert(&it->node.avlcc, &t->u.avlcc));
+        break;
+    }
+    return found;
+}
+
+/* The item is left to the caller, see mt_remove() */
+static inline void mt_unlink(struct mt_tree_state *t, struct item *it)
+{
+    switch (t->type) {
+    case TREE_LATCH:
+        pthread_mutex_lock(&t->lock);
+        rbtree_latch_remove(&it->node.latch, &t->u.latch);
+        pthread_mutex_unlock(&t->lock);
+        break;
+    case TREE_SKIPLIST:
+        skiplist_remove(&it->node.skiplist, &t->u.skiplist);
+        break;
+    case TREE_AVLCC:
+        avltree_cc_remove(&it->node.avlcc, &t->u.avlcc);
+        break;
+    }
+}
+
+/* The item is retired, the caller must not touch it afterwards */
+static inline void mt_remove(struct mt_tree_state *t, struct item *it)
+{
+    mt_unlink(t, it);
+    anytree_epoch_retire(&t->epoch, &it->retire, free_item);
+}
+
+/*
+ * Removing a node no longer in the tree must change nothing. The latch
+ * tree is left out: without the tree pointer that is undefined there.
+ */
+static inline int mt_can_unlink_again(const struct mt_tree_state *t)
+{
+    return t->type != TREE_LATCH;
+}
+
+/* In-order walk, single threaded */
+static inline struct item *mt_first(struct mt_tree_state *t)
+{
+    switch (t->type) {
+    case TREE_LATCH:    return node_item(rbtree_latch_first(&t->u.latch));
+    case TREE_SKIPLIST: return node_item(skiplist_first(&t->u.skiplist));
+    case TREE_AVLCC:    return node_item(avltree_cc_first(&t->u.avlcc));
+    }
+    return NULL;
+}
+
+static inline struct item *mt_next(struct mt_tree_state *t, struct item *it)
+{
+    switch (t->type) {
+    case TREE_LATCH:    return node_item(rbtree_latch_next(&it->node.latch));
+    case TREE_SKIPLIST: return node_item(skiplist_next(&it->node.skiplist));
+    case TREE_AVLCC:    return node_item(avltree_cc_next(&it->node.avlcc));
+    }
+    return NULL;
+}
+
+
+/*
+ * Workers
+ */
+struct stress_case {
+    struct mt_tree_state tree;
+    unsigned long keys;         /* dynamic keys [0, keys), pinned [keys, 2 keys) */
+    struct item **pinned;
+    unsigned threads;
+    unsigned long ops;
+    unsigned long failures;
+};
+
+struct worker {
+    pthread_t thread;
+    struct stress_case *c;
+    unsigned id;
+    uint64_t rng;
+    struct item **owned;        /* owned[i] holds key i * threads + id, the model */
+    unsigned long owned_count;
+    struct item *removed;       /* removed last, not retired yet: removed again next time */
+};
+
+static uint64_t seed = 0x9e3779b97f4a7c15ULL;
+
+static inline uint64_t rng_next(uint64_t *state)
+{
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+static struct item *new_item(const struct mt_tree_state *t, uint64_t key)
+{
+    unsigned height = t->type == TREE_SKIPLIST ? skiplist_random_height() : 0;
+    struct item *it = malloc(sizeof(*it) + skiplist_tower_size(height));
+
+    if (!it) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    it->key = key;
+    if (height)
+        skiplist_node_init(&it->node.skiplist, height);
+    return it;
+}
+
+static void fail(struct stress_case *c, const char *what, uint64_t key)
+{
+    if (__atomic_fetch_add(&c->failures, 1, __ATOMIC_RELAXED) < 10)
+        fprintf(stderr, "%s: %s, key %llu\n", tree_names[c->tree.type], what, (unsigned long long)key);
+}
+
+static void *worker_run(void *arg)
+{
+    struct worker *w = (struct worker *)arg;
+    struct stress_case *c = w->c;
+    struct mt_tree_state *t = &c->tree;
+    struct anytree_epoch_reader *reader;
+    unsigned long i;
+
+    if (!(reader = anytree_epoch_register(&t->epoch))) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+
+    for (i = 0; i < c->ops; i++) {
+        uint64_t r = rng_next(&w->rng);
+        unsigned long slot = (r >> 8) % w->owned_count;
+        uint64_t key = slot * c->threads + w->id;
+        struct item *it;
+
+        anytree_epoch_enter(&t->epoch, reader);
+        switch (r % 4) {
+        case 0:                 /* own key: insert or remove */
+            if (w->owned[slot] && mt_can_unlink_again(t)) {
+                mt_unlink(t, w->owned[slot]);
+                if (w->removed) {
+                    mt_unlink(t, w->removed);
+                    anytree_epoch_retire(&t->epoch, &w->removed->retire, free_item);
+                }
+                w->removed = w->owned[slot];
+                w->owned[slot] = NULL;
+            } else if (w->owned[slot]) {
+                mt_remove(t, w->owned[slot]);
+                w->owned[slot] = NULL;
+            } else {
+                w->owned[slot] = new_item(t, key);
+                if (mt_insert(t, w->owned[slot]))
+                    fail(c, "insert found a key its owner had removed", key);
+            }
+            break;
+        case 1:                 /* own key: lookup against the model */
+            if (mt_lookup(t, key) != w->owned[slot])
+                fail(c, "lookup disagrees with the model", key);
+            break;
+        case 2:                 /* any dynamic key */
+            key = (r >> 8) % c->keys;
+            if ((it = mt_lookup(t, key)) && it->key != key)
+                fail(c, "lookup found another key", key);
+            break;
+        case 3:                 /* pinned key */
+            key = c->keys + (r >> 8) % c->keys;
+            if (!(it = mt_lookup(t, key)) || it->key != key)
+                fail(c, "lookup missed a pinned key", key);
+            break;
+        }
+        anytree_epoch_exit(reader);
+        if (i % 64 == 63)
+            anytree_epoch_collect(&t->epoch);
+    }
+
+    if (w->removed)
+        anytree_epoch_retire(&t->epoch, &w->removed->retire, free_item);
+    anytree_epoch_unregister(reader);
+    return NULL;
+}
+
+/* Compares an in-order walk with the models and the pinned range */
+static void check_final(struct stress_case *c, struct worker *workers)
+{
+    struct mt_tree_state *t = &c->tree;
+    struct item *it = mt_first(t);
+    uint64_t key;
+
+    for (key = 0; key < 2 * c->keys; key++) {
+        struct item *expect;
+
+        if (key < c->keys) {
+            struct worker *w = &workers[key % c->threads];
+            unsigned long slot = key / c->threads;
+
+            expect = slot < w->owned_count ? w->owned[slot] : NULL;
+        } else
+            expect = c->pinned[key - c->keys];
+        if (!expect)
+            continue;
+        if (it != expect) {
+            fail(c, "final walk differs from the models", key);
+            return;
+        }
+        it = mt_next(t, it);
+    }
+    if (it)
+        fail(c, "final walk has extra keys", it->key);
+}
+
+static unsigned long run_case(enum mt_tree type, unsigned threads, unsigned long keys, unsigned long ops)
+{
+    struct stress_case c;
+    struct worker *workers = calloc(threads, sizeof(*workers));
+    struct item **pinned = malloc(keys * sizeof(*pinned));
+    unsigned long k, slot;
+    unsigned i;
+
+    if (!workers || !pinned) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    memset(&c, 0, sizeof(c));
+    mt_init(&c.tree, type);
+    c.keys = keys;
+    c.pinned = pinned;
+    c.threads = threads;
+    c.ops = ops;
+
+    for (k = 0; k < keys; k++) {
+        pinned[k] = new_item(&c.tree, keys + k);
+        mt_insert(&c.tree, pinned[k]);
+    }
+    for (i = 0; i < threads; i++) {
+        struct worker *w = &workers[i];
+
+        w->c = &c;
+        w->id = i;
+        w->rng = seed + i;
+        w->owned_count = (keys + threads - 1 - i) / threads;
+        if (w->owned_count == 0)
+            w->owned_count = 1;
+        w->owned = calloc(w->owned_count, sizeof(*w->owned));
+        if (!w->owned) {
+            fprintf(stderr, "out of memory\n");
+            exit(1);
+        }
+        for (slot = 0; slot < w->owned_count; slot += 2) {
+            w->owned[slot] = new_item(&c.tree, slot * threads + i);
+            mt_insert(&c.tree, w->owned[slot]);
+        }
+    }
+
+    for (i = 0; i < threads; i++)
+        if (pthread_create(&workers[i].thread, NULL, worker_run, &workers[i])) {
+            fprintf(stderr, "cannot start thread %u\n", i);
+            exit(1);
+        }
+    for (i = 0; i < threads; i++)
+        pthread_join(workers[i].thread, NULL);
+
+    check_final(&c, workers);
+    printf("%s: %u threads, %lu keys, %lu ops per thread: %s\n",
+           tree_names[type], threads, keys, ops, c.failures ? "FAILED" : "ok");
+
+    /* single threaded again: no reader left */
+    for (i = 0; i < threads; i++) {
+        for (k = 0; k < workers[i].owned_count; k++)
+            if (workers[i].owned[k])
+                mt_remove(&c.tree, workers[i].owned[k]);
+        free(workers[i].owned);
+    }
+    for (k = 0; k < keys; k++)
+        mt_remove(&c.tree, pinned[k]);
+    anytree_epoch_destroy(&c.tree.epoch);
+    pthread_mutex_destroy(&c.tree.lock);
+    free(pinned);
+    free(workers);
+    return c.failures;
+}
+
+
+/*
+ * Driver
+ */
+static unsigned parse_list(const char *arg, const char *const *names, unsigned count)
+{
+    unsigned mask = 0, i;
+    char *copy = strdup(arg), *tok, *save = NULL;
+
+    for (tok = strtok_r(copy, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+        for (i = 0; i < count; i++)
+            if (strcmp(tok, names[i]) == 0)
+                break;
+        if (i == count) {
+            fprintf(stderr, "unknown name '%s'\n", tok);
+            exit(2);
+        }
+        mask |= 1u << i;
+    }
+    free(copy);
+    return mask;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-t trees] [-T threads] [-m exp] [-n ops] [-s seed]\n", prog);
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    unsigned trees = ~0u;
+    int threads = 4, exp = 3;
+    unsigned long keys = 1, ops = 200000, failures = 0;
+    int opt, i;
+    unsigned t;
+
+    while ((opt = getopt(argc, argv, "t:T:m:n:s:")) != -1) {
+        switch (opt) {
+        case 't': trees = parse_list(optarg, tree_names, TREE_COUNT); break;
+        case 'T': threads = atoi(optarg); break;
+        case 'm': exp = atoi(optarg); break;
+        case 'n': ops = strtoul(optarg, NULL, 0); break;
+        case 's': seed = strtoull(optarg, NULL, 0); break;
+        default: usage(argv[0]);
+        }
+    }
+    if (threads < 1 || exp < 1 || exp > 7)
+        usage(argv[0]);
+    for (i = 0; i < exp; i++)
+        keys *= 10;
+
+    for (t = 0; t < TREE_COUNT; t++)
+        if (trees & (1u << t))
+            failures += run_case(t, threads, keys, ops);
+    return failures ? 1 : 0;
+}
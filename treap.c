@@ -0,0 +1,816 @@
+#include "treap.h"
+
+/* Tree back-pointer, see avl.c */
+#ifdef ANYTREE_NO_TREE_POINTER
+static inline void set_tree(struct treap *tree, struct treap_node *node)
+{
+    (void)tree;
+    (void)node;
+}
+
+static inline int in_tree(const struct treap_node *node, const struct treap *tree)
+{
+    (void)node;
+    (void)tree;
+    return 1;
+}
+#else
+static inline void set_tree(struct treap *tree, struct treap_node *node)
+{
+    node->tree = tree;
+}
+
+static inline int in_tree(const struct treap_node *node, const struct treap *tree)
+{
+    return node->tree == tree;
+}
+#endif
+
+/*
+ * The priority of a node is the MurmurHash3 finalizer of its address. The
+ * finalizer is a bijection, so distinct nodes never tie and only NULL
+ * hashes to 0, and it scatters the evenly spaced addresses of an array.
+ * Parents have higher priorities than their children.
+ */
+static inline uint64_t priority(const struct treap_node *node)
+{
+    uint64_t h = (uint64_t)(uintptr_t)node;
+
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+static inline void INIT_NODE(struct treap_node *node, struct treap *tree)
+{
+    node->left = NULL;
+    node->right = NULL;
+    set_tree(tree, node);
+}
+
+static inline struct treap_node *get_first(struct treap_node *node)
+{
+    while (node->left)
+        node = node->left;
+    return node;
+}
+
+static inline struct treap_node *get_last(struct treap_node *node)
+{
+    while (node->right)
+        node = node->right;
+    return node;
+}
+
+struct treap_node *treap_first(const struct treap *tree)
+{
+    return tree->first;
+}
+
+struct treap_node *treap_last(const struct treap *tree)
+{
+    return tree->last;
+}
+
+struct treap_node *treap_next(const struct treap_node *node)
+{
+    struct treap_node *parent;
+
+    if (node->right)
+        return get_first(node->right);
+
+    while ((parent = node->parent) && parent->right == node)
+        node = parent;
+    return parent;
+}
+
+struct treap_node *treap_prev(const struct treap_node *node)
+{
+    struct treap_node *parent;
+
+    if (node->left)
+        return get_last(node->left);
+
+    while ((parent = node->parent) && parent->left == node)
+        node = parent;
+    return parent;
+}
+
+static void set_child(struct treap_node *child, struct treap_node *node, int left)
+{
+    if (left)
+        node->left = child;
+    else
+        node->right = child;
+}
+
+/* Lifts 'node' above its parent, either way */
+static void rotate_up(struct treap_node *node, struct treap *tree)
+{
+    struct treap_node *parent = node->parent;
+    struct treap_node *grand = parent->parent;
+
+    if (parent->left == node) {
+        parent->left = node->right;
+        if (node->right)
+            node->right->parent = parent;
+        node->right = parent;
+    } else {
+        parent->right = node->left;
+        if (node->left)
+            node->left->parent = parent;
+        node->left = parent;
+    }
+    parent->parent = node;
+    node->parent = grand;
+
+    if (grand)
+        set_child(node, grand, grand->left == parent);
+    else
+        tree->root = node;
+}
+
+static inline struct treap_node *do_lookup(const struct treap_node *key, const struct treap *tree, struct treap_node **pparent, int *is_left)
+{
+    struct treap_node *node = tree->root;
+    int res = 0;
+
+    *pparent = NULL;
+    *is_left = 0;
+
+    while (node) {
+        res = tree->cmp_fn(node, key);
+        if (res == 0)
+            return node;
+        *pparent = node;
+        if ((*is_left = res > 0))
+            node = node->left;
+        else
+            node = node->right;
+    }
+    return NULL;
+}
+
+struct treap_node *treap_lookup(const struct treap_node *key, const struct treap *tree)
+{
+    struct treap_node *parent;
+    int is_left;
+
+    return do_lookup(key, tree, &parent, &is_left);
+}
+
+/* Bounded searches, see avl.c */
+static struct treap_node *do_bound(const struct treap_node *key, const struct treap *tree, int after, int strict)
+{
+    struct treap_node *node = tree->root;
+    struct treap_node *bound = NULL;
+
+    while (node) {
+        int res = tree->cmp_fn(node, key);
+        if (res == 0 && !strict)
+            return node;
+        if (after) {
+            if (res > 0) {
+                bound = node;
+                node = node->left;
+            } else
+                node = node->right;
+        } else {
+            if (res < 0) {
+                bound = node;
+                node = node->right;
+            } else
+                node = node->left;
+        }
+    }
+    return bound;
+}
+
+struct treap_node *treap_lower_bound(const struct treap_node *key, const struct treap *tree)
+{
+    return do_bound(key, tree, 1, 0);
+}
+
+struct treap_node *treap_upper_bound(const struct treap_node *key, const struct treap *tree)
+{
+    return do_bound(key, tree, 1, 1);
+}
+
+struct treap_node *treap_floor(const struct treap_node *key, const struct treap *tree)
+{
+    return do_bound(key, tree, 0, 0);
+}
+
+/* Range [lo, hi), see avl.c */
+struct treap_node *treap_range(const struct treap_node *lo, const struct treap_node *hi, const struct treap *tree, struct treap_node **end)
+{
+    *end = NULL;
+    if (!tree->root || (lo && hi && tree->cmp_fn(lo, hi) >= 0))
+        return NULL;
+
+    if (hi && tree->cmp_fn(tree->last, hi) >= 0)
+        *end = treap_lower_bound(hi, tree);
+    if (!lo || tree->cmp_fn(tree->first, lo) >= 0)
+        return tree->first;
+    return treap_lower_bound(lo, tree);
+}
+
+unsigned treap_range_count(const struct treap_node *lo, const struct treap_node *hi, const struct treap *tree)
+{
+    struct treap_node *node, *end;
+    unsigned count = 0;
+
+    for (node = treap_range(lo, hi, tree, &end); node != end; node = treap_next(node))
+        count++;
+    return count;
+}
+
+/* Searches by key, see avl.c */
+static struct treap_node *do_bound_key(const void *key, treap_key_cmp_fn_t cmp, const struct treap *tree, int after, int strict)
+{
+    struct treap_node *node = tree->root;
+    struct treap_node *bound = NULL;
+
+    while (node) {
+        int res = cmp(key, node);
+        if (res == 0 && !strict)
+            return node;
+        if (after) {
+            if (res < 0) {
+                bound = node;
+                node = node->left;
+            } else
+                node = node->right;
+        } else {
+            if (res > 0) {
+                bound = node;
+                node = node->right;
+            } else
+                node = node->left;
+        }
+    }
+    return bound;
+}
+
+struct treap_node *treap_lookup_key(const void *key, treap_key_cmp_fn_t cmp, const struct treap *tree)
+{
+    struct treap_node *node = tree->root;
+
+    while (node) {
+        int res = cmp(key, node);
+        if (res == 0)
+            return node;
+        if (res < 0)
+            node = node->left;
+        else
+            node = node->right;
+    }
+    return NULL;
+}
+
+struct treap_node *treap_lower_bound_key(const void *key, treap_key_cmp_fn_t cmp, const struct treap *tree)
+{
+    return do_bound_key(key, cmp, tree, 1, 0);
+}
+
+struct treap_node *treap_upper_bound_key(const void *key, treap_key_cmp_fn_t cmp, const struct treap *tree)
+{
+    return do_bound_key(key, cmp, tree, 1, 1);
+}
+
+struct treap_node *treap_floor_key(const void *key, treap_key_cmp_fn_t cmp, const struct treap *tree)
+{
+    return do_bound_key(key, cmp, tree, 0, 0);
+}
+
+/*
+ * Links 'node' as a leaf at a free child slot of 'parent' and rotates it
+ * up past the ancestors of lower priority: fewer than two rotations on
+ * average, and no rebalancing state to update on the way.
+ */
+void treap_link(struct treap_node *node, struct treap_node *parent, int is_left, struct treap *tree)
+{
+    uint64_t prio;
+
+    ++tree->size;
+    INIT_NODE(node, tree);
+    node->parent = parent;
+
+    if (!parent) {
+        tree->root = node;
+        tree->first = tree->last = node;
+        return;
+    }
+    set_child(node, parent, is_left);
+    if (is_left) {
+        if (parent == tree->first)
+            tree->first = node;
+    } else {
+        if (parent == tree->last)
+            tree->last = node;
+    }
+
+    prio = priority(node);
+    while (node->parent && priority(node->parent) < prio)
+        rotate_up(node, tree);
+}
+
+struct treap_node *treap_insert(struct treap_node *node, struct treap *tree)
+{
+    struct treap_node *key, *parent;
+    int is_left;
+
+    key = do_lookup(node, tree, &parent, &is_left);
+    if (key)
+        return key;
+
+    treap_link(node, parent, is_left, tree);
+    return NULL;
+}
+
+/* Hinted insertion, see avl.c */
+static struct treap_node *insert_between(struct treap_node *node, struct treap_node *prev, struct treap_node *next, struct treap *tree)
+{
+    int res;
+
+    if (prev) {
+        res = tree->cmp_fn(prev, node);
+        if (res == 0)
+            return prev;
+        if (res > 0)
+            return treap_insert(node, tree);
+    }
+    if (next) {
+        res = tree->cmp_fn(next, node);
+        if (res == 0)
+            return next;
+        if (res < 0)
+            return treap_insert(node, tree);
+    }
+
+    if (prev && !prev->right)
+        treap_link(node, prev, 0, tree);
+    else
+        treap_link(node, next, 1, tree);
+    return NULL;
+}
+
+struct treap_node *treap_insert_after(struct treap_node *node, struct treap_node *hint, struct treap *tree)
+{
+    if (hint && !in_tree(hint, tree))
+        return treap_insert(node, tree);
+    return insert_between(node, hint, hint ? treap_next(hint) : tree->first, tree);
+}
+
+struct treap_node *treap_insert_before(struct treap_node *node, struct treap_node *hint, struct treap *tree)
+{
+    if (hint && !in_tree(hint, tree))
+        return treap_insert(node, tree);
+    return insert_between(node, hint ? treap_prev(hint) : tree->last, hint, tree);
+}
+
+/* Rotates 'node' down below its children of higher priority */
+static void sift_down(struct treap_node *node, struct treap *tree)
+{
+    uint64_t prio = priority(node);
+    struct treap_node *child;
+
+    for (;;) {
+        child = node->left;
+        if (node->right && (!child || priority(node->right) > priority(child)))
+            child = node->right;
+        if (!child || priority(child) < prio)
+            return;
+        rotate_up(child, tree);
+    }
+}
+
+void treap_remove(struct treap_node *node, struct treap *tree)
+{
+    struct treap_node *parent, *child;
+
+    if (!in_tree(node, tree))
+        return;
+
+    --tree->size;
+
+    if (node == tree->first)
+        tree->first = treap_next(node);
+    if (node == tree->last)
+        tree->last = treap_prev(node);
+
+    /* down to where a child is missing, then spliced out */
+    while (node->left && node->right)
+        rotate_up(priority(node->left) > priority(node->right) ? node->left : node->right, tree);
+
+    child = node->left ? node->left : node->right;
+    parent = node->parent;
+    if (child)
+        child->parent = parent;
+    if (parent)
+        set_child(child, parent, parent->left == node);
+    else
+        tree->root = child;
+}
+
+struct treap_node *treap_remove_key(const void *key, treap_key_cmp_fn_t cmp, struct treap *tree)
+{
+    struct treap_node *node = treap_lookup_key(key, cmp, tree);
+
+    if (node)
+        treap_remove(node, tree);
+    return node;
+}
+
+/*
+ * 'node' takes the place of 'old', but its address hashes to another
+ * priority: it is then rotated up or down to restore the heap order, as
+ * few rotations on average as an insertion.
+ */
+void treap_replace(struct treap_node *old, struct treap_node *node, struct treap *tree)
+{
+    struct treap_node *parent = old->parent;
+    uint64_t prio;
+
+    if (parent)
+        set_child(node, parent, parent->left == old);
+    else
+        tree->root = node;
+
+    if (old->left)
+        old->left->parent = node;
+    if (old->right)
+        old->right->parent = node;
+
+    if (tree->first == old)
+        tree->first = node;
+    if (tree->last == old)
+        tree->last = node;
+
+    *node = *old;
+
+    prio = priority(node);
+    while (node->parent && priority(node->parent) < prio)
+        rotate_up(node, tree);
+    sift_down(node, tree);
+}
+
+/*
+ * Bulk build: links nodes[], which must be sorted in strictly ascending
+ * order, without calling the comparator. Each node is pushed onto the
+ * right spine after popping the spine nodes of lower priority, which
+ * become its left subtree: O(n) overall.
+ */
+int treap_build_sorted(struct treap_node **nodes, unsigned count, struct treap *tree)
+{
+    struct treap_node *spine = NULL, *below, *node;
+    uint64_t prio;
+    unsigned i;
+
+    if (tree->size)
+        return -1;
+
+    tree->root = NULL;
+    for (i = 0; i < count; i++) {
+        node = nodes[i];
+        prio = priority(node);
+        INIT_NODE(node, tree);
+
+        for (below = NULL; spine && priority(spine) < prio; spine = spine->parent)
+            below = spine;
+        node->left = below;
+        if (below)
+            below->parent = node;
+        node->parent = spine;
+        if (spine)
+            spine->right = node;
+        else
+            tree->root = node;
+        spine = node;
+    }
+    tree->size = count;
+    tree->first = count ? nodes[0] : NULL;
+    tree->last = count ? nodes[count - 1] : NULL;
+    return 0;
+}
+
+/*
+ * Join, split, union and range removal work on detached subtrees, whose
+ * roots have a NULL parent.
+ *
+ * do_join() links 'left', the optional 'pivot' and 'right', in this order,
+ * walking down the right spine of 'left' and the left spine of 'right'
+ * and taking the node of higher priority at each step, until the pivot's
+ * priority is the highest or, without pivot, a spine ends. Its cost is the
+ * length of the spines, O(log n) expected.
+ */
+static struct treap_node *do_join(struct treap_node *left, struct treap_node *pivot, struct treap_node *right)
+{
+    struct treap_node *root = NULL, *parent = NULL, *top;
+    struct treap_node **link = &root;
+    uint64_t p = pivot ? priority(pivot) : 0;
+    uint64_t l, r;
+
+    for (;;) {
+        if (!pivot && (!left || !right))
+            break;
+        l = left ? priority(left) : 0;
+        r = right ? priority(right) : 0;
+        if (l > r && l > p) {
+            top = left;
+            left = left->right;
+            top->parent = parent;
+            *link = top;
+            link = &top->right;
+        } else if (r > p) {
+            top = right;
+            right = right->left;
+            top->parent = parent;
+            *link = top;
+            link = &top->left;
+        } else
+            break;
+        parent = top;
+    }
+
+    if (pivot) {
+        pivot->left = left;
+        pivot->right = right;
+        if (left)
+            left->parent = pivot;
+        if (right)
+            right->parent = pivot;
+        top = pivot;
+    } else
+        top = left ? left : right;
+    if (top)
+        top->parent = parent;
+    *link = top;
+    return root;
+}
+
+/*
+ * Splits the subtree 'node' along the search path of 'key' into the nodes
+ * less than 'key' and the others. With 'take_equal', a node equal to 'key'
+ * goes to neither side and is returned.
+ */
+static struct treap_node *do_split(struct treap_node *node, const struct treap_node *key, treap_cmp_fn_t cmp, int take_equal,
+                                   struct treap_node **left, struct treap_node **right)
+{
+    struct treap_node *lparent = NULL, *rparent = NULL, *next;
+    int res;
+
+    while (node) {
+        res = cmp(node, key);
+        if (res == 0 && take_equal) {
+            if ((*left = node->left))
+                node->left->parent = lparent;
+            if ((*right = node->right))
+                node->right->parent = rparent;
+            return node;
+        }
+        if (res < 0) {
+            next = node->right;
+            node->parent = lparent;
+            *left = lparent = node;
+            left = &node->right;
+        } else {
+            next = node->left;
+            node->parent = rparent;
+            *right = rparent = node;
+            right = &node->left;
+        }
+        node = next;
+    }
+    *left = *right = NULL;
+    return NULL;
+}
+
+static struct treap_node *set_children(struct treap_node *node, struct treap_node *left, struct treap_node *right)
+{
+    node->left = left;
+    node->right = right;
+    if (left)
+        left->parent = node;
+    if (right)
+        right->parent = node;
+    return node;
+}
+
+/*
+ * Union of the subtrees 'mine' and 'theirs': the root of higher priority
+ * stays on top and the other subtree is split around it, then the halves
+ * are merged recursively, in O(m log(n/m + 1)) expected time for sizes
+ * m <= n. Of two equal nodes the one from 'mine' is kept, the other is
+ * pushed onto the 'dups' list, chained through 'right'.
+ */
+static struct treap_node *do_union(struct treap_node *mine, struct treap_node *theirs, treap_cmp_fn_t cmp, struct treap_node **dups)
+{
+    struct treap_node *l, *r, *equal, *left, *right;
+
+    if (!mine || !theirs)
+        return mine ? mine : theirs;
+
+    if (priority(mine) > priority(theirs)) {
+        equal = do_split(theirs, mine, cmp, 1, &l, &r);
+        if (equal) {
+            equal->right = *dups;
+            *dups = equal;
+        }
+        left = do_union(mine->left, l, cmp, dups);
+        right = do_union(mine->right, r, cmp, dups);
+        return set_children(mine, left, right);
+    }
+
+    equal = do_split(mine, theirs, cmp, 1, &l, &r);
+    left = do_union(l, theirs->left, cmp, dups);
+    right = do_union(r, theirs->right, cmp, dups);
+    if (!equal)
+        return set_children(theirs, left, right);
+    theirs->right = *dups;
+    *dups = theirs;
+    return do_join(left, equal, right);
+}
+
+/*
+ * Moves the nodes of a detached subtree over to 'tree' and counts them,
+ * visiting each: linear in the nodes that change trees.
+ */
+static unsigned adopt(struct treap_node *root, struct treap *tree)
+{
+    struct treap_node *node;
+    unsigned count = 0;
+
+    if (!root)
+        return 0;
+    for (node = get_first(root); node; node = treap_next(node)) {
+        set_tree(tree, node);
+        count++;
+    }
+    return count;
+}
+
+/*
+ * Keys in 'left' must precede 'pivot', which must precede the keys in
+ * 'right'. Unlike rbtree_join(), a NULL pivot merges the two trees
+ * directly. All nodes end up in 'left' and 'right' is left empty.
+ */
+void treap_join(struct treap *left, struct treap_node *pivot, struct treap *right)
+{
+    unsigned size = left->size + right->size;
+
+    if (!pivot && !right->root)
+        return;
+    if (pivot) {
+        INIT_NODE(pivot, left);
+        size++;
+    }
+#ifndef ANYTREE_NO_TREE_POINTER
+    adopt(right->root, left);
+#endif
+
+    left->root = do_join(left->root, pivot, right->root);
+    left->size = size;
+    if (!left->first)
+        left->first = pivot ? pivot : right->first;
+    if (right->last)
+        left->last = right->last;
+    else
+        left->last = pivot;
+    treap_init(right, right->cmp_fn);
+}
+
+/*
+ * Moves every node not less than 'key' into 'right', which is
+ * (re)initialized with the comparator of 'tree'.
+ */
+void treap_split(const struct treap_node *key, struct treap *tree, struct treap *right)
+{
+    struct treap_node *l, *r;
+
+    treap_init(right, tree->cmp_fn);
+    if (!tree->root)
+        return;
+
+    do_split(tree->root, key, tree->cmp_fn, 0, &l, &r);
+
+    right->root = r;
+    right->first = r ? get_first(r) : NULL;
+    right->last = r ? tree->last : NULL;
+    right->size = adopt(r, right);
+
+    tree->root = l;
+    tree->first = l ? tree->first : NULL;
+    tree->last = l ? get_last(l) : NULL;
+    tree->size -= right->size;
+}
+
+/*
+ * Moves the nodes of 'other' into 'tree', except those whose key is
+ * already in 'tree': these stay in 'other', which holds nothing else
+ * afterwards. Both trees must order their nodes alike.
+ */
+void treap_union(struct treap *tree, struct treap *other)
+{
+    struct treap_node *dups = NULL, *node;
+    unsigned size = tree->size + other->size;
+
+    if (!other->root)
+        return;
+#ifndef ANYTREE_NO_TREE_POINTER
+    adopt(other->root, tree);
+#endif
+
+    tree->root = do_union(tree->root, other->root, tree->cmp_fn, &dups);
+    tree->root->parent = NULL;
+    tree->first = get_first(tree->root);
+    tree->last = get_last(tree->root);
+
+    treap_init(other, other->cmp_fn);
+    while ((node = dups)) {
+        dups = node->right;
+        treap_insert(node, other);
+        size--;
+    }
+    tree->size = size;
+}
+
+/*
+ * Moves the nodes of [lo, hi) into 'removed', which is (re)initialized with
+ * the comparator of 'tree'. A NULL bound leaves that side open. Two splits
+ * cut the range out and a join closes the gap.
+ */
+void treap_remove_range(const struct treap_node *lo, const struct treap_node *hi, struct treap *tree, struct treap *removed)
+{
+    struct treap_node *l = NULL, *m = tree->root, *r = NULL;
+
+    treap_init(removed, tree->cmp_fn);
+    if (!tree->root || (lo && hi && tree->cmp_fn(lo, hi) >= 0))
+        return;
+
+    if (lo)
+        do_split(m, lo, tree->cmp_fn, 0, &l, &m);
+    if (hi && m)
+        do_split(m, hi, tree->cmp_fn, 0, &m, &r);
+    if (!m) {
+        tree->root = do_join(l, NULL, r);
+        return;
+    }
+
+    removed->root = m;
+    removed->first = get_first(m);
+    removed->last = get_last(m);
+    removed->size = adopt(m, removed);
+
+    if (!l)
+        tree->first = r ? get_first(r) : NULL;
+    if (!r)
+        tree->last = l ? get_last(l) : NULL;
+    tree->root = do_join(l, NULL, r);
+    tree->size -= removed->size;
+}
+
+int treap_init(struct treap *tree, treap_cmp_fn_t fn)
+{
+    tree->cmp_fn = fn;
+    tree->size = 0;
+    tree->root = NULL;
+    tree->first = NULL;
+    tree->last = NULL;
+    return 0;
+}
+
+void treap_clean(struct treap *tree)
+{
+    struct treap_node *i;
+    for (i = treap_first(tree); i; i = treap_next(i))
+        set_tree(NULL, i);
+    treap_init(tree, tree->cmp_fn);
+}
+
+void treap_foreach(struct treap *tree, treap_call_fn_t call)
+{
+    struct treap_node * i;
+    struct treap_node * n;
+    for (i = treap_first(tree); i; )
+    {
+        n = treap_next(i);
+        call(i);
+        i = n;
+    }
+}
+
+void treap_foreach_backward(struct treap *tree, treap_call_fn_t call)
+{
+    struct treap_node * i;
+    struct treap_node * n;
+    for (i = treap_last(tree); i; )
+    {
+        n = treap_prev(i);
+        call(i);
+        i = n;
+    }
+}
@@ -0,0 +1,102 @@
+#ifndef ANYTREE__TREAP__INCLUDED
+#define ANYTREE__TREAP__INCLUDED
+
+#include <stdint.h>
+#include <stddef.h>
+
+
+#ifdef __GNUC__
+#  define treap_container_of(node, type, member) ({      \
+    const struct treap_node *__mptr = (node);            \
+    (type *)( (char *)__mptr - offsetof(type,member) );})
+#else
+#  define treap_container_of(node, type, member)         \
+    ((type *)((char *)(node) - offsetof(type, member)))
+#endif
+
+
+/*
+ * Randomized treap: a binary search tree kept in heap order of priorities
+ * drawn at random, which makes its shape that of a tree built from the
+ * keys in random order, whatever the order they come in. The priority of a
+ * node is a hash of its address, so nodes store none and the tree keeps no
+ * random state. Insertion and removal take O(log n) expected time and fewer
+ * than two rotations on average. Split, join and range removal relink in
+ * O(log n) expected time, and union in O(m log(n/m + 1)) for sizes m <= n,
+ * but the walks below come on top.
+ *
+ * The hash is fixed: a caller choosing the addresses of its nodes could
+ * choose a degenerate tree.
+ */
+struct treap;
+
+struct treap_node {
+#ifndef ANYTREE_NO_TREE_POINTER
+    struct treap *tree;
+#endif
+    struct treap_node *left, *right;
+    struct treap_node *parent;
+};
+
+typedef int (*treap_cmp_fn_t)(const struct treap_node *, const struct treap_node *);
+typedef int (*treap_key_cmp_fn_t)(const void *key, const struct treap_node *);
+
+struct treap {
+    treap_cmp_fn_t cmp_fn;
+    unsigned size;
+
+    struct treap_node *root;
+    struct treap_node *first, *last;
+};
+
+struct treap_node *treap_first(const struct treap *tree);
+struct treap_node *treap_last(const struct treap *tree);
+struct treap_node *treap_next(const struct treap_node *node);
+struct treap_node *treap_prev(const struct treap_node *node);
+
+struct treap_node *treap_lookup(const struct treap_node *key, const struct treap *tree);
+struct treap_node *treap_lower_bound(const struct treap_node *key, const struct treap *tree);
+struct treap_node *treap_upper_bound(const struct treap_node *key, const struct treap *tree);
+struct treap_node *treap_floor(const struct treap_node *key, const struct treap *tree);
+#define treap_ceil(KEY, TREE) treap_lower_bound(KEY, TREE)
+
+struct treap_node *treap_range(const struct treap_node *lo, const struct treap_node *hi, const struct treap *tree, struct treap_node **end);
+unsigned treap_range_count(const struct treap_node *lo, const struct treap_node *hi, const struct treap *tree);
+
+struct treap_node *treap_lookup_key(const void *key, treap_key_cmp_fn_t cmp, const struct treap *tree);
+struct treap_node *treap_lower_bound_key(const void *key, treap_key_cmp_fn_t cmp, const struct treap *tree);
+struct treap_node *treap_upper_bound_key(const void *key, treap_key_cmp_fn_t cmp, const struct treap *tree);
+struct treap_node *treap_floor_key(const void *key, treap_key_cmp_fn_t cmp, const struct treap *tree);
+struct treap_node *treap_remove_key(const void *key, treap_key_cmp_fn_t cmp, struct treap *tree);
+struct treap_node *treap_insert(struct treap_node *node, struct treap *tree);
+struct treap_node *treap_insert_after(struct treap_node *node, struct treap_node *hint, struct treap *tree);
+struct treap_node *treap_insert_before(struct treap_node *node, struct treap_node *hint, struct treap *tree);
+void treap_link(struct treap_node *node, struct treap_node *parent, int is_left, struct treap *tree);
+void treap_remove(struct treap_node *node, struct treap *tree);
+void treap_replace(struct treap_node *old, struct treap_node *node, struct treap *tree);
+int treap_build_sorted(struct treap_node **nodes, unsigned count, struct treap *tree);
+
+/*
+ * Bulk operations. The nodes changing trees have their tree pointer
+ * updated in a walk over them: join and union walk the nodes of 'right'
+ * and 'other', split and range removal the nodes they move out, which they
+ * also count. Each walk adds O(nodes walked) to the cost. Built with
+ * ANYTREE_NO_TREE_POINTER, join and union do not walk, but split and range
+ * removal still walk to count, so only join stays O(log n) expected.
+ */
+void treap_join(struct treap *left, struct treap_node *pivot, struct treap *right);
+void treap_split(const struct treap_node *key, struct treap *tree, struct treap *right);
+void treap_union(struct treap *tree, struct treap *other);
+void treap_remove_range(const struct treap_node *lo, const struct treap_node *hi, struct treap *tree, struct treap *removed);
+
+#define treap_is_empty(TREE) (TREE->size == 0)
+#define treap_size(TREE) (TREE->size)
+
+int treap_init(struct treap *tree, treap_cmp_fn_t cmp);
+void treap_clean(struct treap *tree);
+
+typedef void (*treap_call_fn_t)(const struct treap_node *);
+void treap_foreach(struct treap *tree, treap_call_fn_t call);
+void treap_foreach_backward(struct treap *tree, treap_call_fn_t call);
+
+#endif
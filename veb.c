@@ -0,0 +1,130 @@
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "veb.h"
+
+
+#define UNPLACED UINT_MAX
+
+static int height(const struct anytree_veb *veb, const void *node)
+{
+    int left, right;
+
+    if (!node)
+        return 0;
+    left = height(veb, veb->child(node, 0));
+    right = height(veb, veb->child(node, 1));
+    return (left > right ? left : right) + 1;
+}
+
+static int place_node(struct anytree_veb *veb, const void *node)
+{
+    uintptr_t offset = (uintptr_t)node - (uintptr_t)veb->nodes;
+    size_t index = offset / veb->stride;
+
+    if ((uintptr_t)node < (uintptr_t)veb->nodes || offset % veb->stride || index >= veb->count)
+        return -1;
+    if (veb->dest[index] != UNPLACED)
+        return -1;
+    veb->dest[index] = veb->placed++;
+    return 0;
+}
+
+static int place(struct anytree_veb *veb, const void *node, int levels);
+
+/* Places the subtrees 'depth' levels below 'node', from left to right */
+static int place_below(struct anytree_veb *veb, const void *node, int depth, int levels)
+{
+    if (!node)
+        return 0;
+    if (!depth)
+        return place(veb, node, levels);
+    if (place_below(veb, veb->child(node, 0), depth - 1, levels))
+        return -1;
+    return place_below(veb, veb->child(node, 1), depth - 1, levels);
+}
+
+/* Places the top 'levels' levels of the subtree rooted at 'node' */
+static int place(struct anytree_veb *veb, const void *node, int levels)
+{
+    int top = levels / 2;
+
+    if (!node)
+        return 0;
+    if (levels == 1)
+        return place_node(veb, node);
+    if (place(veb, node, top))
+        return -1;
+    return place_below(veb, node, top, levels - top);
+}
+
+int anytree_veb_plan(struct anytree_veb *veb, void *array, unsigned count, size_t stride, size_t offset,
+                     const void *root, unsigned size, anytree_veb_child_fn_t child)
+{
+    unsigned i;
+
+    veb->nodes = (char *)array + offset;
+    veb->stride = stride;
+    veb->offset = offset;
+    veb->count = count;
+    veb->child = child;
+    veb->placed = 0;
+
+    veb->dest = (unsigned *)malloc((count + 1UL) * sizeof(veb->dest[0]));
+    veb->source = (unsigned *)malloc((count + 1UL) * sizeof(veb->source[0]));
+    veb->spare = malloc(stride);
+    if (!veb->dest || !veb->source || !veb->spare)
+        goto fail;
+
+    for (i = 0; i < count; i++)
+        veb->dest[i] = UNPLACED;
+    if (size > count || place(veb, root, height(veb, root)) || veb->placed != size)
+        goto fail;
+
+    for (i = 0; i < count; i++) {
+        if (veb->dest[i] == UNPLACED)
+            veb->dest[i] = veb->placed++;
+        veb->source[veb->dest[i]] = i;
+    }
+    return 0;
+
+fail:
+    anytree_veb_done(veb);
+    return -1;
+}
+
+static inline void *element(const struct anytree_veb *veb, unsigned index)
+{
+    return veb->nodes - veb->offset + (size_t)index * veb->stride;
+}
+
+/* Follows each cycle of the permutation, saving only its first element */
+void anytree_veb_move(struct anytree_veb *veb)
+{
+    unsigned *source = veb->source;
+    unsigned i, j, k;
+
+    for (i = 0; i < veb->count; i++) {
+        if (source[i] == i)
+            continue;
+        memcpy(veb->spare, element(veb, i), veb->stride);
+        for (j = i; source[j] != i; j = k) {
+            k = source[j];
+            memcpy(element(veb, j), element(veb, k), veb->stride);
+            source[j] = j;
+        }
+        memcpy(element(veb, j), veb->spare, veb->stride);
+        source[j] = j;
+    }
+}
+
+void anytree_veb_done(struct anytree_veb *veb)
+{
+    free(veb->dest);
+    free(veb->source);
+    free(veb->spare);
+    veb->dest = veb->source = NULL;
+    veb->spare = NULL;
+}
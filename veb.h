@@ -0,0 +1,57 @@
+#ifndef ANYTREE__VEB__INCLUDED
+#define ANYTREE__VEB__INCLUDED
+
+#include <stddef.h>
+
+
+/*
+ * Van Emde Boas relayout of a binary tree whose nodes are embedded in the
+ * elements of an array: the tree of height h is cut at half its height,
+ * the top half is laid out first and each tree hanging below it follows,
+ * all recursively. Whatever the cache line or page size, a descent then
+ * crosses about log_B(n) blocks instead of one per level.
+ *
+ * Private to the avl and rb trees, which fix up their own links: plan,
+ * move the elements, then translate every link held in the moved nodes.
+ */
+typedef void *(*anytree_veb_child_fn_t)(const void *node, int right);
+
+struct anytree_veb {
+    char *nodes;                    /* the node of element 0 */
+    size_t stride, offset;
+    unsigned count;
+    anytree_veb_child_fn_t child;
+
+    unsigned *dest;                 /* the new index of each element */
+    unsigned *source;               /* the old index of each new element */
+    void *spare;                    /* room for one element */
+    unsigned placed;
+};
+
+/*
+ * Gives the 'size' nodes of the tree rooted at 'root' the first indices,
+ * in van Emde Boas order, and the other elements the next ones, in their
+ * current order. Fails without changing anything when a node is not in
+ * the array or when out of memory.
+ */
+int anytree_veb_plan(struct anytree_veb *veb, void *array, unsigned count, size_t stride, size_t offset,
+                     const void *root, unsigned size, anytree_veb_child_fn_t child);
+/* Moves the elements to their new indices; links still hold the old addresses */
+void anytree_veb_move(struct anytree_veb *veb);
+void anytree_veb_done(struct anytree_veb *veb);
+
+/* The node of element 'index', counted after the move */
+static inline void *anytree_veb_node(const struct anytree_veb *veb, unsigned index)
+{
+    return veb->nodes + (size_t)index * veb->stride;
+}
+
+/* The new address of a node known by its old one */
+static inline void *anytree_veb_moved(const struct anytree_veb *veb, const void *node)
+{
+    if (!node)
+        return NULL;
+    return anytree_veb_node(veb, veb->dest[(size_t)((const char *)node - veb->nodes) / veb->stride]);
+}
+
+#endif